@@ -31,6 +31,7 @@
 
 #include "sysdb.h"
 #include "client/sock.h"
+#include "utils/compress.h"
 #include "utils/error.h"
 #include "utils/strbuf.h"
 #include "utils/proto.h"
@@ -69,6 +70,12 @@ struct sdb_client {
 	sdb_ssl_client_t *ssl;
 	sdb_ssl_session_t *ssl_session;
 
+	/* requested compression algorithm and the compression context of the
+	 * current connection (NULL unless negotiated) */
+	uint32_t compression;
+	sdb_compress_t *compress;
+	sdb_strbuf_t *compress_buf;
+
 	ssize_t (*read)(sdb_client_t *, sdb_strbuf_t *, size_t);
 	ssize_t (*write)(sdb_client_t *, const void *, size_t);
 };
@@ -257,6 +264,7 @@ sdb_client_destroy(sdb_client_t *client)
 	client->address = NULL;
 
 	sdb_ssl_free_options(&client->ssl_opts);
+	sdb_strbuf_destroy(client->compress_buf);
 
 	free(client);
 } /* sdb_client_destroy */
@@ -333,6 +341,13 @@ sdb_client_connect(sdb_client_t *client, const char *username)
 			(uint32_t)strlen(username), username, &rstatus, buf);
 	if ((status >= 0) && (rstatus == SDB_CONNECTION_OK)) {
 		sdb_strbuf_destroy(buf);
+
+		/* older servers do not support compression; carry on without */
+		if (client->compression
+				&& sdb_client_set_option(client,
+					SDB_CONNECTION_OPTION_COMPRESSION, client->compression))
+			sdb_log(SDB_LOG_WARNING, "client: Compression not supported "
+					"by server at %s; continuing without", client->address);
 		return 0;
 	}
 
@@ -362,6 +377,70 @@ sdb_client_connect(sdb_client_t *client, const char *username)
 	return (int)status;
 } /* sdb_client_connect */
 
+int
+sdb_client_set_compression(sdb_client_t *client, uint32_t algo)
+{
+	if (! client)
+		return -1;
+	if ((algo != SDB_CONNECTION_COMPRESSION_NONE)
+			&& (! sdb_compress_supported(algo))) {
+		sdb_log(SDB_LOG_ERR, "client: Compression algorithm %u not "
+				"supported by this build", algo);
+		return -1;
+	}
+	client->compression = algo;
+	return 0;
+} /* sdb_client_set_compression */
+
+int
+sdb_client_set_option(sdb_client_t *client, uint32_t opt, uint32_t value)
+{
+	char msg[2 * sizeof(uint32_t)];
+	sdb_compress_t *c = NULL;
+	sdb_strbuf_t *buf;
+	uint32_t rstatus = 0;
+	ssize_t status;
+
+	if (! client)
+		return -1;
+
+	/* make sure to be able to decompress replies before asking for them */
+	if ((opt == SDB_CONNECTION_OPTION_COMPRESSION)
+			&& (value != SDB_CONNECTION_COMPRESSION_NONE)) {
+		if (! client->compress_buf)
+			client->compress_buf = sdb_strbuf_create(1024);
+		c = sdb_compress_create(value);
+		if ((! c) || (! client->compress_buf)) {
+			sdb_log(SDB_LOG_ERR, "client: Failed to set up compression "
+					"algorithm %u", value);
+			sdb_compress_destroy(c);
+			return -1;
+		}
+	}
+
+	sdb_proto_marshal_int32(msg, sizeof(msg), opt);
+	sdb_proto_marshal_int32(msg + sizeof(uint32_t),
+			sizeof(msg) - sizeof(uint32_t), value);
+
+	buf = sdb_strbuf_create(64);
+	status = sdb_client_rpc(client, SDB_CONNECTION_SET_OPTION,
+			(uint32_t)sizeof(msg), msg, &rstatus, buf);
+	if ((status >= 0) && (rstatus != SDB_CONNECTION_OK)) {
+		sdb_log(SDB_LOG_ERR, "client: Failed to set option %u to %u: %s",
+				opt, value, sdb_strbuf_string(buf));
+		status = -1;
+	}
+	sdb_strbuf_destroy(buf);
+
+	if ((status >= 0) && (opt == SDB_CONNECTION_OPTION_COMPRESSION)) {
+		sdb_compress_destroy(client->compress);
+		client->compress = c;
+	}
+	else
+		sdb_compress_destroy(c);
+	return status < 0 ? -1 : 0;
+} /* sdb_client_set_option */
+
 int
 sdb_client_sockfd(sdb_client_t *client)
 {
@@ -401,6 +480,10 @@ sdb_client_close(sdb_client_t *client)
 		client->ssl = NULL;
 	}
 
+	/* compression has to be negotiated again for each connection */
+	sdb_compress_destroy(client->compress);
+	client->compress = NULL;
+
 	close(client->fd);
 	client->fd = -1;
 	client->eof = 1;
@@ -463,14 +546,23 @@ ssize_t
 sdb_client_send(sdb_client_t *client,
 		uint32_t cmd, uint32_t msg_len, const char *msg)
 {
-	char buf[2 * sizeof(uint32_t) + msg_len];
-
 	if ((! client) || (! client->fd))
 		return -1;
-	if (sdb_proto_marshal(buf, sizeof(buf), cmd, msg_len, msg) < 0)
-		return -1;
 
-	return client->write(client, buf, sizeof(buf));
+	if (client->compress && (msg_len >= SDB_COMPRESS_MIN_SIZE)) {
+		sdb_strbuf_clear(client->compress_buf);
+		if (sdb_compress_message(client->compress, client->compress_buf,
+					cmd, msg_len, msg) < 0)
+			return -1;
+		return client->write(client, SDB_STRBUF_STR(client->compress_buf));
+	}
+	else {
+		char buf[2 * sizeof(uint32_t) + msg_len];
+
+		if (sdb_proto_marshal(buf, sizeof(buf), cmd, msg_len, msg) < 0)
+			return -1;
+		return client->write(client, buf, sizeof(buf));
+	}
 } /* sdb_client_send */
 
 ssize_t
@@ -544,6 +636,23 @@ sdb_client_recv(sdb_client_t *client,
 		/* remove status,len */
 		sdb_strbuf_skip(buf, data_offset, 2 * sizeof(rstatus));
 
+	if ((rstatus == SDB_CONNECTION_COMPRESSED) && client->compress) {
+		ssize_t n;
+
+		/* replace the compressed message with the original one */
+		sdb_strbuf_clear(client->compress_buf);
+		n = sdb_decompress_message(client->compress,
+				sdb_strbuf_string(buf) + data_offset, total,
+				&rstatus, client->compress_buf);
+		sdb_strbuf_skip(buf, data_offset, total);
+		if (n < 0) {
+			errno = EBADMSG;
+			return -1;
+		}
+		sdb_strbuf_memappend(buf, SDB_STRBUF_STR(client->compress_buf));
+		total = (size_t)n;
+	}
+
 	if (code)
 		*code = rstatus;
 
@@ -558,5 +667,13 @@ sdb_client_eof(sdb_client_t *client)
 	return client->eof;
 } /* sdb_client_eof */
 
+bool
+sdb_client_pending(sdb_client_t *client)
+{
+	if ((! client) || (client->fd < 0) || (! client->ssl_session))
+		return 0;
+	return sdb_ssl_session_pending(client->ssl_session);
+} /* sdb_client_pending */
+
 /* vim: set tw=78 sw=4 ts=4 noexpandtab : */
 
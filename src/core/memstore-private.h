@@ -35,10 +35,15 @@
 #include "core/memstore.h"
 #include "core/store.h"
 #include "utils/avltree.h"
+#include "utils/llist.h"
+#include "utils/strbuf.h"
 
 #include <sys/types.h>
 #include <regex.h>
 
+#include <pthread.h>
+#include <stdbool.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -60,6 +65,13 @@ struct sdb_memstore_obj {
 	char **backends;
 	size_t backends_num;
 	sdb_memstore_obj_t *parent;
+
+	/* modification sequence number of the last actual change of the object
+	 * or any of its attributes; objects of the same type are linked in order
+	 * of this number (see sdb_memstore_scan_changed) */
+	uint64_t seq;
+	sdb_memstore_obj_t *prev_changed;
+	sdb_memstore_obj_t *next_changed;
 };
 #define STORE_OBJ(obj) ((sdb_memstore_obj_t *)(obj))
 #define STORE_CONST_OBJ(obj) ((const sdb_memstore_obj_t *)(obj))
@@ -101,6 +113,9 @@ typedef struct {
 	sdb_avltree_t *services;
 	sdb_avltree_t *metrics;
 	sdb_avltree_t *attributes;
+
+	/* store generation of the last update of the host or any children */
+	uint64_t generation;
 } host_t;
 #define HOST(obj) ((host_t *)(obj))
 #define CONST_HOST(obj) ((const host_t *)(obj))
@@ -109,15 +124,129 @@ typedef struct {
 #define _last_update super.last_update
 #define _interval super.interval
 
+/* the replication backlog (see memstore_repl.c) */
+typedef struct sdb_memstore_backlog sdb_memstore_backlog_t;
+
+/* a partition of the store; each shard is protected by its own lock */
+typedef struct {
+	/* hosts are the top-level entries and
+	 * reference everything else */
+	sdb_avltree_t *hosts;
+	pthread_rwlock_t host_lock;
+
+	/* for hosts, services, and metrics, all objects of this shard ordered by
+	 * their modification sequence number; protected by host_lock */
+	struct {
+		sdb_memstore_obj_t *oldest;
+		sdb_memstore_obj_t *newest;
+	} changes[3];
+} shard_t;
+
+struct sdb_memstore {
+	sdb_object_t super;
+
+	/* hosts are partitioned by the hash of their name */
+	shard_t *shards;
+	size_t shards_num;
+
+	/* incremented on each successful update and last assigned modification
+	 * sequence number; protected by counter_lock */
+	uint64_t generation;
+	uint64_t seq;
+	pthread_mutex_t counter_lock;
+
+	/* subscriptions to updates; protected by watch_lock */
+	sdb_llist_t *watches;
+	pthread_rwlock_t watch_lock;
+
+	/* recent updates for replicas; NULL unless replication is enabled */
+	sdb_memstore_backlog_t *backlog;
+};
+
+/*
+ * sdb_memstore_scan_shard:
+ * Call 'cb' for each host of the specified shard (in order of their names)
+ * following the host named 'after' (starting with the first host if NULL)
+ * while holding only that shard's lock. The scan stops as soon as the
+ * callback returns a non-zero value. This allows to walk the whole store in
+ * steps without blocking updates in the meantime.
+ *
+ * Returns:
+ *  - zero if all remaining hosts of the shard have been scanned
+ *  - the callback's return value if it was positive
+ *  - a negative value on error
+ */
+int
+sdb_memstore_scan_shard(sdb_memstore_t *store, size_t shard,
+		const char *after, sdb_memstore_lookup_cb cb, void *user_data);
+
+/*
+ * serialization
+ */
+
+/*
+ * sdb_memstore_records_t:
+ * Serializes all objects passed to sdb_memstore_record_writer into 'buf'
+ * using the record format of snapshots (see memstore_snapshot.c). If 'entries'
+ * is true, each record is prefixed with 'seq' as used by the replication
+ * stream (see memstore_repl.c).
+ */
+typedef struct {
+	sdb_object_t super;
+
+	sdb_strbuf_t *buf;
+	/* the payload of the current record */
+	sdb_strbuf_t *record;
+	uint64_t records_num;
+
+	bool entries;
+	uint64_t seq;
+} sdb_memstore_records_t;
+
+extern sdb_store_writer_t sdb_memstore_record_writer;
+
+/*
+ * sdb_memstore_apply_record:
+ * Store the object described by a single record of the specified type (as
+ * written by sdb_memstore_record_writer) in the store.
+ */
+int
+sdb_memstore_apply_record(sdb_memstore_t *store, uint32_t type,
+		const char *buf, size_t len);
+
+/*
+ * sdb_memstore_backlog_append:
+ * Append the current state of the specified object to the backlog; expects
+ * the lock of the object's shard to be held for writing.
+ */
+void
+sdb_memstore_backlog_append(sdb_memstore_backlog_t *backlog,
+		sdb_memstore_obj_t *obj);
+
+void
+sdb_memstore_backlog_destroy(sdb_memstore_backlog_t *backlog);
+
 /*
  * querying
  */
 
+typedef struct {
+	int index; /* starting at 1 */
+	sdb_memstore_expr_t *expr;
+} query_param_t;
+
 struct sdb_memstore_query {
 	sdb_object_t super;
 	sdb_ast_node_t *ast;
 	sdb_memstore_matcher_t *matcher;
 	sdb_memstore_matcher_t *filter;
+
+	/* placeholders referenced by the matchers; the same index may be
+	 * referenced multiple times */
+	query_param_t *params;
+	size_t params_num;
+	size_t max_param;
+	bool bound;
 };
 #define QUERY(m) ((sdb_memstore_query_t *)(m))
 
@@ -126,6 +255,7 @@ struct sdb_memstore_query {
  */
 
 enum {
+	PARAM_VALUE = -4, /* bound parameter value stored in data */
 	TYPED_EXPR  = -3, /* obj type stored in data.data.integer */
 	ATTR_VALUE  = -2, /* attr name stored in data.data.string */
 	FIELD_VALUE = -1, /* field type stored in data.data.integer */
@@ -34,8 +34,10 @@
 #include "core/plugin.h"
 #include "utils/avltree.h"
 #include "utils/error.h"
+#include "utils/llist.h"
 
 #include <assert.h>
+#include <ctype.h>
 
 #include <errno.h>
 
@@ -50,14 +52,26 @@
  * private types
  */
 
-struct sdb_memstore {
+/* scan shards concurrently if the store contains at least that many hosts */
+#define SCAN_PARALLEL_MIN_HOSTS 1024
+
+/* index into the 'changes' lists; -1 for unindexed types */
+#define CHANGES_IDX(t) \
+	(((t) == SDB_HOST) ? 0 \
+		: ((t) == SDB_SERVICE) ? 1 \
+		: ((t) == SDB_METRIC) ? 2 : -1)
+
+/* a subscription to updates of objects matching a query */
+typedef struct {
 	sdb_object_t super;
 
-	/* hosts are the top-level entries and
-	 * reference everything else */
-	sdb_avltree_t *hosts;
-	pthread_rwlock_t host_lock;
-};
+	sdb_memstore_query_t *q;
+	int type;
+
+	sdb_store_writer_t *w;
+	sdb_object_t *wd;
+} watch_t;
+#define WATCH(obj) ((watch_t *)(obj))
 
 /* internal representation of a to-be-stored object */
 typedef struct {
@@ -78,17 +92,37 @@ static sdb_type_t metric_type;
 static sdb_type_t attribute_type;
 
 static int
-store_init(sdb_object_t *obj, va_list __attribute__((unused)) ap)
+store_init(sdb_object_t *obj, va_list ap)
 {
+	sdb_memstore_t *st = SDB_MEMSTORE(obj);
+	size_t shards_num = va_arg(ap, size_t);
 	int err;
-	if (! (SDB_MEMSTORE(obj)->hosts = sdb_avltree_create()))
+
+	if (! shards_num)
 		return -1;
-	if ((err = pthread_rwlock_init(&SDB_MEMSTORE(obj)->host_lock,
-					/* attr = */ NULL))) {
-		char errbuf[128];
-		sdb_log(SDB_LOG_ERR, "memstore: Failed to initialize lock: %s",
-				sdb_strerror(err, errbuf, sizeof(errbuf)));
+
+	pthread_mutex_init(&st->counter_lock, /* attr = */ NULL);
+	pthread_rwlock_init(&st->watch_lock, /* attr = */ NULL);
+	if (! (st->watches = sdb_llist_create()))
 		return -1;
+
+	if (! (st->shards = calloc(shards_num, sizeof(*st->shards))))
+		return -1;
+	/* only initialized shards will be destroyed */
+	for (st->shards_num = 0; st->shards_num < shards_num; ++st->shards_num) {
+		shard_t *shard = st->shards + st->shards_num;
+
+		if ((err = pthread_rwlock_init(&shard->host_lock,
+						/* attr = */ NULL))) {
+			char errbuf[128];
+			sdb_log(SDB_LOG_ERR, "memstore: Failed to initialize lock: %s",
+					sdb_strerror(err, errbuf, sizeof(errbuf)));
+			return -1;
+		}
+		if (! (shard->hosts = sdb_avltree_create())) {
+			pthread_rwlock_destroy(&shard->host_lock);
+			return -1;
+		}
 	}
 	return 0;
 } /* store_init */
@@ -96,17 +130,69 @@ store_init(sdb_object_t *obj, va_list __attribute__((unused)) ap)
 static void
 store_destroy(sdb_object_t *obj)
 {
+	sdb_memstore_t *st = SDB_MEMSTORE(obj);
+	size_t i;
 	int err;
-	if ((err = pthread_rwlock_destroy(&SDB_MEMSTORE(obj)->host_lock))) {
-		char errbuf[128];
-		sdb_log(SDB_LOG_ERR, "memstore: Failed to destroy lock: %s",
-				sdb_strerror(err, errbuf, sizeof(errbuf)));
-		return;
+
+	for (i = 0; i < st->shards_num; ++i) {
+		if ((err = pthread_rwlock_destroy(&st->shards[i].host_lock))) {
+			char errbuf[128];
+			sdb_log(SDB_LOG_ERR, "memstore: Failed to destroy lock: %s",
+					sdb_strerror(err, errbuf, sizeof(errbuf)));
+			return;
+		}
+		sdb_avltree_destroy(st->shards[i].hosts);
+		st->shards[i].hosts = NULL;
 	}
-	sdb_avltree_destroy(SDB_MEMSTORE(obj)->hosts);
-	SDB_MEMSTORE(obj)->hosts = NULL;
+	free(st->shards);
+	st->shards = NULL;
+	st->shards_num = 0;
+
+	sdb_llist_destroy(st->watches);
+	st->watches = NULL;
+	pthread_rwlock_destroy(&st->watch_lock);
+
+	sdb_memstore_backlog_destroy(st->backlog);
+	st->backlog = NULL;
+	pthread_mutex_destroy(&st->counter_lock);
 } /* store_destroy */
 
+/* returns the shard responsible for the specified host */
+static shard_t *
+get_shard(sdb_memstore_t *st, const char *hostname)
+{
+	/* FNV-1a; hostnames are case-insensitive */
+	uint32_t hash = 2166136261U;
+
+	if (st->shards_num == 1)
+		return st->shards;
+
+	for ( ; *hostname; ++hostname) {
+		hash ^= (uint32_t)tolower((unsigned char)*hostname);
+		hash *= 16777619U;
+	}
+	return st->shards + (hash % st->shards_num);
+} /* get_shard */
+
+static void
+lock_shards(sdb_memstore_t *st)
+{
+	size_t i;
+
+	/* always lock in the same order */
+	for (i = 0; i < st->shards_num; ++i)
+		pthread_rwlock_rdlock(&st->shards[i].host_lock);
+} /* lock_shards */
+
+static void
+unlock_shards(sdb_memstore_t *st)
+{
+	size_t i;
+
+	for (i = st->shards_num; i > 0; --i)
+		pthread_rwlock_unlock(&st->shards[i - 1].host_lock);
+} /* unlock_shards */
+
 static int
 store_obj_init(sdb_object_t *obj, va_list ap)
 {
@@ -272,6 +358,13 @@ attr_destroy(sdb_object_t *obj)
 	sdb_data_free_datum(&ATTR(obj)->value);
 } /* attr_destroy */
 
+static void
+watch_destroy(sdb_object_t *obj)
+{
+	sdb_object_deref(SDB_OBJ(WATCH(obj)->q));
+	sdb_object_deref(WATCH(obj)->wd);
+} /* watch_destroy */
+
 static sdb_type_t store_type = {
 	/* size = */ sizeof(sdb_memstore_t),
 	/* init = */ store_init,
@@ -302,16 +395,25 @@ static sdb_type_t attribute_type = {
 	/* destroy = */ attr_destroy
 };
 
+static sdb_type_t watch_type = {
+	/* size = */ sizeof(watch_t),
+	/* init = */ NULL,
+	/* destroy = */ watch_destroy
+};
+
 /*
  * private helper functions
  */
 
+/* returns the number of newly recorded backends or a negative value on
+ * error */
 static int
 record_backends(sdb_memstore_obj_t *obj,
 		const char * const *backends, size_t backends_num)
 {
 	char **tmp;
 	size_t i;
+	int added = 0;
 
 	for (i = 0; i < backends_num; i++) {
 		bool found = 0;
@@ -337,12 +439,15 @@ record_backends(sdb_memstore_obj_t *obj,
 			return -1;
 
 		++obj->backends_num;
+		++added;
 	}
-	return 0;
+	return added;
 } /* record_backends */
 
+/* store the specified object; 'changed' is set to true if the object was
+ * created or any of its meta-data other than the update timestamps changed */
 static int
-store_obj(store_obj_t *obj, sdb_memstore_obj_t **updated_obj)
+store_obj(store_obj_t *obj, sdb_memstore_obj_t **updated_obj, bool *changed)
 {
 	sdb_memstore_obj_t *old, *new;
 	int status = 0;
@@ -372,6 +477,7 @@ store_obj(store_obj_t *obj, sdb_memstore_obj_t **updated_obj)
 
 		if (new) {
 			status = sdb_avltree_insert(obj->parent_tree, SDB_OBJ(new));
+			*changed = true;
 
 			/* pass control to the tree or destroy in case of an error */
 			sdb_object_deref(SDB_OBJ(new));
@@ -403,11 +509,120 @@ store_obj(store_obj_t *obj, sdb_memstore_obj_t **updated_obj)
 	if (updated_obj)
 		*updated_obj = new;
 
-	if (record_backends(new, obj->backends, obj->backends_num))
+	status = record_backends(new, obj->backends, obj->backends_num);
+	if (status < 0)
 		return -1;
-	return status;
+	if (status > 0)
+		*changed = true;
+	return 0;
 } /* store_obj */
 
+/* record an update of 'host' (or any of its children); expects the host lock
+ * to be held for writing and the counter lock to be held */
+static void
+bump_generation(sdb_memstore_t *st, host_t *host)
+{
+	++st->generation;
+	if (host)
+		host->generation = st->generation;
+} /* bump_generation */
+
+/* send an update of 'obj' to all watchers subscribed to it; an attribute is
+ * sent to the watchers of its parent object; expects the host lock to be held
+ * for writing */
+static void
+notify_watchers(sdb_memstore_t *st, host_t *host, sdb_memstore_obj_t *obj)
+{
+	sdb_memstore_obj_t *owner = obj;
+	sdb_llist_iter_t *iter;
+
+	if (! sdb_llist_len(st->watches))
+		return;
+
+	if (obj->type == SDB_ATTRIBUTE)
+		owner = obj->parent;
+	assert(owner);
+
+	pthread_rwlock_rdlock(&st->watch_lock);
+	iter = sdb_llist_get_iter(st->watches);
+	while (sdb_llist_iter_has_next(iter)) {
+		watch_t *watch = WATCH(sdb_llist_iter_get_next(iter));
+		sdb_memstore_matcher_t *filter = watch->q->filter;
+
+		if (watch->type != owner->type)
+			continue;
+		/* same semantics as LOOKUP queries; see sdb_memstore_scan and
+		 * sdb_memstore_emit_full */
+		if ((owner != STORE_OBJ(host))
+				&& (! sdb_memstore_matcher_matches(filter,
+						STORE_OBJ(host), NULL)))
+			continue;
+		if (! sdb_memstore_matcher_matches(watch->q->matcher, owner, filter))
+			continue;
+		if ((obj != owner)
+				&& (! sdb_memstore_matcher_matches(filter, obj, NULL)))
+			continue;
+
+		if (sdb_memstore_emit(obj, watch->w, watch->wd))
+			sdb_log(SDB_LOG_ERR, "memstore: Failed to notify watcher '%s' "
+					"about update of %s '%s'", SDB_OBJ(watch)->name,
+					SDB_STORE_TYPE_TO_NAME(obj->type), obj->_name);
+	}
+	sdb_llist_iter_destroy(iter);
+	pthread_rwlock_unlock(&st->watch_lock);
+} /* notify_watchers */
+
+/* assign a new modification sequence number to 'obj' and move it to the end
+ * of the shard's list of changed objects of its type; expects the host lock
+ * to be held for writing and the counter lock to be held */
+static void
+bump_sequence(sdb_memstore_t *st, shard_t *shard, sdb_memstore_obj_t *obj)
+{
+	int idx = CHANGES_IDX(obj->type);
+
+	obj->seq = ++st->seq;
+	if ((idx < 0) || (shard->changes[idx].newest == obj))
+		return;
+
+	/* unlink (a no-op for new objects) */
+	if (obj->prev_changed)
+		obj->prev_changed->next_changed = obj->next_changed;
+	if (obj->next_changed)
+		obj->next_changed->prev_changed = obj->prev_changed;
+	if (shard->changes[idx].oldest == obj)
+		shard->changes[idx].oldest = obj->next_changed;
+
+	obj->prev_changed = shard->changes[idx].newest;
+	obj->next_changed = NULL;
+	if (obj->prev_changed)
+		obj->prev_changed->next_changed = obj;
+	else
+		shard->changes[idx].oldest = obj;
+	shard->changes[idx].newest = obj;
+} /* bump_sequence */
+
+/* record a successful update of 'obj' belonging to 'host'; a change of an
+ * attribute is a change of its parent as well; watchers are only notified
+ * about actual changes (not about updates of the timestamp only); expects
+ * the host lock to be held for writing */
+static void
+record_update(sdb_memstore_t *st, shard_t *shard, host_t *host,
+		sdb_memstore_obj_t *obj, bool changed)
+{
+	pthread_mutex_lock(&st->counter_lock);
+	if (changed) {
+		bump_sequence(st, shard, obj);
+		if ((obj->type == SDB_ATTRIBUTE) && obj->parent)
+			bump_sequence(st, shard, obj->parent);
+	}
+	bump_generation(st, host);
+	pthread_mutex_unlock(&st->counter_lock);
+	if (changed)
+		notify_watchers(st, host, obj);
+	if (st->backlog)
+		sdb_memstore_backlog_append(st->backlog, obj);
+} /* record_update */
+
 static int
 store_metric_update_store(metric_store_t *store,
 		const sdb_metric_store_t __attribute__((unused)) *s,
@@ -454,10 +669,12 @@ store_metric_add_store(metric_t *metric, const sdb_metric_store_t *s,
 	return 0;
 } /* store_metric_add_store */
 
+/* returns the number of newly added stores or a negative value on error */
 static int
 store_metric_stores(metric_t *metric, sdb_store_metric_t *m)
 {
 	size_t i;
+	int added = 0;
 
 	if (! m->stores_num)
 		return 0;
@@ -479,11 +696,13 @@ store_metric_stores(metric_t *metric, sdb_store_metric_t *m)
 			}
 		}
 
-		if (j >= metric->stores_num)
+		if (j >= metric->stores_num) {
 			if (store_metric_add_store(metric, m->stores + i, last_update) < 0)
 				return -1;
+			++added;
+		}
 	}
-	return 0;
+	return added;
 } /* store_metric_stores */
 
 /* The store's host_lock has to be acquired before calling this function. */
@@ -517,6 +736,23 @@ get_obj_attrs(sdb_memstore_obj_t *obj)
 	return NULL;
 } /* get_obj_attrs */
 
+/* order objects by their host's and their own name, like a scan does */
+static int
+cmp_obj_by_host(const void *a, const void *b)
+{
+	const sdb_memstore_obj_t *o1 = *(const sdb_memstore_obj_t * const *)a;
+	const sdb_memstore_obj_t *o2 = *(const sdb_memstore_obj_t * const *)b;
+	int diff;
+
+	if ((o1->type != SDB_HOST) && (o2->type != SDB_HOST)) {
+		diff = sdb_object_cmp_by_name(SDB_CONST_OBJ(o1->parent),
+				SDB_CONST_OBJ(o2->parent));
+		if (diff)
+			return diff;
+	}
+	return sdb_object_cmp_by_name(SDB_CONST_OBJ(o1), SDB_CONST_OBJ(o2));
+} /* cmp_obj_by_host */
+
 /*
  * store writer API
  */
@@ -528,9 +764,11 @@ store_attribute(sdb_store_attribute_t *attr, sdb_object_t *user_data)
 	store_obj_t obj = STORE_OBJ_INIT;
 	sdb_memstore_obj_t *new = NULL;
 	const char *hostname;
+	shard_t *shard;
 	host_t *host;
 
 	sdb_avltree_t *children = NULL;
+	bool changed = false;
 	int status = 0;
 
 	if ((! attr) || (! attr->parent) || (! attr->key))
@@ -542,8 +780,9 @@ store_attribute(sdb_store_attribute_t *attr, sdb_object_t *user_data)
 	if (! hostname)
 		return -1;
 
-	pthread_rwlock_wrlock(&st->host_lock);
-	host = HOST(sdb_avltree_lookup(st->hosts, hostname));
+	shard = get_shard(st, hostname);
+	pthread_rwlock_wrlock(&shard->host_lock);
+	host = HOST(sdb_avltree_lookup(shard->hosts, hostname));
 	if (! host) {
 		sdb_log(SDB_LOG_ERR, "memstore: Failed to store attribute '%s' - "
 				"host '%s' not found", attr->key, hostname);
@@ -586,20 +825,24 @@ store_attribute(sdb_store_attribute_t *attr, sdb_object_t *user_data)
 	obj.backends = attr->backends;
 	obj.backends_num = attr->backends_num;
 	if (! status)
-		status = store_obj(&obj, &new);
+		status = store_obj(&obj, &new, &changed);
 
 	if (! status) {
 		assert(new);
 		/* update the value if it changed */
-		if (sdb_data_cmp(&ATTR(new)->value, &attr->value))
+		if (sdb_data_cmp(&ATTR(new)->value, &attr->value)) {
 			if (sdb_data_copy(&ATTR(new)->value, &attr->value))
 				status = -1;
+			changed = true;
+		}
 	}
+	if (! status)
+		record_update(st, shard, host, new, changed);
 
 	if (obj.parent != STORE_OBJ(host))
 		sdb_object_deref(SDB_OBJ(obj.parent));
 	sdb_object_deref(SDB_OBJ(host));
-	pthread_rwlock_unlock(&st->host_lock);
+	pthread_rwlock_unlock(&shard->host_lock);
 
 	return status;
 } /* store_attribute */
@@ -608,20 +851,28 @@ static int
 store_host(sdb_store_host_t *host, sdb_object_t *user_data)
 {
 	sdb_memstore_t *st = SDB_MEMSTORE(user_data);
-	store_obj_t obj = { NULL, st->hosts, SDB_HOST, NULL, 0, 0, NULL, 0 };
+	store_obj_t obj = STORE_OBJ_INIT;
+	sdb_memstore_obj_t *new = NULL;
+	shard_t *shard;
+	bool changed = false;
 	int status = 0;
 
 	if ((! host) || (! host->name))
 		return -1;
 
+	shard = get_shard(st, host->name);
+	obj.parent_tree = shard->hosts;
+	obj.type = SDB_HOST;
 	obj.name = host->name;
 	obj.last_update = host->last_update;
 	obj.interval = host->interval;
 	obj.backends = host->backends;
 	obj.backends_num = host->backends_num;
-	pthread_rwlock_wrlock(&st->host_lock);
-	status = store_obj(&obj, NULL);
-	pthread_rwlock_unlock(&st->host_lock);
+	pthread_rwlock_wrlock(&shard->host_lock);
+	status = store_obj(&obj, &new, &changed);
+	if (! status)
+		record_update(st, shard, HOST(new), new, changed);
+	pthread_rwlock_unlock(&shard->host_lock);
 
 	return status;
 } /* store_host */
@@ -631,15 +882,19 @@ store_service(sdb_store_service_t *service, sdb_object_t *user_data)
 {
 	sdb_memstore_t *st = SDB_MEMSTORE(user_data);
 	store_obj_t obj = STORE_OBJ_INIT;
+	sdb_memstore_obj_t *new = NULL;
+	shard_t *shard;
 	host_t *host;
 
+	bool changed = false;
 	int status = 0;
 
 	if ((! service) || (! service->hostname) || (! service->name))
 		return -1;
 
-	pthread_rwlock_wrlock(&st->host_lock);
-	host = HOST(sdb_avltree_lookup(st->hosts, service->hostname));
+	shard = get_shard(st, service->hostname);
+	pthread_rwlock_wrlock(&shard->host_lock);
+	host = HOST(sdb_avltree_lookup(shard->hosts, service->hostname));
 	obj.parent = STORE_OBJ(host);
 	obj.parent_tree = get_host_children(host, SDB_SERVICE);
 	obj.type = SDB_SERVICE;
@@ -655,10 +910,12 @@ store_service(sdb_store_service_t *service, sdb_object_t *user_data)
 	obj.backends = service->backends;
 	obj.backends_num = service->backends_num;
 	if (! status)
-		status = store_obj(&obj, NULL);
+		status = store_obj(&obj, &new, &changed);
+	if (! status)
+		record_update(st, shard, host, new, changed);
 
 	sdb_object_deref(SDB_OBJ(host));
-	pthread_rwlock_unlock(&st->host_lock);
+	pthread_rwlock_unlock(&shard->host_lock);
 	return status;
 } /* store_service */
 
@@ -668,8 +925,10 @@ store_metric(sdb_store_metric_t *metric, sdb_object_t *user_data)
 	sdb_memstore_t *st = SDB_MEMSTORE(user_data);
 	store_obj_t obj = STORE_OBJ_INIT;
 	sdb_memstore_obj_t *new = NULL;
+	shard_t *shard;
 	host_t *host;
 
+	bool changed = false;
 	int status = 0;
 	size_t i;
 
@@ -680,8 +939,9 @@ store_metric(sdb_store_metric_t *metric, sdb_object_t *user_data)
 		if ((metric->stores[i].type == NULL) || (metric->stores[i].id == NULL))
 			return -1;
 
-	pthread_rwlock_wrlock(&st->host_lock);
-	host = HOST(sdb_avltree_lookup(st->hosts, metric->hostname));
+	shard = get_shard(st, metric->hostname);
+	pthread_rwlock_wrlock(&shard->host_lock);
+	host = HOST(sdb_avltree_lookup(shard->hosts, metric->hostname));
 	obj.parent = STORE_OBJ(host);
 	obj.parent_tree = get_host_children(host, SDB_METRIC);
 	obj.type = SDB_METRIC;
@@ -697,18 +957,22 @@ store_metric(sdb_store_metric_t *metric, sdb_object_t *user_data)
 	obj.backends = metric->backends;
 	obj.backends_num = metric->backends_num;
 	if (! status)
-		status = store_obj(&obj, &new);
-	sdb_object_deref(SDB_OBJ(host));
+		status = store_obj(&obj, &new, &changed);
 
 	if (status) {
-		pthread_rwlock_unlock(&st->host_lock);
+		sdb_object_deref(SDB_OBJ(host));
+		pthread_rwlock_unlock(&shard->host_lock);
 		return status;
 	}
 
 	assert(new);
-	if (store_metric_stores(METRIC(new), metric))
-		status = -1;
-	pthread_rwlock_unlock(&st->host_lock);
+	status = store_metric_stores(METRIC(new), metric);
+	if (status >= 0) {
+		record_update(st, shard, host, new, changed || (status > 0));
+		status = 0;
+	}
+	sdb_object_deref(SDB_OBJ(host));
+	pthread_rwlock_unlock(&shard->host_lock);
 	return status;
 } /* store_metric */
 
@@ -737,8 +1001,43 @@ execute_query(sdb_object_t *q,
 			QUERY(q), w, wd, errbuf);
 } /* execute_query */
 
+static uint64_t
+generation(const char *hostname, sdb_object_t *user_data)
+{
+	return sdb_memstore_generation(SDB_MEMSTORE(user_data), hostname);
+} /* generation */
+
+static int
+bind_query(sdb_object_t *q, const sdb_data_t *values, size_t values_num,
+		sdb_strbuf_t *errbuf, sdb_object_t __attribute__((unused)) *user_data)
+{
+	return sdb_memstore_query_bind(QUERY(q), values, values_num, errbuf);
+} /* bind_query */
+
+static sdb_object_t *
+watch_query(sdb_object_t *q, sdb_store_writer_t *w, sdb_object_t *wd,
+		sdb_strbuf_t *errbuf, sdb_object_t *user_data)
+{
+	return sdb_memstore_watch(SDB_MEMSTORE(user_data), QUERY(q), w, wd, errbuf);
+} /* watch_query */
+
+static int
+unwatch_query(sdb_object_t *watch, sdb_object_t *user_data)
+{
+	return sdb_memstore_unwatch(SDB_MEMSTORE(user_data), watch);
+} /* unwatch_query */
+
+static int
+replicate(sdb_store_repl_pos_t *pos, sdb_strbuf_t *buf, size_t max,
+		int notify_fd, sdb_object_t *user_data)
+{
+	return sdb_memstore_replicate(SDB_MEMSTORE(user_data), pos,
+			buf, max, notify_fd);
+} /* replicate */
+
 sdb_store_reader_t sdb_memstore_reader = {
-	prepare_query, execute_query,
+	prepare_query, execute_query, generation, bind_query,
+	watch_query, unwatch_query, replicate,
 };
 
 /*
@@ -748,15 +1047,21 @@ sdb_store_reader_t sdb_memstore_reader = {
 sdb_memstore_t *
 sdb_memstore_create(void)
 {
-	return SDB_MEMSTORE(sdb_object_create("memstore", store_type));
+	return sdb_memstore_create_sharded(1);
 } /* sdb_memstore_create */
 
+sdb_memstore_t *
+sdb_memstore_create_sharded(size_t shards)
+{
+	return SDB_MEMSTORE(sdb_object_create("memstore", store_type, shards));
+} /* sdb_memstore_create_sharded */
+
 int
 sdb_memstore_host(sdb_memstore_t *store, const char *name,
 		sdb_time_t last_update, sdb_time_t interval)
 {
 	sdb_store_host_t host = {
-		name, last_update, interval, NULL, 0,
+		name, last_update, interval, NULL, 0, 0,
 	};
 	return store_host(&host, SDB_OBJ(store));
 } /* sdb_memstore_host */
@@ -766,7 +1071,7 @@ sdb_memstore_service(sdb_memstore_t *store, const char *hostname, const char *na
 		sdb_time_t last_update, sdb_time_t interval)
 {
 	sdb_store_service_t service = {
-		hostname, name, last_update, interval, NULL, 0,
+		hostname, name, last_update, interval, NULL, 0, 0,
 	};
 	return store_service(&service, SDB_OBJ(store));
 } /* sdb_memstore_service */
@@ -778,15 +1083,15 @@ sdb_memstore_metric(sdb_memstore_t *store, const char *hostname, const char *nam
 {
 	sdb_store_metric_t metric = {
 		hostname, name, /* stores */ NULL, 0,
-		last_update, interval, NULL, 0,
+		last_update, interval, NULL, 0, 0,
 	};
+	sdb_metric_store_t s = SDB_METRIC_STORE_INIT;
+
 	if (metric_store) {
-		metric.stores = &(const sdb_metric_store_t){
-			metric_store->type,
-			metric_store->id,
-			NULL,
-			metric_store->last_update,
-		};
+		s.type = metric_store->type;
+		s.id = metric_store->id;
+		s.last_update = metric_store->last_update;
+		metric.stores = &s;
 		metric.stores_num = 1;
 	}
 	return store_metric(&metric, SDB_OBJ(store));
@@ -799,7 +1104,7 @@ sdb_memstore_attribute(sdb_memstore_t *store, const char *hostname,
 {
 	sdb_store_attribute_t attr = {
 		NULL, SDB_HOST, hostname, key, SDB_DATA_INIT,
-		last_update, interval, NULL, 0,
+		last_update, interval, NULL, 0, 0,
 	};
 	if (value) {
 		attr.value = *value;
@@ -814,7 +1119,7 @@ sdb_memstore_service_attr(sdb_memstore_t *store, const char *hostname,
 {
 	sdb_store_attribute_t attr = {
 		hostname, SDB_SERVICE, service, key, SDB_DATA_INIT,
-		last_update, interval, NULL, 0,
+		last_update, interval, NULL, 0, 0,
 	};
 	if (value) {
 		attr.value = *value;
@@ -829,7 +1134,7 @@ sdb_memstore_metric_attr(sdb_memstore_t *store, const char *hostname,
 {
 	sdb_store_attribute_t attr = {
 		hostname, SDB_METRIC, metric, key, SDB_DATA_INIT,
-		last_update, interval, NULL, 0,
+		last_update, interval, NULL, 0, 0,
 	};
 	if (value) {
 		attr.value = *value;
@@ -845,13 +1150,114 @@ sdb_memstore_get_host(sdb_memstore_t *store, const char *name)
 	if ((! store) || (! name))
 		return NULL;
 
-	host = HOST(sdb_avltree_lookup(store->hosts, name));
+	host = HOST(sdb_avltree_lookup(get_shard(store, name)->hosts, name));
 	if (! host)
 		return NULL;
 
 	return STORE_OBJ(host);
 } /* sdb_memstore_get_host */
 
+uint64_t
+sdb_memstore_generation(sdb_memstore_t *store, const char *hostname)
+{
+	uint64_t gen;
+	host_t *host = NULL;
+
+	if (! store)
+		return 0;
+
+	if (hostname) {
+		shard_t *shard = get_shard(store, hostname);
+
+		pthread_rwlock_rdlock(&shard->host_lock);
+		host = HOST(sdb_avltree_lookup(shard->hosts, hostname));
+		if (host)
+			gen = host->generation;
+		pthread_rwlock_unlock(&shard->host_lock);
+
+		if (host) {
+			sdb_object_deref(SDB_OBJ(host));
+			return gen;
+		}
+	}
+
+	pthread_mutex_lock(&store->counter_lock);
+	gen = store->generation;
+	pthread_mutex_unlock(&store->counter_lock);
+	return gen;
+} /* sdb_memstore_generation */
+
+static int
+is_watch(const sdb_object_t *obj, const void *watch)
+{
+	return obj != watch;
+} /* is_watch */
+
+sdb_object_t *
+sdb_memstore_watch(sdb_memstore_t *store, sdb_memstore_query_t *q,
+		sdb_store_writer_t *w, sdb_object_t *wd, sdb_strbuf_t *errbuf)
+{
+	sdb_object_t *watch;
+	int status;
+
+	if ((! store) || (! q) || (! q->ast) || (! w))
+		return NULL;
+
+	if (q->ast->type != SDB_AST_TYPE_LOOKUP) {
+		sdb_strbuf_sprintf(errbuf, "Cannot watch query of type %s; "
+				"only LOOKUP queries are supported",
+				SDB_AST_TYPE_TO_STRING(q->ast));
+		return NULL;
+	}
+	if (q->max_param) {
+		sdb_strbuf_sprintf(errbuf, "Cannot watch query using placeholders");
+		return NULL;
+	}
+
+	watch = sdb_object_create("watch", watch_type);
+	if (! watch) {
+		sdb_strbuf_sprintf(errbuf, "Out of memory");
+		return NULL;
+	}
+
+	sdb_object_ref(SDB_OBJ(q));
+	WATCH(watch)->q = q;
+	WATCH(watch)->type = SDB_AST_LOOKUP(q->ast)->obj_type;
+	WATCH(watch)->w = w;
+	sdb_object_ref(wd);
+	WATCH(watch)->wd = wd;
+
+	pthread_rwlock_wrlock(&store->watch_lock);
+	status = sdb_llist_append(store->watches, watch);
+	pthread_rwlock_unlock(&store->watch_lock);
+
+	if (status) {
+		sdb_strbuf_sprintf(errbuf, "Failed to register watch");
+		sdb_object_deref(watch);
+		return NULL;
+	}
+	return watch;
+} /* sdb_memstore_watch */
+
+int
+sdb_memstore_unwatch(sdb_memstore_t *store, sdb_object_t *watch)
+{
+	sdb_object_t *obj;
+
+	if ((! store) || (! watch))
+		return -1;
+
+	pthread_rwlock_wrlock(&store->watch_lock);
+	obj = sdb_llist_remove(store->watches, is_watch, watch);
+	pthread_rwlock_unlock(&store->watch_lock);
+
+	if (! obj)
+		return 1;
+	/* release the reference held by the list */
+	sdb_object_deref(obj);
+	return 0;
+} /* sdb_memstore_unwatch */
+
 sdb_memstore_obj_t *
 sdb_memstore_get_child(sdb_memstore_obj_t *obj, int type, const char *name)
 {
@@ -915,6 +1321,10 @@ sdb_memstore_get_field(sdb_memstore_obj_t *obj, int field, sdb_data_t *res)
 			tmp.type = SDB_TYPE_BOOLEAN;
 			tmp.data.boolean = METRIC(obj)->stores_num > 0;
 			break;
+		case SDB_FIELD_SEQUENCE:
+			tmp.type = SDB_TYPE_INTEGER;
+			tmp.data.integer = (int64_t)obj->seq;
+			break;
 		default:
 			return -1;
 	}
@@ -949,24 +1359,16 @@ sdb_memstore_get_attr(sdb_memstore_obj_t *obj, const char *name, sdb_data_t *res
 	return 0;
 } /* sdb_memstore_get_attr */
 
-int
-sdb_memstore_scan(sdb_memstore_t *store, int type,
+/* scan a single shard; expects its host lock to be held */
+static int
+scan_shard(shard_t *shard, int type,
 		sdb_memstore_matcher_t *m, sdb_memstore_matcher_t *filter,
 		sdb_memstore_lookup_cb cb, void *user_data)
 {
 	sdb_avltree_iter_t *host_iter = NULL;
 	int status = 0;
 
-	if ((! store) || (! cb))
-		return -1;
-
-	if ((type != SDB_HOST) && (type != SDB_SERVICE) && (type != SDB_METRIC)) {
-		sdb_log(SDB_LOG_ERR, "memstore: Cannot scan objects of type %d", type);
-		return -1;
-	}
-
-	pthread_rwlock_rdlock(&store->host_lock);
-	host_iter = sdb_avltree_get_iter(store->hosts);
+	host_iter = sdb_avltree_get_iter(shard->hosts);
 	if (! host_iter)
 		status = -1;
 
@@ -1016,10 +1418,260 @@ sdb_memstore_scan(sdb_memstore_t *store, int type,
 	}
 
 	sdb_avltree_iter_destroy(host_iter);
-	pthread_rwlock_unlock(&store->host_lock);
+	return status;
+} /* scan_shard */
+
+/* the matching objects of a single shard in scan order */
+typedef struct {
+	shard_t *shard;
+	int type;
+	sdb_memstore_matcher_t *m;
+	sdb_memstore_matcher_t *filter;
+
+	sdb_memstore_obj_t **objs;
+	size_t objs_num;
+	size_t objs_size;
+
+	int status;
+	bool threaded;
+	pthread_t thread;
+} shard_scan_t;
+
+static int
+scan_collect(sdb_memstore_obj_t *obj,
+		sdb_memstore_matcher_t __attribute__((unused)) *filter,
+		void *user_data)
+{
+	shard_scan_t *scan = user_data;
+
+	if (scan->objs_num >= scan->objs_size) {
+		size_t size = scan->objs_size ? 2 * scan->objs_size : 64;
+		sdb_memstore_obj_t **tmp;
+
+		tmp = realloc(scan->objs, size * sizeof(*tmp));
+		if (! tmp)
+			return -1;
+		scan->objs = tmp;
+		scan->objs_size = size;
+	}
+	scan->objs[scan->objs_num] = obj;
+	++scan->objs_num;
+	return 0;
+} /* scan_collect */
+
+static void *
+scan_shard_collect(void *data)
+{
+	shard_scan_t *scan = data;
+
+	scan->status = scan_shard(scan->shard, scan->type, scan->m, scan->filter,
+			scan_collect, scan);
+	return NULL;
+} /* scan_shard_collect */
+
+/* scan all shards (concurrently, for large stores), merging the results in
+ * scan order; expects all host locks to be held */
+static int
+scan_sharded(sdb_memstore_t *store, int type,
+		sdb_memstore_matcher_t *m, sdb_memstore_matcher_t *filter,
+		sdb_memstore_lookup_cb cb, void *user_data)
+{
+	shard_scan_t *scans;
+	size_t *pos;
+	size_t hosts_num = 0, i;
+	bool parallel;
+	int status = 0;
+
+	scans = calloc(store->shards_num, sizeof(*scans));
+	pos = calloc(store->shards_num, sizeof(*pos));
+	if ((! scans) || (! pos)) {
+		free(scans);
+		free(pos);
+		return -1;
+	}
+
+	for (i = 0; i < store->shards_num; ++i)
+		hosts_num += sdb_avltree_size(store->shards[i].hosts);
+	parallel = hosts_num >= SCAN_PARALLEL_MIN_HOSTS;
+
+	for (i = 0; i < store->shards_num; ++i) {
+		shard_scan_t *scan = scans + i;
+
+		scan->shard = store->shards + i;
+		scan->type = type;
+		scan->m = m;
+		scan->filter = filter;
+
+		/* the first shard is handled by the calling thread; fall back to
+		 * scanning inline if a thread cannot be started */
+		if (parallel && i && (! pthread_create(&scan->thread,
+						/* attr = */ NULL, scan_shard_collect, scan)))
+			scan->threaded = true;
+		else if (i)
+			scan_shard_collect(scan);
+	}
+	scan_shard_collect(scans);
+
+	for (i = 0; i < store->shards_num; ++i) {
+		if (scans[i].threaded)
+			pthread_join(scans[i].thread, NULL);
+		if (scans[i].status)
+			status = -1;
+	}
+
+	/* k-way merge */
+	while (! status) {
+		sdb_memstore_obj_t *next = NULL;
+		size_t idx = 0;
+
+		for (i = 0; i < store->shards_num; ++i) {
+			sdb_memstore_obj_t *obj;
+
+			if (pos[i] >= scans[i].objs_num)
+				continue;
+			obj = scans[i].objs[pos[i]];
+			if ((! next) || (cmp_obj_by_host(&obj, &next) < 0)) {
+				next = obj;
+				idx = i;
+			}
+		}
+		if (! next)
+			break;
+		++pos[idx];
+
+		if (cb(next, filter, user_data)) {
+			sdb_log(SDB_LOG_ERR, "memstore: Callback returned "
+					"an error while scanning");
+			status = -1;
+		}
+	}
+
+	for (i = 0; i < store->shards_num; ++i)
+		free(scans[i].objs);
+	free(scans);
+	free(pos);
+	return status;
+} /* scan_sharded */
+
+int
+sdb_memstore_scan(sdb_memstore_t *store, int type,
+		sdb_memstore_matcher_t *m, sdb_memstore_matcher_t *filter,
+		sdb_memstore_lookup_cb cb, void *user_data)
+{
+	int status;
+
+	if ((! store) || (! cb))
+		return -1;
+
+	if ((type != SDB_HOST) && (type != SDB_SERVICE) && (type != SDB_METRIC)) {
+		sdb_log(SDB_LOG_ERR, "memstore: Cannot scan objects of type %d", type);
+		return -1;
+	}
+
+	lock_shards(store);
+	if (store->shards_num == 1)
+		status = scan_shard(store->shards, type, m, filter, cb, user_data);
+	else
+		status = scan_sharded(store, type, m, filter, cb, user_data);
+	unlock_shards(store);
 	return status;
 } /* sdb_memstore_scan */
 
+int
+sdb_memstore_scan_shard(sdb_memstore_t *store, size_t shard,
+		const char *after, sdb_memstore_lookup_cb cb, void *user_data)
+{
+	sdb_avltree_iter_t *iter;
+	int status = 0;
+
+	if ((! store) || (shard >= store->shards_num) || (! cb))
+		return -1;
+
+	pthread_rwlock_rdlock(&store->shards[shard].host_lock);
+	iter = sdb_avltree_get_iter_after(store->shards[shard].hosts, after);
+	if (! iter)
+		status = -1;
+
+	while (sdb_avltree_iter_has_next(iter)) {
+		sdb_memstore_obj_t *host;
+
+		host = STORE_OBJ(sdb_avltree_iter_get_next(iter));
+		assert(host);
+
+		if ((status = cb(host, /* filter = */ NULL, user_data)))
+			break;
+	}
+
+	sdb_avltree_iter_destroy(iter);
+	pthread_rwlock_unlock(&store->shards[shard].host_lock);
+	return status;
+} /* sdb_memstore_scan_shard */
+
+int
+sdb_memstore_scan_changed(sdb_memstore_t *store, int type, uint64_t since,
+		sdb_memstore_matcher_t *m, sdb_memstore_matcher_t *filter,
+		sdb_memstore_lookup_cb cb, void *user_data)
+{
+	sdb_memstore_obj_t **changed = NULL;
+	sdb_memstore_obj_t *obj;
+	size_t changed_num = 0, i, j;
+	int idx = CHANGES_IDX(type);
+	int status = 0;
+
+	if ((! store) || (! cb))
+		return -1;
+
+	if ((type != SDB_HOST) && (type != SDB_SERVICE) && (type != SDB_METRIC)) {
+		sdb_log(SDB_LOG_ERR, "memstore: Cannot scan objects of type %d", type);
+		return -1;
+	}
+
+	/* lock all shards at once to make sure not to miss any updates
+	 * happening while scanning */
+	lock_shards(store);
+	for (j = 0; j < store->shards_num; ++j)
+		for (obj = store->shards[j].changes[idx].newest;
+				obj && (obj->seq > since); obj = obj->prev_changed)
+			++changed_num;
+
+	if (changed_num) {
+		changed = calloc(changed_num, sizeof(*changed));
+		if (! changed) {
+			unlock_shards(store);
+			return -1;
+		}
+
+		i = 0;
+		for (j = 0; j < store->shards_num; ++j)
+			for (obj = store->shards[j].changes[idx].newest;
+					obj && (obj->seq > since); obj = obj->prev_changed)
+				changed[i++] = obj;
+		qsort(changed, changed_num, sizeof(*changed), cmp_obj_by_host);
+	}
+
+	for (i = 0; i < changed_num; ++i) {
+		sdb_memstore_obj_t *host = changed[i];
+		if (host->type != SDB_HOST)
+			host = host->parent;
+
+		if (! sdb_memstore_matcher_matches(filter, host, NULL))
+			continue;
+		if (! sdb_memstore_matcher_matches(m, changed[i], filter))
+			continue;
+
+		if (cb(changed[i], filter, user_data)) {
+			sdb_log(SDB_LOG_ERR, "memstore: Callback returned "
+					"an error while scanning");
+			status = -1;
+			break;
+		}
+	}
+
+	unlock_shards(store);
+	free(changed);
+	return status;
+} /* sdb_memstore_scan_changed */
+
 int
 sdb_memstore_emit(sdb_memstore_obj_t *obj, sdb_store_writer_t *w, sdb_object_t *wd)
 {
@@ -1035,6 +1687,7 @@ sdb_memstore_emit(sdb_memstore_obj_t *obj, sdb_store_writer_t *w, sdb_object_t *
 				obj->interval,
 				(const char * const *)obj->backends,
 				obj->backends_num,
+				obj->seq,
 			};
 			if (! w->store_host)
 				return -1;
@@ -1049,6 +1702,7 @@ sdb_memstore_emit(sdb_memstore_obj_t *obj, sdb_store_writer_t *w, sdb_object_t *
 				obj->interval,
 				(const char * const *)obj->backends,
 				obj->backends_num,
+				obj->seq,
 			};
 			if (! w->store_service)
 				return -1;
@@ -1066,6 +1720,7 @@ sdb_memstore_emit(sdb_memstore_obj_t *obj, sdb_store_writer_t *w, sdb_object_t *
 				obj->interval,
 				(const char * const *)obj->backends,
 				obj->backends_num,
+				obj->seq,
 			};
 			size_t i;
 
@@ -1091,6 +1746,7 @@ sdb_memstore_emit(sdb_memstore_obj_t *obj, sdb_store_writer_t *w, sdb_object_t *
 				obj->interval,
 				(const char * const *)obj->backends,
 				obj->backends_num,
+				obj->seq,
 			};
 			if (obj->parent && (obj->parent->type != SDB_HOST)
 					&& obj->parent->parent)
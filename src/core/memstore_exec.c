@@ -163,11 +163,18 @@ exec_fetch(sdb_memstore_t *store,
 static int
 exec_list(sdb_memstore_t *store,
 		sdb_store_writer_t *w, sdb_object_t *wd, sdb_strbuf_t *errbuf,
-		int type, sdb_memstore_matcher_t *filter)
+		int type, int64_t since, sdb_memstore_matcher_t *filter)
 {
 	iter_t iter = { NULL, w, wd };
-
-	if (sdb_memstore_scan(store, type, /* m = */ NULL, filter, list_tojson, &iter)) {
+	int status;
+
+	if (since >= 0)
+		status = sdb_memstore_scan_changed(store, type, (uint64_t)since,
+				/* m = */ NULL, filter, list_tojson, &iter);
+	else
+		status = sdb_memstore_scan(store, type, /* m = */ NULL, filter,
+				list_tojson, &iter);
+	if (status) {
 		sdb_log(SDB_LOG_ERR, "memstore: Failed to serialize "
 				"store to JSON");
 		sdb_strbuf_sprintf(errbuf, "Out of memory");
@@ -211,6 +218,12 @@ sdb_memstore_query_execute(sdb_memstore_t *store, sdb_memstore_query_t *q,
 		sdb_log(SDB_LOG_ERR, "memstore: Invalid empty query");
 		return -1;
 	}
+	if (! q->bound) {
+		sdb_strbuf_sprintf(errbuf, "Cannot execute query without binding "
+				"values to its %zu parameter%s", q->max_param,
+				q->max_param == 1 ? "" : "s");
+		return -1;
+	}
 
 	ast = q->ast;
 	switch (ast->type) {
@@ -222,7 +235,7 @@ sdb_memstore_query_execute(sdb_memstore_t *store, sdb_memstore_query_t *q,
 
 	case SDB_AST_TYPE_LIST:
 		return exec_list(store, w, wd, errbuf, SDB_AST_LIST(ast)->obj_type,
-				q->filter);
+				SDB_AST_LIST(ast)->since, q->filter);
 
 	case SDB_AST_TYPE_LOOKUP:
 		return exec_lookup(store, w, wd, errbuf, SDB_AST_LOOKUP(ast)->obj_type,
@@ -170,7 +170,7 @@ sdb_memstore_expr_fieldvalue(int field)
 	sdb_data_t value = { SDB_TYPE_INTEGER, { .integer = field } };
 	sdb_memstore_expr_t *e;
 
-	if ((field < SDB_FIELD_NAME) || (SDB_FIELD_TIMESERIES < field))
+	if ((field < SDB_FIELD_NAME) || (SDB_FIELD_SEQUENCE < field))
 		return NULL;
 	e = SDB_MEMSTORE_EXPR(sdb_object_create("memstore-fieldvalue", expr_type,
 				FIELD_VALUE, NULL, NULL, &value));
@@ -196,6 +196,21 @@ sdb_memstore_expr_attrvalue(const char *name)
 	return expr;
 } /* sdb_memstore_expr_attrvalue */
 
+sdb_memstore_expr_t *
+sdb_memstore_expr_param(void)
+{
+	sdb_data_t value = SDB_DATA_INIT;
+	sdb_memstore_expr_t *e;
+
+	e = SDB_MEMSTORE_EXPR(sdb_object_create("memstore-param", expr_type,
+				PARAM_VALUE, NULL, NULL, &value));
+	if (! e)
+		return NULL;
+	/* unknown until a value is bound */
+	e->data_type = -1;
+	return e;
+} /* sdb_memstore_expr_param */
+
 sdb_memstore_expr_t *
 sdb_memstore_expr_constvalue(const sdb_data_t *value)
 {
@@ -223,7 +238,7 @@ sdb_memstore_expr_eval(sdb_memstore_expr_t *expr, sdb_memstore_obj_t *obj,
 	if (filter && obj && (! sdb_memstore_matcher_matches(filter, obj, NULL)))
 		obj = NULL; /* this object does not exist */
 
-	if (! expr->type)
+	if ((! expr->type) || (expr->type == PARAM_VALUE))
 		return sdb_data_copy(res, &expr->data);
 	else if (expr->type == FIELD_VALUE)
 		return sdb_memstore_get_field(obj, (int)expr->data.data.integer, res);
@@ -31,12 +31,49 @@
 #include "utils/error.h"
 
 #include <assert.h>
+#include <stdlib.h>
 
 static sdb_memstore_matcher_t *
-node_to_matcher(sdb_ast_node_t *n);
+node_to_matcher(sdb_memstore_query_t *q, sdb_ast_node_t *n);
 
 static sdb_memstore_expr_t *
-node_to_expr(sdb_ast_node_t *n)
+param_to_expr(sdb_memstore_query_t *q, sdb_ast_node_t *n)
+{
+	query_param_t *params;
+	sdb_memstore_expr_t *e;
+	int idx = SDB_AST_PARAM(n)->index;
+
+	if (! q) {
+		sdb_log(SDB_LOG_ERR, "memstore: Query parameter $%d is not "
+				"supported in this context", idx);
+		return NULL;
+	}
+	if ((idx < 1) || (SDB_AST_MAX_PARAMS < idx)) {
+		sdb_log(SDB_LOG_ERR, "memstore: Invalid query parameter $%d", idx);
+		return NULL;
+	}
+
+	params = realloc(q->params, (q->params_num + 1) * sizeof(*params));
+	if (! params)
+		return NULL;
+	q->params = params;
+
+	e = sdb_memstore_expr_param();
+	if (! e)
+		return NULL;
+
+	/* the query keeps its own reference to be able to bind values */
+	sdb_object_ref(SDB_OBJ(e));
+	q->params[q->params_num].index = idx;
+	q->params[q->params_num].expr = e;
+	++q->params_num;
+	if ((size_t)idx > q->max_param)
+		q->max_param = (size_t)idx;
+	return e;
+} /* param_to_expr */
+
+static sdb_memstore_expr_t *
+node_to_expr(sdb_memstore_query_t *q, sdb_ast_node_t *n)
 {
 	sdb_memstore_expr_t *left = NULL, *right = NULL;
 	sdb_memstore_expr_t *e;
@@ -55,10 +92,10 @@ node_to_expr(sdb_ast_node_t *n)
 			return NULL;
 		}
 
-		left = node_to_expr(SDB_AST_OP(n)->left);
+		left = node_to_expr(q, SDB_AST_OP(n)->left);
 		if (! left)
 			return NULL;
-		right = node_to_expr(SDB_AST_OP(n)->right);
+		right = node_to_expr(q, SDB_AST_OP(n)->right);
 		if (! right) {
 			sdb_object_deref(SDB_OBJ(left));
 			return NULL;
@@ -70,13 +107,16 @@ node_to_expr(sdb_ast_node_t *n)
 	case SDB_AST_TYPE_CONST:
 		return sdb_memstore_expr_constvalue(&SDB_AST_CONST(n)->value);
 
+	case SDB_AST_TYPE_PARAM:
+		return param_to_expr(q, n);
+
 	case SDB_AST_TYPE_VALUE:
 		if (SDB_AST_VALUE(n)->type == SDB_ATTRIBUTE)
 			return sdb_memstore_expr_attrvalue(SDB_AST_VALUE(n)->name);
 		return sdb_memstore_expr_fieldvalue(SDB_AST_VALUE(n)->type);
 
 	case SDB_AST_TYPE_TYPED:
-		right = node_to_expr(SDB_AST_TYPED(n)->expr);
+		right = node_to_expr(q, SDB_AST_TYPED(n)->expr);
 		if (! right)
 			return NULL;
 		e = sdb_memstore_expr_typed(SDB_AST_TYPED(n)->type, right);
@@ -95,17 +135,17 @@ node_to_expr(sdb_ast_node_t *n)
 } /* node_to_expr */
 
 static sdb_memstore_matcher_t *
-logical_to_matcher(sdb_ast_node_t *n)
+logical_to_matcher(sdb_memstore_query_t *q, sdb_ast_node_t *n)
 {
 	sdb_memstore_matcher_t *left = NULL, *right;
 	sdb_memstore_matcher_t *m;
 
 	if (SDB_AST_OP(n)->left) {
-		left = node_to_matcher(SDB_AST_OP(n)->left);
+		left = node_to_matcher(q, SDB_AST_OP(n)->left);
 		if (! left)
 			return NULL;
 	}
-	right = node_to_matcher(SDB_AST_OP(n)->right);
+	right = node_to_matcher(q, SDB_AST_OP(n)->right);
 	if (! right) {
 		sdb_object_deref(SDB_OBJ(left));
 		return NULL;
@@ -133,17 +173,17 @@ logical_to_matcher(sdb_ast_node_t *n)
 } /* logical_to_matcher */
 
 static sdb_memstore_matcher_t *
-cmp_to_matcher(sdb_ast_node_t *n)
+cmp_to_matcher(sdb_memstore_query_t *q, sdb_ast_node_t *n)
 {
 	sdb_memstore_expr_t *left = NULL, *right;
 	sdb_memstore_matcher_t *m;
 
 	if (SDB_AST_OP(n)->left) {
-		left = node_to_expr(SDB_AST_OP(n)->left);
+		left = node_to_expr(q, SDB_AST_OP(n)->left);
 		if (! left)
 			return NULL;
 	}
-	right = node_to_expr(SDB_AST_OP(n)->right);
+	right = node_to_expr(q, SDB_AST_OP(n)->right);
 	if (! right) {
 		sdb_object_deref(SDB_OBJ(left));
 		return NULL;
@@ -200,7 +240,7 @@ cmp_to_matcher(sdb_ast_node_t *n)
 } /* cmp_to_matcher */
 
 static sdb_memstore_matcher_t *
-iter_to_matcher(sdb_ast_node_t *n)
+iter_to_matcher(sdb_memstore_query_t *q, sdb_ast_node_t *n)
 {
 	sdb_memstore_expr_t *iter;
 	sdb_memstore_matcher_t *expr, *m;
@@ -208,10 +248,10 @@ iter_to_matcher(sdb_ast_node_t *n)
 	assert((SDB_AST_ITER(n)->expr->type == SDB_AST_TYPE_OPERATOR)
 			&& (! SDB_AST_OP(SDB_AST_ITER(n)->expr)->left));
 
-	iter = node_to_expr(SDB_AST_ITER(n)->iter);
+	iter = node_to_expr(q, SDB_AST_ITER(n)->iter);
 	if (! iter)
 		return NULL;
-	expr = cmp_to_matcher(SDB_AST_ITER(n)->expr);
+	expr = cmp_to_matcher(q, SDB_AST_ITER(n)->expr);
 	if (! expr) {
 		sdb_object_deref(SDB_OBJ(iter));
 		return NULL;
@@ -238,7 +278,7 @@ iter_to_matcher(sdb_ast_node_t *n)
 } /* iter_to_matcher */
 
 static sdb_memstore_matcher_t *
-node_to_matcher(sdb_ast_node_t *n)
+node_to_matcher(sdb_memstore_query_t *q, sdb_ast_node_t *n)
 {
 	int kind;
 
@@ -257,12 +297,12 @@ node_to_matcher(sdb_ast_node_t *n)
 
 		kind = SDB_AST_OP(n)->kind;
 		if ((kind == SDB_AST_AND) || (kind == SDB_AST_OR) || (kind == SDB_AST_NOT))
-			return logical_to_matcher(n);
+			return logical_to_matcher(q, n);
 		else
-			return cmp_to_matcher(n);
+			return cmp_to_matcher(q, n);
 
 	case SDB_AST_TYPE_ITERATOR:
-		return iter_to_matcher(n);
+		return iter_to_matcher(q, n);
 	}
 
 	sdb_log(SDB_LOG_ERR, "memstore: Invalid matcher node of type %s (%#x)",
@@ -283,6 +323,9 @@ query_init(sdb_object_t *obj, va_list ap)
 	QUERY(obj)->ast = ast;
 	sdb_object_ref(SDB_OBJ(ast));
 
+	/* queries without placeholders are ready for execution right away */
+	QUERY(obj)->bound = true;
+
 	switch (ast->type) {
 	case SDB_AST_TYPE_FETCH:
 		filter = SDB_AST_FETCH(ast)->filter;
@@ -306,22 +349,31 @@ query_init(sdb_object_t *obj, va_list ap)
 	}
 
 	if (matcher) {
-		QUERY(obj)->matcher = node_to_matcher(matcher);
+		QUERY(obj)->matcher = node_to_matcher(QUERY(obj), matcher);
 		if (! QUERY(obj)->matcher)
 			return -1;
 	}
 	if (filter) {
-		QUERY(obj)->filter = node_to_matcher(filter);
+		QUERY(obj)->filter = node_to_matcher(QUERY(obj), filter);
 		if (! QUERY(obj)->filter)
 			return -1;
 	}
 
+	if (QUERY(obj)->params_num)
+		QUERY(obj)->bound = false;
 	return 0;
 } /* query_init */
 
 static void
 query_destroy(sdb_object_t *obj)
 {
+	size_t i;
+
+	for (i = 0; i < QUERY(obj)->params_num; ++i)
+		sdb_object_deref(SDB_OBJ(QUERY(obj)->params[i].expr));
+	if (QUERY(obj)->params)
+		free(QUERY(obj)->params);
+
 	sdb_object_deref(SDB_OBJ(QUERY(obj)->ast));
 	sdb_object_deref(SDB_OBJ(QUERY(obj)->matcher));
 	sdb_object_deref(SDB_OBJ(QUERY(obj)->filter));
@@ -348,7 +400,54 @@ sdb_memstore_query_prepare(sdb_ast_node_t *ast)
 sdb_memstore_matcher_t *
 sdb_memstore_query_prepare_matcher(sdb_ast_node_t *ast)
 {
-	return node_to_matcher(ast);
+	/* placeholders are only supported in full queries */
+	return node_to_matcher(NULL, ast);
 } /* sdb_memstore_query_prepare_matcher */
 
+size_t
+sdb_memstore_query_params(sdb_memstore_query_t *q)
+{
+	if (! q)
+		return 0;
+	return q->max_param;
+} /* sdb_memstore_query_params */
+
+int
+sdb_memstore_query_bind(sdb_memstore_query_t *q,
+		const sdb_data_t *values, size_t values_num, sdb_strbuf_t *errbuf)
+{
+	size_t i;
+
+	if ((! q) || (values_num && (! values)))
+		return -1;
+
+	if (values_num != q->max_param) {
+		sdb_strbuf_sprintf(errbuf, "Query expects %zu parameter%s, got %zu",
+				q->max_param, q->max_param == 1 ? "" : "s", values_num);
+		return -1;
+	}
+	if (! q->params_num) {
+		/* nothing to do; don't modify the query to allow for executing it
+		 * concurrently */
+		return 0;
+	}
+
+	/* mark the query as unbound while updating the values to make sure it
+	 * won't be executed with a partial set of parameters on error */
+	q->bound = false;
+	for (i = 0; i < q->params_num; ++i) {
+		sdb_memstore_expr_t *e = q->params[i].expr;
+		const sdb_data_t *v = &values[q->params[i].index - 1];
+
+		if (sdb_data_copy(&e->data, v)) {
+			sdb_strbuf_sprintf(errbuf, "Failed to bind parameter $%d",
+					q->params[i].index);
+			return -1;
+		}
+		e->data_type = v->type;
+	}
+	q->bound = true;
+	return 0;
+} /* sdb_memstore_query_bind */
+
 /* vim: set tw=78 sw=4 ts=4 noexpandtab : */
@@ -0,0 +1,514 @@
+/*
+ * SysDB - src/core/memstore_repl.c
+ * Copyright (C) 2014-2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This module implements replication of an in-memory store.
+ *
+ * Each update of a stored object appends an entry describing the object's
+ * new state to the backlog. An entry is a snapshot record (see
+ * memstore_snapshot.c) prefixed with its sequence number:
+ *
+ *   entry: <sequence number (64bit)> | <type> | <length> | <payload>
+ *
+ * Entries are appended while holding the lock of the object's shard, so
+ * entries of the same host are ordered in the same way as the respective
+ * updates. Applying all entries in order reproduces the store's state; since
+ * each entry carries the full state of an object, applying an entry multiple
+ * times does not do any harm either. The backlog is made up of chunks of
+ * consecutive entries; the oldest chunks are dropped once the backlog
+ * exceeds its maximum size.
+ */
+
+#if HAVE_CONFIG_H
+#	include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include "sysdb.h"
+#include "core/memstore-private.h"
+#include "utils/error.h"
+#include "utils/proto.h"
+#include "utils/strbuf.h"
+
+#include <errno.h>
+#include <inttypes.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* start a new chunk once the current one exceeds this size */
+#define CHUNK_SIZE (64 * 1024)
+/* sequence number + type + length */
+#define ENTRY_HEADER_LEN 16
+
+/*
+ * private data types
+ */
+
+typedef struct chunk {
+	struct chunk *next;
+	/* sequence number of the first entry */
+	uint64_t first_seq;
+	sdb_strbuf_t *buf;
+} chunk_t;
+
+struct sdb_memstore_backlog {
+	pthread_mutex_t lock;
+
+	/* identifier of the replication stream and the sequence number of the
+	 * latest entry */
+	uint64_t id;
+	uint64_t seq;
+
+	chunk_t *head;
+	chunk_t *tail;
+	size_t size;
+	size_t max_size;
+
+	/* scratch buffer used for encoding entries */
+	sdb_strbuf_t *record;
+
+	/* written to once new entries are available; -1 if nobody waits */
+	int notify_fd;
+};
+
+/*
+ * private helper functions
+ */
+
+/* a new identifier for each stream; the identifier has to differ from that
+ * of any stream started before, including those of previous processes */
+static uint64_t
+new_id(void)
+{
+	static pthread_mutex_t counter_lock = PTHREAD_MUTEX_INITIALIZER;
+	static uint64_t counter = 0;
+	uint64_t id;
+
+	pthread_mutex_lock(&counter_lock);
+	id = (uint64_t)sdb_gettime() ^ ((uint64_t)getpid() << 40) ^ ++counter;
+	pthread_mutex_unlock(&counter_lock);
+	return id ? id : 1;
+} /* new_id */
+
+static int
+read_int64(const char *buf, size_t len, uint64_t *v)
+{
+	uint32_t hi, lo;
+
+	if ((sdb_proto_unmarshal_int32(buf, len, &hi) < 0)
+			|| (sdb_proto_unmarshal_int32(buf + 4, len - 4, &lo) < 0))
+		return -1;
+	*v = ((uint64_t)hi << 32) | lo;
+	return 0;
+} /* read_int64 */
+
+/* parse the header of the entry at the beginning of 'buf' */
+static int
+read_entry(const char *buf, size_t len,
+		uint64_t *seq, uint32_t *type, uint32_t *payload_len)
+{
+	if ((len < ENTRY_HEADER_LEN) || read_int64(buf, len, seq))
+		return -1;
+	sdb_proto_unmarshal_int32(buf + 8, len - 8, type);
+	sdb_proto_unmarshal_int32(buf + 12, len - 12, payload_len);
+	if (*payload_len > len - ENTRY_HEADER_LEN)
+		return -1;
+	return 0;
+} /* read_entry */
+
+static void
+chunk_destroy(chunk_t *c)
+{
+	if (! c)
+		return;
+	sdb_strbuf_destroy(c->buf);
+	free(c);
+} /* chunk_destroy */
+
+static chunk_t *
+chunk_create(uint64_t first_seq)
+{
+	chunk_t *c = calloc(1, sizeof(*c));
+
+	if (! c)
+		return NULL;
+	c->first_seq = first_seq;
+	c->buf = sdb_strbuf_create(CHUNK_SIZE + 1024);
+	if (! c->buf) {
+		free(c);
+		return NULL;
+	}
+	return c;
+} /* chunk_create */
+
+/* drop all entries and start a new stream; expects the lock to be held */
+static void
+backlog_reset(sdb_memstore_backlog_t *bl)
+{
+	while (bl->head) {
+		chunk_t *c = bl->head;
+		bl->head = c->next;
+		chunk_destroy(c);
+	}
+	bl->tail = NULL;
+	bl->size = 0;
+	bl->id = new_id();
+} /* backlog_reset */
+
+/* returns the oldest position from which the stream may be continued;
+ * expects the lock to be held */
+static uint64_t
+backlog_oldest(sdb_memstore_backlog_t *bl)
+{
+	if (! bl->head)
+		return bl->seq;
+	return bl->head->first_seq - 1;
+} /* backlog_oldest */
+
+static void
+backlog_notify(sdb_memstore_backlog_t *bl)
+{
+	if (bl->notify_fd < 0)
+		return;
+	if (write(bl->notify_fd, "", 1) <= 0)
+		sdb_log(SDB_LOG_DEBUG, "memstore: Failed to notify replicas "
+				"about new entries");
+	bl->notify_fd = -1;
+} /* backlog_notify */
+
+/* append all entries following 'seq' (up to about 'max' bytes); expects the
+ * lock to be held and the position to be available */
+static void
+backlog_read(sdb_memstore_backlog_t *bl, uint64_t *seq,
+		sdb_strbuf_t *buf, size_t max)
+{
+	chunk_t *c;
+
+	/* find the chunk including the next entry */
+	for (c = bl->head; c; c = c->next)
+		if ((! c->next) || (c->next->first_seq > *seq + 1))
+			break;
+
+	for ( ; c && (*seq < bl->seq); c = c->next) {
+		const char *data = sdb_strbuf_string(c->buf);
+		size_t len = sdb_strbuf_len(c->buf);
+		size_t pos = 0;
+
+		/* skip entries which have been read before */
+		while (pos < len) {
+			uint64_t entry_seq;
+			uint32_t type, payload_len;
+
+			if (read_entry(data + pos, len - pos,
+						&entry_seq, &type, &payload_len)
+					|| (entry_seq > *seq))
+				break;
+			pos += ENTRY_HEADER_LEN + payload_len;
+		}
+
+		sdb_strbuf_memappend(buf, data + pos, len - pos);
+		*seq = c->next ? c->next->first_seq - 1 : bl->seq;
+		if (sdb_strbuf_len(buf) >= max)
+			break;
+	}
+} /* backlog_read */
+
+/* the state of writing a part of a full copy */
+typedef struct {
+	sdb_memstore_records_t rec;
+	sdb_store_repl_pos_t *pos;
+	/* the part starts at 'start' and ends at about 'max' bytes */
+	size_t start;
+	size_t max;
+
+	/* the previous host of the current scan */
+	const char *last;
+} copy_t;
+
+static int
+copy_host(sdb_memstore_obj_t *host,
+		sdb_memstore_matcher_t __attribute__((unused)) *filter,
+		void *user_data)
+{
+	copy_t *copy = user_data;
+	size_t len = sdb_strbuf_len(copy->rec.buf);
+	const char *name = SDB_OBJ(host)->name;
+
+	if (sdb_memstore_emit_full(host, /* filter = */ NULL,
+				&sdb_memstore_record_writer, SDB_OBJ(&copy->rec)))
+		return -1;
+	if (sdb_strbuf_len(copy->rec.buf) < copy->max) {
+		copy->last = name;
+		return 0;
+	}
+
+	/* a part exceeds the maximum size only if a single host does */
+	if ((len > copy->start) && (sdb_strbuf_len(copy->rec.buf) > copy->max)) {
+		sdb_strbuf_skip(copy->rec.buf, len,
+				sdb_strbuf_len(copy->rec.buf) - len);
+		name = copy->last;
+	}
+
+	/* remember where to continue; without any previous host in this scan,
+	 * that's where the scan started */
+	if (name) {
+		free(copy->pos->copy_key);
+		copy->pos->copy_key = strdup(name);
+		if (! copy->pos->copy_key)
+			return -1;
+	}
+	return 1;
+} /* copy_host */
+
+/* write the next part (of about 'max' bytes) of a copy of the store; the
+ * last part is followed by an empty entry marking the position which the
+ * copy reflects */
+static int
+write_copy(sdb_memstore_t *store, sdb_store_repl_pos_t *pos,
+		sdb_strbuf_t *buf, size_t max)
+{
+	copy_t copy = {
+		{ SDB_OBJECT_INIT, NULL, NULL, 0, true, 0 }, NULL, 0, 0, NULL,
+	};
+	char marker[ENTRY_HEADER_LEN];
+	int status = 0;
+
+	copy.rec.buf = buf;
+	copy.rec.record = sdb_strbuf_create(1024);
+	if (! copy.rec.record)
+		return -1;
+	copy.pos = pos;
+	copy.start = sdb_strbuf_len(buf);
+	copy.max = copy.start + max;
+
+	/* updates assigned later sequence numbers may or may not be included;
+	 * they are part of the stream following the copy anyway */
+	while (pos->copy_part < store->shards_num) {
+		copy.last = NULL;
+		status = sdb_memstore_scan_shard(store, pos->copy_part,
+				pos->copy_key, copy_host, &copy);
+		if (status)
+			break;
+
+		++pos->copy_part;
+		free(pos->copy_key);
+		pos->copy_key = NULL;
+	}
+	sdb_strbuf_destroy(copy.rec.record);
+	if (status)
+		return status < 0 ? -1 : 0;
+
+	memset(marker, 0, sizeof(marker));
+	sdb_proto_marshal_int32(marker, 4, (uint32_t)(pos->seq >> 32));
+	sdb_proto_marshal_int32(marker + 4, 4,
+			(uint32_t)(pos->seq & 0xffffffff));
+	if (sdb_strbuf_memappend(buf, marker, sizeof(marker)) < 0)
+		return -1;
+	pos->copying = false;
+	return 0;
+} /* write_copy */
+
+/*
+ * private API
+ */
+
+void
+sdb_memstore_backlog_append(sdb_memstore_backlog_t *bl,
+		sdb_memstore_obj_t *obj)
+{
+	sdb_memstore_records_t rec = { SDB_OBJECT_INIT, NULL, NULL, 0, true, 0 };
+	size_t len;
+
+	pthread_mutex_lock(&bl->lock);
+	if ((! bl->tail) || (sdb_strbuf_len(bl->tail->buf) >= CHUNK_SIZE)) {
+		chunk_t *c = chunk_create(bl->seq + 1);
+		if (! c) {
+			sdb_log(SDB_LOG_ERR, "memstore: Failed to allocate replication "
+					"backlog; replicas will have to resynchronize");
+			backlog_reset(bl);
+			++bl->seq;
+			pthread_mutex_unlock(&bl->lock);
+			return;
+		}
+		if (bl->tail)
+			bl->tail->next = c;
+		else
+			bl->head = c;
+		bl->tail = c;
+	}
+
+	len = sdb_strbuf_len(bl->tail->buf);
+	rec.buf = bl->tail->buf;
+	rec.record = bl->record;
+	rec.seq = bl->seq + 1;
+	if (sdb_memstore_emit(obj, &sdb_memstore_record_writer, SDB_OBJ(&rec))) {
+		sdb_log(SDB_LOG_ERR, "memstore: Failed to record update of %s '%s' "
+				"for replication; replicas will have to resynchronize",
+				SDB_STORE_TYPE_TO_NAME(obj->type), SDB_OBJ(obj)->name);
+		backlog_reset(bl);
+		++bl->seq;
+		pthread_mutex_unlock(&bl->lock);
+		return;
+	}
+	++bl->seq;
+	bl->size += sdb_strbuf_len(bl->tail->buf) - len;
+
+	/* drop the oldest entries but always keep the current chunk */
+	while ((bl->size > bl->max_size) && (bl->head != bl->tail)) {
+		chunk_t *c = bl->head;
+		bl->head = c->next;
+		bl->size -= sdb_strbuf_len(c->buf);
+		chunk_destroy(c);
+	}
+
+	backlog_notify(bl);
+	pthread_mutex_unlock(&bl->lock);
+} /* sdb_memstore_backlog_append */
+
+void
+sdb_memstore_backlog_destroy(sdb_memstore_backlog_t *bl)
+{
+	if (! bl)
+		return;
+
+	backlog_reset(bl);
+	sdb_strbuf_destroy(bl->record);
+	pthread_mutex_destroy(&bl->lock);
+	free(bl);
+} /* sdb_memstore_backlog_destroy */
+
+/*
+ * public API
+ */
+
+int
+sdb_memstore_enable_replication(sdb_memstore_t *store, size_t backlog_size)
+{
+	sdb_memstore_backlog_t *bl;
+
+	if ((! store) || (! backlog_size))
+		return -1;
+
+	bl = calloc(1, sizeof(*bl));
+	if (! bl)
+		return -1;
+	pthread_mutex_init(&bl->lock, /* attr = */ NULL);
+	bl->record = sdb_strbuf_create(1024);
+	if (! bl->record) {
+		sdb_memstore_backlog_destroy(bl);
+		return -1;
+	}
+	bl->id = new_id();
+	bl->max_size = backlog_size;
+	bl->notify_fd = -1;
+
+	sdb_memstore_backlog_destroy(store->backlog);
+	store->backlog = bl;
+	return 0;
+} /* sdb_memstore_enable_replication */
+
+int
+sdb_memstore_replicate(sdb_memstore_t *store, sdb_store_repl_pos_t *pos,
+		sdb_strbuf_t *buf, size_t max, int notify_fd)
+{
+	sdb_memstore_backlog_t *bl;
+
+	if ((! store) || (! store->backlog) || (! pos))
+		return -1;
+	bl = store->backlog;
+
+	pthread_mutex_lock(&bl->lock);
+	if ((! pos->copying) && (pos->id == bl->id) && (pos->seq <= bl->seq)
+			&& (pos->seq >= backlog_oldest(bl))) {
+		int pending = pos->seq < bl->seq;
+
+		if (buf && pending)
+			backlog_read(bl, &pos->seq, buf, max);
+		else if (! pending)
+			bl->notify_fd = notify_fd;
+		pthread_mutex_unlock(&bl->lock);
+		return buf ? 0 : pending;
+	}
+
+	if (! buf) {
+		pthread_mutex_unlock(&bl->lock);
+		return 1;
+	}
+
+	if (! pos->copying) {
+		pos->id = bl->id;
+		pos->seq = bl->seq;
+		pos->copying = true;
+		pos->copy_part = 0;
+		free(pos->copy_key);
+		pos->copy_key = NULL;
+	}
+
+	/* the scan acquires the shard locks, so the copy has to be written
+	 * without holding the backlog's lock */
+	pthread_mutex_unlock(&bl->lock);
+
+	if (write_copy(store, pos, buf, max))
+		return -1;
+	return 1;
+} /* sdb_memstore_replicate */
+
+int
+sdb_memstore_apply_replication(sdb_memstore_t *store,
+		const char *buf, size_t len, uint64_t *seq)
+{
+	int n = 0;
+
+	if ((! store) || (! buf) || (! seq))
+		return -1;
+
+	while (len > 0) {
+		uint64_t entry_seq;
+		uint32_t type, payload_len;
+
+		if (read_entry(buf, len, &entry_seq, &type, &payload_len))
+			return -1;
+		buf += ENTRY_HEADER_LEN;
+		len -= ENTRY_HEADER_LEN;
+
+		/* failing to apply an entry (e.g., because of running out of
+		 * memory) does not prevent applying any further entries */
+		if (type && sdb_memstore_apply_record(store, type, buf, payload_len))
+			sdb_log(SDB_LOG_ERR, "memstore: Failed to apply replicated "
+					"entry %"PRIu64" (type %"PRIu32")", entry_seq, type);
+		if (entry_seq)
+			*seq = entry_seq;
+
+		buf += payload_len;
+		len -= payload_len;
+		++n;
+	}
+	return n;
+} /* sdb_memstore_apply_replication */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
@@ -0,0 +1,723 @@
+/*
+ * SysDB - src/core/memstore_snapshot.c
+ * Copyright (C) 2014-2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This module implements persistent snapshots of an in-memory store.
+ *
+ * A snapshot file consists of a header followed by a sequence of records,
+ * one for each stored object, and a trailer. All integers are stored in
+ * network byte order and all strings are null-terminated such that the
+ * records may be used directly from a memory mapping of the file.
+ *
+ *   header:  "SDBSNAP\0" | <version> | <sequence number (64bit)>
+ *   record:  <type> | <length> | <payload>
+ *   trailer: 0 | 8 | <number of records (64bit)>
+ *
+ * Hosts are stored shard by shard, in order of their names, each host being
+ * followed by all of its children, as emitted by sdb_memstore_emit_full().
+ */
+
+#if HAVE_CONFIG_H
+#	include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include "sysdb.h"
+#include "core/memstore-private.h"
+#include "utils/error.h"
+#include "utils/os.h"
+#include "utils/proto.h"
+#include "utils/strbuf.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SNAPSHOT_MAGIC "SDBSNAP"
+#define SNAPSHOT_VERSION 1
+
+/* magic + version + sequence number */
+#define SNAPSHOT_HEADER_LEN (sizeof(SNAPSHOT_MAGIC) + 4 + 8)
+/* type + length */
+#define RECORD_HEADER_LEN 8
+
+/* write out serialized records once about that many bytes are buffered */
+#define SNAPSHOT_BUF_SIZE (1024 * 1024)
+
+/*
+ * private helper functions
+ */
+
+static int
+append_int32(sdb_strbuf_t *buf, uint32_t v)
+{
+	char tmp[4];
+	sdb_proto_marshal_int32(tmp, sizeof(tmp), v);
+	return sdb_strbuf_memappend(buf, tmp, sizeof(tmp)) < 0 ? -1 : 0;
+} /* append_int32 */
+
+static int
+append_int64(sdb_strbuf_t *buf, uint64_t v)
+{
+	if (append_int32(buf, (uint32_t)(v >> 32)))
+		return -1;
+	return append_int32(buf, (uint32_t)(v & 0xffffffff));
+} /* append_int64 */
+
+static int
+append_string(sdb_strbuf_t *buf, const char *s)
+{
+	if (! s)
+		s = "";
+	return sdb_strbuf_memappend(buf, s, strlen(s) + 1) < 0 ? -1 : 0;
+} /* append_string */
+
+/* a cursor into a snapshot's memory mapping */
+typedef struct {
+	const char *buf;
+	size_t len;
+} cursor_t;
+
+static int
+read_int32(cursor_t *c, uint32_t *v)
+{
+	ssize_t n = sdb_proto_unmarshal_int32(c->buf, c->len, v);
+	if (n < 0)
+		return -1;
+	c->buf += n;
+	c->len -= (size_t)n;
+	return 0;
+} /* read_int32 */
+
+static int
+read_int64(cursor_t *c, uint64_t *v)
+{
+	uint32_t hi, lo;
+
+	if (read_int32(c, &hi) || read_int32(c, &lo))
+		return -1;
+	*v = ((uint64_t)hi << 32) | lo;
+	return 0;
+} /* read_int64 */
+
+static int
+read_time(cursor_t *c, sdb_time_t *t)
+{
+	uint64_t v;
+
+	if (read_int64(c, &v))
+		return -1;
+	*t = (sdb_time_t)v;
+	return 0;
+} /* read_time */
+
+static int
+read_string(cursor_t *c, const char **s)
+{
+	const char *end = memchr(c->buf, '\0', c->len);
+
+	if (! end)
+		return -1;
+	*s = c->buf;
+	c->len -= (size_t)(end - c->buf) + 1;
+	c->buf = end + 1;
+	return 0;
+} /* read_string */
+
+/*
+ * snapshot writer:
+ * A store writer serializing all objects into a memory buffer.
+ */
+
+typedef sdb_memstore_records_t snapshot_t;
+#define SNAPSHOT(obj) ((snapshot_t *)(obj))
+
+/* serialize the meta-data common to all objects */
+static int
+add_meta(snapshot_t *snap, sdb_time_t last_update, sdb_time_t interval,
+		const char * const *backends, size_t backends_num)
+{
+	size_t i;
+
+	sdb_strbuf_clear(snap->record);
+	if (append_int64(snap->record, (uint64_t)last_update)
+			|| append_int64(snap->record, (uint64_t)interval)
+			|| append_int32(snap->record, (uint32_t)backends_num))
+		return -1;
+	for (i = 0; i < backends_num; ++i)
+		if (append_string(snap->record, backends[i]))
+			return -1;
+	return 0;
+} /* add_meta */
+
+static int
+add_record(snapshot_t *snap, int type)
+{
+	size_t len = sdb_strbuf_len(snap->record);
+
+	if (snap->entries && append_int64(snap->buf, snap->seq))
+		return -1;
+	if (append_int32(snap->buf, (uint32_t)type)
+			|| append_int32(snap->buf, (uint32_t)len)
+			|| (sdb_strbuf_memappend(snap->buf,
+					sdb_strbuf_string(snap->record), len) < 0))
+		return -1;
+	++snap->records_num;
+	return 0;
+} /* add_record */
+
+static int
+snapshot_host(sdb_store_host_t *host, sdb_object_t *user_data)
+{
+	snapshot_t *snap = SNAPSHOT(user_data);
+
+	if (add_meta(snap, host->last_update, host->interval,
+				host->backends, host->backends_num)
+			|| append_string(snap->record, host->name))
+		return -1;
+	return add_record(snap, SDB_HOST);
+} /* snapshot_host */
+
+static int
+snapshot_service(sdb_store_service_t *service, sdb_object_t *user_data)
+{
+	snapshot_t *snap = SNAPSHOT(user_data);
+
+	if (add_meta(snap, service->last_update, service->interval,
+				service->backends, service->backends_num)
+			|| append_string(snap->record, service->hostname)
+			|| append_string(snap->record, service->name))
+		return -1;
+	return add_record(snap, SDB_SERVICE);
+} /* snapshot_service */
+
+static int
+snapshot_metric(sdb_store_metric_t *metric, sdb_object_t *user_data)
+{
+	snapshot_t *snap = SNAPSHOT(user_data);
+	size_t i;
+
+	if (add_meta(snap, metric->last_update, metric->interval,
+				metric->backends, metric->backends_num)
+			|| append_string(snap->record, metric->hostname)
+			|| append_string(snap->record, metric->name)
+			|| append_int32(snap->record, (uint32_t)metric->stores_num))
+		return -1;
+	for (i = 0; i < metric->stores_num; ++i) {
+		const sdb_metric_store_t *s = metric->stores + i;
+		if (append_string(snap->record, s->type)
+				|| append_string(snap->record, s->id)
+				|| append_int64(snap->record, (uint64_t)s->last_update))
+			return -1;
+	}
+	return add_record(snap, SDB_METRIC);
+} /* snapshot_metric */
+
+static int
+snapshot_attribute(sdb_store_attribute_t *attr, sdb_object_t *user_data)
+{
+	snapshot_t *snap = SNAPSHOT(user_data);
+	ssize_t len;
+
+	if (add_meta(snap, attr->last_update, attr->interval,
+				attr->backends, attr->backends_num)
+			|| append_int32(snap->record, (uint32_t)attr->parent_type)
+			|| append_string(snap->record, attr->hostname)
+			|| append_string(snap->record, attr->parent)
+			|| append_string(snap->record, attr->key))
+		return -1;
+
+	len = sdb_proto_marshal_data(NULL, 0, &attr->value);
+	if (len < 0)
+		return -1;
+	else {
+		char value[len];
+		sdb_proto_marshal_data(value, sizeof(value), &attr->value);
+		if (sdb_strbuf_memappend(snap->record, value, sizeof(value)) < 0)
+			return -1;
+	}
+	return add_record(snap, SDB_ATTRIBUTE);
+} /* snapshot_attribute */
+
+sdb_store_writer_t sdb_memstore_record_writer = {
+	snapshot_host, snapshot_service, snapshot_metric, snapshot_attribute,
+};
+
+/* the state of serializing the store in parts of about SNAPSHOT_BUF_SIZE
+ * bytes */
+typedef struct {
+	snapshot_t snap;
+	/* the last host serialized so far */
+	char *last;
+} snapshot_scan_t;
+
+static int
+snapshot_obj(sdb_memstore_obj_t *obj,
+		sdb_memstore_matcher_t __attribute__((unused)) *filter,
+		void *user_data)
+{
+	snapshot_scan_t *scan = user_data;
+
+	if (sdb_memstore_emit_full(obj, /* filter = */ NULL,
+				&sdb_memstore_record_writer, SDB_OBJ(&scan->snap)))
+		return -1;
+	if (sdb_strbuf_len(scan->snap.buf) < SNAPSHOT_BUF_SIZE)
+		return 0;
+
+	/* stop to write out the buffer without holding the shard's lock */
+	free(scan->last);
+	scan->last = strdup(SDB_OBJ(obj)->name);
+	return scan->last ? 1 : -1;
+} /* snapshot_obj */
+
+/* write all buffered data to the specified file and clear the buffer */
+static int
+write_buf(int fd, sdb_strbuf_t *buf, size_t *size)
+{
+	if (sdb_write(fd, sdb_strbuf_len(buf), sdb_strbuf_string(buf)) < 0)
+		return -1;
+	*size += sdb_strbuf_len(buf);
+	sdb_strbuf_clear(buf);
+	return 0;
+} /* write_buf */
+
+/*
+ * snapshot loader
+ */
+
+typedef struct {
+	const char **backends;
+	size_t backends_size;
+	sdb_metric_store_t *stores;
+	size_t stores_size;
+} loader_t;
+
+static int
+load_meta(cursor_t *c, loader_t *l, sdb_time_t *last_update,
+		sdb_time_t *interval, const char * const **backends,
+		size_t *backends_num)
+{
+	uint32_t n, i;
+
+	if (read_time(c, last_update) || read_time(c, interval)
+			|| read_int32(c, &n))
+		return -1;
+	/* each string requires at least one byte */
+	if (n > c->len)
+		return -1;
+
+	if (n > l->backends_size) {
+		const char **tmp = realloc(l->backends, n * sizeof(*tmp));
+		if (! tmp)
+			return -1;
+		l->backends = tmp;
+		l->backends_size = n;
+	}
+	for (i = 0; i < n; ++i)
+		if (read_string(c, l->backends + i))
+			return -1;
+
+	*backends = l->backends;
+	*backends_num = n;
+	return 0;
+} /* load_meta */
+
+static int
+load_host(sdb_memstore_t *store, cursor_t *c, loader_t *l)
+{
+	sdb_store_host_t host = SDB_STORE_HOST_INIT;
+
+	if (load_meta(c, l, &host.last_update, &host.interval,
+				&host.backends, &host.backends_num)
+			|| read_string(c, &host.name))
+		return -1;
+	return sdb_memstore_writer.store_host(&host, SDB_OBJ(store));
+} /* load_host */
+
+static int
+load_service(sdb_memstore_t *store, cursor_t *c, loader_t *l)
+{
+	sdb_store_service_t service = SDB_STORE_SERVICE_INIT;
+
+	if (load_meta(c, l, &service.last_update, &service.interval,
+				&service.backends, &service.backends_num)
+			|| read_string(c, &service.hostname)
+			|| read_string(c, &service.name))
+		return -1;
+	return sdb_memstore_writer.store_service(&service, SDB_OBJ(store));
+} /* load_service */
+
+static int
+load_metric(sdb_memstore_t *store, cursor_t *c, loader_t *l)
+{
+	sdb_store_metric_t metric = SDB_STORE_METRIC_INIT;
+	uint32_t n, i;
+
+	if (load_meta(c, l, &metric.last_update, &metric.interval,
+				&metric.backends, &metric.backends_num)
+			|| read_string(c, &metric.hostname)
+			|| read_string(c, &metric.name)
+			|| read_int32(c, &n))
+		return -1;
+	/* two strings and a timestamp per store */
+	if (n > c->len / 10)
+		return -1;
+
+	if (n > l->stores_size) {
+		sdb_metric_store_t *tmp = realloc(l->stores, n * sizeof(*tmp));
+		if (! tmp)
+			return -1;
+		l->stores = tmp;
+		l->stores_size = n;
+	}
+	for (i = 0; i < n; ++i) {
+		sdb_metric_store_t *s = l->stores + i;
+		s->info = NULL;
+		if (read_string(c, &s->type) || read_string(c, &s->id)
+				|| read_time(c, &s->last_update))
+			return -1;
+	}
+
+	metric.stores = l->stores;
+	metric.stores_num = n;
+	return sdb_memstore_writer.store_metric(&metric, SDB_OBJ(store));
+} /* load_metric */
+
+static int
+load_attribute(sdb_memstore_t *store, cursor_t *c, loader_t *l)
+{
+	sdb_store_attribute_t attr = SDB_STORE_ATTRIBUTE_INIT;
+	uint32_t parent_type;
+	ssize_t n;
+	int status;
+
+	if (load_meta(c, l, &attr.last_update, &attr.interval,
+				&attr.backends, &attr.backends_num)
+			|| read_int32(c, &parent_type)
+			|| read_string(c, &attr.hostname)
+			|| read_string(c, &attr.parent)
+			|| read_string(c, &attr.key))
+		return -1;
+	attr.parent_type = (int)parent_type;
+	if (! *attr.hostname)
+		attr.hostname = NULL;
+
+	n = sdb_proto_unmarshal_data(c->buf, c->len, &attr.value);
+	if (n < 0)
+		return -1;
+	c->buf += n;
+	c->len -= (size_t)n;
+
+	status = sdb_memstore_writer.store_attribute(&attr, SDB_OBJ(store));
+	sdb_data_free_datum(&attr.value);
+	return status;
+} /* load_attribute */
+
+static int
+load_record(sdb_memstore_t *store, uint32_t type, cursor_t *c, loader_t *l)
+{
+	if (type == SDB_HOST)
+		return load_host(store, c, l);
+	else if (type == SDB_SERVICE)
+		return load_service(store, c, l);
+	else if (type == SDB_METRIC)
+		return load_metric(store, c, l);
+	else if (type == SDB_ATTRIBUTE)
+		return load_attribute(store, c, l);
+	return -1;
+} /* load_record */
+
+static int
+load_records(sdb_memstore_t *store, const char *filename, cursor_t *c)
+{
+	loader_t loader = { NULL, 0, NULL, 0 };
+	uint64_t records_num = 0, expected;
+	int status = 0;
+
+	while (42) {
+		uint32_t type, len;
+		cursor_t record;
+
+		if (read_int32(c, &type) || read_int32(c, &len) || (len > c->len)) {
+			sdb_log(SDB_LOG_ERR, "memstore: Snapshot '%s' is truncated "
+					"after %"PRIu64" records", filename, records_num);
+			status = -1;
+			break;
+		}
+		record.buf = c->buf;
+		record.len = len;
+		c->buf += len;
+		c->len -= len;
+
+		if (! type) {
+			/* trailer */
+			if (read_int64(&record, &expected) || (expected != records_num)) {
+				sdb_log(SDB_LOG_ERR, "memstore: Snapshot '%s' is corrupt: "
+						"found %"PRIu64" records, expected %"PRIu64,
+						filename, records_num, expected);
+				status = -1;
+			}
+			break;
+		}
+
+		status = load_record(store, type, &record, &loader);
+		if (status) {
+			sdb_log(SDB_LOG_ERR, "memstore: Failed to load record %"PRIu64
+					" (type %"PRIu32") from snapshot '%s'",
+					records_num, type, filename);
+			status = -1;
+			break;
+		}
+		++records_num;
+	}
+
+	free(loader.backends);
+	free(loader.stores);
+	return status;
+} /* load_records */
+
+/*
+ * private API
+ */
+
+int
+sdb_memstore_apply_record(sdb_memstore_t *store, uint32_t type,
+		const char *buf, size_t len)
+{
+	loader_t loader = { NULL, 0, NULL, 0 };
+	cursor_t c = { buf, len };
+	int status;
+
+	status = load_record(store, type, &c, &loader);
+	free(loader.backends);
+	free(loader.stores);
+	return status;
+} /* sdb_memstore_apply_record */
+
+/*
+ * public API
+ */
+
+int
+sdb_memstore_snapshot(sdb_memstore_t *store, const char *filename)
+{
+	snapshot_scan_t scan = {
+		{ SDB_OBJECT_INIT, NULL, NULL, 0, false, 0 }, NULL,
+	};
+	char tmp_name[filename ? strlen(filename) + 5 : 1];
+	char errbuf[1024];
+	sdb_time_t start;
+	uint64_t seq;
+	size_t size = 0, i = 0;
+	int fd, status = 0;
+
+	if ((! store) || (! filename))
+		return -1;
+
+	start = sdb_gettime();
+
+	/* write to a temporary file first to atomically replace the snapshot */
+	snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", filename);
+	fd = open(tmp_name, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		sdb_log(SDB_LOG_ERR, "memstore: Failed to write snapshot '%s': %s",
+				filename, sdb_strerror(errno, errbuf, sizeof(errbuf)));
+		return -1;
+	}
+
+	scan.snap.buf = sdb_strbuf_create(SNAPSHOT_BUF_SIZE + 1024);
+	scan.snap.record = sdb_strbuf_create(1024);
+	if ((! scan.snap.buf) || (! scan.snap.record)) {
+		sdb_strbuf_destroy(scan.snap.buf);
+		sdb_strbuf_destroy(scan.snap.record);
+		close(fd);
+		unlink(tmp_name);
+		return -1;
+	}
+
+	/* any update assigned a later sequence number may or may not be part of
+	 * the snapshot; this is fine since loading the snapshot will assign new
+	 * sequence numbers anyway */
+	pthread_mutex_lock(&store->counter_lock);
+	seq = store->seq;
+	pthread_mutex_unlock(&store->counter_lock);
+
+	sdb_strbuf_memappend(scan.snap.buf, SNAPSHOT_MAGIC,
+			sizeof(SNAPSHOT_MAGIC));
+	append_int32(scan.snap.buf, SNAPSHOT_VERSION);
+	append_int64(scan.snap.buf, seq);
+
+	/* serialize one shard at a time, writing out the buffer whenever it
+	 * fills up; each host is serialized from a consistent view of the host
+	 * while updates of other hosts may go on */
+	while (i < store->shards_num) {
+		status = sdb_memstore_scan_shard(store, i, scan.last,
+				snapshot_obj, &scan);
+		if (status < 0) {
+			sdb_log(SDB_LOG_ERR, "memstore: Failed to serialize snapshot");
+			break;
+		}
+		if (! status) {
+			free(scan.last);
+			scan.last = NULL;
+			++i;
+		}
+
+		status = 0;
+		if ((sdb_strbuf_len(scan.snap.buf) >= SNAPSHOT_BUF_SIZE)
+				&& write_buf(fd, scan.snap.buf, &size)) {
+			status = 1;
+			break;
+		}
+	}
+	free(scan.last);
+
+	/* a positive status indicates an I/O error which has not been reported
+	 * yet */
+	if (! status) {
+		sdb_strbuf_clear(scan.snap.record);
+		if (append_int64(scan.snap.record, scan.snap.records_num)
+				|| add_record(&scan.snap, 0)) {
+			sdb_log(SDB_LOG_ERR, "memstore: Failed to serialize snapshot");
+			status = -1;
+		}
+	}
+	if ((! status) && (write_buf(fd, scan.snap.buf, &size) || fsync(fd)))
+		status = 1;
+	if (close(fd) && (! status))
+		status = 1;
+	if ((! status) && rename(tmp_name, filename))
+		status = 1;
+	if (status > 0)
+		sdb_log(SDB_LOG_ERR, "memstore: Failed to write snapshot '%s': %s",
+				filename, sdb_strerror(errno, errbuf, sizeof(errbuf)));
+	sdb_strbuf_destroy(scan.snap.record);
+	sdb_strbuf_destroy(scan.snap.buf);
+
+	if (status) {
+		unlink(tmp_name);
+		return -1;
+	}
+	sdb_sync_dir(filename);
+
+	sdb_log(SDB_LOG_INFO, "memstore: Wrote snapshot of %"PRIu64" objects "
+			"(%zu bytes) to '%s' in %.3fs", scan.snap.records_num - 1,
+			size, filename, SDB_TIME_TO_DOUBLE(sdb_gettime() - start));
+	return 0;
+} /* sdb_memstore_snapshot */
+
+int
+sdb_memstore_load_snapshot(sdb_memstore_t *store, const char *filename)
+{
+	char errbuf[1024];
+	struct stat st;
+	sdb_time_t start;
+	cursor_t c;
+	void *map;
+	uint32_t version;
+	uint64_t seq;
+	int fd, status;
+
+	if ((! store) || (! filename))
+		return -1;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		if (errno == ENOENT)
+			return 1;
+		sdb_log(SDB_LOG_ERR, "memstore: Failed to open snapshot '%s': %s",
+				filename, sdb_strerror(errno, errbuf, sizeof(errbuf)));
+		return -1;
+	}
+	if (fstat(fd, &st)) {
+		sdb_log(SDB_LOG_ERR, "memstore: Failed to stat snapshot '%s': %s",
+				filename, sdb_strerror(errno, errbuf, sizeof(errbuf)));
+		close(fd);
+		return -1;
+	}
+	if ((size_t)st.st_size < SNAPSHOT_HEADER_LEN) {
+		sdb_log(SDB_LOG_ERR, "memstore: Invalid snapshot '%s': "
+				"file too short", filename);
+		close(fd);
+		return -1;
+	}
+
+	start = sdb_gettime();
+	map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		sdb_log(SDB_LOG_ERR, "memstore: Failed to map snapshot '%s': %s",
+				filename, sdb_strerror(errno, errbuf, sizeof(errbuf)));
+		return -1;
+	}
+	/* the file is read exactly once from start to end */
+	madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+	c.buf = map;
+	c.len = (size_t)st.st_size;
+	if (memcmp(c.buf, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC))) {
+		sdb_log(SDB_LOG_ERR, "memstore: Invalid snapshot '%s': "
+				"bad magic", filename);
+		munmap(map, (size_t)st.st_size);
+		return -1;
+	}
+	c.buf += sizeof(SNAPSHOT_MAGIC);
+	c.len -= sizeof(SNAPSHOT_MAGIC);
+	read_int32(&c, &version);
+	read_int64(&c, &seq);
+	if (version != SNAPSHOT_VERSION) {
+		sdb_log(SDB_LOG_ERR, "memstore: Unsupported version %"PRIu32
+				" of snapshot '%s'", version, filename);
+		munmap(map, (size_t)st.st_size);
+		return -1;
+	}
+
+	/* objects loaded from the snapshot are assigned sequence numbers beyond
+	 * those handed out before, making sure they are reported as changed */
+	pthread_mutex_lock(&store->counter_lock);
+	if (store->seq < seq)
+		store->seq = seq;
+	pthread_mutex_unlock(&store->counter_lock);
+
+	status = load_records(store, filename, &c);
+	munmap(map, (size_t)st.st_size);
+
+	if (! status)
+		sdb_log(SDB_LOG_INFO, "memstore: Loaded snapshot '%s' "
+				"(%zu bytes) in %.3fs", filename, (size_t)st.st_size,
+				SDB_TIME_TO_DOUBLE(sdb_gettime() - start));
+	return status;
+} /* sdb_memstore_load_snapshot */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
@@ -0,0 +1,793 @@
+/*
+ * SysDB - src/core/memstore_wal.c
+ * Copyright (C) 2014-2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This module implements a write-ahead log for an in-memory store.
+ *
+ * Each successful update of the store is appended to the log as a record
+ * consisting of its length (32bit integer in network byte order), the
+ * object's interval and backends (encoded as data values), and the object
+ * itself encoded as expected by sdb_proto_unmarshal_object.
+ *
+ * Records are collected in memory and written by a dedicated thread. All
+ * records accumulating while the thread is busy are written (and synced)
+ * at once, such that concurrent writers share the cost of a single sync
+ * (group commit).
+ */
+
+#if HAVE_CONFIG_H
+#	include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include "sysdb.h"
+#include "core/memstore-private.h"
+#include "utils/error.h"
+#include "utils/os.h"
+#include "utils/proto.h"
+#include "utils/strbuf.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <pthread.h>
+
+struct sdb_memstore_wal {
+	sdb_object_t super;
+
+	sdb_memstore_t *store;
+	char *filename;
+	int fd;
+
+	int sync;
+	sdb_time_t sync_interval;
+
+	/* pending records and number of appended and committed records */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_cond_t committed_cond;
+	sdb_strbuf_t *pending;
+	uint64_t appended;
+	uint64_t committed;
+	bool error;
+	bool shutdown;
+
+	/* serializes all I/O on the log file */
+	pthread_mutex_t io_lock;
+	sdb_strbuf_t *writing;
+
+	pthread_t flusher;
+	bool flusher_running;
+};
+#define WAL(obj) ((sdb_memstore_wal_t *)(obj))
+
+/*
+ * private helper functions
+ */
+
+/* write all pending records to disk; expects the I/O lock to be held */
+static int
+flush_records(sdb_memstore_wal_t *wal, bool sync)
+{
+	sdb_strbuf_t *tmp;
+	uint64_t target;
+	int status = 0;
+
+	pthread_mutex_lock(&wal->lock);
+	tmp = wal->pending;
+	wal->pending = wal->writing;
+	wal->writing = tmp;
+	target = wal->appended;
+	pthread_mutex_unlock(&wal->lock);
+
+	if (sdb_strbuf_len(wal->writing))
+		if (sdb_write(wal->fd, sdb_strbuf_len(wal->writing),
+					sdb_strbuf_string(wal->writing)) < 0)
+			status = -1;
+	if ((! status) && sync && fsync(wal->fd))
+		status = -1;
+	sdb_strbuf_clear(wal->writing);
+
+	pthread_mutex_lock(&wal->lock);
+	if (status && (! wal->error)) {
+		char errbuf[1024];
+		sdb_log(SDB_LOG_ERR, "memstore: Failed to write to write-ahead "
+				"log '%s': %s", wal->filename,
+				sdb_strerror(errno, errbuf, sizeof(errbuf)));
+		wal->error = true;
+	}
+	/* failed records are committed as well; writers check the error flag */
+	wal->committed = target;
+	pthread_cond_broadcast(&wal->committed_cond);
+	pthread_mutex_unlock(&wal->lock);
+	return status;
+} /* flush_records */
+
+static void *
+flusher(void *arg)
+{
+	sdb_memstore_wal_t *wal = arg;
+	sdb_time_t last_sync = sdb_gettime();
+	bool dirty = false;
+
+	while (42) {
+		sdb_time_t now;
+		bool sync, done;
+
+		pthread_mutex_lock(&wal->lock);
+		while ((! wal->shutdown) && (! sdb_strbuf_len(wal->pending))) {
+			if ((wal->sync == SDB_MEMSTORE_WAL_SYNC_INTERVAL) && dirty) {
+				sdb_time_t deadline = last_sync + wal->sync_interval;
+				struct timespec ts;
+
+				ts.tv_sec = (time_t)SDB_TIME_TO_SECS(deadline);
+				ts.tv_nsec = (long)(deadline % SECS_TO_SDB_TIME(1));
+				if (pthread_cond_timedwait(&wal->cond,
+							&wal->lock, &ts) == ETIMEDOUT)
+					break;
+			}
+			else
+				pthread_cond_wait(&wal->cond, &wal->lock);
+		}
+		done = wal->shutdown;
+		pthread_mutex_unlock(&wal->lock);
+
+		now = sdb_gettime();
+		sync = done || (wal->sync == SDB_MEMSTORE_WAL_SYNC_ALWAYS)
+			|| ((wal->sync == SDB_MEMSTORE_WAL_SYNC_INTERVAL)
+					&& (now - last_sync >= wal->sync_interval));
+
+		pthread_mutex_lock(&wal->io_lock);
+		flush_records(wal, sync);
+		pthread_mutex_unlock(&wal->io_lock);
+
+		if (sync) {
+			last_sync = now;
+			dirty = false;
+		}
+		else
+			dirty = true;
+
+		if (done)
+			break;
+	}
+	return NULL;
+} /* flusher */
+
+/* encode a single record and append it to the log; the update has been
+ * applied to the store already */
+static int
+append_record(sdb_memstore_wal_t *wal, const sdb_proto_object_t *obj,
+		sdb_time_t interval, const char * const *backends, size_t backends_num)
+{
+	sdb_data_t iv = { SDB_TYPE_DATETIME, { .datetime = interval } };
+	sdb_data_t be = { SDB_TYPE_ARRAY | SDB_TYPE_STRING, { .array = {
+		backends_num, NULL } } };
+	/* the datum is used read-only */
+	union {
+		const char * const *c;
+		void *v;
+	} be_values = { backends };
+	ssize_t iv_len, be_len, obj_len;
+	size_t len, pos;
+	uint64_t ticket;
+	int status = 0;
+
+	char static_buf[1024];
+	char *buf = static_buf;
+
+	be.data.array.values = be_values.v;
+	iv_len = sdb_proto_marshal_data(NULL, 0, &iv);
+	be_len = sdb_proto_marshal_data(NULL, 0, &be);
+	obj_len = sdb_proto_marshal_object(NULL, 0, obj);
+	if ((iv_len < 0) || (be_len < 0) || (obj_len < 0))
+		return -1;
+
+	len = 4 + (size_t)(iv_len + be_len + obj_len);
+	if (len > sizeof(static_buf)) {
+		buf = malloc(len);
+		if (! buf)
+			return -1;
+	}
+
+	pos = sdb_proto_marshal_int32(buf, len, (uint32_t)(len - 4));
+	pos += sdb_proto_marshal_data(buf + pos, len - pos, &iv);
+	pos += sdb_proto_marshal_data(buf + pos, len - pos, &be);
+	sdb_proto_marshal_object(buf + pos, len - pos, obj);
+
+	pthread_mutex_lock(&wal->lock);
+	if (wal->error || (sdb_strbuf_memappend(wal->pending, buf, len) < 0))
+		status = -1;
+	else {
+		ticket = ++wal->appended;
+		/* the flusher only waits for an empty buffer */
+		if (sdb_strbuf_len(wal->pending) == len)
+			pthread_cond_signal(&wal->cond);
+		if (wal->sync == SDB_MEMSTORE_WAL_SYNC_ALWAYS) {
+			while (wal->committed < ticket)
+				pthread_cond_wait(&wal->committed_cond, &wal->lock);
+			if (wal->error)
+				status = -1;
+		}
+	}
+	pthread_mutex_unlock(&wal->lock);
+
+	if (buf != static_buf)
+		free(buf);
+	return status;
+} /* append_record */
+
+/*
+ * WAL type
+ */
+
+static int
+wal_init(sdb_object_t *obj, va_list ap)
+{
+	sdb_memstore_wal_t *wal = WAL(obj);
+	sdb_memstore_t *store;
+	const char *filename;
+	char errbuf[1024];
+
+	store = va_arg(ap, sdb_memstore_t *);
+	filename = va_arg(ap, const char *);
+	wal->sync = va_arg(ap, int);
+	wal->sync_interval = va_arg(ap, sdb_time_t);
+
+	wal->fd = -1;
+	pthread_mutex_init(&wal->lock, /* attr = */ NULL);
+	pthread_cond_init(&wal->cond, /* attr = */ NULL);
+	pthread_cond_init(&wal->committed_cond, /* attr = */ NULL);
+	pthread_mutex_init(&wal->io_lock, /* attr = */ NULL);
+
+	if ((! store) || (! filename))
+		return -1;
+	if ((wal->sync == SDB_MEMSTORE_WAL_SYNC_INTERVAL)
+			&& (wal->sync_interval <= 0))
+		return -1;
+
+	sdb_object_ref(SDB_OBJ(store));
+	wal->store = store;
+
+	wal->filename = strdup(filename);
+	wal->pending = sdb_strbuf_create(64 * 1024);
+	wal->writing = sdb_strbuf_create(64 * 1024);
+	if ((! wal->filename) || (! wal->pending) || (! wal->writing))
+		return -1;
+
+	wal->fd = open(filename, O_WRONLY | O_CREAT | O_APPEND, 0600);
+	if (wal->fd < 0) {
+		sdb_log(SDB_LOG_ERR, "memstore: Failed to open write-ahead log "
+				"'%s': %s", filename,
+				sdb_strerror(errno, errbuf, sizeof(errbuf)));
+		return -1;
+	}
+	sdb_sync_dir(filename);
+
+	if (pthread_create(&wal->flusher, /* attr = */ NULL, flusher, wal)) {
+		sdb_log(SDB_LOG_ERR, "memstore: Failed to start write-ahead log "
+				"thread: %s", sdb_strerror(errno, errbuf, sizeof(errbuf)));
+		return -1;
+	}
+	wal->flusher_running = true;
+	return 0;
+} /* wal_init */
+
+static void
+wal_destroy(sdb_object_t *obj)
+{
+	sdb_memstore_wal_t *wal = WAL(obj);
+
+	if (wal->flusher_running) {
+		pthread_mutex_lock(&wal->lock);
+		wal->shutdown = true;
+		pthread_cond_signal(&wal->cond);
+		pthread_mutex_unlock(&wal->lock);
+		pthread_join(wal->flusher, NULL);
+	}
+
+	if (wal->fd >= 0)
+		close(wal->fd);
+	wal->fd = -1;
+
+	sdb_strbuf_destroy(wal->pending);
+	sdb_strbuf_destroy(wal->writing);
+	if (wal->filename)
+		free(wal->filename);
+	wal->filename = NULL;
+
+	sdb_object_deref(SDB_OBJ(wal->store));
+	wal->store = NULL;
+
+	pthread_mutex_destroy(&wal->lock);
+	pthread_cond_destroy(&wal->cond);
+	pthread_cond_destroy(&wal->committed_cond);
+	pthread_mutex_destroy(&wal->io_lock);
+} /* wal_destroy */
+
+static sdb_type_t wal_type = {
+	/* size = */ sizeof(sdb_memstore_wal_t),
+	/* init = */ wal_init,
+	/* destroy = */ wal_destroy,
+};
+
+/*
+ * store writer
+ */
+
+static int
+wal_store_host(sdb_store_host_t *host, sdb_object_t *user_data)
+{
+	sdb_memstore_wal_t *wal = WAL(user_data);
+	sdb_proto_object_t obj;
+	int status;
+
+	status = sdb_memstore_writer.store_host(host, SDB_OBJ(wal->store));
+	if (status)
+		return status;
+
+	memset(&obj, 0, sizeof(obj));
+	obj.type = SDB_HOST;
+	obj.data.host.last_update = host->last_update;
+	obj.data.host.name = host->name;
+	return append_record(wal, &obj, host->interval,
+			host->backends, host->backends_num);
+} /* wal_store_host */
+
+static int
+wal_store_service(sdb_store_service_t *service, sdb_object_t *user_data)
+{
+	sdb_memstore_wal_t *wal = WAL(user_data);
+	sdb_proto_object_t obj;
+	int status;
+
+	status = sdb_memstore_writer.store_service(service, SDB_OBJ(wal->store));
+	if (status)
+		return status;
+
+	memset(&obj, 0, sizeof(obj));
+	obj.type = SDB_SERVICE;
+	obj.data.service.last_update = service->last_update;
+	obj.data.service.hostname = service->hostname;
+	obj.data.service.name = service->name;
+	return append_record(wal, &obj, service->interval,
+			service->backends, service->backends_num);
+} /* wal_store_service */
+
+static int
+wal_store_metric(sdb_store_metric_t *metric, sdb_object_t *user_data)
+{
+	sdb_memstore_wal_t *wal = WAL(user_data);
+	sdb_proto_metric_store_t static_stores[8];
+	sdb_proto_object_t obj;
+	size_t i;
+	int status;
+
+	status = sdb_memstore_writer.store_metric(metric, SDB_OBJ(wal->store));
+	if (status)
+		return status;
+
+	memset(&obj, 0, sizeof(obj));
+	obj.type = SDB_METRIC;
+	obj.data.metric.last_update = metric->last_update;
+	obj.data.metric.hostname = metric->hostname;
+	obj.data.metric.name = metric->name;
+
+	obj.stores = static_stores;
+	if (metric->stores_num > SDB_STATIC_ARRAY_LEN(static_stores)) {
+		obj.stores = calloc(metric->stores_num, sizeof(*obj.stores));
+		if (! obj.stores)
+			return -1;
+	}
+	for (i = 0; i < metric->stores_num; ++i) {
+		obj.stores[i].type = metric->stores[i].type;
+		obj.stores[i].id = metric->stores[i].id;
+		obj.stores[i].last_update = metric->stores[i].last_update;
+	}
+	obj.stores_num = metric->stores_num;
+
+	status = append_record(wal, &obj, metric->interval,
+			metric->backends, metric->backends_num);
+	if (obj.stores != static_stores)
+		free(obj.stores);
+	return status;
+} /* wal_store_metric */
+
+static int
+wal_store_attribute(sdb_store_attribute_t *attr, sdb_object_t *user_data)
+{
+	sdb_memstore_wal_t *wal = WAL(user_data);
+	sdb_proto_object_t obj;
+	int status;
+
+	status = sdb_memstore_writer.store_attribute(attr, SDB_OBJ(wal->store));
+	if (status)
+		return status;
+
+	memset(&obj, 0, sizeof(obj));
+	obj.type = attr->parent_type | SDB_ATTRIBUTE;
+	obj.data.attribute.last_update = attr->last_update;
+	obj.data.attribute.parent_type = attr->parent_type;
+	obj.data.attribute.hostname = attr->hostname;
+	obj.data.attribute.parent = attr->parent;
+	obj.data.attribute.key = attr->key;
+	obj.data.attribute.value = attr->value;
+	return append_record(wal, &obj, attr->interval,
+			attr->backends, attr->backends_num);
+} /* wal_store_attribute */
+
+sdb_store_writer_t sdb_memstore_wal_writer = {
+	wal_store_host, wal_store_service, wal_store_metric, wal_store_attribute,
+};
+
+/*
+ * replay
+ */
+
+/* returns true if the store holds a more recent version of the object; this
+ * makes replaying records which are included in a snapshot idempotent */
+static bool
+is_stale(sdb_memstore_t *store, const sdb_proto_object_t *obj)
+{
+	sdb_memstore_obj_t *host, *parent = NULL, *o = NULL;
+	const char *hostname;
+	sdb_time_t last_update;
+	bool stale;
+
+	if (obj->type == SDB_HOST) {
+		hostname = obj->data.host.name;
+		last_update = obj->data.host.last_update;
+	}
+	else if (obj->type == SDB_SERVICE) {
+		hostname = obj->data.service.hostname;
+		last_update = obj->data.service.last_update;
+	}
+	else if (obj->type == SDB_METRIC) {
+		hostname = obj->data.metric.hostname;
+		last_update = obj->data.metric.last_update;
+	}
+	else {
+		hostname = obj->data.attribute.hostname;
+		if (obj->data.attribute.parent_type == SDB_HOST)
+			hostname = obj->data.attribute.parent;
+		last_update = obj->data.attribute.last_update;
+	}
+
+	host = sdb_memstore_get_host(store, hostname);
+	if (! host)
+		return false;
+
+	if (obj->type == SDB_HOST)
+		o = host;
+	else if (obj->type == SDB_SERVICE)
+		o = sdb_memstore_get_child(host, SDB_SERVICE, obj->data.service.name);
+	else if (obj->type == SDB_METRIC)
+		o = sdb_memstore_get_child(host, SDB_METRIC, obj->data.metric.name);
+	else {
+		parent = host;
+		if (obj->data.attribute.parent_type != SDB_HOST)
+			parent = sdb_memstore_get_child(host,
+					obj->data.attribute.parent_type,
+					obj->data.attribute.parent);
+		if (parent)
+			o = sdb_memstore_get_child(parent, SDB_ATTRIBUTE,
+					obj->data.attribute.key);
+	}
+
+	stale = o && (o->last_update > last_update);
+	if (o != host)
+		sdb_object_deref(SDB_OBJ(o));
+	if (parent != host)
+		sdb_object_deref(SDB_OBJ(parent));
+	sdb_object_deref(SDB_OBJ(host));
+	return stale;
+} /* is_stale */
+
+static int
+replay_record(sdb_memstore_t *store, const char *buf, size_t len)
+{
+	sdb_data_t interval = SDB_DATA_INIT, backends = SDB_DATA_INIT;
+	sdb_proto_object_t obj;
+	ssize_t n;
+	int status = -1;
+
+	memset(&obj, 0, sizeof(obj));
+	if ((n = sdb_proto_unmarshal_data(buf, len, &interval)) < 0)
+		return -1;
+	buf += n; len -= (size_t)n;
+	if ((n = sdb_proto_unmarshal_data(buf, len, &backends)) < 0)
+		goto out;
+	buf += n; len -= (size_t)n;
+	if ((interval.type != SDB_TYPE_DATETIME)
+			|| (backends.type != (SDB_TYPE_ARRAY | SDB_TYPE_STRING)))
+		goto out;
+	if (((n = sdb_proto_unmarshal_object(buf, len, &obj)) < 0)
+			|| ((size_t)n != len))
+		goto out;
+
+	/* failing to apply a record is not an error of the log; the store logs
+	 * any such errors and the remaining records are still valid */
+	status = 0;
+	if (is_stale(store, &obj))
+		goto out;
+
+	if (obj.type == SDB_HOST) {
+		sdb_store_host_t host = SDB_STORE_HOST_INIT;
+		host.name = obj.data.host.name;
+		host.last_update = obj.data.host.last_update;
+		host.interval = interval.data.datetime;
+		host.backends = (const char * const *)backends.data.array.values;
+		host.backends_num = backends.data.array.length;
+		sdb_memstore_writer.store_host(&host, SDB_OBJ(store));
+	}
+	else if (obj.type == SDB_SERVICE) {
+		sdb_store_service_t service = SDB_STORE_SERVICE_INIT;
+		service.hostname = obj.data.service.hostname;
+		service.name = obj.data.service.name;
+		service.last_update = obj.data.service.last_update;
+		service.interval = interval.data.datetime;
+		service.backends = (const char * const *)backends.data.array.values;
+		service.backends_num = backends.data.array.length;
+		sdb_memstore_writer.store_service(&service, SDB_OBJ(store));
+	}
+	else if (obj.type == SDB_METRIC) {
+		sdb_store_metric_t metric = SDB_STORE_METRIC_INIT;
+		sdb_metric_store_t static_stores[8];
+		sdb_metric_store_t *stores = static_stores;
+		size_t i;
+
+		if (obj.stores_num > SDB_STATIC_ARRAY_LEN(static_stores)) {
+			stores = calloc(obj.stores_num, sizeof(*stores));
+			if (! stores) {
+				status = -1;
+				goto out;
+			}
+		}
+		for (i = 0; i < obj.stores_num; ++i) {
+			stores[i].type = obj.stores[i].type;
+			stores[i].id = obj.stores[i].id;
+			stores[i].info = NULL;
+			stores[i].last_update = obj.stores[i].last_update;
+		}
+		metric.hostname = obj.data.metric.hostname;
+		metric.name = obj.data.metric.name;
+		metric.stores = stores;
+		metric.stores_num = obj.stores_num;
+		metric.last_update = obj.data.metric.last_update;
+		metric.interval = interval.data.datetime;
+		metric.backends = (const char * const *)backends.data.array.values;
+		metric.backends_num = backends.data.array.length;
+		sdb_memstore_writer.store_metric(&metric, SDB_OBJ(store));
+		if (stores != static_stores)
+			free(stores);
+	}
+	else {
+		sdb_store_attribute_t attr = SDB_STORE_ATTRIBUTE_INIT;
+		attr.hostname = obj.data.attribute.hostname;
+		attr.parent_type = obj.data.attribute.parent_type;
+		attr.parent = obj.data.attribute.parent;
+		attr.key = obj.data.attribute.key;
+		attr.value = obj.data.attribute.value;
+		attr.last_update = obj.data.attribute.last_update;
+		attr.interval = interval.data.datetime;
+		attr.backends = (const char * const *)backends.data.array.values;
+		attr.backends_num = backends.data.array.length;
+		sdb_memstore_writer.store_attribute(&attr, SDB_OBJ(store));
+	}
+
+out:
+	sdb_proto_free_object(&obj);
+	sdb_data_free_datum(&interval);
+	sdb_data_free_datum(&backends);
+	return status;
+} /* replay_record */
+
+/* replay a single log file; returns the number of replayed records; a torn
+ * or corrupt record at the end of the log is discarded if 'repair' is
+ * true */
+static int64_t
+replay_file(sdb_memstore_t *store, const char *filename, bool repair)
+{
+	char errbuf[1024];
+	struct stat st;
+	const char *buf;
+	void *map = NULL;
+	size_t len, pos = 0;
+	int64_t records = 0;
+	int fd;
+
+	fd = open(filename, repair ? O_RDWR : O_RDONLY);
+	if (fd < 0) {
+		if (errno == ENOENT)
+			return 0;
+		sdb_log(SDB_LOG_ERR, "memstore: Failed to open write-ahead log "
+				"'%s': %s", filename,
+				sdb_strerror(errno, errbuf, sizeof(errbuf)));
+		return -1;
+	}
+	if (fstat(fd, &st)) {
+		sdb_log(SDB_LOG_ERR, "memstore: Failed to stat write-ahead log "
+				"'%s': %s", filename,
+				sdb_strerror(errno, errbuf, sizeof(errbuf)));
+		close(fd);
+		return -1;
+	}
+
+	len = (size_t)st.st_size;
+	if (len) {
+		map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) {
+			sdb_log(SDB_LOG_ERR, "memstore: Failed to map write-ahead log "
+					"'%s': %s", filename,
+					sdb_strerror(errno, errbuf, sizeof(errbuf)));
+			close(fd);
+			return -1;
+		}
+		madvise(map, len, MADV_SEQUENTIAL);
+	}
+	buf = map;
+
+	while (pos < len) {
+		uint32_t rec_len;
+
+		if ((sdb_proto_unmarshal_int32(buf + pos, len - pos, &rec_len) < 0)
+				|| (rec_len > len - pos - sizeof(rec_len)))
+			break;
+		if (replay_record(store, buf + pos + sizeof(rec_len), rec_len))
+			break;
+		pos += sizeof(rec_len) + rec_len;
+		++records;
+	}
+
+	if (pos < len) {
+		sdb_log(SDB_LOG_WARNING, "memstore: Discarding %zu bytes of torn "
+				"or corrupt data at offset %zu of write-ahead log '%s'",
+				len - pos, pos, filename);
+		if (repair && ftruncate(fd, (off_t)pos))
+			sdb_log(SDB_LOG_ERR, "memstore: Failed to truncate write-ahead "
+					"log '%s': %s", filename,
+					sdb_strerror(errno, errbuf, sizeof(errbuf)));
+	}
+
+	if (map)
+		munmap(map, len);
+	close(fd);
+	return records;
+} /* replay_file */
+
+/*
+ * public API
+ */
+
+sdb_memstore_wal_t *
+sdb_memstore_wal_create(sdb_memstore_t *store, const char *filename,
+		int sync, sdb_time_t sync_interval)
+{
+	return WAL(sdb_object_create("memstore-wal", wal_type,
+				store, filename, sync, sync_interval));
+} /* sdb_memstore_wal_create */
+
+int
+sdb_memstore_wal_replay(sdb_memstore_t *store, const char *filename)
+{
+	char old_name[filename ? strlen(filename) + 5 : 1];
+	int64_t n, m;
+	sdb_time_t start;
+
+	if ((! store) || (! filename))
+		return -1;
+
+	start = sdb_gettime();
+	snprintf(old_name, sizeof(old_name), "%s.old", filename);
+
+	/* a log left behind by an incomplete checkpoint precedes the current
+	 * log */
+	n = replay_file(store, old_name, /* repair = */ false);
+	if (n < 0)
+		return -1;
+	m = replay_file(store, filename, /* repair = */ true);
+	if (m < 0)
+		return -1;
+
+	if (n + m)
+		sdb_log(SDB_LOG_INFO, "memstore: Replayed %"PRId64" records from "
+				"write-ahead log '%s' in %.3fs", n + m, filename,
+				SDB_TIME_TO_DOUBLE(sdb_gettime() - start));
+	return 0;
+} /* sdb_memstore_wal_replay */
+
+int
+sdb_memstore_wal_checkpoint(sdb_memstore_wal_t *wal, const char *snapshot)
+{
+	char old_name[wal ? strlen(wal->filename) + 5 : 1];
+	char errbuf[1024];
+	struct stat st;
+	int status = 0;
+
+	if ((! wal) || (! snapshot))
+		return -1;
+
+	snprintf(old_name, sizeof(old_name), "%s.old", wal->filename);
+
+	/* Rotate the log: any record in the old log has been applied to the store
+	 * before the rotation and, thus, is included in the snapshot. If an old
+	 * log exists already, a previous checkpoint failed. It covers all records
+	 * up to its rotation and the current log has to be retained. */
+	pthread_mutex_lock(&wal->io_lock);
+	if (stat(old_name, &st) && (errno == ENOENT)) {
+		int fd = -1;
+
+		status = flush_records(wal, /* sync = */ true);
+		if ((! status) && (! (status = rename(wal->filename, old_name)))) {
+			fd = open(wal->filename, O_WRONLY | O_CREAT | O_APPEND, 0600);
+			if (fd < 0) {
+				sdb_strerror(errno, errbuf, sizeof(errbuf));
+				/* keep appending to the current log */
+				rename(old_name, wal->filename);
+				status = -1;
+			}
+		}
+		else
+			sdb_strerror(errno, errbuf, sizeof(errbuf));
+
+		if (status)
+			sdb_log(SDB_LOG_ERR, "memstore: Failed to rotate write-ahead "
+					"log '%s': %s", wal->filename, errbuf);
+		else {
+			close(wal->fd);
+			wal->fd = fd;
+			sdb_sync_dir(wal->filename);
+		}
+	}
+	pthread_mutex_unlock(&wal->io_lock);
+	if (status)
+		return -1;
+
+	if (sdb_memstore_snapshot(wal->store, snapshot))
+		return -1;
+
+	if (unlink(old_name) && (errno != ENOENT)) {
+		sdb_log(SDB_LOG_ERR, "memstore: Failed to remove write-ahead "
+				"log '%s': %s", old_name,
+				sdb_strerror(errno, errbuf, sizeof(errbuf)));
+		return -1;
+	}
+	sdb_sync_dir(old_name);
+	return 0;
+} /* sdb_memstore_wal_checkpoint */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
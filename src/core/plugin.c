@@ -32,16 +32,19 @@
 #include "sysdb.h"
 #include "core/plugin.h"
 #include "core/time.h"
+#include "utils/channel.h"
 #include "utils/error.h"
 #include "utils/llist.h"
 #include "utils/strbuf.h"
 
 #include <assert.h>
+#include <ctype.h>
 
 #include <errno.h>
 
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <strings.h>
 #include <unistd.h>
@@ -94,6 +97,13 @@ typedef struct {
 #define ccb_ctx super.cb_ctx
 	sdb_time_t ccb_interval;
 	sdb_time_t ccb_next_update;
+	sdb_time_t ccb_timeout;
+
+	/* run-time state; protected by collector_lock */
+	bool ccb_running;
+	bool ccb_timed_out;
+	sdb_time_t ccb_last_start;
+	sdb_plugin_collector_stats_t ccb_stats;
 } collector_t;
 #define CCB(obj) ((collector_t *)(obj))
 #define CONST_CCB(obj) ((const collector_t *)(obj))
@@ -103,6 +113,7 @@ typedef struct {
 #define w_user_data super.cb_user_data
 #define w_ctx super.cb_ctx
 	sdb_store_writer_t impl;
+	sdb_plugin_writer_opts_t opts;
 } writer_t;
 #define WRITER(obj) ((writer_t *)(obj))
 
@@ -122,6 +133,29 @@ typedef struct {
 } ts_fetcher_t;
 #define TS_FETCHER(obj) ((ts_fetcher_t *)(obj))
 
+/* a query (or subscription) prepared by a single reader */
+typedef struct {
+	reader_t *reader;
+	sdb_object_t *q;
+} reader_query_t;
+
+/* a query prepared by all readers; see sdb_plugin_prepare_query */
+typedef struct {
+	sdb_object_t super;
+	int type; /* the type of the query (SDB_AST_TYPE_*) */
+	reader_query_t *queries;
+	size_t queries_num;
+} prepared_t;
+#define PREPARED(obj) ((prepared_t *)(obj))
+
+/* subscriptions registered with all readers; see sdb_plugin_watch */
+typedef struct {
+	sdb_object_t super;
+	reader_query_t *watches;
+	size_t watches_num;
+} watch_t;
+#define WATCH(obj) ((watch_t *)(obj))
+
 /*
  * private variables
  */
@@ -145,6 +179,11 @@ static sdb_llist_t      *timeseries_fetcher_list = NULL;
 static sdb_llist_t      *writer_list = NULL;
 static sdb_llist_t      *reader_list = NULL;
 
+/* protects the collector list and the collectors' run-time state
+ * while the collector loop is running */
+static pthread_mutex_t   collector_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t    collector_cond = PTHREAD_COND_INITIALIZER;
+
 static struct {
 	const char   *type;
 	sdb_llist_t **list;
@@ -341,6 +380,430 @@ static sdb_store_writer_t query_writer = {
 	query_store_metric, query_store_attribute,
 };
 
+/*
+ * federated queries:
+ * If multiple readers are registered, a query is executed by all of them in
+ * parallel. Each reader's result is collected into a list of per-host groups
+ * which are then merged in host order and passed on to the query writer.
+ */
+
+/* a copy of an object returned by a reader; all arrays and strings are
+ * stored in a single allocation following the record */
+typedef struct {
+	int type;
+	union {
+		sdb_store_host_t host;
+		sdb_store_service_t service;
+		sdb_store_metric_t metric;
+		sdb_store_attribute_t attr;
+	} obj;
+} query_record_t;
+
+/* references to all members of a record which need to be copied */
+typedef struct {
+	const char **strings[3];
+	size_t strings_num;
+	const char * const **backends;
+	size_t backends_num;
+	const sdb_metric_store_t **stores;
+	size_t stores_num;
+} query_record_members_t;
+
+/* a host and all of its children as returned by a single reader */
+typedef struct {
+	const char *hostname;
+	sdb_time_t last_update;
+	size_t reader_idx;
+	size_t idx;
+
+	query_record_t **records;
+	size_t records_num;
+	size_t records_size;
+} query_group_t;
+
+typedef struct {
+	sdb_object_t super;
+
+	reader_t *reader;
+	sdb_object_t *q;
+	size_t reader_idx;
+
+	query_group_t *groups;
+	size_t groups_num;
+	size_t groups_size;
+
+	int status;
+	sdb_strbuf_t *errbuf;
+	pthread_t thread;
+} query_collector_t;
+#define QUERY_COLLECTOR(obj) ((query_collector_t *)(obj))
+
+static void
+query_record_members(query_record_t *rec, query_record_members_t *m)
+{
+	memset(m, 0, sizeof(*m));
+	switch (rec->type) {
+	case SDB_HOST:
+		m->strings[m->strings_num++] = &rec->obj.host.name;
+		m->backends = &rec->obj.host.backends;
+		m->backends_num = rec->obj.host.backends_num;
+		break;
+	case SDB_SERVICE:
+		m->strings[m->strings_num++] = &rec->obj.service.hostname;
+		m->strings[m->strings_num++] = &rec->obj.service.name;
+		m->backends = &rec->obj.service.backends;
+		m->backends_num = rec->obj.service.backends_num;
+		break;
+	case SDB_METRIC:
+		m->strings[m->strings_num++] = &rec->obj.metric.hostname;
+		m->strings[m->strings_num++] = &rec->obj.metric.name;
+		m->backends = &rec->obj.metric.backends;
+		m->backends_num = rec->obj.metric.backends_num;
+		m->stores = &rec->obj.metric.stores;
+		m->stores_num = rec->obj.metric.stores_num;
+		break;
+	case SDB_ATTRIBUTE:
+		m->strings[m->strings_num++] = &rec->obj.attr.hostname;
+		m->strings[m->strings_num++] = &rec->obj.attr.parent;
+		m->strings[m->strings_num++] = &rec->obj.attr.key;
+		m->backends = &rec->obj.attr.backends;
+		m->backends_num = rec->obj.attr.backends_num;
+		break;
+	}
+} /* query_record_members */
+
+static size_t
+query_strlen(const char *s)
+{
+	return s ? strlen(s) + 1 : 0;
+} /* query_strlen */
+
+static const char *
+query_strcpy(char **buf, const char *s)
+{
+	char *copy = *buf;
+	size_t len;
+
+	if (! s)
+		return NULL;
+	len = strlen(s) + 1;
+	memcpy(copy, s, len);
+	*buf += len;
+	return copy;
+} /* query_strcpy */
+
+static query_record_t *
+query_record_create(int type, const void *obj)
+{
+	query_record_t tmp, *rec;
+	query_record_members_t m;
+	const char **backends;
+	sdb_metric_store_t *stores;
+	size_t len, i;
+	char *buf;
+
+	memset(&tmp, 0, sizeof(tmp));
+	tmp.type = type;
+	switch (type) {
+	case SDB_HOST:
+		tmp.obj.host = *(const sdb_store_host_t *)obj;
+		break;
+	case SDB_SERVICE:
+		tmp.obj.service = *(const sdb_store_service_t *)obj;
+		break;
+	case SDB_METRIC:
+		tmp.obj.metric = *(const sdb_store_metric_t *)obj;
+		break;
+	case SDB_ATTRIBUTE:
+		tmp.obj.attr = *(const sdb_store_attribute_t *)obj;
+		break;
+	default:
+		return NULL;
+	}
+
+	query_record_members(&tmp, &m);
+	len = m.backends_num * sizeof(*backends)
+		+ m.stores_num * sizeof(*stores);
+	for (i = 0; i < m.strings_num; ++i)
+		len += query_strlen(*m.strings[i]);
+	for (i = 0; i < m.backends_num; ++i)
+		len += query_strlen((*m.backends)[i]);
+	for (i = 0; i < m.stores_num; ++i)
+		len += query_strlen((*m.stores)[i].type)
+			+ query_strlen((*m.stores)[i].id);
+
+	rec = malloc(sizeof(*rec) + len);
+	if (! rec)
+		return NULL;
+	*rec = tmp;
+
+	/* pointer arrays first to ensure proper alignment */
+	backends = (const char **)(rec + 1);
+	stores = (sdb_metric_store_t *)(backends + m.backends_num);
+	buf = (char *)(stores + m.stores_num);
+
+	query_record_members(rec, &m);
+	for (i = 0; i < m.strings_num; ++i)
+		*m.strings[i] = query_strcpy(&buf, *m.strings[i]);
+	for (i = 0; i < m.backends_num; ++i)
+		backends[i] = query_strcpy(&buf, (*m.backends)[i]);
+	*m.backends = m.backends_num ? backends : NULL;
+	for (i = 0; i < m.stores_num; ++i) {
+		stores[i] = (*m.stores)[i];
+		stores[i].type = query_strcpy(&buf, stores[i].type);
+		stores[i].id = query_strcpy(&buf, stores[i].id);
+		/* will be added by the query writer if requested */
+		stores[i].info = NULL;
+	}
+	if (m.stores)
+		*m.stores = m.stores_num ? stores : NULL;
+
+	if (type == SDB_ATTRIBUTE) {
+		const sdb_store_attribute_t *attr = obj;
+		sdb_data_t null = SDB_DATA_INIT;
+
+		/* the shallow copy must not be freed by sdb_data_copy */
+		rec->obj.attr.value = null;
+		if (sdb_data_copy(&rec->obj.attr.value, &attr->value)) {
+			free(rec);
+			return NULL;
+		}
+	}
+	return rec;
+} /* query_record_create */
+
+static void
+query_record_destroy(query_record_t *rec)
+{
+	if (rec->type == SDB_ATTRIBUTE)
+		sdb_data_free_datum(&rec->obj.attr.value);
+	free(rec);
+} /* query_record_destroy */
+
+static int
+query_record_write(query_record_t *rec, query_writer_t *qw)
+{
+	switch (rec->type) {
+	case SDB_HOST:
+		return query_store_host(&rec->obj.host, SDB_OBJ(qw));
+	case SDB_SERVICE:
+		return query_store_service(&rec->obj.service, SDB_OBJ(qw));
+	case SDB_METRIC:
+		return query_store_metric(&rec->obj.metric, SDB_OBJ(qw));
+	case SDB_ATTRIBUTE:
+		return query_store_attribute(&rec->obj.attr, SDB_OBJ(qw));
+	}
+	return -1;
+} /* query_record_write */
+
+/* returns the name of the host the record belongs to */
+static const char *
+query_record_hostname(query_record_t *rec)
+{
+	const char *hostname = NULL;
+
+	switch (rec->type) {
+	case SDB_HOST:
+		hostname = rec->obj.host.name;
+		break;
+	case SDB_SERVICE:
+		hostname = rec->obj.service.hostname;
+		break;
+	case SDB_METRIC:
+		hostname = rec->obj.metric.hostname;
+		break;
+	case SDB_ATTRIBUTE:
+		hostname = rec->obj.attr.hostname;
+		if ((! hostname) && (rec->obj.attr.parent_type == SDB_HOST))
+			hostname = rec->obj.attr.parent;
+		break;
+	}
+	return hostname ? hostname : "";
+} /* query_record_hostname */
+
+static void
+query_collector_clear(query_collector_t *c)
+{
+	size_t i, j;
+
+	for (i = 0; i < c->groups_num; ++i) {
+		for (j = 0; j < c->groups[i].records_num; ++j)
+			query_record_destroy(c->groups[i].records[j]);
+		free(c->groups[i].records);
+	}
+	free(c->groups);
+	c->groups = NULL;
+	c->groups_num = c->groups_size = 0;
+	sdb_strbuf_destroy(c->errbuf);
+	c->errbuf = NULL;
+} /* query_collector_clear */
+
+static int
+query_collect(int type, const void *obj, sdb_object_t *user_data)
+{
+	query_collector_t *c = QUERY_COLLECTOR(user_data);
+	query_record_t *rec;
+	query_group_t *g = NULL;
+	const char *hostname;
+
+	rec = query_record_create(type, obj);
+	if (! rec)
+		return -1;
+	hostname = query_record_hostname(rec);
+
+	if (c->groups_num)
+		g = c->groups + c->groups_num - 1;
+
+	/* the reader emits each host followed by its children */
+	if ((! g) || (type == SDB_HOST)
+			|| strcasecmp(g->hostname, hostname)) {
+		if (c->groups_num >= c->groups_size) {
+			size_t size = c->groups_size ? 2 * c->groups_size : 16;
+			query_group_t *tmp;
+
+			tmp = realloc(c->groups, size * sizeof(*tmp));
+			if (! tmp) {
+				query_record_destroy(rec);
+				return -1;
+			}
+			c->groups = tmp;
+			c->groups_size = size;
+		}
+
+		g = c->groups + c->groups_num;
+		memset(g, 0, sizeof(*g));
+		g->hostname = hostname;
+		if (type == SDB_HOST)
+			g->last_update = rec->obj.host.last_update;
+		g->reader_idx = c->reader_idx;
+		g->idx = c->groups_num;
+		++c->groups_num;
+	}
+
+	if (g->records_num >= g->records_size) {
+		size_t size = g->records_size ? 2 * g->records_size : 8;
+		query_record_t **tmp;
+
+		tmp = realloc(g->records, size * sizeof(*tmp));
+		if (! tmp) {
+			query_record_destroy(rec);
+			return -1;
+		}
+		g->records = tmp;
+		g->records_size = size;
+	}
+	g->records[g->records_num] = rec;
+	++g->records_num;
+	return 0;
+} /* query_collect */
+
+static int
+query_collect_host(sdb_store_host_t *host, sdb_object_t *user_data)
+{
+	return query_collect(SDB_HOST, host, user_data);
+} /* query_collect_host */
+
+static int
+query_collect_service(sdb_store_service_t *service, sdb_object_t *user_data)
+{
+	return query_collect(SDB_SERVICE, service, user_data);
+} /* query_collect_service */
+
+static int
+query_collect_metric(sdb_store_metric_t *metric, sdb_object_t *user_data)
+{
+	return query_collect(SDB_METRIC, metric, user_data);
+} /* query_collect_metric */
+
+static int
+query_collect_attribute(sdb_store_attribute_t *attr, sdb_object_t *user_data)
+{
+	return query_collect(SDB_ATTRIBUTE, attr, user_data);
+} /* query_collect_attribute */
+
+static sdb_store_writer_t query_collector = {
+	query_collect_host, query_collect_service,
+	query_collect_metric, query_collect_attribute,
+};
+
+static void *
+query_collector_run(void *data)
+{
+	query_collector_t *c = data;
+	reader_t *reader = c->reader;
+
+	c->status = reader->impl.execute_query(c->q, &query_collector,
+			SDB_OBJ(c), c->errbuf, reader->r_user_data);
+	return NULL;
+} /* query_collector_run */
+
+static int
+query_group_cmp(const void *a, const void *b)
+{
+	const query_group_t *g1 = *(const query_group_t * const *)a;
+	const query_group_t *g2 = *(const query_group_t * const *)b;
+	int diff;
+
+	diff = strcasecmp(g1->hostname, g2->hostname);
+	if (diff)
+		return diff;
+	if (g1->reader_idx != g2->reader_idx)
+		return g1->reader_idx < g2->reader_idx ? -1 : 1;
+	if (g1->idx != g2->idx)
+		return g1->idx < g2->idx ? -1 : 1;
+	return 0;
+} /* query_group_cmp */
+
+/*
+ * Merge the results of all collectors in host order. Hosts are expected to
+ * be partitioned across readers; if a host has been returned by multiple
+ * readers anyway, the most recently updated copy wins.
+ */
+static int
+query_merge(query_collector_t *collectors, size_t collectors_num,
+		query_writer_t *qw)
+{
+	query_group_t **groups;
+	size_t groups_num = 0, i, j;
+	int status = 0;
+
+	for (i = 0; i < collectors_num; ++i)
+		groups_num += collectors[i].groups_num;
+	if (! groups_num)
+		return 0;
+
+	groups = malloc(groups_num * sizeof(*groups));
+	if (! groups)
+		return -1;
+
+	groups_num = 0;
+	for (i = 0; i < collectors_num; ++i)
+		for (j = 0; j < collectors[i].groups_num; ++j)
+			groups[groups_num++] = collectors[i].groups + j;
+	qsort(groups, groups_num, sizeof(*groups), query_group_cmp);
+
+	for (i = 0; (i < groups_num) && (! status); ) {
+		query_group_t *g = groups[i];
+
+		for (j = i + 1; j < groups_num; ++j) {
+			if (strcasecmp(groups[j]->hostname, g->hostname))
+				break;
+			if (groups[j]->last_update > g->last_update)
+				g = groups[j];
+		}
+		i = j;
+
+		for (j = 0; j < g->records_num; ++j) {
+			status = query_record_write(g->records[j], qw);
+			if (status)
+				break;
+		}
+	}
+
+	free(groups);
+	return status;
+} /* query_merge */
+
 /*
  * private types
  */
@@ -552,7 +1015,8 @@ plugin_reader_init(sdb_object_t *obj, va_list ap)
 	ud = va_arg(ap, sdb_object_t *);
 	assert(impl);
 
-	if ((! impl->prepare_query) || (! impl->execute_query)) {
+	if ((! impl->prepare_query) || (! impl->execute_query)
+			|| ((impl->watch != NULL) != (impl->unwatch != NULL))) {
 		sdb_log(SDB_LOG_ERR, "store reader callback '%s' does not fully "
 				"implement the reader interface.", obj->name);
 		return -1;
@@ -629,6 +1093,53 @@ static sdb_type_t ts_fetcher_type = {
 	plugin_ts_fetcher_destroy
 };
 
+static void
+prepared_destroy(sdb_object_t *obj)
+{
+	prepared_t *prepared = PREPARED(obj);
+	size_t i;
+
+	assert(obj);
+	for (i = 0; i < prepared->queries_num; ++i) {
+		sdb_object_deref(prepared->queries[i].q);
+		sdb_object_deref(SDB_OBJ(prepared->queries[i].reader));
+	}
+	free(prepared->queries);
+} /* prepared_destroy */
+
+static sdb_type_t prepared_type = {
+	sizeof(prepared_t),
+
+	NULL,
+	prepared_destroy
+};
+
+static void
+watch_destroy(sdb_object_t *obj)
+{
+	watch_t *watch = WATCH(obj);
+	size_t i;
+
+	assert(obj);
+	for (i = 0; i < watch->watches_num; ++i) {
+		reader_t *reader = watch->watches[i].reader;
+
+		if (watch->watches[i].q)
+			reader->impl.unwatch(watch->watches[i].q,
+					reader->r_user_data);
+		sdb_object_deref(watch->watches[i].q);
+		sdb_object_deref(SDB_OBJ(reader));
+	}
+	free(watch->watches);
+} /* watch_destroy */
+
+static sdb_type_t watch_type = {
+	sizeof(watch_t),
+
+	NULL,
+	watch_destroy
+};
+
 static int
 module_init(const char *name, lt_dlhandle lh, sdb_plugin_info_t *info)
 {
@@ -763,9 +1274,11 @@ plugin_get_name(const char *name, char *buf, size_t bufsize)
 	return buf;
 } /* plugin_get_name */
 
+/* 'opts' may only be specified for store writers */
 static int
 plugin_add_impl(sdb_llist_t **list, sdb_type_t T, const char *type,
-		const char *name, void *impl, sdb_object_t *user_data)
+		const char *name, void *impl, const sdb_plugin_writer_opts_t *opts,
+		sdb_object_t *user_data)
 {
 	sdb_object_t *obj;
 
@@ -773,6 +1286,7 @@ plugin_add_impl(sdb_llist_t **list, sdb_type_t T, const char *type,
 		return -1;
 
 	assert(list);
+	assert((! opts) || (list == &writer_list));
 
 	if (! *list)
 		*list = sdb_llist_create();
@@ -783,6 +1297,9 @@ plugin_add_impl(sdb_llist_t **list, sdb_type_t T, const char *type,
 	if (! obj)
 		return -1;
 
+	if (opts)
+		WRITER(obj)->opts = *opts;
+
 	if (sdb_llist_append(*list, obj)) {
 		sdb_object_deref(obj);
 		return -1;
@@ -791,7 +1308,12 @@ plugin_add_impl(sdb_llist_t **list, sdb_type_t T, const char *type,
 	/* pass control to the list */
 	sdb_object_deref(obj);
 
-	sdb_log(SDB_LOG_INFO, "Registered %s callback '%s'.", type, name);
+	if (opts && opts->changes_only)
+		sdb_log(SDB_LOG_INFO, "Registered %s callback '%s' "
+				"(changes only, heartbeat = %.3fs).", type, name,
+				SDB_TIME_TO_DOUBLE(opts->heartbeat));
+	else
+		sdb_log(SDB_LOG_INFO, "Registered %s callback '%s'.", type, name);
 	return 0;
 } /* plugin_add_impl */
 
@@ -800,10 +1322,36 @@ plugin_add_impl(sdb_llist_t **list, sdb_type_t T, const char *type,
  */
 
 typedef struct {
+	/* the object to be stored; used to detect changes */
+	const char * const *backends;
+	size_t backends_num;
+	const sdb_data_t *value; /* attributes only */
+	const sdb_metric_store_t *store; /* metrics only */
+
+	/* meta-data of the currently stored object */
 	int obj_type;
 	sdb_time_t last_update;
 	sdb_time_t interval;
+	bool changed;
 } interval_fetcher_t;
+#define INTERVAL_FETCHER_INIT { NULL, 0, NULL, NULL, 0, 0, 0, false }
+
+/* returns true if all backends in 'want' are included in 'have' */
+static bool
+has_backends(const char * const *have, size_t have_num,
+		const char * const *want, size_t want_num)
+{
+	size_t i, j;
+
+	for (i = 0; i < want_num; ++i) {
+		for (j = 0; j < have_num; ++j)
+			if (! strcasecmp(have[j], want[i]))
+				break;
+		if (j >= have_num)
+			return false;
+	}
+	return true;
+} /* has_backends */
 
 static int
 interval_fetcher_host(sdb_store_host_t *host, sdb_object_t *user_data)
@@ -811,6 +1359,8 @@ interval_fetcher_host(sdb_store_host_t *host, sdb_object_t *user_data)
 	interval_fetcher_t *lu = SDB_OBJ_WRAPPER(user_data)->data;
 	lu->obj_type = SDB_HOST;
 	lu->last_update = host->last_update;
+	lu->changed = ! has_backends(host->backends, host->backends_num,
+			lu->backends, lu->backends_num);
 	return 0;
 } /* interval_fetcher_host */
 
@@ -820,6 +1370,8 @@ interval_fetcher_service(sdb_store_service_t *svc, sdb_object_t *user_data)
 	interval_fetcher_t *lu = SDB_OBJ_WRAPPER(user_data)->data;
 	lu->obj_type = SDB_SERVICE;
 	lu->last_update = svc->last_update;
+	lu->changed = ! has_backends(svc->backends, svc->backends_num,
+			lu->backends, lu->backends_num);
 	return 0;
 } /* interval_fetcher_service */
 
@@ -827,8 +1379,20 @@ static int
 interval_fetcher_metric(sdb_store_metric_t *metric, sdb_object_t *user_data)
 {
 	interval_fetcher_t *lu = SDB_OBJ_WRAPPER(user_data)->data;
+	size_t i;
+
 	lu->obj_type = SDB_METRIC;
 	lu->last_update = metric->last_update;
+	lu->changed = ! has_backends(metric->backends, metric->backends_num,
+			lu->backends, lu->backends_num);
+
+	if ((! lu->store) || lu->changed)
+		return 0;
+	for (i = 0; i < metric->stores_num; ++i)
+		if ((! strcasecmp(metric->stores[i].type, lu->store->type))
+				&& (! strcasecmp(metric->stores[i].id, lu->store->id)))
+			return 0;
+	lu->changed = true;
 	return 0;
 } /* interval_fetcher_metric */
 
@@ -838,6 +1402,10 @@ interval_fetcher_attr(sdb_store_attribute_t *attr, sdb_object_t *user_data)
 	interval_fetcher_t *lu = SDB_OBJ_WRAPPER(user_data)->data;
 	lu->obj_type = SDB_ATTRIBUTE;
 	lu->last_update = attr->last_update;
+	lu->changed = ! has_backends(attr->backends, attr->backends_num,
+			lu->backends, lu->backends_num);
+	if (lu->value && sdb_data_cmp(&attr->value, lu->value))
+		lu->changed = true;
 	return 0;
 } /* interval_fetcher_attr */
 
@@ -846,10 +1414,17 @@ static sdb_store_writer_t interval_fetcher = {
 	interval_fetcher_metric, interval_fetcher_attr,
 };
 
+/*
+ * Determine the update interval of the specified object and whether storing
+ * it changes anything other than its update timestamps; 'lu' has to be
+ * populated with the object to be stored. Returns 1 if the update is outdated
+ * and should be ignored.
+ */
 static int
 get_interval(int obj_type, const char *hostname,
 		int parent_type, const char *parent, const char *name,
-		sdb_time_t last_update, sdb_time_t *interval_out)
+		sdb_time_t last_update, interval_fetcher_t *lu,
+		sdb_time_t *interval_out)
 {
 	sdb_ast_fetch_t fetch = SDB_AST_FETCH_INIT;
 	char hn[hostname ? strlen(hostname) + 1 : 1];
@@ -857,8 +1432,7 @@ get_interval(int obj_type, const char *hostname,
 	char n[strlen(name) + 1];
 	int status;
 
-	interval_fetcher_t lu = { 0, 0, 0 };
-	sdb_object_wrapper_t obj = SDB_OBJECT_WRAPPER_STATIC(&lu);
+	sdb_object_wrapper_t obj = SDB_OBJECT_WRAPPER_STATIC(lu);
 	sdb_time_t interval;
 
 	assert(name);
@@ -875,26 +1449,31 @@ get_interval(int obj_type, const char *hostname,
 	fetch.parent = parent ? pn : NULL;
 	fetch.name = n;
 
+	lu->obj_type = 0;
+	lu->last_update = lu->interval = 0;
 	status = sdb_plugin_query(SDB_AST_NODE(&fetch),
 			&interval_fetcher, SDB_OBJ(&obj), NULL, NULL);
-	if ((status < 0) || (lu.obj_type != obj_type) || (lu.last_update == 0)) {
+	if ((status < 0) || (lu->obj_type != obj_type) || (lu->last_update == 0)) {
+		/* a new object (or the store cannot tell) */
+		lu->last_update = 0;
+		lu->changed = true;
 		*interval_out = 0;
 		return 0;
 	}
 
-	if (lu.last_update >= last_update) {
-		if (lu.last_update > last_update)
+	if (lu->last_update >= last_update) {
+		if (lu->last_update > last_update)
 			sdb_log(SDB_LOG_DEBUG, "Cannot update %s '%s' - "
 					"value too old (%"PRIsdbTIME" < %"PRIsdbTIME")",
 					SDB_STORE_TYPE_TO_NAME(obj_type), name,
-					lu.last_update, last_update);
-		*interval_out = lu.interval;
+					lu->last_update, last_update);
+		*interval_out = lu->interval;
 		return 1;
 	}
 
-	interval = last_update - lu.last_update;
-	if (lu.interval && interval)
-		interval = (sdb_time_t)((0.9 * (double)lu.interval)
+	interval = last_update - lu->last_update;
+	if (lu->interval && interval)
+		interval = (sdb_time_t)((0.9 * (double)lu->interval)
 				+ (0.1 * (double)interval));
 	*interval_out = interval;
 	return 0;
@@ -915,76 +1494,1280 @@ get_backend(char **backends, size_t *backends_num)
 	*backends_num = 1;
 } /* get_backend */
 
+/* returns true if the update described by 'lu' is to be passed on to the
+ * writer according to its options */
+static bool
+writer_accepts(writer_t *writer, interval_fetcher_t *lu,
+		sdb_time_t last_update)
+{
+	sdb_time_t heartbeat = writer->opts.heartbeat;
+
+	if ((! writer->opts.changes_only) || lu->changed)
+		return true;
+	/* pass on the first update in each heartbeat interval */
+	return heartbeat
+		&& ((lu->last_update / heartbeat) != (last_update / heartbeat));
+} /* writer_accepts */
+
 /*
- * public API
+ * collector loop
  */
 
-int
-sdb_plugin_load(const char *basedir, const char *name,
-		const sdb_plugin_ctx_t *plugin_ctx)
+/* the maximum time to wait before checking the loop's state again */
+#define COLLECTOR_LOOP_CHECK_INTERVAL SECS_TO_SDB_TIME(1)
+
+typedef struct {
+	sdb_plugin_loop_t *loop;
+
+	/* channel used to dispatch collectors to the worker threads */
+	sdb_channel_t *chan;
+	pthread_t *threads;
+	size_t num_threads;
+
+	/* the number of dispatched collectors which did not finish yet;
+	 * protected by collector_lock */
+	size_t busy;
+} collector_pool_t;
+
+static int
+collector_lookup_obj(const sdb_object_t *obj, const void *id)
 {
-	ctx_t *ctx;
+	return obj == id ? 0 : 1;
+} /* collector_lookup_obj */
 
-	int status;
+/* collector_lock has to be held */
+static void
+collector_timed_out(sdb_object_t *obj, sdb_time_t runtime)
+{
+	collector_t *ccb = CCB(obj);
 
-	if ((! name) || (! *name))
-		return -1;
+	ccb->ccb_timed_out = 1;
+	++ccb->ccb_stats.timeouts;
+	sdb_log(SDB_LOG_WARNING, "Collector '%s' has been running for %.3fs, "
+			"exceeding its timeout of %.3fs", obj->name,
+			SDB_TIME_TO_DOUBLE(runtime),
+			SDB_TIME_TO_DOUBLE(ccb->ccb_timeout));
+} /* collector_timed_out */
 
-	if (! all_plugins) {
-		if (! (all_plugins = sdb_llist_create())) {
-			sdb_log(SDB_LOG_ERR, "Failed to load plugin '%s': "
-					"internal error while creating linked list", name);
-			return -1;
+/*
+ * Determine the next collector to be run (if any) and check all running
+ * collectors for timeouts. 'wakeup' will be lowered to the time at which
+ * this has to be done again. collector_lock has to be held.
+ */
+static void
+collector_next(collector_pool_t *pool, sdb_time_t now,
+		sdb_object_t **next, sdb_time_t *wakeup)
+{
+	sdb_llist_iter_t *iter;
+
+	iter = sdb_llist_get_iter(collector_list);
+	while (sdb_llist_iter_has_next(iter)) {
+		sdb_object_t *obj = sdb_llist_iter_get_next(iter);
+		collector_t *ccb = CCB(obj);
+
+		if (ccb->ccb_running) {
+			sdb_time_t deadline = ccb->ccb_last_start + ccb->ccb_timeout;
+
+			if ((! ccb->ccb_timeout) || ccb->ccb_timed_out)
+				continue;
+			if (deadline <= now)
+				collector_timed_out(obj, now - ccb->ccb_last_start);
+			else if (deadline < *wakeup)
+				*wakeup = deadline;
+			continue;
 		}
+
+		/* the list is sorted by the time of the next update and running
+		 * collectors are always due; we're done once we find the first
+		 * collector which is not due yet */
+		if (ccb->ccb_next_update > now) {
+			if (ccb->ccb_next_update < *wakeup)
+				*wakeup = ccb->ccb_next_update;
+			break;
+		}
+
+		if ((! *next) && ((! pool->num_threads)
+					|| (pool->busy < pool->num_threads)))
+			*next = obj;
 	}
+	sdb_llist_iter_destroy(iter);
+} /* collector_next */
 
-	ctx = CTX(sdb_llist_search_by_name(all_plugins, name));
-	if (ctx) {
-		/* plugin already loaded */
-		if (! ctx->use_cnt) {
-			/* reloading plugin */
-			ctx_t *old_ctx = ctx_set(ctx);
+/* collector_lock has to be held */
+static void
+collector_reschedule(sdb_plugin_loop_t *loop, sdb_object_t *obj,
+		sdb_time_t now)
+{
+	collector_t *ccb = CCB(obj);
+	sdb_time_t interval;
 
-			status = module_init(ctx->info.plugin_name, ctx->handle, NULL);
-			ctx_set(old_ctx);
-			if (status)
-				return status;
+	/* the list owns the object; keep it alive until re-inserted */
+	obj = sdb_llist_remove(collector_list, collector_lookup_obj, obj);
+	if (! obj)
+		return;
 
-			ctx_set(old_ctx);
-			sdb_log(SDB_LOG_INFO, "Successfully reloaded plugin "
-					"'%s' (%s)", ctx->info.plugin_name,
-					INFO_GET(&ctx->info, description));
-		}
-		++ctx->use_cnt;
-		return 0;
+	interval = ccb->ccb_interval;
+	if (! interval)
+		interval = loop->default_interval;
+	if (! interval) {
+		sdb_log(SDB_LOG_WARNING, "No interval configured "
+				"for plugin '%s'; skipping any further "
+				"iterations.", obj->name);
+		sdb_object_deref(obj);
+		return;
 	}
 
-	return module_load(basedir, name, plugin_ctx);
-} /* sdb_plugin_load */
+	ccb->ccb_next_update += interval;
+	if (now > ccb->ccb_next_update) {
+		sdb_log(SDB_LOG_WARNING, "Plugin '%s' took too "
+				"long; skipping iterations to keep up.",
+				obj->name);
+		++ccb->ccb_stats.overruns;
+		ccb->ccb_next_update = now;
+	}
 
-int
-sdb_plugin_set_info(sdb_plugin_info_t *info, int type, ...)
+	if (sdb_llist_insert_sorted(collector_list, obj,
+				plugin_cmp_next_update)) {
+		sdb_log(SDB_LOG_ERR, "Failed to re-insert plugin '%s' into "
+				"collector list. Unable to further use the plugin.",
+				obj->name);
+	}
+
+	/* pass control back to the list */
+	sdb_object_deref(obj);
+} /* collector_reschedule */
+
+static void
+collector_run(collector_pool_t *pool, sdb_object_t *obj)
 {
-	va_list ap;
+	collector_t *ccb = CCB(obj);
+	sdb_plugin_collector_cb callback;
+	ctx_t *old_ctx;
 
-	if (! info)
-		return -1;
+	sdb_time_t now, runtime = 0;
+	int status;
 
-	va_start(ap, type);
+	callback = (sdb_plugin_collector_cb)ccb->ccb_callback;
 
-	switch (type) {
-		case SDB_PLUGIN_INFO_DESC:
-			{
-				char *desc = va_arg(ap, char *);
-				if (desc) {
-					if (info->description)
-						free(info->description);
-					info->description = strdup(desc);
-				}
-			}
-			break;
-		case SDB_PLUGIN_INFO_COPYRIGHT:
-			{
+	old_ctx = ctx_set(ccb->ccb_ctx);
+	status = callback(ccb->ccb_user_data);
+	ctx_set(old_ctx);
+
+	if (! (now = sdb_gettime())) {
+		char errbuf[1024];
+		sdb_log(SDB_LOG_ERR, "Failed to determine current "
+				"time in collector main loop: %s",
+				sdb_strerror(errno, errbuf, sizeof(errbuf)));
+		now = ccb->ccb_last_start;
+	}
+
+	pthread_mutex_lock(&collector_lock);
+	if (now > ccb->ccb_last_start)
+		runtime = now - ccb->ccb_last_start;
+
+	++ccb->ccb_stats.runs;
+	if (status)
+		++ccb->ccb_stats.failures;
+	ccb->ccb_stats.last_runtime = runtime;
+	ccb->ccb_stats.total_runtime += runtime;
+	if (runtime > ccb->ccb_stats.max_runtime)
+		ccb->ccb_stats.max_runtime = runtime;
+
+	if (ccb->ccb_timed_out)
+		sdb_log(SDB_LOG_INFO, "Collector '%s' finished after %.3fs",
+				obj->name, SDB_TIME_TO_DOUBLE(runtime));
+	else if (ccb->ccb_timeout && (runtime > ccb->ccb_timeout))
+		collector_timed_out(obj, runtime);
+
+	ccb->ccb_running = 0;
+	if (pool->num_threads)
+		--pool->busy;
+	collector_reschedule(pool->loop, obj, now);
+
+	pthread_cond_broadcast(&collector_cond);
+	pthread_mutex_unlock(&collector_lock);
+} /* collector_run */
+
+static void *
+collector_worker(void *data)
+{
+	collector_pool_t *pool = data;
+
+	while (42) {
+		struct timespec timeout = { 0, 500000000 }; /* .5 seconds */
+		sdb_object_t *obj = NULL;
+
+		errno = 0;
+		if (sdb_channel_select(pool->chan, /* read */ NULL, &obj,
+					/* write */ NULL, NULL, &timeout)) {
+			char errbuf[1024];
+
+			if (errno == ETIMEDOUT)
+				continue;
+			if (errno == EBADF) /* channel shut down */
+				break;
+
+			sdb_log(SDB_LOG_ERR, "Failed to read from collector "
+					"channel: %s",
+					sdb_strerror(errno, errbuf, sizeof(errbuf)));
+			continue;
+		}
+
+		collector_run(pool, obj);
+	}
+	return NULL;
+} /* collector_worker */
+
+static void
+collector_log_stats(void)
+{
+	sdb_llist_iter_t *iter;
+
+	pthread_mutex_lock(&collector_lock);
+	iter = sdb_llist_get_iter(collector_list);
+	while (sdb_llist_iter_has_next(iter)) {
+		sdb_object_t *obj = sdb_llist_iter_get_next(iter);
+		sdb_plugin_collector_stats_t *stats = &CCB(obj)->ccb_stats;
+		sdb_time_t avg = 0;
+
+		if (stats->runs)
+			avg = stats->total_runtime / (sdb_time_t)stats->runs;
+		sdb_log(SDB_LOG_INFO, "Collector '%s': %zu run%s (%zu failed, "
+				"%zu timed out, %zu overrun%s); run-time: "
+				"%.3fs avg, %.3fs max", obj->name,
+				stats->runs, stats->runs == 1 ? "" : "s",
+				stats->failures, stats->timeouts,
+				stats->overruns, stats->overruns == 1 ? "" : "s",
+				SDB_TIME_TO_DOUBLE(avg),
+				SDB_TIME_TO_DOUBLE(stats->max_runtime));
+	}
+	sdb_llist_iter_destroy(iter);
+	pthread_mutex_unlock(&collector_lock);
+} /* collector_log_stats */
+
+/*
+ * store helpers: send an object to all registered store writers
+ */
+
+static int
+plugin_store_attribute(const char *hostname, const char *key,
+		const sdb_data_t *value, sdb_time_t last_update)
+{
+	sdb_store_attribute_t attr = SDB_STORE_ATTRIBUTE_INIT;
+	interval_fetcher_t lu = INTERVAL_FETCHER_INIT;
+	char *backends[1];
+	char *cname;
+
+	sdb_llist_iter_t *iter;
+	int status = 0;
+
+	if ((! hostname) || (! key) || (! value))
+		return -1;
+
+	if (! sdb_llist_len(writer_list)) {
+		sdb_log(SDB_LOG_ERR, "Cannot store attribute: no writers registered");
+		return -1;
+	}
+
+	cname = sdb_plugin_cname(strdup(hostname));
+	if (! cname) {
+		sdb_log(SDB_LOG_ERR, "strdup failed");
+		return -1;
+	}
+
+	attr.parent_type = SDB_HOST;
+	attr.parent = cname;
+	attr.key = key;
+	attr.value = *value;
+	attr.last_update = last_update ? last_update : sdb_gettime();
+	attr.backends = (const char * const *)backends;
+	get_backend(backends, &attr.backends_num);
+	lu.backends = attr.backends;
+	lu.backends_num = attr.backends_num;
+	lu.value = value;
+	if (get_interval(SDB_ATTRIBUTE, cname, -1, NULL, key,
+				attr.last_update, &lu, &attr.interval)) {
+		free(cname);
+		return 1;
+	}
+
+	iter = sdb_llist_get_iter(writer_list);
+	while (sdb_llist_iter_has_next(iter)) {
+		writer_t *writer = WRITER(sdb_llist_iter_get_next(iter));
+		int s;
+		assert(writer);
+		if (! writer_accepts(writer, &lu, attr.last_update))
+			continue;
+		s = writer->impl.store_attribute(&attr, writer->w_user_data);
+		if (((s > 0) && (status >= 0)) || (s < 0))
+			status = s;
+	}
+	sdb_llist_iter_destroy(iter);
+	free(cname);
+	return status;
+} /* plugin_store_attribute */
+
+static int
+plugin_store_service_attribute(const char *hostname, const char *service,
+		const char *key, const sdb_data_t *value, sdb_time_t last_update)
+{
+	sdb_store_attribute_t attr = SDB_STORE_ATTRIBUTE_INIT;
+	interval_fetcher_t lu = INTERVAL_FETCHER_INIT;
+	char *backends[1];
+	char *cname;
+
+	sdb_llist_iter_t *iter;
+	int status = 0;
+
+	if ((! hostname) || (! service) || (! key) || (! value))
+		return -1;
+
+	if (! sdb_llist_len(writer_list)) {
+		sdb_log(SDB_LOG_ERR, "Cannot store service attribute: "
+				"no writers registered");
+		return -1;
+	}
+
+	cname = sdb_plugin_cname(strdup(hostname));
+	if (! cname) {
+		sdb_log(SDB_LOG_ERR, "strdup failed");
+		return -1;
+	}
+
+	attr.hostname = cname;
+	attr.parent_type = SDB_SERVICE;
+	attr.parent = service;
+	attr.key = key;
+	attr.value = *value;
+	attr.last_update = last_update ? last_update : sdb_gettime();
+	attr.backends = (const char * const *)backends;
+	get_backend(backends, &attr.backends_num);
+	lu.backends = attr.backends;
+	lu.backends_num = attr.backends_num;
+	lu.value = value;
+	if (get_interval(SDB_ATTRIBUTE, cname, SDB_SERVICE, service, key,
+				attr.last_update, &lu, &attr.interval)) {
+		free(cname);
+		return 1;
+	}
+
+	iter = sdb_llist_get_iter(writer_list);
+	while (sdb_llist_iter_has_next(iter)) {
+		writer_t *writer = WRITER(sdb_llist_iter_get_next(iter));
+		int s;
+		assert(writer);
+		if (! writer_accepts(writer, &lu, attr.last_update))
+			continue;
+		s = writer->impl.store_attribute(&attr, writer->w_user_data);
+		if (((s > 0) && (status >= 0)) || (s < 0))
+			status = s;
+	}
+	sdb_llist_iter_destroy(iter);
+	free(cname);
+	return status;
+} /* plugin_store_service_attribute */
+
+static int
+plugin_store_metric_attribute(const char *hostname, const char *metric,
+		const char *key, const sdb_data_t *value, sdb_time_t last_update)
+{
+	sdb_store_attribute_t attr = SDB_STORE_ATTRIBUTE_INIT;
+	interval_fetcher_t lu = INTERVAL_FETCHER_INIT;
+	char *backends[1];
+	char *cname;
+
+	sdb_llist_iter_t *iter;
+	int status = 0;
+
+	if ((! hostname) || (! metric) || (! key) || (! value))
+		return -1;
+
+	if (! sdb_llist_len(writer_list)) {
+		sdb_log(SDB_LOG_ERR, "Cannot store metric attribute: "
+				"no writers registered");
+		return -1;
+	}
+
+	cname = sdb_plugin_cname(strdup(hostname));
+	if (! cname) {
+		sdb_log(SDB_LOG_ERR, "strdup failed");
+		return -1;
+	}
+
+	attr.hostname = cname;
+	attr.parent_type = SDB_METRIC;
+	attr.parent = metric;
+	attr.key = key;
+	attr.value = *value;
+	attr.last_update = last_update ? last_update : sdb_gettime();
+	attr.backends = (const char * const *)backends;
+	get_backend(backends, &attr.backends_num);
+	lu.backends = attr.backends;
+	lu.backends_num = attr.backends_num;
+	lu.value = value;
+	if (get_interval(SDB_ATTRIBUTE, cname, SDB_METRIC, metric, key,
+				attr.last_update, &lu, &attr.interval)) {
+		free(cname);
+		return 1;
+	}
+
+	iter = sdb_llist_get_iter(writer_list);
+	while (sdb_llist_iter_has_next(iter)) {
+		writer_t *writer = WRITER(sdb_llist_iter_get_next(iter));
+		int s;
+		assert(writer);
+		if (! writer_accepts(writer, &lu, attr.last_update))
+			continue;
+		s = writer->impl.store_attribute(&attr, writer->w_user_data);
+		if (((s > 0) && (status >= 0)) || (s < 0))
+			status = s;
+	}
+	sdb_llist_iter_destroy(iter);
+	free(cname);
+	return status;
+} /* plugin_store_metric_attribute */
+
+static int
+plugin_store_host(const char *name, sdb_time_t last_update)
+{
+	sdb_store_host_t host = SDB_STORE_HOST_INIT;
+	interval_fetcher_t lu = INTERVAL_FETCHER_INIT;
+	char *backends[1];
+	char *cname;
+
+	sdb_llist_iter_t *iter;
+	int status = 0;
+
+	if (! name)
+		return -1;
+
+	if (! sdb_llist_len(writer_list)) {
+		sdb_log(SDB_LOG_ERR, "Cannot store host: no writers registered");
+		return -1;
+	}
+
+	cname = sdb_plugin_cname(strdup(name));
+	if (! cname) {
+		sdb_log(SDB_LOG_ERR, "strdup failed");
+		return -1;
+	}
+
+	host.name = cname;
+	host.last_update = last_update ? last_update : sdb_gettime();
+	host.backends = (const char * const *)backends;
+	get_backend(backends, &host.backends_num);
+	lu.backends = host.backends;
+	lu.backends_num = host.backends_num;
+	if (get_interval(SDB_HOST, NULL, -1, NULL, cname,
+				host.last_update, &lu, &host.interval)) {
+		free(cname);
+		return 1;
+	}
+
+	iter = sdb_llist_get_iter(writer_list);
+	while (sdb_llist_iter_has_next(iter)) {
+		writer_t *writer = WRITER(sdb_llist_iter_get_next(iter));
+		int s;
+		assert(writer);
+		if (! writer_accepts(writer, &lu, host.last_update))
+			continue;
+		s = writer->impl.store_host(&host, writer->w_user_data);
+		if (((s > 0) && (status >= 0)) || (s < 0))
+			status = s;
+	}
+	sdb_llist_iter_destroy(iter);
+	free(cname);
+	return status;
+} /* plugin_store_host */
+
+static int
+plugin_store_service(const char *hostname, const char *name,
+		sdb_time_t last_update)
+{
+	sdb_store_service_t service = SDB_STORE_SERVICE_INIT;
+	interval_fetcher_t lu = INTERVAL_FETCHER_INIT;
+	char *backends[1];
+	char *cname;
+
+	sdb_llist_iter_t *iter;
+	sdb_data_t d;
+
+	int status = 0;
+
+	if ((! hostname) || (! name))
+		return -1;
+
+	if (! sdb_llist_len(writer_list)) {
+		sdb_log(SDB_LOG_ERR, "Cannot store service: "
+				"no writers registered");
+		return -1;
+	}
+
+	cname = sdb_plugin_cname(strdup(hostname));
+	if (! cname) {
+		sdb_log(SDB_LOG_ERR, "strdup failed");
+		return -1;
+	}
+
+	service.hostname = cname;
+	service.name = name;
+	service.last_update = last_update ? last_update : sdb_gettime();
+	service.backends = (const char * const *)backends;
+	get_backend(backends, &service.backends_num);
+	lu.backends = service.backends;
+	lu.backends_num = service.backends_num;
+	if (get_interval(SDB_SERVICE, cname, -1, NULL, name,
+				service.last_update, &lu, &service.interval)) {
+		free(cname);
+		return 1;
+	}
+
+	iter = sdb_llist_get_iter(writer_list);
+	while (sdb_llist_iter_has_next(iter)) {
+		writer_t *writer = WRITER(sdb_llist_iter_get_next(iter));
+		int s;
+		assert(writer);
+		if (! writer_accepts(writer, &lu, service.last_update))
+			continue;
+		s = writer->impl.store_service(&service, writer->w_user_data);
+		if (((s > 0) && (status >= 0)) || (s < 0))
+			status = s;
+	}
+	sdb_llist_iter_destroy(iter);
+
+	if (! status) {
+		/* record the hostname as an attribute */
+		d.type = SDB_TYPE_STRING;
+		d.data.string = cname;
+		if (plugin_store_service_attribute(cname, name,
+					"hostname", &d, service.last_update))
+			status = -1;
+	}
+
+	free(cname);
+	return status;
+} /* plugin_store_service */
+
+static int
+plugin_store_metric(const char *hostname, const char *name,
+		sdb_metric_store_t *store, sdb_time_t last_update)
+{
+	sdb_store_metric_t metric = SDB_STORE_METRIC_INIT;
+	interval_fetcher_t lu = INTERVAL_FETCHER_INIT;
+	char *backends[1];
+	char *cname;
+
+	sdb_llist_iter_t *iter;
+	sdb_data_t d;
+
+	int status = 0;
+
+	if ((! hostname) || (! name))
+		return -1;
+
+	if (! sdb_llist_len(writer_list)) {
+		sdb_log(SDB_LOG_ERR, "Cannot store metric: no writers registered");
+		return -1;
+	}
+
+	cname = sdb_plugin_cname(strdup(hostname));
+	if (! cname) {
+		sdb_log(SDB_LOG_ERR, "strdup failed");
+		return -1;
+	}
+
+	if (store && ((! store->type) || (! store->id)))
+		store = NULL;
+
+	metric.hostname = cname;
+	metric.name = name;
+	if (store) {
+		if (store->last_update < last_update)
+			store->last_update = last_update;
+		metric.stores = store;
+		metric.stores_num = 1;
+	}
+	metric.last_update = last_update ? last_update : sdb_gettime();
+	metric.backends = (const char * const *)backends;
+	get_backend(backends, &metric.backends_num);
+	lu.store = store;
+	lu.backends = metric.backends;
+	lu.backends_num = metric.backends_num;
+	if (get_interval(SDB_METRIC, cname, -1, NULL, name,
+				metric.last_update, &lu, &metric.interval)) {
+		free(cname);
+		return 1;
+	}
+
+	iter = sdb_llist_get_iter(writer_list);
+	while (sdb_llist_iter_has_next(iter)) {
+		writer_t *writer = WRITER(sdb_llist_iter_get_next(iter));
+		int s;
+		assert(writer);
+		if (! writer_accepts(writer, &lu, metric.last_update))
+			continue;
+		s = writer->impl.store_metric(&metric, writer->w_user_data);
+		if (((s > 0) && (status >= 0)) || (s < 0))
+			status = s;
+	}
+	sdb_llist_iter_destroy(iter);
+
+	if (! status) {
+		/* record the hostname as an attribute */
+		d.type = SDB_TYPE_STRING;
+		d.data.string = cname;
+		if (plugin_store_metric_attribute(cname, name,
+					"hostname", &d, metric.last_update))
+			status = -1;
+	}
+
+	free(cname);
+	return status;
+} /* plugin_store_metric */
+
+/*
+ * asynchronous ingest pipeline
+ */
+
+/* a store request queued for one of the writer threads; all strings are
+ * stored in a single allocation following the record */
+typedef struct {
+	int type;
+	int parent_type;
+	const char *hostname;
+	const char *parent;
+	const char *name;
+	sdb_data_t value;
+
+	bool have_store;
+	sdb_metric_store_t store;
+
+	sdb_time_t last_update;
+
+	/* the plugin context of the caller */
+	ctx_t *ctx;
+} ingest_record_t;
+
+typedef struct {
+	sdb_channel_t *chan;
+	pthread_t thread;
+
+	/* statistics; protected by lock */
+	pthread_mutex_t lock;
+	sdb_plugin_ingest_stats_t stats;
+} ingest_queue_t;
+
+static struct {
+	ingest_queue_t *queues;
+	size_t queues_num;
+	size_t batch_size;
+} ingest = { NULL, 0, 0 };
+
+/* store requests hold a read-lock while accessing the queues */
+static pthread_rwlock_t ingest_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static ingest_record_t *
+ingest_record_create(int type, int parent_type, const char *hostname,
+		const char *parent, const char *name, const sdb_data_t *value,
+		const sdb_metric_store_t *store, sdb_time_t last_update)
+{
+	const char *strings[] = {
+		hostname, parent, name,
+		store ? store->type : NULL, store ? store->id : NULL,
+	};
+	const char **copies[SDB_STATIC_ARRAY_LEN(strings)];
+	ingest_record_t *rec;
+	size_t len = 0, i;
+	char *buf;
+
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(strings); ++i)
+		if (strings[i])
+			len += strlen(strings[i]) + 1;
+
+	rec = malloc(sizeof(*rec) + len);
+	if (! rec)
+		return NULL;
+	memset(rec, 0, sizeof(*rec));
+
+	rec->type = type;
+	rec->parent_type = parent_type;
+	rec->last_update = last_update ? last_update : sdb_gettime();
+	if (store) {
+		rec->have_store = 1;
+		rec->store.last_update = store->last_update;
+		if (rec->store.last_update < last_update)
+			rec->store.last_update = last_update;
+	}
+
+	copies[0] = &rec->hostname;
+	copies[1] = &rec->parent;
+	copies[2] = &rec->name;
+	copies[3] = &rec->store.type;
+	copies[4] = &rec->store.id;
+
+	buf = (char *)(rec + 1);
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(strings); ++i) {
+		if (! strings[i])
+			continue;
+		len = strlen(strings[i]) + 1;
+		memcpy(buf, strings[i], len);
+		*copies[i] = buf;
+		buf += len;
+	}
+
+	if (value && sdb_data_copy(&rec->value, value)) {
+		free(rec);
+		return NULL;
+	}
+
+	rec->ctx = ctx_get();
+	sdb_object_ref(SDB_OBJ(rec->ctx));
+	return rec;
+} /* ingest_record_create */
+
+static void
+ingest_record_destroy(ingest_record_t *rec)
+{
+	sdb_data_free_datum(&rec->value);
+	sdb_object_deref(SDB_OBJ(rec->ctx));
+	free(rec);
+} /* ingest_record_destroy */
+
+static int
+ingest_record_store(ingest_record_t *rec)
+{
+	sdb_metric_store_t *store = NULL;
+	ctx_t *old_ctx;
+	int status = -1;
+
+	old_ctx = ctx_set(rec->ctx);
+	switch (rec->type) {
+	case SDB_HOST:
+		status = plugin_store_host(rec->name, rec->last_update);
+		break;
+	case SDB_SERVICE:
+		status = plugin_store_service(rec->hostname, rec->name,
+				rec->last_update);
+		break;
+	case SDB_METRIC:
+		if (rec->have_store)
+			store = &rec->store;
+		status = plugin_store_metric(rec->hostname, rec->name,
+				store, rec->last_update);
+		break;
+	case SDB_ATTRIBUTE:
+		if (rec->parent_type == SDB_SERVICE)
+			status = plugin_store_service_attribute(rec->hostname,
+					rec->parent, rec->name, &rec->value, rec->last_update);
+		else if (rec->parent_type == SDB_METRIC)
+			status = plugin_store_metric_attribute(rec->hostname,
+					rec->parent, rec->name, &rec->value, rec->last_update);
+		else
+			status = plugin_store_attribute(rec->hostname,
+					rec->name, &rec->value, rec->last_update);
+		break;
+	}
+	ctx_set(old_ctx);
+	return status;
+} /* ingest_record_store */
+
+static void *
+ingest_worker(void *data)
+{
+	ingest_queue_t *q = data;
+	ingest_record_t *batch[ingest.batch_size];
+
+	while (42) {
+		struct timespec timeout = { 0, 500000000 }; /* .5 seconds */
+		size_t n, failed = 0, i;
+
+		errno = 0;
+		if (sdb_channel_select(q->chan, /* read */ NULL, &batch[0],
+					/* write */ NULL, NULL, &timeout)) {
+			char errbuf[1024];
+
+			if (errno == ETIMEDOUT)
+				continue;
+			if (errno == EBADF) /* channel shut down */
+				break;
+
+			sdb_log(SDB_LOG_ERR, "Failed to read from ingest queue: %s",
+					sdb_strerror(errno, errbuf, sizeof(errbuf)));
+			continue;
+		}
+
+		/* drain whatever is available without waiting any further */
+		for (n = 1; n < ingest.batch_size; ++n)
+			if (sdb_channel_read(q->chan, &batch[n]))
+				break;
+
+		for (i = 0; i < n; ++i) {
+			if (ingest_record_store(batch[i]) < 0)
+				++failed;
+			ingest_record_destroy(batch[i]);
+		}
+
+		pthread_mutex_lock(&q->lock);
+		q->stats.queued -= n;
+		q->stats.processed += n;
+		q->stats.failed += failed;
+		++q->stats.batches;
+		pthread_mutex_unlock(&q->lock);
+	}
+	return NULL;
+} /* ingest_worker */
+
+/* returns the queue responsible for the specified host;
+ * ingest_lock has to be held */
+static ingest_queue_t *
+ingest_get_queue(const char *hostname)
+{
+	/* FNV-1a; hostnames are case-insensitive */
+	uint32_t hash = 2166136261U;
+
+	for ( ; *hostname; ++hostname) {
+		hash ^= (uint32_t)tolower((unsigned char)*hostname);
+		hash *= 16777619U;
+	}
+	return ingest.queues + (hash % ingest.queues_num);
+} /* ingest_get_queue */
+
+/*
+ * Queue the specified object if the ingest pipeline is running. Returns 0
+ * if the object has been queued, a positive value if the pipeline is not
+ * running, and a negative value on error.
+ */
+static int
+ingest_enqueue(int type, int parent_type, const char *hostname,
+		const char *parent, const char *name, const sdb_data_t *value,
+		const sdb_metric_store_t *store, sdb_time_t last_update)
+{
+	ingest_record_t *rec;
+	ingest_queue_t *q;
+	int status;
+
+	pthread_rwlock_rdlock(&ingest_lock);
+	if (! ingest.queues_num) {
+		pthread_rwlock_unlock(&ingest_lock);
+		return 1;
+	}
+
+	rec = ingest_record_create(type, parent_type, hostname, parent, name,
+			value, store, last_update);
+	if (! rec) {
+		pthread_rwlock_unlock(&ingest_lock);
+		sdb_log(SDB_LOG_ERR, "Failed to allocate ingest record");
+		return -1;
+	}
+
+	q = ingest_get_queue(hostname);
+
+	pthread_mutex_lock(&q->lock);
+	++q->stats.queued;
+	if (q->stats.queued > q->stats.max_queued)
+		q->stats.max_queued = q->stats.queued;
+	pthread_mutex_unlock(&q->lock);
+
+	status = sdb_channel_write(q->chan, &rec);
+	if (status) {
+		/* backpressure: wait for the writer thread to catch up */
+		pthread_mutex_lock(&q->lock);
+		++q->stats.stalls;
+		pthread_mutex_unlock(&q->lock);
+
+		do {
+			struct timespec timeout = { 0, 500000000 }; /* .5 seconds */
+			errno = 0;
+			status = sdb_channel_select(q->chan, /* read */ NULL, NULL,
+					/* write */ NULL, &rec, &timeout);
+		} while (status && (errno == ETIMEDOUT));
+	}
+
+	pthread_mutex_lock(&q->lock);
+	if (status)
+		--q->stats.queued;
+	else
+		++q->stats.enqueued;
+	pthread_mutex_unlock(&q->lock);
+	pthread_rwlock_unlock(&ingest_lock);
+
+	if (status) {
+		char errbuf[1024];
+		sdb_log(SDB_LOG_ERR, "Failed to queue %s '%s': %s",
+				SDB_STORE_TYPE_TO_NAME(type), name,
+				sdb_strerror(errno, errbuf, sizeof(errbuf)));
+		ingest_record_destroy(rec);
+		return -1;
+	}
+	return 0;
+} /* ingest_enqueue */
+
+/*
+ * cname cache
+ */
+
+typedef struct {
+	sdb_object_t super;
+
+	/* NULL if no callback changed the hostname */
+	char *cname;
+	sdb_time_t expires;
+} cname_entry_t;
+#define CNAME_ENTRY(obj) ((cname_entry_t *)(obj))
+
+static int
+cname_entry_init(sdb_object_t *obj, va_list ap)
+{
+	const char *cname = va_arg(ap, const char *);
+
+	CNAME_ENTRY(obj)->expires = va_arg(ap, sdb_time_t);
+	if (cname && (! (CNAME_ENTRY(obj)->cname = strdup(cname))))
+		return -1;
+	return 0;
+} /* cname_entry_init */
+
+static void
+cname_entry_destroy(sdb_object_t *obj)
+{
+	if (CNAME_ENTRY(obj)->cname)
+		free(CNAME_ENTRY(obj)->cname);
+} /* cname_entry_destroy */
+
+static bool
+cname_entry_valid(sdb_object_t *obj)
+{
+	return CNAME_ENTRY(obj)->expires > sdb_gettime();
+} /* cname_entry_valid */
+
+static sdb_type_t cname_entry_type = {
+	sizeof(cname_entry_t),
+
+	cname_entry_init,
+	cname_entry_destroy
+};
+
+static struct {
+	sdb_lru_t *lru;
+	sdb_plugin_cname_cache_opts_t opts;
+
+	/* hostnames queued for or being resolved by the resolver threads */
+	sdb_llist_t *pending;
+	sdb_channel_t *chan;
+	pthread_t *threads;
+	size_t threads_num;
+	bool shutdown;
+
+	uint64_t stale;
+	uint64_t timeouts;
+} cname_cache = {
+	NULL, SDB_PLUGIN_CNAME_CACHE_OPTS_INIT,
+	NULL, NULL, NULL, 0, 0, 0, 0,
+};
+
+/* held for reading while using the cache
+ * and for writing while (re-)configuring it */
+static pthread_rwlock_t cname_cache_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+
+/* protects the pending list and the statistics; the condition is signaled
+ * whenever a resolver thread finished a lookup */
+static pthread_mutex_t cname_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cname_cache_cond = PTHREAD_COND_INITIALIZER;
+
+/* pass the hostname through all cname callbacks */
+static char *
+cname_resolve(char *hostname, bool *changed)
+{
+	sdb_llist_iter_t *iter;
+
+	if (changed)
+		*changed = 0;
+
+	iter = sdb_llist_get_iter(cname_list);
+	while (sdb_llist_iter_has_next(iter)) {
+		sdb_plugin_cname_cb callback;
+		char *cname;
+
+		sdb_object_t *obj = sdb_llist_iter_get_next(iter);
+		assert(obj);
+
+		callback = (sdb_plugin_cname_cb)CB(obj)->cb_callback;
+		cname = callback(hostname, CB(obj)->cb_user_data);
+		if (cname) {
+			free(hostname);
+			hostname = cname;
+			if (changed)
+				*changed = 1;
+		}
+		/* else: don't change hostname */
+	}
+	sdb_llist_iter_destroy(iter);
+	return hostname;
+} /* cname_resolve */
+
+/* resolve the hostname and cache the result;
+ * returns a new reference to the cache entry */
+static sdb_object_t *
+cname_cache_resolve(const char *hostname)
+{
+	sdb_object_t *entry;
+	sdb_time_t ttl;
+	bool changed = 0;
+	char *cname;
+
+	cname = strdup(hostname);
+	if (! cname)
+		return NULL;
+
+	cname = cname_resolve(cname, &changed);
+	ttl = changed ? cname_cache.opts.ttl : cname_cache.opts.negative_ttl;
+	entry = sdb_object_create(hostname, cname_entry_type,
+			changed ? cname : NULL, sdb_gettime() + ttl);
+	free(cname);
+	if (! entry)
+		return NULL;
+
+	sdb_lru_insert(cname_cache.lru, entry);
+	return entry;
+} /* cname_cache_resolve */
+
+/* queue the hostname for the resolver threads unless already queued;
+ * cname_cache_lock has to be held */
+static int
+cname_cache_schedule(const char *hostname)
+{
+	sdb_object_t *obj;
+
+	if (sdb_llist_search_by_name(cname_cache.pending, hostname))
+		return 0;
+
+	obj = sdb_object_create_T(hostname, sdb_object_t);
+	if (! obj)
+		return -1;
+
+	if (sdb_llist_append(cname_cache.pending, obj)) {
+		sdb_object_deref(obj);
+		return -1;
+	}
+
+	/* the list owns the object; the resolver thread will remove it */
+	if (sdb_channel_write(cname_cache.chan, &obj)) {
+		sdb_log(SDB_LOG_DEBUG, "cname cache: Resolver queue full; "
+				"not resolving '%s' in the background", hostname);
+		obj = sdb_llist_remove_by_name(cname_cache.pending, hostname);
+		sdb_object_deref(obj);
+		sdb_object_deref(obj);
+		return -1;
+	}
+	sdb_object_deref(obj);
+	return 0;
+} /* cname_cache_schedule */
+
+static void *
+cname_cache_worker(void __attribute__((unused)) *data)
+{
+	while (42) {
+		struct timespec timeout = { 0, 500000000 }; /* .5 seconds */
+		sdb_object_t *obj = NULL;
+		bool shutdown;
+
+		errno = 0;
+		if (sdb_channel_select(cname_cache.chan, /* read */ NULL, &obj,
+					/* write */ NULL, NULL, &timeout)) {
+			char errbuf[1024];
+
+			if (errno == ETIMEDOUT)
+				continue;
+			if (errno == EBADF) /* channel shut down */
+				break;
+
+			sdb_log(SDB_LOG_ERR, "cname cache: Failed to read from "
+					"resolver queue: %s",
+					sdb_strerror(errno, errbuf, sizeof(errbuf)));
+			continue;
+		}
+
+		pthread_mutex_lock(&cname_cache_lock);
+		shutdown = cname_cache.shutdown;
+		pthread_mutex_unlock(&cname_cache_lock);
+
+		/* don't bother resolving any queued names when shutting down */
+		if (! shutdown)
+			sdb_object_deref(cname_cache_resolve(obj->name));
+
+		pthread_mutex_lock(&cname_cache_lock);
+		obj = sdb_llist_remove_by_name(cname_cache.pending, obj->name);
+		sdb_object_deref(obj);
+		pthread_cond_broadcast(&cname_cache_cond);
+		pthread_mutex_unlock(&cname_cache_lock);
+	}
+	return NULL;
+} /* cname_cache_worker */
+
+/*
+ * Lookup the hostname from the cache, resolving it if necessary. Returns a
+ * new reference to the cache entry or NULL if the hostname could not be
+ * resolved in time. cname_cache_rwlock has to be held.
+ */
+static sdb_object_t *
+cname_cache_lookup(const char *hostname)
+{
+	sdb_object_t *entry;
+	sdb_time_t now, deadline;
+
+	now = sdb_gettime();
+	entry = sdb_lru_lookup(cname_cache.lru, hostname);
+	if (entry && (CNAME_ENTRY(entry)->expires > now))
+		return entry;
+
+	if (! cname_cache.threads_num) {
+		sdb_object_deref(entry);
+		return cname_cache_resolve(hostname);
+	}
+
+	pthread_mutex_lock(&cname_cache_lock);
+	cname_cache_schedule(hostname);
+	if (entry) {
+		/* keep using the previous result until refreshed */
+		++cname_cache.stale;
+		pthread_mutex_unlock(&cname_cache_lock);
+		return entry;
+	}
+
+	deadline = now + cname_cache.opts.timeout;
+	while (42) {
+		struct timespec ts;
+
+		entry = sdb_lru_lookup(cname_cache.lru, hostname);
+		if (entry || (! sdb_llist_search_by_name(cname_cache.pending,
+						hostname)))
+			break;
+
+		if (now >= deadline) {
+			++cname_cache.timeouts;
+			sdb_log(SDB_LOG_DEBUG, "cname cache: Timeout resolving '%s'; "
+					"using it unchanged", hostname);
+			break;
+		}
+
+		ts.tv_sec = (time_t)SDB_TIME_TO_SECS(deadline);
+		ts.tv_nsec = (long)(deadline % SECS_TO_SDB_TIME(1));
+		pthread_cond_timedwait(&cname_cache_cond, &cname_cache_lock, &ts);
+		now = sdb_gettime();
+	}
+	pthread_mutex_unlock(&cname_cache_lock);
+	return entry;
+} /* cname_cache_lookup */
+
+/* cname_cache_rwlock has to be held for writing */
+static void
+cname_cache_destroy(void)
+{
+	sdb_plugin_cname_cache_stats_t stats;
+	size_t i;
+
+	if (! cname_cache.lru)
+		return;
+
+	if (cname_cache.threads_num) {
+		pthread_mutex_lock(&cname_cache_lock);
+		cname_cache.shutdown = 1;
+		pthread_mutex_unlock(&cname_cache_lock);
+
+		if (! sdb_channel_shutdown(cname_cache.chan))
+			for (i = 0; i < cname_cache.threads_num; ++i)
+				pthread_join(cname_cache.threads[i], NULL);
+	}
+	sdb_channel_destroy(cname_cache.chan);
+	free(cname_cache.threads);
+	sdb_llist_destroy(cname_cache.pending);
+
+	sdb_lru_stats(cname_cache.lru, &stats.lru);
+	sdb_log(SDB_LOG_INFO, "cname cache: %zu entries, %"PRIu64" hits, "
+			"%"PRIu64" misses, %"PRIu64" evictions, %"PRIu64" stale, "
+			"%"PRIu64" timeouts", stats.lru.size, stats.lru.hits,
+			stats.lru.misses, stats.lru.evictions, cname_cache.stale,
+			cname_cache.timeouts);
+	sdb_lru_destroy(cname_cache.lru);
+
+	cname_cache.lru = NULL;
+	cname_cache.pending = NULL;
+	cname_cache.chan = NULL;
+	cname_cache.threads = NULL;
+	cname_cache.threads_num = 0;
+	cname_cache.shutdown = 0;
+	cname_cache.stale = cname_cache.timeouts = 0;
+} /* cname_cache_destroy */
+
+/*
+ * public API
+ */
+
+int
+sdb_plugin_load(const char *basedir, const char *name,
+		const sdb_plugin_ctx_t *plugin_ctx)
+{
+	ctx_t *ctx;
+
+	int status;
+
+	if ((! name) || (! *name))
+		return -1;
+
+	if (! all_plugins) {
+		if (! (all_plugins = sdb_llist_create())) {
+			sdb_log(SDB_LOG_ERR, "Failed to load plugin '%s': "
+					"internal error while creating linked list", name);
+			return -1;
+		}
+	}
+
+	ctx = CTX(sdb_llist_search_by_name(all_plugins, name));
+	if (ctx) {
+		/* plugin already loaded */
+		if (! ctx->use_cnt) {
+			/* reloading plugin */
+			ctx_t *old_ctx = ctx_set(ctx);
+
+			status = module_init(ctx->info.plugin_name, ctx->handle, NULL);
+			ctx_set(old_ctx);
+			if (status)
+				return status;
+
+			ctx_set(old_ctx);
+			sdb_log(SDB_LOG_INFO, "Successfully reloaded plugin "
+					"'%s' (%s)", ctx->info.plugin_name,
+					INFO_GET(&ctx->info, description));
+		}
+		++ctx->use_cnt;
+		return 0;
+	}
+
+	return module_load(basedir, name, plugin_ctx);
+} /* sdb_plugin_load */
+
+int
+sdb_plugin_set_info(sdb_plugin_info_t *info, int type, ...)
+{
+	va_list ap;
+
+	if (! info)
+		return -1;
+
+	va_start(ap, type);
+
+	switch (type) {
+		case SDB_PLUGIN_INFO_DESC:
+			{
+				char *desc = va_arg(ap, char *);
+				if (desc) {
+					if (info->description)
+						free(info->description);
+					info->description = strdup(desc);
+				}
+			}
+			break;
+		case SDB_PLUGIN_INFO_COPYRIGHT:
+			{
 				char *copyright = va_arg(ap, char *);
 				if (copyright)
 					info->copyright = strdup(copyright);
@@ -1032,7 +2815,7 @@ sdb_plugin_register_config(sdb_plugin_config_cb callback)
 		return -1;
 	}
 	return plugin_add_impl(&config_list, callback_type, "config",
-			ctx->info.plugin_name, (void *)callback, NULL);
+			ctx->info.plugin_name, (void *)callback, /* opts = */ NULL, NULL);
 } /* sdb_plugin_register_config */
 
 int
@@ -1042,7 +2825,7 @@ sdb_plugin_register_init(const char *name, sdb_plugin_init_cb callback,
 	char cb_name[1024];
 	return plugin_add_impl(&init_list, callback_type, "init",
 			plugin_get_name(name, cb_name, sizeof(cb_name)),
-			(void *)callback, user_data);
+			(void *)callback, /* opts = */ NULL, user_data);
 } /* sdb_plugin_register_init */
 
 int
@@ -1052,7 +2835,7 @@ sdb_plugin_register_shutdown(const char *name, sdb_plugin_shutdown_cb callback,
 	char cb_name[1024];
 	return plugin_add_impl(&shutdown_list, callback_type, "shutdown",
 			plugin_get_name(name, cb_name, sizeof(cb_name)),
-			(void *)callback, user_data);
+			(void *)callback, /* opts = */ NULL, user_data);
 } /* sdb_plugin_register_shutdown */
 
 int
@@ -1062,7 +2845,7 @@ sdb_plugin_register_log(const char *name, sdb_plugin_log_cb callback,
 	char cb_name[1024];
 	return plugin_add_impl(&log_list, callback_type, "log",
 			plugin_get_name(name, cb_name, sizeof(cb_name)),
-			callback, user_data);
+			callback, /* opts = */ NULL, user_data);
 } /* sdb_plugin_register_log */
 
 int
@@ -1072,7 +2855,7 @@ sdb_plugin_register_cname(const char *name, sdb_plugin_cname_cb callback,
 	char cb_name[1024];
 	return plugin_add_impl(&cname_list, callback_type, "cname",
 			plugin_get_name(name, cb_name, sizeof(cb_name)),
-			callback, user_data);
+			callback, /* opts = */ NULL, user_data);
 } /* sdb_plugin_register_cname */
 
 int
@@ -1110,6 +2893,8 @@ sdb_plugin_register_collector(const char *name, sdb_plugin_collector_cb callback
 
 		CCB(obj)->ccb_interval = ctx->public.interval;
 	}
+	if (CB(obj)->cb_ctx)
+		CCB(obj)->ccb_timeout = CB(obj)->cb_ctx->public.timeout;
 
 	if (! (CCB(obj)->ccb_next_update = sdb_gettime())) {
 		char errbuf[1024];
@@ -1129,8 +2914,9 @@ sdb_plugin_register_collector(const char *name, sdb_plugin_collector_cb callback
 	sdb_object_deref(obj);
 
 	sdb_log(SDB_LOG_INFO, "Registered collector callback '%s' "
-			"(interval = %.3fs).", cb_name,
-			SDB_TIME_TO_DOUBLE(CCB(obj)->ccb_interval));
+			"(interval = %.3fs, timeout = %.3fs).", cb_name,
+			SDB_TIME_TO_DOUBLE(CCB(obj)->ccb_interval),
+			SDB_TIME_TO_DOUBLE(CCB(obj)->ccb_timeout));
 	return 0;
 } /* sdb_plugin_register_collector */
 
@@ -1139,18 +2925,27 @@ sdb_plugin_register_timeseries_fetcher(const char *name,
 		sdb_timeseries_fetcher_t *fetcher, sdb_object_t *user_data)
 {
 	return plugin_add_impl(&timeseries_fetcher_list, ts_fetcher_type, "time-series fetcher",
-			name, fetcher, user_data);
+			name, fetcher, /* opts = */ NULL, user_data);
 } /* sdb_plugin_register_timeseries_fetcher */
 
 int
 sdb_plugin_register_writer(const char *name,
 		sdb_store_writer_t *writer, sdb_object_t *user_data)
+{
+	return sdb_plugin_register_writer_opts(name, writer,
+			/* opts = */ NULL, user_data);
+} /* sdb_store_register_writer */
+
+int
+sdb_plugin_register_writer_opts(const char *name,
+		sdb_store_writer_t *writer, const sdb_plugin_writer_opts_t *opts,
+		sdb_object_t *user_data)
 {
 	char cb_name[1024];
 	return plugin_add_impl(&writer_list, writer_type, "store writer",
 			plugin_get_name(name, cb_name, sizeof(cb_name)),
-			writer, user_data);
-} /* sdb_store_register_writer */
+			writer, opts, user_data);
+} /* sdb_plugin_register_writer_opts */
 
 int
 sdb_plugin_register_reader(const char *name,
@@ -1159,7 +2954,7 @@ sdb_plugin_register_reader(const char *name,
 	char cb_name[1024];
 	return plugin_add_impl(&reader_list, reader_type, "store reader",
 			plugin_get_name(name, cb_name, sizeof(cb_name)),
-			reader, user_data);
+			reader, /* opts = */ NULL, user_data);
 } /* sdb_plugin_register_reader */
 
 void
@@ -1384,6 +3179,10 @@ sdb_plugin_shutdown_all(void)
 int
 sdb_plugin_collector_loop(sdb_plugin_loop_t *loop)
 {
+	collector_pool_t pool = { NULL, NULL, NULL, 0, 0 };
+	size_t i;
+	int status = 0;
+
 	if (! collector_list) {
 		sdb_log(SDB_LOG_WARNING, "No collectors registered. "
 				"Quiting main loop.");
@@ -1393,106 +3192,135 @@ sdb_plugin_collector_loop(sdb_plugin_loop_t *loop)
 	if (! loop)
 		return -1;
 
-	while (loop->do_loop) {
-		sdb_plugin_collector_cb callback;
-		ctx_t *old_ctx;
-
-		sdb_time_t interval, now;
+	pool.loop = loop;
+	if (loop->num_threads) {
+		pool.threads = calloc(loop->num_threads, sizeof(*pool.threads));
+		/* at most num_threads collectors are in flight at any time */
+		pool.chan = sdb_channel_create(loop->num_threads,
+				sizeof(sdb_object_t *));
+		if ((! pool.threads) || (! pool.chan)) {
+			sdb_log(SDB_LOG_ERR, "Failed to allocate collector "
+					"thread pool");
+			free(pool.threads);
+			sdb_channel_destroy(pool.chan);
+			return -1;
+		}
 
-		sdb_object_t *obj = sdb_llist_shift(collector_list);
-		if (! obj)
+		for (i = 0; i < loop->num_threads; ++i) {
+			errno = 0;
+			if (pthread_create(&pool.threads[i], /* attr = */ NULL,
+						collector_worker, /* arg = */ &pool)) {
+				char errbuf[1024];
+				sdb_log(SDB_LOG_ERR, "Failed to create collector "
+						"thread: %s",
+						sdb_strerror(errno, errbuf, sizeof(errbuf)));
+				break;
+			}
+		}
+		pool.num_threads = i;
+		if (! pool.num_threads) {
+			free(pool.threads);
+			sdb_channel_destroy(pool.chan);
 			return -1;
+		}
+
+		sdb_log(SDB_LOG_INFO, "Starting %zu collector thread%s",
+				pool.num_threads, pool.num_threads == 1 ? "" : "s");
+	}
 
-		callback = (sdb_plugin_collector_cb)CCB(obj)->ccb_callback;
+	pthread_mutex_lock(&collector_lock);
+	while (loop->do_loop) {
+		sdb_object_t *obj = NULL;
+		sdb_time_t now, wakeup;
+		struct timespec ts;
 
 		if (! (now = sdb_gettime())) {
 			char errbuf[1024];
 			sdb_log(SDB_LOG_ERR, "Failed to determine current "
 					"time in collector main loop: %s",
 					sdb_strerror(errno, errbuf, sizeof(errbuf)));
-			now = CCB(obj)->ccb_next_update;
+			status = -1;
+			break;
 		}
 
-		if (now < CCB(obj)->ccb_next_update) {
-			interval = CCB(obj)->ccb_next_update - now;
-
-			errno = 0;
-			while (loop->do_loop && sdb_sleep(interval, &interval)) {
-				if (errno != EINTR) {
-					char errbuf[1024];
-					sdb_log(SDB_LOG_ERR, "Failed to sleep "
-							"in collector main loop: %s",
-							sdb_strerror(errno, errbuf, sizeof(errbuf)));
-					sdb_llist_insert_sorted(collector_list, obj,
-							plugin_cmp_next_update);
-					sdb_object_deref(obj);
-					return -1;
-				}
-				errno = 0;
-			}
-
-			if (! loop->do_loop) {
-				/* put back; don't worry about errors */
-				sdb_llist_insert_sorted(collector_list, obj,
-						plugin_cmp_next_update);
-				sdb_object_deref(obj);
-				return 0;
-			}
+		if ((! sdb_llist_len(collector_list)) && (! pool.busy)) {
+			sdb_log(SDB_LOG_WARNING, "No collectors left. "
+					"Quiting main loop.");
+			status = -1;
+			break;
 		}
 
-		old_ctx = ctx_set(CCB(obj)->ccb_ctx);
-		if (callback(CCB(obj)->ccb_user_data)) {
-			/* XXX */
-		}
-		ctx_set(old_ctx);
+		/* wake up regularly to notice loop->do_loop being reset */
+		wakeup = now + COLLECTOR_LOOP_CHECK_INTERVAL;
+		collector_next(&pool, now, &obj, &wakeup);
 
-		interval = CCB(obj)->ccb_interval;
-		if (! interval)
-			interval = loop->default_interval;
-		if (! interval) {
-			sdb_log(SDB_LOG_WARNING, "No interval configured "
-					"for plugin '%s'; skipping any further "
-					"iterations.", obj->name);
-			sdb_object_deref(obj);
+		if (! obj) {
+			ts.tv_sec = (time_t)SDB_TIME_TO_SECS(wakeup);
+			ts.tv_nsec = (long)(wakeup % SECS_TO_SDB_TIME(1));
+			pthread_cond_timedwait(&collector_cond, &collector_lock, &ts);
 			continue;
 		}
 
-		CCB(obj)->ccb_next_update += interval;
+		CCB(obj)->ccb_running = 1;
+		CCB(obj)->ccb_timed_out = 0;
+		CCB(obj)->ccb_last_start = now;
 
-		if (! (now = sdb_gettime())) {
-			char errbuf[1024];
-			sdb_log(SDB_LOG_ERR, "Failed to determine current "
-					"time in collector main loop: %s",
-					sdb_strerror(errno, errbuf, sizeof(errbuf)));
-			now = CCB(obj)->ccb_next_update;
+		if (! pool.num_threads) {
+			pthread_mutex_unlock(&collector_lock);
+			collector_run(&pool, obj);
+			pthread_mutex_lock(&collector_lock);
+			continue;
 		}
 
-		if (now > CCB(obj)->ccb_next_update) {
-			sdb_log(SDB_LOG_WARNING, "Plugin '%s' took too "
-					"long; skipping iterations to keep up.",
+		++pool.busy;
+		if (sdb_channel_write(pool.chan, &obj)) {
+			/* this should not happen as long as busy <= num_threads */
+			sdb_log(SDB_LOG_ERR, "Failed to dispatch collector '%s'",
 					obj->name);
-			CCB(obj)->ccb_next_update = now;
+			CCB(obj)->ccb_running = 0;
+			--pool.busy;
+			status = -1;
+			break;
 		}
+	}
+	pthread_mutex_unlock(&collector_lock);
+
+	if (pool.num_threads) {
+		sdb_log(SDB_LOG_INFO, "Waiting for collector threads to terminate");
+		/* running collectors will finish their current run */
+		if (! sdb_channel_shutdown(pool.chan))
+			for (i = 0; i < pool.num_threads; ++i)
+				pthread_join(pool.threads[i], NULL);
+		sdb_channel_destroy(pool.chan);
+		free(pool.threads);
+	}
 
-		if (sdb_llist_insert_sorted(collector_list, obj,
-					plugin_cmp_next_update)) {
-			sdb_log(SDB_LOG_ERR, "Failed to re-insert plugin '%s' into "
-					"collector list. Unable to further use the plugin.",
-					obj->name);
-			sdb_object_deref(obj);
-			return -1;
-		}
+	collector_log_stats();
+	return status;
+} /* sdb_plugin_collector_loop */
 
-		/* pass control back to the list */
-		sdb_object_deref(obj);
-	}
-	return 0;
-} /* sdb_plugin_read_loop */
+int
+sdb_plugin_get_collector_stats(const char *name,
+		sdb_plugin_collector_stats_t *stats)
+{
+	sdb_object_t *obj;
+
+	if ((! name) || (! stats))
+		return -1;
+
+	pthread_mutex_lock(&collector_lock);
+	obj = sdb_llist_search_by_name(collector_list, name);
+	if (obj)
+		*stats = CCB(obj)->ccb_stats;
+	pthread_mutex_unlock(&collector_lock);
+	return obj ? 0 : -1;
+} /* sdb_plugin_get_collector_stats */
 
 char *
 sdb_plugin_cname(char *hostname)
 {
-	sdb_llist_iter_t *iter;
+	sdb_object_t *entry;
+	char *cname = NULL;
 
 	if (! hostname)
 		return NULL;
@@ -1500,26 +3328,98 @@ sdb_plugin_cname(char *hostname)
 	if (! cname_list)
 		return hostname;
 
-	iter = sdb_llist_get_iter(cname_list);
-	while (sdb_llist_iter_has_next(iter)) {
-		sdb_plugin_cname_cb callback;
-		char *cname;
+	pthread_rwlock_rdlock(&cname_cache_rwlock);
+	if (! cname_cache.lru) {
+		pthread_rwlock_unlock(&cname_cache_rwlock);
+		return cname_resolve(hostname, NULL);
+	}
 
-		sdb_object_t *obj = sdb_llist_iter_get_next(iter);
-		assert(obj);
+	entry = cname_cache_lookup(hostname);
+	pthread_rwlock_unlock(&cname_cache_rwlock);
 
-		callback = (sdb_plugin_cname_cb)CB(obj)->cb_callback;
-		cname = callback(hostname, CB(obj)->cb_user_data);
-		if (cname) {
-			free(hostname);
-			hostname = cname;
-		}
-		/* else: don't change hostname */
+	if (entry && CNAME_ENTRY(entry)->cname)
+		cname = strdup(CNAME_ENTRY(entry)->cname);
+	sdb_object_deref(entry);
+
+	if (cname) {
+		free(hostname);
+		hostname = cname;
 	}
-	sdb_llist_iter_destroy(iter);
 	return hostname;
 } /* sdb_plugin_cname */
 
+int
+sdb_plugin_cname_cache_configure(const sdb_plugin_cname_cache_opts_t *opts)
+{
+	size_t i;
+
+	pthread_rwlock_wrlock(&cname_cache_rwlock);
+	cname_cache_destroy();
+
+	if ((! opts) || (! opts->size)) {
+		pthread_rwlock_unlock(&cname_cache_rwlock);
+		return 0;
+	}
+
+	cname_cache.opts = *opts;
+	/* resolver threads refresh expired entries while still using them */
+	cname_cache.lru = sdb_lru_create(opts->size,
+			opts->num_threads ? NULL : cname_entry_valid);
+	cname_cache.pending = sdb_llist_create();
+	if (opts->num_threads) {
+		/* don't queue more names than we're able to cache */
+		cname_cache.chan = sdb_channel_create(opts->size,
+				sizeof(sdb_object_t *));
+		cname_cache.threads = calloc(opts->num_threads,
+				sizeof(*cname_cache.threads));
+	}
+
+	if ((! cname_cache.lru) || (! cname_cache.pending)
+			|| (opts->num_threads
+				&& ((! cname_cache.chan) || (! cname_cache.threads)))) {
+		sdb_log(SDB_LOG_ERR, "cname cache: Failed to create cache "
+				"of size %zu", opts->size);
+		cname_cache_destroy();
+		pthread_rwlock_unlock(&cname_cache_rwlock);
+		return -1;
+	}
+
+	for (i = 0; i < opts->num_threads; ++i) {
+		errno = 0;
+		if (pthread_create(&cname_cache.threads[i], /* attr = */ NULL,
+					cname_cache_worker, /* arg = */ NULL)) {
+			char errbuf[1024];
+			sdb_log(SDB_LOG_ERR, "cname cache: Failed to create "
+					"resolver thread: %s",
+					sdb_strerror(errno, errbuf, sizeof(errbuf)));
+			cname_cache_destroy();
+			pthread_rwlock_unlock(&cname_cache_rwlock);
+			return -1;
+		}
+		cname_cache.threads_num = i + 1;
+	}
+	pthread_rwlock_unlock(&cname_cache_rwlock);
+	return 0;
+} /* sdb_plugin_cname_cache_configure */
+
+void
+sdb_plugin_cname_cache_stats(sdb_plugin_cname_cache_stats_t *stats)
+{
+	if (! stats)
+		return;
+
+	memset(stats, 0, sizeof(*stats));
+	pthread_rwlock_rdlock(&cname_cache_rwlock);
+	if (cname_cache.lru) {
+		sdb_lru_stats(cname_cache.lru, &stats->lru);
+		pthread_mutex_lock(&cname_cache_lock);
+		stats->stale = cname_cache.stale;
+		stats->timeouts = cname_cache.timeouts;
+		pthread_mutex_unlock(&cname_cache_lock);
+	}
+	pthread_rwlock_unlock(&cname_cache_rwlock);
+} /* sdb_plugin_cname_cache_stats */
+
 int
 sdb_plugin_log(int prio, const char *msg)
 {
@@ -1662,23 +3562,16 @@ sdb_plugin_describe_timeseries(const char *type, const char *id)
 	return ts_info;
 } /* sdb_plugin_describe_timeseries */
 
-int
-sdb_plugin_query(sdb_ast_node_t *ast,
-		sdb_store_writer_t *w, sdb_object_t *wd,
-		sdb_query_opts_t *opts, sdb_strbuf_t *errbuf)
+sdb_object_t *
+sdb_plugin_prepare_query(sdb_ast_node_t *ast, sdb_strbuf_t *errbuf)
 {
-	query_writer_t qw = QUERY_WRITER_INIT(w, wd);
-	reader_t *reader;
-	sdb_object_t *q;
-
+	sdb_object_t *prepared;
+	reader_query_t *queries;
+	sdb_llist_iter_t *iter;
 	size_t n = sdb_llist_len(reader_list);
-	int status = 0;
 
 	if (! ast)
-		return 0;
-
-	if (opts)
-		qw.opts = *opts;
+		return NULL;
 
 	if ((ast->type != SDB_AST_TYPE_FETCH)
 			&& (ast->type != SDB_AST_TYPE_LIST)
@@ -1687,373 +3580,545 @@ sdb_plugin_query(sdb_ast_node_t *ast,
 				SDB_AST_TYPE_TO_STRING(ast));
 		sdb_strbuf_sprintf(errbuf, "Cannot execute query of type %s",
 				SDB_AST_TYPE_TO_STRING(ast));
-		return -1;
+		return NULL;
 	}
 
-	if (n != 1) {
-		char *msg = (n > 0)
-			? "Cannot execute query: multiple readers not supported"
-			: "Cannot execute query: no readers registered";
+	if (! n) {
+		char *msg = "Cannot execute query: no readers registered";
 		sdb_strbuf_sprintf(errbuf, "%s", msg);
 		sdb_log(SDB_LOG_ERR, "%s", msg);
-		return -1;
+		return NULL;
 	}
 
-	reader = READER(sdb_llist_get(reader_list, 0));
-	assert(reader);
+	prepared = sdb_object_create(SDB_AST_TYPE_TO_STRING(ast), prepared_type);
+	queries = calloc(n, sizeof(*queries));
+	if ((! prepared) || (! queries)) {
+		sdb_strbuf_sprintf(errbuf, "Out of memory");
+		sdb_object_deref(prepared);
+		free(queries);
+		return NULL;
+	}
+	PREPARED(prepared)->type = ast->type;
+	PREPARED(prepared)->queries = queries;
 
-	q = reader->impl.prepare_query(ast, errbuf, reader->r_user_data);
-	if (q)
-		status = reader->impl.execute_query(q, &query_writer, SDB_OBJ(&qw),
-				errbuf, reader->r_user_data);
-	else
-		status = -1;
+	iter = sdb_llist_get_iter(reader_list);
+	while (sdb_llist_iter_has_next(iter)) {
+		reader_t *reader = READER(sdb_llist_iter_get_next(iter));
+		sdb_object_t *q;
+
+		assert(reader);
+		if (PREPARED(prepared)->queries_num >= n)
+			break; /* a reader has been registered concurrently */
+
+		q = reader->impl.prepare_query(ast, errbuf, reader->r_user_data);
+		if (! q) {
+			sdb_llist_iter_destroy(iter);
+			sdb_object_deref(prepared);
+			return NULL;
+		}
 
-	sdb_object_deref(SDB_OBJ(q));
-	sdb_object_deref(SDB_OBJ(reader));
-	return status;
-} /* sdb_plugin_query */
+		sdb_object_ref(SDB_OBJ(reader));
+		queries[PREPARED(prepared)->queries_num].reader = reader;
+		queries[PREPARED(prepared)->queries_num].q = q;
+		++PREPARED(prepared)->queries_num;
+	}
+	sdb_llist_iter_destroy(iter);
+	return prepared;
+} /* sdb_plugin_prepare_query */
 
-int
-sdb_plugin_store_host(const char *name, sdb_time_t last_update)
+static int
+bind_query(reader_query_t *query, const sdb_data_t *params,
+		size_t params_num, sdb_strbuf_t *errbuf)
 {
-	sdb_store_host_t host = SDB_STORE_HOST_INIT;
-	char *backends[1];
-	char *cname;
+	reader_t *reader = query->reader;
 
-	sdb_llist_iter_t *iter;
-	int status = 0;
-
-	if (! name)
+	if (reader->impl.bind_query)
+		return reader->impl.bind_query(query->q, params, params_num,
+				errbuf, reader->r_user_data);
+	if (params_num) {
+		sdb_strbuf_sprintf(errbuf, "Query parameters not supported "
+				"by store reader '%s'", SDB_OBJ(reader)->name);
 		return -1;
+	}
+	return 0;
+} /* bind_query */
 
-	if (! sdb_llist_len(writer_list)) {
-		sdb_log(SDB_LOG_ERR, "Cannot store host: no writers registered");
+/* execute a query using all readers in parallel, merging the results */
+static int
+execute_federated(prepared_t *prepared, query_writer_t *qw,
+		sdb_strbuf_t *errbuf)
+{
+	query_collector_t *collectors;
+	size_t succeeded = 0, i;
+	int status = 0, result = 0;
+
+	collectors = calloc(prepared->queries_num, sizeof(*collectors));
+	if (! collectors) {
+		sdb_strbuf_sprintf(errbuf, "Out of memory");
 		return -1;
 	}
 
-	cname = sdb_plugin_cname(strdup(name));
-	if (! cname) {
-		sdb_log(SDB_LOG_ERR, "strdup failed");
-		return -1;
+	for (i = 0; i < prepared->queries_num; ++i) {
+		query_collector_t *c = collectors + i;
+
+		c->reader = prepared->queries[i].reader;
+		c->q = prepared->queries[i].q;
+		c->reader_idx = i;
+		c->errbuf = sdb_strbuf_create(0);
+		c->status = -1;
+		if (! c->errbuf)
+			break;
+		/* the first reader is handled by the calling thread */
+		if (i && pthread_create(&c->thread, /* attr = */ NULL,
+					query_collector_run, c)) {
+			sdb_strbuf_destroy(c->errbuf);
+			c->errbuf = NULL;
+			break;
+		}
 	}
 
-	host.name = cname;
-	host.last_update = last_update ? last_update : sdb_gettime();
-	if (get_interval(SDB_HOST, NULL, -1, NULL, cname,
-				host.last_update, &host.interval)) {
-		free(cname);
-		return 1;
+	if (i < prepared->queries_num) {
+		sdb_strbuf_sprintf(errbuf, "Failed to start query "
+				"on store reader '%s'",
+				SDB_OBJ(prepared->queries[i].reader)->name);
+		status = -1;
 	}
-	host.backends = (const char * const *)backends;
-	get_backend(backends, &host.backends_num);
+	else
+		query_collector_run(collectors);
 
-	iter = sdb_llist_get_iter(writer_list);
-	while (sdb_llist_iter_has_next(iter)) {
-		writer_t *writer = WRITER(sdb_llist_iter_get_next(iter));
-		int s;
-		assert(writer);
-		s = writer->impl.store_host(&host, writer->w_user_data);
-		if (((s > 0) && (status >= 0)) || (s < 0))
-			status = s;
+	for (i = 0; i < prepared->queries_num; ++i) {
+		query_collector_t *c = collectors + i;
+
+		if (! c->errbuf)
+			break;
+		if (i)
+			pthread_join(c->thread, NULL);
+
+		/* the reader returns the type of the result on success */
+		if (c->status >= 0) {
+			if (! succeeded)
+				result = c->status;
+			++succeeded;
+			continue;
+		}
+
+		/* FETCH succeeds if any of the readers found the object */
+		if (status || (prepared->type == SDB_AST_TYPE_FETCH))
+			continue;
+		sdb_strbuf_sprintf(errbuf, "%s",
+				sdb_strbuf_string(c->errbuf));
+		status = c->status;
 	}
-	sdb_llist_iter_destroy(iter);
-	free(cname);
-	return status;
-} /* sdb_plugin_store_host */
+
+	if ((! status) && (! succeeded)) {
+		sdb_strbuf_sprintf(errbuf, "%s",
+				sdb_strbuf_string(collectors[0].errbuf));
+		status = collectors[0].status;
+	}
+	if ((! status) && query_merge(collectors, prepared->queries_num, qw)) {
+		sdb_strbuf_sprintf(errbuf, "Failed to merge query results");
+		status = -1;
+	}
+
+	for (i = 0; i < prepared->queries_num; ++i)
+		query_collector_clear(collectors + i);
+	free(collectors);
+	return status ? status : result;
+} /* execute_federated */
 
 int
-sdb_plugin_store_service(const char *hostname, const char *name,
-		sdb_time_t last_update)
+sdb_plugin_execute_query(sdb_object_t *prepared,
+		const sdb_data_t *params, size_t params_num,
+		sdb_store_writer_t *w, sdb_object_t *wd,
+		sdb_query_opts_t *opts, sdb_strbuf_t *errbuf)
 {
-	sdb_store_service_t service = SDB_STORE_SERVICE_INIT;
-	char *backends[1];
-	char *cname;
+	query_writer_t qw = QUERY_WRITER_INIT(w, wd);
+	reader_query_t *query;
+	size_t i;
 
-	sdb_llist_iter_t *iter;
-	sdb_data_t d;
+	if (! prepared)
+		return -1;
 
-	int status = 0;
+	if (opts)
+		qw.opts = *opts;
 
-	if ((! hostname) || (! name))
-		return -1;
+	for (i = 0; i < PREPARED(prepared)->queries_num; ++i)
+		if (bind_query(PREPARED(prepared)->queries + i,
+					params, params_num, errbuf))
+			return -1;
 
-	if (! sdb_llist_len(writer_list)) {
-		sdb_log(SDB_LOG_ERR, "Cannot store service: "
-				"no writers registered");
+	if (PREPARED(prepared)->queries_num > 1)
+		return execute_federated(PREPARED(prepared), &qw, errbuf);
+
+	query = PREPARED(prepared)->queries;
+	return query->reader->impl.execute_query(query->q, &query_writer,
+			SDB_OBJ(&qw), errbuf, query->reader->r_user_data);
+} /* sdb_plugin_execute_query */
+
+int
+sdb_plugin_query(sdb_ast_node_t *ast,
+		sdb_store_writer_t *w, sdb_object_t *wd,
+		sdb_query_opts_t *opts, sdb_strbuf_t *errbuf)
+{
+	sdb_object_t *prepared;
+	int status;
+
+	if (! ast)
+		return 0;
+
+	prepared = sdb_plugin_prepare_query(ast, errbuf);
+	if (! prepared)
 		return -1;
+
+	status = sdb_plugin_execute_query(prepared, NULL, 0, w, wd, opts, errbuf);
+	sdb_object_deref(prepared);
+	return status;
+} /* sdb_plugin_query */
+
+sdb_object_t *
+sdb_plugin_watch(sdb_ast_node_t *ast,
+		sdb_store_writer_t *w, sdb_object_t *wd, sdb_strbuf_t *errbuf)
+{
+	sdb_object_t *prepared, *obj;
+	reader_query_t *watches;
+	size_t n, i;
+
+	if ((! ast) || (! w))
+		return NULL;
+
+	if (ast->type != SDB_AST_TYPE_LOOKUP) {
+		sdb_strbuf_sprintf(errbuf, "Cannot watch query of type %s",
+				SDB_AST_TYPE_TO_STRING(ast));
+		return NULL;
 	}
 
-	cname = sdb_plugin_cname(strdup(hostname));
-	if (! cname) {
-		sdb_log(SDB_LOG_ERR, "strdup failed");
-		return -1;
+	prepared = sdb_plugin_prepare_query(ast, errbuf);
+	if (! prepared)
+		return NULL;
+
+	n = PREPARED(prepared)->queries_num;
+	for (i = 0; i < n; ++i) {
+		reader_t *reader = PREPARED(prepared)->queries[i].reader;
+		if (! reader->impl.watch) {
+			sdb_strbuf_sprintf(errbuf, "Watching queries not supported "
+					"by store reader '%s'", SDB_OBJ(reader)->name);
+			sdb_object_deref(prepared);
+			return NULL;
+		}
 	}
 
-	service.hostname = cname;
-	service.name = name;
-	service.last_update = last_update ? last_update : sdb_gettime();
-	if (get_interval(SDB_SERVICE, cname, -1, NULL, name,
-				service.last_update, &service.interval)) {
-		free(cname);
-		return 1;
+	obj = sdb_object_create("watch", watch_type);
+	watches = calloc(n, sizeof(*watches));
+	if ((! obj) || (! watches)) {
+		sdb_strbuf_sprintf(errbuf, "Out of memory");
+		sdb_object_deref(prepared);
+		sdb_object_deref(obj);
+		free(watches);
+		return NULL;
 	}
-	service.backends = (const char * const *)backends;
-	get_backend(backends, &service.backends_num);
+	WATCH(obj)->watches = watches;
 
-	iter = sdb_llist_get_iter(writer_list);
+	/* updates are pushed by each reader individually */
+	for (i = 0; i < n; ++i) {
+		reader_query_t *query = PREPARED(prepared)->queries + i;
+
+		sdb_object_ref(SDB_OBJ(query->reader));
+		watches[i].reader = query->reader;
+		++WATCH(obj)->watches_num;
+
+		watches[i].q = query->reader->impl.watch(query->q, w, wd,
+				errbuf, query->reader->r_user_data);
+		if (! watches[i].q) {
+			sdb_object_deref(prepared);
+			sdb_object_deref(obj);
+			return NULL;
+		}
+	}
+	sdb_object_deref(prepared);
+	return obj;
+} /* sdb_plugin_watch */
+
+uint64_t
+sdb_plugin_query_generation(const char *hostname)
+{
+	sdb_llist_iter_t *iter;
+	uint64_t gen = 0;
+
+	/* with multiple readers, the sum of all generations changes whenever
+	 * any of them changes */
+	iter = sdb_llist_get_iter(reader_list);
 	while (sdb_llist_iter_has_next(iter)) {
-		writer_t *writer = WRITER(sdb_llist_iter_get_next(iter));
-		int s;
-		assert(writer);
-		s = writer->impl.store_service(&service, writer->w_user_data);
-		if (((s > 0) && (status >= 0)) || (s < 0))
-			status = s;
+		reader_t *reader = READER(sdb_llist_iter_get_next(iter));
+		uint64_t g = 0;
+
+		assert(reader);
+		if (reader->impl.generation)
+			g = reader->impl.generation(hostname, reader->r_user_data);
+		if (! g) {
+			gen = 0;
+			break;
+		}
+		gen += g;
+	}
+	sdb_llist_iter_destroy(iter);
+	return gen;
+} /* sdb_plugin_query_generation */
+
+int
+sdb_plugin_replicate(sdb_store_repl_pos_t *pos,
+		sdb_strbuf_t *buf, size_t max, int notify_fd, sdb_strbuf_t *errbuf)
+{
+	sdb_llist_iter_t *iter;
+	reader_t *reader = NULL;
+	int status;
+
+	iter = sdb_llist_get_iter(reader_list);
+	while (sdb_llist_iter_has_next(iter)) {
+		reader = READER(sdb_llist_iter_get_next(iter));
+		assert(reader);
+		if (reader->impl.replicate)
+			break;
+		reader = NULL;
 	}
 	sdb_llist_iter_destroy(iter);
 
-	if (! status) {
-		/* record the hostname as an attribute */
-		d.type = SDB_TYPE_STRING;
-		d.data.string = cname;
-		if (sdb_plugin_store_service_attribute(cname, name,
-					"hostname", &d, service.last_update))
-			status = -1;
+	if (! reader) {
+		sdb_strbuf_sprintf(errbuf, "Replication not supported by any "
+				"store reader");
+		return -1;
 	}
-
-	free(cname);
+	status = reader->impl.replicate(pos, buf, max, notify_fd,
+			reader->r_user_data);
+	if (status < 0)
+		sdb_strbuf_sprintf(errbuf, "Failed to read replication stream "
+				"from store reader '%s'", SDB_OBJ(reader)->name);
 	return status;
-} /* sdb_plugin_store_service */
+} /* sdb_plugin_replicate */
 
 int
-sdb_plugin_store_metric(const char *hostname, const char *name,
-		sdb_metric_store_t *store, sdb_time_t last_update)
+sdb_plugin_ingest_start(const sdb_plugin_ingest_opts_t *opts)
 {
-	sdb_store_metric_t metric = SDB_STORE_METRIC_INIT;
-	char *backends[1];
-	char *cname;
-
-	sdb_llist_iter_t *iter;
-	sdb_data_t d;
-
-	int status = 0;
+	ingest_queue_t *queues;
+	size_t i;
 
-	if ((! hostname) || (! name))
+	if ((! opts) || (! opts->queue_size) || (! opts->batch_size))
 		return -1;
+	if (! opts->num_threads)
+		return 0;
 
-	if (! sdb_llist_len(writer_list)) {
-		sdb_log(SDB_LOG_ERR, "Cannot store metric: no writers registered");
+	pthread_rwlock_wrlock(&ingest_lock);
+	if (ingest.queues_num) {
+		pthread_rwlock_unlock(&ingest_lock);
+		sdb_log(SDB_LOG_ERR, "Ingest pipeline already running");
 		return -1;
 	}
 
-	cname = sdb_plugin_cname(strdup(hostname));
-	if (! cname) {
-		sdb_log(SDB_LOG_ERR, "strdup failed");
+	queues = calloc(opts->num_threads, sizeof(*queues));
+	if (! queues) {
+		pthread_rwlock_unlock(&ingest_lock);
 		return -1;
 	}
 
-	if (store && ((! store->type) || (! store->id)))
-		store = NULL;
-
-	metric.hostname = cname;
-	metric.name = name;
-	if (store) {
-		if (store->last_update < last_update)
-			store->last_update = last_update;
-		metric.stores = store;
-		metric.stores_num = 1;
-	}
-	metric.last_update = last_update ? last_update : sdb_gettime();
-	if (get_interval(SDB_METRIC, cname, -1, NULL, name,
-				metric.last_update, &metric.interval)) {
-		free(cname);
-		return 1;
-	}
-	metric.backends = (const char * const *)backends;
-	get_backend(backends, &metric.backends_num);
+	ingest.queues = queues;
+	ingest.batch_size = opts->batch_size;
+	for (i = 0; i < opts->num_threads; ++i) {
+		pthread_mutex_init(&queues[i].lock, /* attr = */ NULL);
+		queues[i].chan = sdb_channel_create(opts->queue_size,
+				sizeof(ingest_record_t *));
+		if (! queues[i].chan)
+			break;
 
-	iter = sdb_llist_get_iter(writer_list);
-	while (sdb_llist_iter_has_next(iter)) {
-		writer_t *writer = WRITER(sdb_llist_iter_get_next(iter));
-		int s;
-		assert(writer);
-		s = writer->impl.store_metric(&metric, writer->w_user_data);
-		if (((s > 0) && (status >= 0)) || (s < 0))
-			status = s;
+		errno = 0;
+		if (pthread_create(&queues[i].thread, /* attr = */ NULL,
+					ingest_worker, /* arg = */ queues + i)) {
+			char errbuf[1024];
+			sdb_log(SDB_LOG_ERR, "Failed to create ingest thread: %s",
+					sdb_strerror(errno, errbuf, sizeof(errbuf)));
+			sdb_channel_destroy(queues[i].chan);
+			break;
+		}
+		ingest.queues_num = i + 1;
 	}
-	sdb_llist_iter_destroy(iter);
 
-	if (! status) {
-		/* record the hostname as an attribute */
-		d.type = SDB_TYPE_STRING;
-		d.data.string = cname;
-		if (sdb_plugin_store_metric_attribute(cname, name,
-					"hostname", &d, metric.last_update))
-			status = -1;
+	if (ingest.queues_num < opts->num_threads) {
+		pthread_mutex_destroy(&queues[i].lock);
+		pthread_rwlock_unlock(&ingest_lock);
+		sdb_plugin_ingest_stop();
+		return -1;
 	}
+	pthread_rwlock_unlock(&ingest_lock);
 
-	free(cname);
-	return status;
-} /* sdb_plugin_store_metric */
+	sdb_log(SDB_LOG_INFO, "Starting %zu ingest thread%s "
+			"(queue size = %zu, batch size = %zu)", opts->num_threads,
+			opts->num_threads == 1 ? "" : "s", opts->queue_size,
+			opts->batch_size);
+	return 0;
+} /* sdb_plugin_ingest_start */
 
-int
-sdb_plugin_store_attribute(const char *hostname, const char *key,
-		const sdb_data_t *value, sdb_time_t last_update)
+void
+sdb_plugin_ingest_stop(void)
 {
-	sdb_store_attribute_t attr = SDB_STORE_ATTRIBUTE_INIT;
-	char *backends[1];
-	char *cname;
+	sdb_plugin_ingest_stats_t stats;
+	bool have_stats;
+	size_t i;
 
-	sdb_llist_iter_t *iter;
-	int status = 0;
+	have_stats = sdb_plugin_get_ingest_stats(&stats) == 0;
 
-	if ((! hostname) || (! key) || (! value))
-		return -1;
+	pthread_rwlock_wrlock(&ingest_lock);
+	for (i = 0; i < ingest.queues_num; ++i) {
+		ingest_queue_t *q = ingest.queues + i;
 
-	if (! sdb_llist_len(writer_list)) {
-		sdb_log(SDB_LOG_ERR, "Cannot store attribute: no writers registered");
-		return -1;
+		/* the writer thread drains the queue before terminating */
+		if (! sdb_channel_shutdown(q->chan))
+			pthread_join(q->thread, NULL);
+		sdb_channel_destroy(q->chan);
+		pthread_mutex_destroy(&q->lock);
 	}
+	free(ingest.queues);
+	ingest.queues = NULL;
+	ingest.queues_num = 0;
+	pthread_rwlock_unlock(&ingest_lock);
+
+	if (have_stats)
+		sdb_log(SDB_LOG_INFO, "Ingest pipeline: %zu object%s queued, "
+				"%zu failed, %zu batch%s, %zu stall%s, max. queue depth %zu",
+				stats.enqueued, stats.enqueued == 1 ? "" : "s",
+				stats.failed, stats.batches, stats.batches == 1 ? "" : "es",
+				stats.stalls, stats.stalls == 1 ? "" : "s",
+				stats.max_queued);
+} /* sdb_plugin_ingest_stop */
 
-	cname = sdb_plugin_cname(strdup(hostname));
-	if (! cname) {
-		sdb_log(SDB_LOG_ERR, "strdup failed");
+int
+sdb_plugin_get_ingest_stats(sdb_plugin_ingest_stats_t *stats)
+{
+	size_t i;
+
+	if (! stats)
 		return -1;
-	}
 
-	attr.parent_type = SDB_HOST;
-	attr.parent = cname;
-	attr.key = key;
-	attr.value = *value;
-	attr.last_update = last_update ? last_update : sdb_gettime();
-	if (get_interval(SDB_ATTRIBUTE, cname, -1, NULL, key,
-				attr.last_update, &attr.interval)) {
-		free(cname);
-		return 1;
+	pthread_rwlock_rdlock(&ingest_lock);
+	if (! ingest.queues_num) {
+		pthread_rwlock_unlock(&ingest_lock);
+		return -1;
 	}
-	attr.backends = (const char * const *)backends;
-	get_backend(backends, &attr.backends_num);
 
-	iter = sdb_llist_get_iter(writer_list);
-	while (sdb_llist_iter_has_next(iter)) {
-		writer_t *writer = WRITER(sdb_llist_iter_get_next(iter));
-		int s;
-		assert(writer);
-		s = writer->impl.store_attribute(&attr, writer->w_user_data);
-		if (((s > 0) && (status >= 0)) || (s < 0))
-			status = s;
+	memset(stats, 0, sizeof(*stats));
+	for (i = 0; i < ingest.queues_num; ++i) {
+		ingest_queue_t *q = ingest.queues + i;
+
+		pthread_mutex_lock(&q->lock);
+		stats->queued += q->stats.queued;
+		if (q->stats.max_queued > stats->max_queued)
+			stats->max_queued = q->stats.max_queued;
+		stats->enqueued += q->stats.enqueued;
+		stats->processed += q->stats.processed;
+		stats->failed += q->stats.failed;
+		stats->batches += q->stats.batches;
+		stats->stalls += q->stats.stalls;
+		pthread_mutex_unlock(&q->lock);
 	}
-	sdb_llist_iter_destroy(iter);
-	free(cname);
-	return status;
-} /* sdb_plugin_store_attribute */
+	pthread_rwlock_unlock(&ingest_lock);
+	return 0;
+} /* sdb_plugin_get_ingest_stats */
 
 int
-sdb_plugin_store_service_attribute(const char *hostname, const char *service,
-		const char *key, const sdb_data_t *value, sdb_time_t last_update)
+sdb_plugin_store_host(const char *name, sdb_time_t last_update)
 {
-	sdb_store_attribute_t attr = SDB_STORE_ATTRIBUTE_INIT;
-	char *backends[1];
-	char *cname;
+	int status;
 
-	sdb_llist_iter_t *iter;
-	int status = 0;
+	if (! name)
+		return -1;
 
-	if ((! hostname) || (! service) || (! key) || (! value))
+	status = ingest_enqueue(SDB_HOST, 0, name, NULL, name,
+			NULL, NULL, last_update);
+	if (status <= 0)
+		return status;
+	return plugin_store_host(name, last_update);
+} /* sdb_plugin_store_host */
+
+int
+sdb_plugin_store_service(const char *hostname, const char *name,
+		sdb_time_t last_update)
+{
+	int status;
+
+	if ((! hostname) || (! name))
 		return -1;
 
-	if (! sdb_llist_len(writer_list)) {
-		sdb_log(SDB_LOG_ERR, "Cannot store service attribute: "
-				"no writers registered");
+	status = ingest_enqueue(SDB_SERVICE, 0, hostname, NULL, name,
+			NULL, NULL, last_update);
+	if (status <= 0)
+		return status;
+	return plugin_store_service(hostname, name, last_update);
+} /* sdb_plugin_store_service */
+
+int
+sdb_plugin_store_metric(const char *hostname, const char *name,
+		sdb_metric_store_t *store, sdb_time_t last_update)
+{
+	int status;
+
+	if ((! hostname) || (! name))
 		return -1;
-	}
 
-	cname = sdb_plugin_cname(strdup(hostname));
-	if (! cname) {
-		sdb_log(SDB_LOG_ERR, "strdup failed");
+	if (store && ((! store->type) || (! store->id)))
+		store = NULL;
+
+	status = ingest_enqueue(SDB_METRIC, 0, hostname, NULL, name,
+			NULL, store, last_update);
+	if (status <= 0)
+		return status;
+	return plugin_store_metric(hostname, name, store, last_update);
+} /* sdb_plugin_store_metric */
+
+int
+sdb_plugin_store_attribute(const char *hostname, const char *key,
+		const sdb_data_t *value, sdb_time_t last_update)
+{
+	int status;
+
+	if ((! hostname) || (! key) || (! value))
 		return -1;
-	}
 
-	attr.hostname = cname;
-	attr.parent_type = SDB_SERVICE;
-	attr.parent = service;
-	attr.key = key;
-	attr.value = *value;
-	attr.last_update = last_update ? last_update : sdb_gettime();
-	if (get_interval(SDB_ATTRIBUTE, cname, SDB_SERVICE, service, key,
-				attr.last_update, &attr.interval)) {
-		free(cname);
-		return 1;
-	}
-	attr.backends = (const char * const *)backends;
-	get_backend(backends, &attr.backends_num);
+	status = ingest_enqueue(SDB_ATTRIBUTE, SDB_HOST, hostname, NULL, key,
+			value, NULL, last_update);
+	if (status <= 0)
+		return status;
+	return plugin_store_attribute(hostname, key, value, last_update);
+} /* sdb_plugin_store_attribute */
 
-	iter = sdb_llist_get_iter(writer_list);
-	while (sdb_llist_iter_has_next(iter)) {
-		writer_t *writer = WRITER(sdb_llist_iter_get_next(iter));
-		int s;
-		assert(writer);
-		s = writer->impl.store_attribute(&attr, writer->w_user_data);
-		if (((s > 0) && (status >= 0)) || (s < 0))
-			status = s;
-	}
-	sdb_llist_iter_destroy(iter);
-	free(cname);
-	return status;
+int
+sdb_plugin_store_service_attribute(const char *hostname, const char *service,
+		const char *key, const sdb_data_t *value, sdb_time_t last_update)
+{
+	int status;
+
+	if ((! hostname) || (! service) || (! key) || (! value))
+		return -1;
+
+	status = ingest_enqueue(SDB_ATTRIBUTE, SDB_SERVICE, hostname, service,
+			key, value, NULL, last_update);
+	if (status <= 0)
+		return status;
+	return plugin_store_service_attribute(hostname, service,
+			key, value, last_update);
 } /* sdb_plugin_store_service_attribute */
 
 int
 sdb_plugin_store_metric_attribute(const char *hostname, const char *metric,
 		const char *key, const sdb_data_t *value, sdb_time_t last_update)
 {
-	sdb_store_attribute_t attr = SDB_STORE_ATTRIBUTE_INIT;
-	char *backends[1];
-	char *cname;
-
-	sdb_llist_iter_t *iter;
-	int status = 0;
+	int status;
 
 	if ((! hostname) || (! metric) || (! key) || (! value))
 		return -1;
 
-	if (! sdb_llist_len(writer_list)) {
-		sdb_log(SDB_LOG_ERR, "Cannot store metric attribute: "
-				"no writers registered");
-		return -1;
-	}
-
-	cname = sdb_plugin_cname(strdup(hostname));
-	if (! cname) {
-		sdb_log(SDB_LOG_ERR, "strdup failed");
-		return -1;
-	}
-
-	attr.hostname = cname;
-	attr.parent_type = SDB_METRIC;
-	attr.parent = metric;
-	attr.key = key;
-	attr.value = *value;
-	attr.last_update = last_update ? last_update : sdb_gettime();
-	if (get_interval(SDB_ATTRIBUTE, cname, SDB_METRIC, metric, key,
-				attr.last_update, &attr.interval)) {
-		free(cname);
-		return 1;
-	}
-	attr.backends = (const char * const *)backends;
-	get_backend(backends, &attr.backends_num);
-
-	iter = sdb_llist_get_iter(writer_list);
-	while (sdb_llist_iter_has_next(iter)) {
-		writer_t *writer = WRITER(sdb_llist_iter_get_next(iter));
-		int s;
-		assert(writer);
-		s = writer->impl.store_attribute(&attr, writer->w_user_data);
-		if (((s > 0) && (status >= 0)) || (s < 0))
-			status = s;
-	}
-	sdb_llist_iter_destroy(iter);
-	free(cname);
-	return status;
+	status = ingest_enqueue(SDB_ATTRIBUTE, SDB_METRIC, hostname, metric,
+			key, value, NULL, last_update);
+	if (status <= 0)
+		return status;
+	return plugin_store_metric_attribute(hostname, metric,
+			key, value, last_update);
 } /* sdb_plugin_store_metric_attribute */
 
 /* vim: set tw=78 sw=4 ts=4 noexpandtab : */
@@ -0,0 +1,204 @@
+/*
+ * SysDB - src/core/store_binary.c
+ * Copyright (C) 2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * This module implements a compact binary result format based on the wire
+ * format of stored objects as implemented in utils/proto.c.
+ */
+
+#if HAVE_CONFIG_H
+#	include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include "sysdb.h"
+#include "core/store.h"
+#include "utils/proto.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * private data types
+ */
+
+struct sdb_store_binary_formatter {
+	sdb_object_t super;
+
+	/* The string buffer to write to */
+	sdb_strbuf_t *buf;
+};
+#define F(obj) ((sdb_store_binary_formatter_t *)(obj))
+
+static int
+formatter_init(sdb_object_t *obj, va_list ap)
+{
+	sdb_store_binary_formatter_t *f = F(obj);
+
+	f->buf = va_arg(ap, sdb_strbuf_t *);
+	if (! f->buf)
+		return -1;
+	return 0;
+} /* formatter_init */
+
+static sdb_type_t formatter_type = {
+	/* size = */ sizeof(sdb_store_binary_formatter_t),
+	/* init = */ formatter_init,
+	/* destroy = */ NULL,
+};
+
+/*
+ * private helper functions
+ */
+
+/* Each object is written as a record of its length followed by the encoded
+ * object (see sdb_proto_marshal_object). The length allows clients to skip
+ * over or split up records without decoding them. */
+static int
+record(sdb_store_binary_formatter_t *f, const sdb_proto_object_t *obj)
+{
+	char static_buf[1024];
+	char *buf = static_buf;
+	ssize_t len;
+	int status = 0;
+
+	len = sdb_proto_marshal_object(NULL, 0, obj);
+	if (len < 0)
+		return -1;
+	if ((size_t)len > sizeof(static_buf)) {
+		buf = malloc((size_t)len);
+		if (! buf)
+			return -1;
+	}
+
+	sdb_proto_marshal_object(buf, (size_t)len, obj);
+	if (sdb_strbuf_memappend(f->buf, buf, (size_t)len) < 0)
+		status = -1;
+	if (buf != static_buf)
+		free(buf);
+	return status;
+} /* record */
+
+static int
+emit_host(sdb_store_host_t *host, sdb_object_t *user_data)
+{
+	sdb_proto_object_t obj = { SDB_HOST, { .host = SDB_PROTO_HOST_INIT },
+		NULL, 0 };
+
+	if ((! host) || (! user_data))
+		return -1;
+
+	obj.data.host.last_update = host->last_update;
+	obj.data.host.name = host->name;
+	return record(F(user_data), &obj);
+} /* emit_host */
+
+static int
+emit_service(sdb_store_service_t *service, sdb_object_t *user_data)
+{
+	sdb_proto_object_t obj = { SDB_SERVICE,
+		{ .service = SDB_PROTO_SERVICE_INIT }, NULL, 0 };
+
+	if ((! service) || (! user_data))
+		return -1;
+
+	obj.data.service.last_update = service->last_update;
+	obj.data.service.hostname = service->hostname;
+	obj.data.service.name = service->name;
+	return record(F(user_data), &obj);
+} /* emit_service */
+
+static int
+emit_metric(sdb_store_metric_t *metric, sdb_object_t *user_data)
+{
+	sdb_proto_object_t obj = { SDB_METRIC,
+		{ .metric = SDB_PROTO_METRIC_INIT }, NULL, 0 };
+	sdb_proto_metric_store_t static_stores[8];
+	size_t i;
+	int status;
+
+	if ((! metric) || (! user_data))
+		return -1;
+
+	obj.data.metric.last_update = metric->last_update;
+	obj.data.metric.hostname = metric->hostname;
+	obj.data.metric.name = metric->name;
+
+	obj.stores = static_stores;
+	if (metric->stores_num > SDB_STATIC_ARRAY_LEN(static_stores)) {
+		obj.stores = calloc(metric->stores_num, sizeof(*obj.stores));
+		if (! obj.stores)
+			return -1;
+	}
+	for (i = 0; i < metric->stores_num; ++i) {
+		obj.stores[i].type = metric->stores[i].type;
+		obj.stores[i].id = metric->stores[i].id;
+		obj.stores[i].last_update = metric->stores[i].last_update;
+	}
+	obj.stores_num = metric->stores_num;
+
+	status = record(F(user_data), &obj);
+	if (obj.stores != static_stores)
+		free(obj.stores);
+	return status;
+} /* emit_metric */
+
+static int
+emit_attribute(sdb_store_attribute_t *attr, sdb_object_t *user_data)
+{
+	sdb_proto_object_t obj = { 0, { .attribute = SDB_PROTO_ATTRIBUTE_INIT },
+		NULL, 0 };
+
+	if ((! attr) || (! user_data))
+		return -1;
+
+	obj.type = attr->parent_type | SDB_ATTRIBUTE;
+	obj.data.attribute.last_update = attr->last_update;
+	obj.data.attribute.parent_type = attr->parent_type;
+	obj.data.attribute.hostname = attr->hostname;
+	obj.data.attribute.parent = attr->parent;
+	obj.data.attribute.key = attr->key;
+	obj.data.attribute.value = attr->value;
+	return record(F(user_data), &obj);
+} /* emit_attribute */
+
+/*
+ * public API
+ */
+
+sdb_store_writer_t sdb_store_binary_writer = {
+	emit_host, emit_service, emit_metric, emit_attribute,
+};
+
+sdb_store_binary_formatter_t *
+sdb_store_binary_formatter(sdb_strbuf_t *buf)
+{
+	return F(sdb_object_create("binary-formatter", formatter_type, buf));
+} /* sdb_store_binary_formatter */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
@@ -41,6 +41,7 @@
 #include <assert.h>
 
 #include <ctype.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -112,6 +113,7 @@ typedef struct {
 	sdb_time_t interval;
 	size_t backends_num;
 	const char * const *backends;
+	uint64_t seq;
 } obj_t;
 
 /*
@@ -252,6 +254,9 @@ json_emit(sdb_store_json_formatter_t *f, obj_t *obj)
 		}
 	}
 
+	if (f->flags & SDB_WANT_SEQUENCE)
+		sdb_strbuf_append(f->buf, "\"sequence\": %"PRIu64", ", obj->seq);
+
 	/* TODO: make time and interval formats configurable */
 	if (! sdb_strftime(time_str, sizeof(time_str), obj->last_update))
 		snprintf(time_str, sizeof(time_str), "<error>");
@@ -295,6 +300,7 @@ emit_host(sdb_store_host_t *host, sdb_object_t *user_data)
 			host->interval,
 			host->backends_num,
 			(const char * const *)host->backends,
+			host->seq,
 		};
 
 		return json_emit(f, &o);
@@ -321,6 +327,7 @@ emit_service(sdb_store_service_t *service, sdb_object_t *user_data)
 			service->interval,
 			service->backends_num,
 			(const char * const *)service->backends,
+			service->seq,
 		};
 
 		return json_emit(f, &o);
@@ -349,6 +356,7 @@ emit_metric(sdb_store_metric_t *metric, sdb_object_t *user_data)
 			metric->interval,
 			metric->backends_num,
 			(const char * const *)metric->backends,
+			metric->seq,
 		};
 
 		for (i = 0; i < metric->stores_num; i++) {
@@ -396,6 +404,7 @@ emit_attribute(sdb_store_attribute_t *attr, sdb_object_t *user_data)
 			attr->interval,
 			attr->backends_num,
 			(const char * const *)attr->backends,
+			attr->seq,
 		};
 
 		return json_emit(f, &o);
@@ -33,10 +33,323 @@
 #include "core/timeseries.h"
 #include "utils/strings.h"
 
+#include <ctype.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <math.h>
 
+/*
+ * private helper functions
+ */
+
+static size_t
+downsample_points(const sdb_timeseries_t *ts, const sdb_timeseries_opts_t *opts)
+{
+	size_t n = opts->max_points;
+
+	if (opts->resolution && (ts->end > ts->start)) {
+		size_t r = (size_t)((ts->end - ts->start) / opts->resolution) + 1;
+		if ((! n) || (r < n))
+			n = r;
+	}
+	return n;
+} /* downsample_points */
+
+static void
+copy_point(sdb_timeseries_t *dst, size_t i, const sdb_timeseries_t *src,
+		size_t j)
+{
+	size_t k;
+
+	dst->timestamps[i] = src->timestamps[j];
+	for (k = 0; k < src->data_names_len; ++k)
+		dst->data[k][i] = src->data[k][j];
+} /* copy_point */
+
+/*
+ * Replace each bucket of data-points by the average, minimum, or maximum of
+ * its values, time-stamped by the last data-point of the bucket.
+ */
+static void
+downsample_buckets(const sdb_timeseries_t *ts, sdb_timeseries_t *res,
+		int method)
+{
+	size_t i, j;
+
+	for (j = 0; j < res->data_len; ++j)
+		res->timestamps[j] = ts->timestamps[(j + 1) * ts->data_len
+			/ res->data_len - 1];
+
+	for (i = 0; i < ts->data_names_len; ++i) {
+		const double *data = ts->data[i];
+
+		for (j = 0; j < res->data_len; ++j) {
+			size_t start = j * ts->data_len / res->data_len;
+			size_t end = (j + 1) * ts->data_len / res->data_len;
+			double v = 0.0, num = 0.0;
+			size_t k;
+
+			if (method == SDB_TIMESERIES_MIN)
+				v = INFINITY;
+			else if (method == SDB_TIMESERIES_MAX)
+				v = -INFINITY;
+
+			/* comparisons involving NaN are always false */
+			for (k = start; k < end; ++k) {
+				double x = data[k];
+
+				if (method == SDB_TIMESERIES_MIN)
+					v = (x < v) ? x : v;
+				else if (method == SDB_TIMESERIES_MAX)
+					v = (x > v) ? x : v;
+				else
+					v += isnan(x) ? 0.0 : x;
+				num += isnan(x) ? 0.0 : 1.0;
+			}
+			if (num <= 0.0)
+				v = NAN;
+			else if (method == SDB_TIMESERIES_AVERAGE)
+				v /= num;
+
+			res->data[i][j] = v;
+		}
+	}
+} /* downsample_buckets */
+
+/*
+ * Largest-triangle-three-buckets (Steinarsson, 2013): keep the first and
+ * last data-points and select the data-point of each bucket in between which
+ * forms the largest triangle with the previously selected one and the average
+ * of the next bucket. Areas are summed up across all data-sources.
+ */
+static void
+downsample_lttb(const sdb_timeseries_t *ts, sdb_timeseries_t *res)
+{
+	size_t n = res->data_len, len = ts->data_len;
+	double every = (double)(len - 2) / (double)(n - 2);
+	double avg_t[ts->data_names_len], avg_v[ts->data_names_len];
+	size_t prev = 0, i, j, k;
+
+	copy_point(res, 0, ts, 0);
+	for (j = 0; j < n - 2; ++j) {
+		size_t start = (size_t)((double)j * every) + 1;
+		size_t end = (size_t)((double)(j + 1) * every) + 1;
+		size_t next_end = (size_t)((double)(j + 2) * every) + 1;
+		size_t best = start;
+		double max_area = -1.0;
+		double pt;
+
+		if (end > len - 1)
+			end = len - 1;
+		if (next_end > len)
+			next_end = len;
+
+		for (i = 0; i < ts->data_names_len; ++i) {
+			const double *data = ts->data[i];
+			double sum_t = 0.0, sum_v = 0.0;
+			size_t num = 0;
+
+			for (k = end; k < next_end; ++k) {
+				if (isnan(data[k]))
+					continue;
+				sum_t += SDB_TIME_TO_DOUBLE(ts->timestamps[k]
+						- ts->timestamps[0]);
+				sum_v += data[k];
+				++num;
+			}
+			avg_t[i] = num ? sum_t / (double)num : NAN;
+			avg_v[i] = num ? sum_v / (double)num : NAN;
+		}
+
+		pt = SDB_TIME_TO_DOUBLE(ts->timestamps[prev] - ts->timestamps[0]);
+		for (k = start; k < end; ++k) {
+			double kt = SDB_TIME_TO_DOUBLE(ts->timestamps[k]
+					- ts->timestamps[0]);
+			double area = 0.0;
+
+			for (i = 0; i < ts->data_names_len; ++i) {
+				const double *data = ts->data[i];
+				double a = fabs((pt - avg_t[i]) * (data[k] - data[prev])
+						- (pt - kt) * (avg_v[i] - data[prev]));
+
+				/* NaN values do not contribute */
+				if (! isnan(a))
+					area += a;
+			}
+			if (area > max_area) {
+				max_area = area;
+				best = k;
+			}
+		}
+
+		copy_point(res, j + 1, ts, best);
+		prev = best;
+	}
+	copy_point(res, n - 1, ts, len - 1);
+} /* downsample_lttb */
+
+/*
+ * Determine the coarsest average interval between consecutive data-points of
+ * any of the time-series and the overall start and end times.
+ */
+static sdb_time_t
+aggregate_range(const sdb_timeseries_t * const *ts, size_t ts_num,
+		sdb_time_t *start, sdb_time_t *end)
+{
+	sdb_time_t step = 0;
+	bool found = 0;
+	size_t i;
+
+	for (i = 0; i < ts_num; ++i) {
+		const sdb_time_t *timestamps;
+
+		if (! ts[i])
+			continue;
+
+		if ((! found) || (ts[i]->start < *start))
+			*start = ts[i]->start;
+		if ((! found) || (ts[i]->end > *end))
+			*end = ts[i]->end;
+		found = 1;
+
+		if (ts[i]->data_len < 2)
+			continue;
+		timestamps = ts[i]->timestamps;
+		if (timestamps[ts[i]->data_len - 1] > timestamps[0]) {
+			sdb_time_t s = (timestamps[ts[i]->data_len - 1]
+					- timestamps[0]) / (sdb_time_t)(ts[i]->data_len - 1);
+			if (s > step)
+				step = s;
+		}
+	}
+	return step;
+} /* aggregate_range */
+
+/*
+ * Average all data-points of a data-source falling into the same interval
+ * and store them in 'row'.
+ */
+static void
+aggregate_resample(const sdb_time_t *timestamps, const double *data,
+		size_t len, sdb_time_t first, sdb_time_t step,
+		double *row, double *num, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; ++i) {
+		row[i] = 0.0;
+		num[i] = 0.0;
+	}
+	for (i = 0; i < len; ++i) {
+		size_t k;
+
+		if ((timestamps[i] < first) || isnan(data[i]))
+			continue;
+		k = (size_t)((timestamps[i] - first) / step);
+		if (k >= n)
+			continue;
+		row[k] += data[i];
+		num[k] += 1.0;
+	}
+	for (i = 0; i < n; ++i)
+		row[i] = (num[i] > 0.0) ? row[i] / num[i] : NAN;
+} /* aggregate_resample */
+
+static int
+cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x < y) ? -1 : (x > y) ? 1 : 0;
+} /* cmp_double */
+
+/*
+ * Aggregate 'rows' contiguous rows of 'n' values each into 'res'. The loops
+ * walk the rows sequentially and avoid branches such that the compiler is
+ * able to vectorize them. 'tmp' has to provide space for 'n' + 'rows'
+ * values.
+ */
+static void
+aggregate_rows(const double *values, size_t rows, size_t n,
+		int function, double percentile, double *res, double *tmp)
+{
+	double *num = tmp;
+	size_t i, k;
+
+	for (k = 0; k < n; ++k) {
+		num[k] = 0.0;
+		if (function == SDB_TIMESERIES_AGGR_MIN)
+			res[k] = INFINITY;
+		else if (function == SDB_TIMESERIES_AGGR_MAX)
+			res[k] = -INFINITY;
+		else
+			res[k] = 0.0;
+	}
+
+	if (function == SDB_TIMESERIES_AGGR_PERCENTILE) {
+		double *column = tmp + n;
+
+		for (k = 0; k < n; ++k) {
+			size_t m = 0;
+			double rank;
+
+			for (i = 0; i < rows; ++i) {
+				double v = values[i * n + k];
+				if (! isnan(v))
+					column[m++] = v;
+			}
+			if (! m) {
+				res[k] = NAN;
+				continue;
+			}
+
+			/* linear interpolation between the closest ranks */
+			qsort(column, m, sizeof(*column), cmp_double);
+			rank = percentile / 100.0 * (double)(m - 1);
+			i = (size_t)rank;
+			res[k] = column[i];
+			if (i + 1 < m)
+				res[k] += (rank - (double)i) * (column[i + 1] - column[i]);
+		}
+		return;
+	}
+
+	for (i = 0; i < rows; ++i) {
+		const double *row = values + i * n;
+
+		if (function == SDB_TIMESERIES_AGGR_MIN) {
+			for (k = 0; k < n; ++k) {
+				double v = row[k];
+				/* comparisons involving NaN are always false */
+				res[k] = (v < res[k]) ? v : res[k];
+				num[k] += isnan(v) ? 0.0 : 1.0;
+			}
+		}
+		else if (function == SDB_TIMESERIES_AGGR_MAX) {
+			for (k = 0; k < n; ++k) {
+				double v = row[k];
+				res[k] = (v > res[k]) ? v : res[k];
+				num[k] += isnan(v) ? 0.0 : 1.0;
+			}
+		}
+		else {
+			for (k = 0; k < n; ++k) {
+				double v = row[k];
+				res[k] += isnan(v) ? 0.0 : v;
+				num[k] += isnan(v) ? 0.0 : 1.0;
+			}
+		}
+	}
+
+	for (k = 0; k < n; ++k) {
+		if (num[k] <= 0.0)
+			res[k] = NAN;
+		else if (function == SDB_TIMESERIES_AGGR_AVG)
+			res[k] /= num[k];
+	}
+} /* aggregate_rows */
+
 /*
  * public API
  */
@@ -73,6 +386,7 @@ sdb_timeseries_create(size_t data_names_len, const char * const *data_names,
 		size_t data_len)
 {
 	sdb_timeseries_t *ts;
+	double *values;
 	size_t i;
 
 	ts = calloc(1, sizeof(*ts));
@@ -85,18 +399,19 @@ sdb_timeseries_create(size_t data_names_len, const char * const *data_names,
 		return NULL;
 	}
 
-	ts->data = calloc(data_names_len, sizeof(*ts->data));
+	/* a single (never empty) chunk of memory holding the pointers to the
+	 * values of each data-source, the time-stamps, and the values */
+	ts->data = calloc(1, data_names_len * sizeof(*ts->data)
+			+ data_len * sizeof(*ts->timestamps)
+			+ data_names_len * data_len * sizeof(**ts->data) + 1);
 	if (! ts->data) {
 		sdb_timeseries_destroy(ts);
 		return NULL;
 	}
-	for (i = 0; i < data_names_len; ++i) {
-		ts->data[i] = calloc(data_len, sizeof(**ts->data));
-		if (! ts->data[i]) {
-			sdb_timeseries_destroy(ts);
-			return NULL;
-		}
-	}
+	ts->timestamps = (sdb_time_t *)(ts->data + data_names_len);
+	values = (double *)(ts->timestamps + data_len);
+	for (i = 0; i < data_names_len; ++i)
+		ts->data[i] = values + i * data_len;
 	ts->data_len = data_len;
 	return ts;
 } /* sdb_timeseries_create */
@@ -104,26 +419,198 @@ sdb_timeseries_create(size_t data_names_len, const char * const *data_names,
 void
 sdb_timeseries_destroy(sdb_timeseries_t *ts)
 {
-	size_t i;
-
 	if (! ts)
 		return;
 
-	if (ts->data) {
-		for (i = 0; i < ts->data_names_len; ++i) {
-			if (ts->data[i])
-				free(ts->data[i]);
-			ts->data[i] = NULL;
-		}
+	/* time-stamps and values are part of the same allocation */
+	if (ts->data)
 		free(ts->data);
-	}
 	ts->data = NULL;
+	ts->timestamps = NULL;
 	ts->data_len = 0;
 
 	stringv_free(&ts->data_names, &ts->data_names_len);
 	free(ts);
 } /* sdb_timeseries_destroy */
 
+int
+sdb_timeseries_parse_downsample(const char *name)
+{
+	if (! name)
+		return -1;
+
+	if (! strcasecmp(name, "avg"))
+		return SDB_TIMESERIES_AVERAGE;
+	else if (! strcasecmp(name, "min"))
+		return SDB_TIMESERIES_MIN;
+	else if (! strcasecmp(name, "max"))
+		return SDB_TIMESERIES_MAX;
+	else if (! strcasecmp(name, "lttb"))
+		return SDB_TIMESERIES_LTTB;
+	return -1;
+} /* sdb_timeseries_parse_downsample */
+
+sdb_timeseries_t *
+sdb_timeseries_downsample(const sdb_timeseries_t *ts,
+		const sdb_timeseries_opts_t *opts)
+{
+	sdb_timeseries_t *res;
+	int method;
+	size_t n;
+
+	if ((! ts) || (! opts))
+		return NULL;
+
+	method = opts->downsample;
+	if ((method < SDB_TIMESERIES_AVERAGE) || (method > SDB_TIMESERIES_LTTB))
+		return NULL;
+
+	n = downsample_points(ts, opts);
+	if ((! n) || (n > ts->data_len))
+		n = ts->data_len;
+	/* LTTB always keeps the first and last data-point */
+	if ((method == SDB_TIMESERIES_LTTB) && (n < 3))
+		method = SDB_TIMESERIES_AVERAGE;
+
+	res = sdb_timeseries_create(ts->data_names_len,
+			(const char * const *)ts->data_names, n);
+	if (! res)
+		return NULL;
+	res->start = ts->start;
+	res->end = ts->end;
+
+	if (n == ts->data_len) {
+		size_t i;
+		memcpy(res->timestamps, ts->timestamps, n * sizeof(*ts->timestamps));
+		for (i = 0; i < ts->data_names_len; ++i)
+			memcpy(res->data[i], ts->data[i], n * sizeof(*ts->data[i]));
+	}
+	else if (method == SDB_TIMESERIES_LTTB)
+		downsample_lttb(ts, res);
+	else
+		downsample_buckets(ts, res, method);
+	return res;
+} /* sdb_timeseries_downsample */
+
+int
+sdb_timeseries_parse_aggregate(const char *name, double *percentile)
+{
+	double p = 0.0;
+	int f = -1;
+
+	if (! name)
+		return -1;
+
+	if (! strcasecmp(name, "sum"))
+		f = SDB_TIMESERIES_AGGR_SUM;
+	else if (! strcasecmp(name, "avg"))
+		f = SDB_TIMESERIES_AGGR_AVG;
+	else if (! strcasecmp(name, "min"))
+		f = SDB_TIMESERIES_AGGR_MIN;
+	else if (! strcasecmp(name, "max"))
+		f = SDB_TIMESERIES_AGGR_MAX;
+	else if (! strcasecmp(name, "median")) {
+		f = SDB_TIMESERIES_AGGR_PERCENTILE;
+		p = 50.0;
+	}
+	else if (((name[0] == 'p') || (name[0] == 'P'))
+			&& isdigit((int)name[1])) {
+		char *endptr = NULL;
+
+		p = strtod(name + 1, &endptr);
+		if (*endptr || (p > 100.0))
+			return -1;
+		f = SDB_TIMESERIES_AGGR_PERCENTILE;
+	}
+
+	if ((f >= 0) && percentile)
+		*percentile = p;
+	return f;
+} /* sdb_timeseries_parse_aggregate */
+
+sdb_timeseries_t *
+sdb_timeseries_aggregate(const sdb_timeseries_t * const *ts, size_t ts_num,
+		int function, double percentile, sdb_time_t step)
+{
+	const sdb_timeseries_t *base = NULL;
+	sdb_timeseries_t *res;
+	sdb_time_t start = 0, end = 0, first, native;
+	double *values, *tmp;
+	size_t n, i, j, k;
+
+	if ((! ts) || (function <= SDB_TIMESERIES_AGGR_NONE)
+			|| (function > SDB_TIMESERIES_AGGR_PERCENTILE))
+		return NULL;
+	if ((function == SDB_TIMESERIES_AGGR_PERCENTILE)
+			&& ((percentile < 0.0) || (percentile > 100.0)))
+		return NULL;
+
+	for (i = 0; i < ts_num; ++i) {
+		if (ts[i]) {
+			base = ts[i];
+			break;
+		}
+	}
+	if (! base)
+		return NULL;
+
+	/* never resample below the resolution of the input */
+	native = aggregate_range(ts, ts_num, &start, &end);
+	if (step < native)
+		step = native;
+	if (! step)
+		step = (end > start) ? end - start : 1;
+	/* bound the size of the result, in particular if there is no native
+	 * step (no time-series with more than one data-point) */
+	if ((end - start) / step >= SDB_TIMESERIES_AGGR_MAX_POINTS - 2)
+		step = (end - start) / (SDB_TIMESERIES_AGGR_MAX_POINTS - 2) + 1;
+
+	first = start - start % step;
+	n = (size_t)((end - first) / step) + 1;
+
+	res = sdb_timeseries_create(base->data_names_len,
+			(const char * const *)base->data_names, n);
+	if (! res)
+		return NULL;
+	res->start = start;
+	res->end = end;
+
+	/* one row of values per time-series followed by scratch space */
+	values = calloc((ts_num + 1) * n + ts_num, sizeof(*values));
+	if (! values) {
+		sdb_timeseries_destroy(res);
+		return NULL;
+	}
+	tmp = values + ts_num * n;
+
+	for (k = 0; k < n; ++k)
+		res->timestamps[k] = first + (sdb_time_t)k * step;
+
+	for (i = 0; i < base->data_names_len; ++i) {
+		size_t rows = 0;
+
+		for (j = 0; j < ts_num; ++j) {
+			if (! ts[j])
+				continue;
+			for (k = 0; k < ts[j]->data_names_len; ++k)
+				if (! strcmp(ts[j]->data_names[k], base->data_names[i]))
+					break;
+			if (k >= ts[j]->data_names_len)
+				continue;
+
+			aggregate_resample(ts[j]->timestamps, ts[j]->data[k],
+					ts[j]->data_len, first, step, values + rows * n, tmp, n);
+			++rows;
+		}
+
+		aggregate_rows(values, rows, n, function, percentile,
+				res->data[i], tmp);
+	}
+
+	free(values);
+	return res;
+} /* sdb_timeseries_aggregate */
+
 int
 sdb_timeseries_tojson(sdb_timeseries_t *ts, sdb_strbuf_t *buf)
 {
@@ -153,17 +640,17 @@ sdb_timeseries_tojson(sdb_timeseries_t *ts, sdb_strbuf_t *buf)
 		for (j = 0; j < ts->data_len; ++j) {
 			char time_str[64];
 
-			if (! sdb_strftime(time_str, sizeof(time_str), ts->data[i][j].timestamp))
+			if (! sdb_strftime(time_str, sizeof(time_str), ts->timestamps[j]))
 				snprintf(time_str, sizeof(time_str), "<error>");
 			time_str[sizeof(time_str) - 1] = '\0';
 
 			/* Some GNU libc versions may print '-nan' which we dont' want */
-			if (isnan(ts->data[i][j].value))
+			if (isnan(ts->data[i][j]))
 				sdb_strbuf_append(buf, "{\"timestamp\": \"%s\", "
 						"\"value\": \"nan\"}", time_str);
 			else
 				sdb_strbuf_append(buf, "{\"timestamp\": \"%s\", "
-						"\"value\": \"%f\"}", time_str, ts->data[i][j].value);
+						"\"value\": \"%f\"}", time_str, ts->data[i][j]);
 
 			if (j < ts->data_len - 1)
 				sdb_strbuf_append(buf, ",");
@@ -35,7 +35,10 @@
 #include "frontend/connection.h"
 
 #include "core/object.h"
+#include "core/store.h"
 #include "core/timeseries.h"
+#include "utils/compress.h"
+#include "utils/llist.h"
 #include "utils/ssl.h"
 #include "utils/strbuf.h"
 
@@ -77,6 +80,30 @@ struct sdb_conn {
 
 	sdb_strbuf_t *errbuf;
 
+	/* connection settings (see SDB_CONNECTION_SET_OPTION) */
+	uint32_t result_format;
+
+	/* compression context (NULL if disabled) and scratch buffers holding
+	 * decompressed commands and compressed replies respectively */
+	sdb_compress_t *compress;
+	sdb_strbuf_t *inflated;
+	sdb_strbuf_t *deflated;
+
+	/* prepared statements (see SDB_CONNECTION_PREPARE) named by their
+	 * decimal identifier */
+	sdb_llist_t *prepared;
+
+	/* subscriptions (see SDB_CONNECTION_WATCH) named by their decimal
+	 * identifier; pending events are signaled by writing to 'notify_fd'
+	 * (if it's not negative) */
+	sdb_llist_t *watches;
+	int notify_fd;
+
+	/* replication (see SDB_CONNECTION_REPLICATE): position of the last
+	 * entry sent to the replica */
+	bool replicating;
+	sdb_store_repl_pos_t repl_pos;
+
 	/* user information */
 	char *username; /* NULL if the user has not been authenticated */
 	bool  ready; /* indicates that startup finished successfully */
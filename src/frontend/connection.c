@@ -68,6 +68,11 @@ static bool          conn_ctx_key_initialized = 0;
 #define CONN_FD_PREFIX "conn#"
 #define CONN_FD_PLACEHOLDER "XXXXXXX"
 
+/* bounds of the amount of data read from a connection at once; the read size
+ * is doubled (up to the max) whenever a read filled the whole request */
+#define CONN_READ_MIN 1024
+#define CONN_READ_MAX (64 * 1024)
+
 static ssize_t
 conn_read(sdb_conn_t *conn, size_t len)
 {
@@ -145,6 +150,13 @@ connection_init(sdb_object_t *obj, va_list ap)
 	conn->cmd = SDB_CONNECTION_IDLE;
 	conn->cmd_len = 0;
 	conn->skip_len = 0;
+
+	conn->result_format = SDB_CONNECTION_RESULT_JSON;
+	conn->compress = NULL;
+	conn->notify_fd = -1;
+
+	conn->replicating = 0;
+	conn->repl_pos = (sdb_store_repl_pos_t)SDB_STORE_REPL_POS_INIT;
 	return 0;
 } /* connection_init */
 
@@ -159,6 +171,10 @@ connection_destroy(sdb_object_t *obj)
 
 	conn->ready = 0;
 
+	/* subscriptions reference the connection's event queues and have to be
+	 * canceled before the store may send any further updates */
+	sdb_conn_watch_clear(conn);
+
 	if (conn->finish)
 		conn->finish(conn);
 	conn->finish = NULL;
@@ -192,6 +208,17 @@ connection_destroy(sdb_object_t *obj)
 	conn->buf = NULL;
 	sdb_strbuf_destroy(conn->errbuf);
 	conn->errbuf = NULL;
+	sdb_llist_destroy(conn->prepared);
+	conn->prepared = NULL;
+	free(conn->repl_pos.copy_key);
+	conn->repl_pos.copy_key = NULL;
+
+	sdb_compress_destroy(conn->compress);
+	conn->compress = NULL;
+	sdb_strbuf_destroy(conn->inflated);
+	conn->inflated = NULL;
+	sdb_strbuf_destroy(conn->deflated);
+	conn->deflated = NULL;
 } /* connection_destroy */
 
 static sdb_type_t connection_type = {
@@ -306,7 +333,19 @@ command_handle(sdb_conn_t *conn)
 		status = sdb_conn_lookup(conn);
 	else if (conn->cmd == SDB_CONNECTION_STORE)
 		status = sdb_conn_store(conn);
-
+	else if (conn->cmd == SDB_CONNECTION_STORE_BATCH)
+		status = sdb_conn_store_batch(conn);
+	else if (conn->cmd == SDB_CONNECTION_PREPARE)
+		status = sdb_conn_prepare(conn);
+	else if (conn->cmd == SDB_CONNECTION_EXECUTE)
+		status = sdb_conn_execute(conn);
+	else if (conn->cmd == SDB_CONNECTION_WATCH)
+		status = sdb_conn_watch(conn);
+	else if (conn->cmd == SDB_CONNECTION_REPLICATE)
+		status = sdb_conn_replicate(conn);
+
+	else if (conn->cmd == SDB_CONNECTION_SET_OPTION)
+		status = sdb_connection_set_option(conn);
 	else if (conn->cmd == SDB_CONNECTION_SERVER_VERSION)
 		status = sdb_connection_server_version(conn);
 
@@ -327,6 +366,56 @@ command_handle(sdb_conn_t *conn)
 	return status;
 } /* command_handle */
 
+/* decompress the current command and handle it as if it had been sent
+ * uncompressed */
+static int
+command_handle_compressed(sdb_conn_t *conn)
+{
+	sdb_strbuf_t *buf;
+	uint32_t cmd, cmd_len;
+	int status;
+
+	assert(conn && (conn->cmd == SDB_CONNECTION_COMPRESSED));
+
+	if (! conn->compress) {
+		sdb_strbuf_sprintf(conn->errbuf, "Compression not enabled");
+		sdb_connection_send(conn, SDB_CONNECTION_ERROR,
+				(uint32_t)sdb_strbuf_len(conn->errbuf),
+				sdb_strbuf_string(conn->errbuf));
+		return -1;
+	}
+
+	sdb_strbuf_clear(conn->inflated);
+	if ((sdb_decompress_message(conn->compress, sdb_strbuf_string(conn->buf),
+					conn->cmd_len, &cmd, conn->inflated) < 0)
+			|| (cmd == SDB_CONNECTION_IDLE)
+			|| (cmd == SDB_CONNECTION_COMPRESSED)) {
+		/* the compressed stream is out of sync; there's no way to recover */
+		sdb_strbuf_sprintf(conn->errbuf, "Invalid compressed message");
+		sdb_connection_send(conn, SDB_CONNECTION_ERROR,
+				(uint32_t)sdb_strbuf_len(conn->errbuf),
+				sdb_strbuf_string(conn->errbuf));
+		sdb_connection_close(conn);
+		return -1;
+	}
+
+	/* swap in the decompressed command */
+	buf = conn->buf;
+	cmd_len = conn->cmd_len;
+	conn->buf = conn->inflated;
+	conn->inflated = buf;
+	conn->cmd = cmd;
+	conn->cmd_len = (uint32_t)sdb_strbuf_len(conn->buf);
+
+	status = command_handle(conn);
+
+	conn->inflated = conn->buf;
+	conn->buf = buf;
+	conn->cmd = SDB_CONNECTION_COMPRESSED;
+	conn->cmd_len = cmd_len;
+	return status;
+} /* command_handle_compressed */
+
 /* initialize the connection state information */
 static int
 command_init(sdb_conn_t *conn)
@@ -370,23 +459,33 @@ command_init(sdb_conn_t *conn)
 	return 0;
 } /* command_init */
 
-/* returns negative value on error, 0 on EOF, number of octets else */
+/* returns negative value on error, 0 on EOF, number of octets else; if no
+ * data is available, a negative value is returned and errno is set to
+ * EAGAIN */
 static ssize_t
 connection_read(sdb_conn_t *conn)
 {
+	size_t read_size = CONN_READ_MIN;
 	ssize_t n = 0;
 
-	if ((! conn) || (conn->fd < 0))
+	if ((! conn) || (conn->fd < 0)) {
+		errno = EBADF;
 		return -1;
+	}
 
 	while (42) {
 		ssize_t status;
 
 		errno = 0;
-		status = conn->read(conn, 1024);
+		status = conn->read(conn, read_size);
 		if (status < 0) {
-			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+				if (! n) {
+					errno = EAGAIN;
+					return -1;
+				}
 				break;
+			}
 
 			sdb_connection_close(conn);
 			return (int)status;
@@ -402,6 +501,8 @@ connection_read(sdb_conn_t *conn)
 		}
 
 		n += status;
+		if (((size_t)status == read_size) && (read_size < CONN_READ_MAX))
+			read_size *= 2;
 
 		/* give the main loop a chance to execute commands (and free up buffer
 		 * space) on large amounts of incoming traffic */
@@ -412,6 +513,37 @@ connection_read(sdb_conn_t *conn)
 	return n;
 } /* connection_read */
 
+/* handle all complete commands available in the input buffer; pipelined
+ * commands are processed back-to-back without waiting for further input */
+static void
+connection_process(sdb_conn_t *conn)
+{
+	while (conn->fd >= 0) {
+		if ((conn->cmd == SDB_CONNECTION_IDLE) && (! conn->cmd_len)) {
+			if (sdb_strbuf_len(conn->buf) < 2 * sizeof(int32_t))
+				break;
+			if (command_init(conn))
+				break;
+			/* the command might have been rejected and skipped */
+			continue;
+		}
+
+		if (sdb_strbuf_len(conn->buf) < conn->cmd_len)
+			break;
+
+		if (conn->cmd == SDB_CONNECTION_COMPRESSED)
+			command_handle_compressed(conn);
+		else
+			command_handle(conn);
+
+		/* remove the command from the buffer */
+		if (conn->cmd_len)
+			sdb_strbuf_skip(conn->buf, 0, conn->cmd_len);
+		conn->cmd = SDB_CONNECTION_IDLE;
+		conn->cmd_len = 0;
+	}
+} /* connection_process */
+
 /*
  * public API
  */
@@ -479,25 +611,15 @@ ssize_t
 sdb_connection_handle(sdb_conn_t *conn)
 {
 	ssize_t n = 0;
+	bool again = 0;
 
 	sdb_conn_set_ctx(conn);
 
 	while (42) {
 		ssize_t status = connection_read(conn);
 
-		if ((conn->cmd == SDB_CONNECTION_IDLE) && (! conn->cmd_len)
-				&& (sdb_strbuf_len(conn->buf) >= 2 * sizeof(int32_t)))
-			command_init(conn);
-		if ((conn->cmd != SDB_CONNECTION_IDLE)
-				&& (sdb_strbuf_len(conn->buf) >= conn->cmd_len)) {
-			command_handle(conn);
-
-			/* remove the command from the buffer */
-			if (conn->cmd_len)
-				sdb_strbuf_skip(conn->buf, 0, conn->cmd_len);
-			conn->cmd = SDB_CONNECTION_IDLE;
-			conn->cmd_len = 0;
-		}
+		again = (status < 0) && (errno == EAGAIN);
+		connection_process(conn);
 
 		if (status <= 0)
 			break;
@@ -505,7 +627,16 @@ sdb_connection_handle(sdb_conn_t *conn)
 		n += status;
 	}
 
+	/* send any events queued while waiting for or handling commands and
+	 * any new entries of the replication stream */
+	sdb_conn_watch_flush(conn);
+	sdb_conn_replicate_flush(conn);
+
 	sdb_conn_set_ctx(NULL);
+	if ((! n) && again && (conn->fd >= 0)) {
+		errno = EAGAIN;
+		return -1;
+	}
 	return n;
 } /* sdb_connection_handle */
 
@@ -513,15 +644,26 @@ ssize_t
 sdb_connection_send(sdb_conn_t *conn, uint32_t code,
 		uint32_t msg_len, const char *msg)
 {
-	char buf[2 * sizeof(uint32_t) + msg_len];
 	ssize_t status;
 
 	if ((! conn) || (conn->fd < 0))
 		return -1;
-	if (sdb_proto_marshal(buf, sizeof(buf), code, msg_len, msg) < 0)
-		return -1;
 
-	status = conn->write(conn, buf, sizeof(buf));
+	if (conn->compress && (msg_len >= SDB_COMPRESS_MIN_SIZE)) {
+		sdb_strbuf_clear(conn->deflated);
+		if (sdb_compress_message(conn->compress, conn->deflated,
+					code, msg_len, msg) < 0)
+			return -1;
+		status = conn->write(conn, SDB_STRBUF_STR(conn->deflated));
+	}
+	else {
+		char buf[2 * sizeof(uint32_t) + msg_len];
+
+		if (sdb_proto_marshal(buf, sizeof(buf), code, msg_len, msg) < 0)
+			return -1;
+		status = conn->write(conn, buf, sizeof(buf));
+	}
+
 	if (status < 0) {
 		char errbuf[1024];
 
@@ -563,5 +705,70 @@ sdb_connection_server_version(sdb_conn_t *conn)
 	return 0;
 } /* sdb_connection_server_version */
 
+int
+sdb_connection_set_option(sdb_conn_t *conn)
+{
+	uint32_t opt, value;
+
+	if ((! conn) || (conn->cmd != SDB_CONNECTION_SET_OPTION))
+		return -1;
+
+	if (conn->cmd_len != 2 * sizeof(uint32_t)) {
+		sdb_strbuf_sprintf(conn->errbuf, "SET_OPTION: Invalid command "
+				"length %d", conn->cmd_len);
+		return -1;
+	}
+
+	sdb_proto_unmarshal_int32(SDB_STRBUF_STR(conn->buf), &opt);
+	sdb_proto_unmarshal_int32(sdb_strbuf_string(conn->buf) + sizeof(uint32_t),
+			sizeof(uint32_t), &value);
+
+	if (opt == SDB_CONNECTION_OPTION_RESULT_FORMAT) {
+		if ((value != SDB_CONNECTION_RESULT_JSON)
+				&& (value != SDB_CONNECTION_RESULT_BINARY)) {
+			sdb_strbuf_sprintf(conn->errbuf, "SET_OPTION: Unsupported "
+					"result format %u", value);
+			return -1;
+		}
+		conn->result_format = value;
+	}
+	else if (opt == SDB_CONNECTION_OPTION_COMPRESSION) {
+		sdb_compress_t *c = NULL;
+
+		if ((value != SDB_CONNECTION_COMPRESSION_NONE)
+				&& (! sdb_compress_supported(value))) {
+			sdb_strbuf_sprintf(conn->errbuf, "SET_OPTION: Unsupported "
+					"compression algorithm %u", value);
+			return -1;
+		}
+		if (value != SDB_CONNECTION_COMPRESSION_NONE) {
+			if (! conn->inflated)
+				conn->inflated = sdb_strbuf_create(1024);
+			if (! conn->deflated)
+				conn->deflated = sdb_strbuf_create(1024);
+			c = sdb_compress_create(value);
+			if ((! c) || (! conn->inflated) || (! conn->deflated)) {
+				sdb_compress_destroy(c);
+				sdb_strbuf_sprintf(conn->errbuf, "Out of memory");
+				return -1;
+			}
+		}
+
+		/* acknowledge before compressing any replies */
+		sdb_connection_send(conn, SDB_CONNECTION_OK, 0, NULL);
+		sdb_compress_destroy(conn->compress);
+		conn->compress = c;
+		return 0;
+	}
+	else {
+		sdb_strbuf_sprintf(conn->errbuf, "SET_OPTION: Unknown option %u",
+				opt);
+		return -1;
+	}
+
+	sdb_connection_send(conn, SDB_CONNECTION_OK, 0, NULL);
+	return 0;
+} /* sdb_connection_set_option */
+
 /* vim: set tw=78 sw=4 ts=4 noexpandtab : */
 
@@ -35,13 +35,20 @@
 #include "frontend/connection-private.h"
 #include "parser/ast.h"
 #include "parser/parser.h"
+#include "utils/channel.h"
 #include "utils/error.h"
+#include "utils/lru.h"
 #include "utils/proto.h"
 #include "utils/strbuf.h"
 
 #include <errno.h>
 #include <ctype.h>
+#include <inttypes.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+
+#include <pthread.h>
 
 /*
  * metric fetcher:
@@ -61,24 +68,33 @@ metric_fetcher_host(sdb_store_host_t __attribute__((unused)) *host,
 	return 0;
 } /* metric_fetcher_host */
 
-static int
-metric_fetcher_metric(sdb_store_metric_t *metric, sdb_object_t *user_data)
+/* Find the most up to date data store of a metric.
+ * TODO: Consider merging multiple results? */
+static size_t
+metric_latest_store(sdb_store_metric_t *metric)
 {
-	metric_store_t *st = SDB_OBJ_WRAPPER(user_data)->data;
 	sdb_time_t last_update = 0;
 	size_t idx = 0, i;
 
-	if (! metric->stores_num)
-		return -1;
-
-	/* Find the most up to date data store.
-	 * TODO: Consider merging multiple results? */
 	for (i = 0; i < metric->stores_num; ++i) {
 		if (metric->stores[i].last_update > last_update) {
 			last_update = metric->stores[i].last_update;
 			idx = i;
 		}
 	}
+	return idx;
+} /* metric_latest_store */
+
+static int
+metric_fetcher_metric(sdb_store_metric_t *metric, sdb_object_t *user_data)
+{
+	metric_store_t *st = SDB_OBJ_WRAPPER(user_data)->data;
+	size_t idx;
+
+	if (! metric->stores_num)
+		return -1;
+
+	idx = metric_latest_store(metric);
 	st->type = strdup(metric->stores[idx].type);
 	st->id = strdup(metric->stores[idx].id);
 	st->last_update = metric->stores[idx].last_update;
@@ -89,10 +105,295 @@ static sdb_store_writer_t metric_fetcher = {
 	metric_fetcher_host, NULL, metric_fetcher_metric, NULL,
 };
 
+/*
+ * result cache:
+ * Caches the serialized replies of FETCH, LIST, and LOOKUP queries. Entries
+ * are keyed by the user name, the result format, and the normalized query
+ * text and they are valid as long as the store generation of the queried
+ * scope does not change. Queries depending on the current time (i.e. the age
+ * of objects) are never cached.
+ */
+
+typedef struct {
+	sdb_object_t super;
+
+	/* the generation is tracked for this host or for all hosts if NULL */
+	char *hostname;
+	uint64_t generation;
+
+	uint32_t code;
+	char *data;
+	size_t data_len;
+} cache_entry_t;
+#define CACHE_ENTRY(obj) ((cache_entry_t *)(obj))
+
+static sdb_lru_t *result_cache = NULL;
+
+/* see the plan cache below */
+static sdb_lru_t *plan_cache = NULL;
+
+static int
+cache_entry_init(sdb_object_t *obj, va_list ap)
+{
+	cache_entry_t *entry = CACHE_ENTRY(obj);
+	const char *hostname = va_arg(ap, const char *);
+	sdb_strbuf_t *buf;
+
+	entry->generation = va_arg(ap, uint64_t);
+	entry->code = (uint32_t)va_arg(ap, int);
+	buf = va_arg(ap, sdb_strbuf_t *);
+
+	if (hostname && (! (entry->hostname = strdup(hostname))))
+		return -1;
+
+	entry->data_len = sdb_strbuf_len(buf);
+	entry->data = malloc(entry->data_len ? entry->data_len : 1);
+	if (! entry->data)
+		return -1;
+	memcpy(entry->data, sdb_strbuf_string(buf), entry->data_len);
+	return 0;
+} /* cache_entry_init */
+
+static void
+cache_entry_destroy(sdb_object_t *obj)
+{
+	cache_entry_t *entry = CACHE_ENTRY(obj);
+
+	if (entry->hostname)
+		free(entry->hostname);
+	if (entry->data)
+		free(entry->data);
+} /* cache_entry_destroy */
+
+static sdb_type_t cache_entry_type = {
+	/* size = */ sizeof(cache_entry_t),
+	/* init = */ cache_entry_init,
+	/* destroy = */ cache_entry_destroy,
+};
+
+static bool
+cache_entry_valid(sdb_object_t *obj)
+{
+	cache_entry_t *entry = CACHE_ENTRY(obj);
+	return sdb_plugin_query_generation(entry->hostname) == entry->generation;
+} /* cache_entry_valid */
+
+/*
+ * Normalize the query text for use as a cache key by collapsing all
+ * whitespace outside of string literals. Returns false for queries which are
+ * not suitable for caching, that is, queries including multiple statements
+ * or comments.
+ */
+static bool
+cache_normalize_query(sdb_strbuf_t *key, const char *query, size_t len)
+{
+	bool in_string = false, space = false, end = false;
+	size_t start = sdb_strbuf_len(key);
+	size_t i;
+
+	for (i = 0; i < len; ++i) {
+		char c = query[i];
+
+		if (! c)
+			break;
+
+		if (! in_string) {
+			if (isspace((int)c)) {
+				space = true;
+				continue;
+			}
+			if (end)
+				return false;
+			if (c == ';') {
+				end = true;
+				continue;
+			}
+			if ((i + 1 < len) && (((c == '-') && (query[i + 1] == '-'))
+						|| ((c == '/') && (query[i + 1] == '*'))))
+				return false;
+		}
+
+		if (c == '\'')
+			in_string = ! in_string;
+
+		if (space && (sdb_strbuf_len(key) > start))
+			sdb_strbuf_memappend(key, " ", 1);
+		space = false;
+		sdb_strbuf_memappend(key, &c, 1);
+	}
+	return ! in_string;
+} /* cache_normalize_query */
+
+/*
+ * Returns the normalized text of the current query or NULL if the query may
+ * not be cached. Only FETCH, LIST, and LOOKUP queries are cached.
+ */
+static sdb_strbuf_t *
+cache_query(sdb_conn_t *conn)
+{
+	const char *cmds[] = { "FETCH ", "LIST ", "LOOKUP " };
+	sdb_strbuf_t *query;
+	size_t i;
+
+	if ((! result_cache) && (! plan_cache))
+		return NULL;
+
+	query = sdb_strbuf_create(conn->cmd_len + 1);
+	if (! query)
+		return NULL;
+
+	if (! cache_normalize_query(query, sdb_strbuf_string(conn->buf),
+				conn->cmd_len)) {
+		sdb_strbuf_destroy(query);
+		return NULL;
+	}
+
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(cmds); ++i)
+		if (! strncasecmp(sdb_strbuf_string(query), cmds[i], strlen(cmds[i])))
+			return query;
+
+	sdb_strbuf_destroy(query);
+	return NULL;
+} /* cache_query */
+
+/*
+ * Returns the result cache key for the specified normalized query or NULL if
+ * the result may not be cached.
+ */
+static sdb_strbuf_t *
+cache_key(sdb_conn_t *conn, sdb_strbuf_t *query)
+{
+	sdb_strbuf_t *key;
+
+	if ((! result_cache) || (! query))
+		return NULL;
+
+	key = sdb_strbuf_create(sdb_strbuf_len(query) + 64);
+	if (! key)
+		return NULL;
+
+	sdb_strbuf_append(key, "%s\n%"PRIu32"\n%s",
+			conn->username ? conn->username : "", conn->result_format,
+			sdb_strbuf_string(query));
+	return key;
+} /* cache_key */
+
+/* Returns the host the query is restricted to or NULL if any. */
+static const char *
+cache_scope(sdb_ast_node_t *ast)
+{
+	if (ast->type != SDB_AST_TYPE_FETCH)
+		return NULL;
+	if (SDB_AST_FETCH(ast)->obj_type == SDB_HOST)
+		return SDB_AST_FETCH(ast)->name;
+	return SDB_AST_FETCH(ast)->hostname;
+} /* cache_scope */
+
+/*
+ * Returns true if the specified expression depends on the current time, that
+ * is, if it references the age of objects. The result of such an expression
+ * changes without any updates to the store.
+ */
+static bool
+cache_time_dependent(sdb_ast_node_t *node)
+{
+	if (! node)
+		return false;
+
+	switch (node->type) {
+	case SDB_AST_TYPE_FETCH:
+		return cache_time_dependent(SDB_AST_FETCH(node)->filter);
+	case SDB_AST_TYPE_LIST:
+		return cache_time_dependent(SDB_AST_LIST(node)->filter);
+	case SDB_AST_TYPE_LOOKUP:
+		return cache_time_dependent(SDB_AST_LOOKUP(node)->matcher)
+			|| cache_time_dependent(SDB_AST_LOOKUP(node)->filter);
+	case SDB_AST_TYPE_OPERATOR:
+		return cache_time_dependent(SDB_AST_OP(node)->left)
+			|| cache_time_dependent(SDB_AST_OP(node)->right);
+	case SDB_AST_TYPE_ITERATOR:
+		return cache_time_dependent(SDB_AST_ITER(node)->iter)
+			|| cache_time_dependent(SDB_AST_ITER(node)->expr);
+	case SDB_AST_TYPE_TYPED:
+		return cache_time_dependent(SDB_AST_TYPED(node)->expr);
+	case SDB_AST_TYPE_VALUE:
+		return SDB_AST_VALUE(node)->type == SDB_FIELD_AGE;
+	}
+	return false;
+} /* cache_time_dependent */
+
 /*
  * private helper functions
  */
 
+/*
+ * prepared statements:
+ * Queries prepared using SDB_CONNECTION_PREPARE are stored with the
+ * connection, named by their decimal statement identifier.
+ */
+
+/* maximum number of prepared statements per connection */
+#define MAX_PREPARED 64
+
+typedef struct {
+	sdb_object_t super;
+	sdb_ast_node_t *ast;
+	sdb_object_t *prepared;
+} stmt_t;
+#define STMT(obj) ((stmt_t *)(obj))
+
+static int
+stmt_init(sdb_object_t *obj, va_list ap)
+{
+	STMT(obj)->ast = va_arg(ap, sdb_ast_node_t *);
+	STMT(obj)->prepared = va_arg(ap, sdb_object_t *);
+
+	sdb_object_ref(SDB_OBJ(STMT(obj)->ast));
+	sdb_object_ref(STMT(obj)->prepared);
+	return 0;
+} /* stmt_init */
+
+static void
+stmt_destroy(sdb_object_t *obj)
+{
+	sdb_object_deref(SDB_OBJ(STMT(obj)->ast));
+	sdb_object_deref(STMT(obj)->prepared);
+} /* stmt_destroy */
+
+static sdb_type_t stmt_type = {
+	/* size = */ sizeof(stmt_t),
+	/* init = */ stmt_init,
+	/* destroy = */ stmt_destroy,
+};
+
+/*
+ * plan cache:
+ * Caches parsed and prepared FETCH, LIST, and LOOKUP queries shared by all
+ * connections. Entries are statement objects keyed by the normalized query
+ * text (see cache_query). They remain valid until the cache is reconfigured.
+ */
+
+/*
+ * Prepare the specified query and add it to the plan cache. Returns a new
+ * reference to the prepared query or NULL on error.
+ */
+static sdb_object_t *
+plan_prepare(const char *query, sdb_ast_node_t *ast, sdb_strbuf_t *errbuf)
+{
+	sdb_object_t *prepared, *stmt;
+
+	prepared = sdb_plugin_prepare_query(ast, errbuf);
+	if (! prepared)
+		return NULL;
+
+	/* failing to cache the plan is not an error */
+	stmt = sdb_object_create(query, stmt_type, ast, prepared);
+	if (stmt)
+		sdb_lru_insert(plan_cache, stmt);
+	sdb_object_deref(stmt);
+	return prepared;
+} /* plan_prepare */
+
 static char *
 sstrdup(const char *s)
 {
@@ -105,10 +406,18 @@ sstrlen(const char *s)
 	return s ? strlen(s) : 0;
 } /* sstrlen */
 
+/*
+ * Execute a FETCH, LIST, or LOOKUP query. If 'prepared' is NULL, the query
+ * will be prepared from 'ast' first; else, the parameters will be bound to
+ * the prepared query which has to match 'ast'.
+ */
 static int
-exec_query(sdb_ast_node_t *ast, sdb_strbuf_t *buf, sdb_strbuf_t *errbuf)
+exec_query(sdb_ast_node_t *ast, sdb_object_t *prepared,
+		const sdb_data_t *params, size_t params_num, uint32_t format,
+		sdb_strbuf_t *buf, sdb_strbuf_t *errbuf)
 {
-	sdb_store_json_formatter_t *f;
+	sdb_store_json_formatter_t *f = NULL;
+	sdb_store_binary_formatter_t *b = NULL;
 	int type = 0, flags = 0;
 	uint32_t res_type = 0;
 	int status;
@@ -121,6 +430,9 @@ exec_query(sdb_ast_node_t *ast, sdb_strbuf_t *buf, sdb_strbuf_t *errbuf)
 	case SDB_AST_TYPE_LIST:
 		type = SDB_AST_LIST(ast)->obj_type;
 		flags = SDB_WANT_ARRAY;
+		/* let clients determine where to continue from */
+		if (SDB_AST_LIST(ast)->since >= 0)
+			flags |= SDB_WANT_SEQUENCE;
 		res_type = htonl(SDB_CONNECTION_LIST);
 		break;
 	case SDB_AST_TYPE_LOOKUP:
@@ -134,14 +446,34 @@ exec_query(sdb_ast_node_t *ast, sdb_strbuf_t *buf, sdb_strbuf_t *errbuf)
 		return -1;
 	}
 
-	f = sdb_store_json_formatter(buf, type, flags);
+	if (prepared)
+		sdb_object_ref(prepared);
+	else if (! (prepared = sdb_plugin_prepare_query(ast, errbuf)))
+		return -1;
+
 	sdb_strbuf_memcpy(buf, &res_type, sizeof(res_type));
-	status = sdb_plugin_query(ast, &sdb_store_json_writer, SDB_OBJ(f),
+
+	if (format == SDB_CONNECTION_RESULT_BINARY) {
+		b = sdb_store_binary_formatter(buf);
+		status = sdb_plugin_execute_query(prepared, params, params_num,
+				&sdb_store_binary_writer, SDB_OBJ(b),
+				&(sdb_query_opts_t){ true }, errbuf);
+		if (status < 0)
+			sdb_strbuf_clear(buf);
+		sdb_object_deref(SDB_OBJ(b));
+		sdb_object_deref(prepared);
+		return status;
+	}
+
+	f = sdb_store_json_formatter(buf, type, flags);
+	status = sdb_plugin_execute_query(prepared, params, params_num,
+			&sdb_store_json_writer, SDB_OBJ(f),
 			&(sdb_query_opts_t){ true }, errbuf);
 	if (status < 0)
 		sdb_strbuf_clear(buf);
 	sdb_store_json_finish(f);
 	sdb_object_deref(SDB_OBJ(f));
+	sdb_object_deref(prepared);
 	return status;
 } /* exec_query */
 
@@ -231,17 +563,517 @@ exec_store(sdb_ast_store_t *st, sdb_strbuf_t *buf, sdb_strbuf_t *errbuf)
 	return SDB_CONNECTION_OK;
 } /* exec_store */
 
+/*
+ * time-series cache:
+ * Caches time-series fetched from data-stores. Entries are keyed by the
+ * data-store type and identifier, the requested data sources, and the
+ * requested time range rounded down to multiples of the TTL, such that
+ * repeated requests for, say, the last hour share an entry. They are valid
+ * until their TTL expires.
+ */
+
+typedef struct {
+	sdb_object_t super;
+	sdb_time_t expires;
+	sdb_timeseries_t *series;
+} ts_entry_t;
+#define TS_ENTRY(obj) ((ts_entry_t *)(obj))
+
+static sdb_lru_t *ts_cache = NULL;
+static sdb_time_t ts_cache_ttl = 0;
+
+static int
+ts_entry_init(sdb_object_t *obj, va_list ap)
+{
+	TS_ENTRY(obj)->expires = va_arg(ap, sdb_time_t);
+	TS_ENTRY(obj)->series = va_arg(ap, sdb_timeseries_t *);
+	return 0;
+} /* ts_entry_init */
+
+static void
+ts_entry_destroy(sdb_object_t *obj)
+{
+	sdb_timeseries_destroy(TS_ENTRY(obj)->series);
+} /* ts_entry_destroy */
+
+static sdb_type_t ts_entry_type = {
+	/* size = */ sizeof(ts_entry_t),
+	/* init = */ ts_entry_init,
+	/* destroy = */ ts_entry_destroy,
+};
+
+static bool
+ts_entry_valid(sdb_object_t *obj)
+{
+	return sdb_gettime() < TS_ENTRY(obj)->expires;
+} /* ts_entry_valid */
+
+static void
+ts_cache_key(sdb_strbuf_t *key, const char *type, const char *id,
+		const sdb_timeseries_opts_t *opts)
+{
+	sdb_time_t start = opts->start, end = opts->end;
+	size_t i;
+
+	if (ts_cache_ttl) {
+		start -= start % ts_cache_ttl;
+		end -= end % ts_cache_ttl;
+	}
+
+	/* prefix all strings with their length to keep keys unambiguous */
+	sdb_strbuf_sprintf(key, "%zu:%s%zu:%s%"PRIsdbTIME"-%"PRIsdbTIME,
+			strlen(type), type, strlen(id), id, start, end);
+	for (i = 0; i < opts->data_names_len; ++i)
+		sdb_strbuf_append(key, ",%zu:%s",
+				strlen(opts->data_names[i]), opts->data_names[i]);
+
+	/* data-stores may use the downsampling options as a hint */
+	if (opts->resolution || opts->max_points)
+		sdb_strbuf_append(key, "/%"PRIsdbTIME",%zu,%d", opts->resolution,
+				opts->max_points, opts->downsample);
+} /* ts_cache_key */
+
+/*
+ * Fetch the specified time-series, looking it up from the cache first if
+ * enabled. Returns a new reference to a cache entry owning the time-series,
+ * which must not be modified, or NULL on error.
+ */
+static sdb_object_t *
+ts_fetch(const char *type, const char *id, sdb_timeseries_opts_t *opts)
+{
+	sdb_strbuf_t *key = NULL;
+	sdb_timeseries_t *series;
+	sdb_object_t *entry;
+
+	if (ts_cache && (key = sdb_strbuf_create(64))) {
+		ts_cache_key(key, type, id, opts);
+		entry = sdb_lru_lookup(ts_cache, sdb_strbuf_string(key));
+		if (entry) {
+			sdb_strbuf_destroy(key);
+			return entry;
+		}
+	}
+
+	series = sdb_plugin_fetch_timeseries(type, id, opts);
+	if (! series) {
+		sdb_strbuf_destroy(key);
+		return NULL;
+	}
+
+	entry = sdb_object_create(key ? sdb_strbuf_string(key) : id,
+			ts_entry_type, sdb_gettime() + ts_cache_ttl, series);
+	if (! entry)
+		sdb_timeseries_destroy(series);
+	else if (key)
+		/* failing to cache the time-series is not an error */
+		sdb_lru_insert(ts_cache, entry);
+	sdb_strbuf_destroy(key);
+	return entry;
+} /* ts_fetch */
+
+/*
+ * Serialize a fetched time-series (a time-series cache entry) to JSON,
+ * downsampling it first if requested. The buffer is left unmodified on
+ * error.
+ */
+static int
+ts_tojson(sdb_object_t *series, sdb_timeseries_opts_t *opts,
+		sdb_strbuf_t *buf)
+{
+	sdb_timeseries_t *data = TS_ENTRY(series)->series;
+	sdb_timeseries_t *sampled = NULL;
+	size_t len = sdb_strbuf_len(buf);
+	int status;
+
+	/* cached time-series are shared, so downsample a copy */
+	if (opts->resolution || opts->max_points) {
+		data = sampled = sdb_timeseries_downsample(data, opts);
+		if (! data)
+			return -1;
+	}
+
+	status = sdb_timeseries_tojson(data, buf);
+	if (status)
+		sdb_strbuf_skip(buf, len, sdb_strbuf_len(buf) - len);
+	sdb_timeseries_destroy(sampled);
+	return status;
+} /* ts_tojson */
+
+/*
+ * multi-metric time-series:
+ * TIMESERIES queries selecting metrics by a condition look up all matching
+ * metrics first and then fetch their time-series concurrently, optionally
+ * aggregating them into a single time-series. The calling thread fetches
+ * time-series itself and hands the batch to the fetcher threads shared by
+ * all connections (if any) which help out when idle. Queries matching more
+ * than ts_max_metrics metrics (unless zero) are rejected.
+ */
+
+#define TS_FETCH_QUEUE_SIZE 1024
+
+static size_t ts_max_metrics = SDB_CONN_TIMESERIES_MAX_METRICS_DEFAULT;
+
+/* pool of fetcher threads; the channel holds references to batches */
+static sdb_channel_t *ts_chan = NULL;
+static pthread_t *ts_workers = NULL;
+static size_t ts_workers_num = 0;
+
+typedef struct {
+	char *hostname;
+	char *name;
+	char *type;
+	char *id;
+
+	/* the fetched time-series (cache entry) or NULL on error */
+	sdb_object_t *series;
+} ts_job_t;
+
+typedef struct {
+	ts_job_t *jobs;
+	size_t jobs_num;
+
+	sdb_timeseries_opts_t *opts;
+
+	/* index of the next job to be handled and the number of finished jobs;
+	 * 'opts' is valid as long as not all jobs have been finished */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	size_t next;
+	size_t done;
+
+	/* maximum number of jobs (if not zero) and whether the query matched
+	 * more metrics than that */
+	size_t max;
+	bool exceeded;
+} ts_batch_t;
+
+static int
+metric_collector_ignore(void __attribute__((unused)) *obj,
+		sdb_object_t __attribute__((unused)) *user_data)
+{
+	return 0;
+} /* metric_collector_ignore */
+
+static int
+metric_collector_metric(sdb_store_metric_t *metric, sdb_object_t *user_data)
+{
+	ts_batch_t *batch = SDB_OBJ_WRAPPER(user_data)->data;
+	ts_job_t *jobs, *job;
+	size_t idx;
+
+	/* metrics without a data-store do not have any time-series */
+	if (! metric->stores_num)
+		return 0;
+
+	/* abort the lookup right away */
+	if (batch->max && (batch->jobs_num >= batch->max)) {
+		batch->exceeded = true;
+		return -1;
+	}
+
+	jobs = realloc(batch->jobs, (batch->jobs_num + 1) * sizeof(*jobs));
+	if (! jobs)
+		return -1;
+	batch->jobs = jobs;
+
+	idx = metric_latest_store(metric);
+	job = jobs + batch->jobs_num;
+	job->hostname = strdup(metric->hostname);
+	job->name = strdup(metric->name);
+	job->type = strdup(metric->stores[idx].type);
+	job->id = strdup(metric->stores[idx].id);
+	job->series = NULL;
+	++batch->jobs_num;
+
+	if ((! job->hostname) || (! job->name) || (! job->type) || (! job->id))
+		return -1;
+	return 0;
+} /* metric_collector_metric */
+
+static sdb_store_writer_t metric_collector = {
+	(int (*)(sdb_store_host_t *, sdb_object_t *))metric_collector_ignore,
+	(int (*)(sdb_store_service_t *, sdb_object_t *))metric_collector_ignore,
+	metric_collector_metric,
+	(int (*)(sdb_store_attribute_t *, sdb_object_t *))metric_collector_ignore,
+};
+
+static void
+ts_batch_destroy(void *data)
+{
+	ts_batch_t *batch = data;
+	size_t i;
+
+	for (i = 0; i < batch->jobs_num; ++i) {
+		ts_job_t *job = batch->jobs + i;
+
+		free(job->hostname);
+		free(job->name);
+		free(job->type);
+		free(job->id);
+		sdb_object_deref(job->series);
+	}
+	free(batch->jobs);
+	pthread_mutex_destroy(&batch->lock);
+	pthread_cond_destroy(&batch->cond);
+	free(batch);
+} /* ts_batch_destroy */
+
+/* handle jobs of the batch until none are left */
+static void
+ts_fetch_jobs(ts_batch_t *batch)
+{
+	while (42) {
+		ts_job_t *job = NULL;
+
+		pthread_mutex_lock(&batch->lock);
+		if (batch->next < batch->jobs_num)
+			job = batch->jobs + batch->next++;
+		pthread_mutex_unlock(&batch->lock);
+
+		if (! job)
+			break;
+		job->series = ts_fetch(job->type, job->id, batch->opts);
+
+		pthread_mutex_lock(&batch->lock);
+		++batch->done;
+		pthread_cond_broadcast(&batch->cond);
+		pthread_mutex_unlock(&batch->lock);
+	}
+} /* ts_fetch_jobs */
+
+static void *
+ts_fetch_worker(void *arg)
+{
+	sdb_channel_t *chan = arg;
+
+	while (42) {
+		struct timespec timeout = { 0, 500000000 }; /* .5 seconds */
+		sdb_object_t *obj = NULL;
+
+		errno = 0;
+		if (sdb_channel_select(chan, /* read */ NULL, &obj,
+					/* write */ NULL, NULL, &timeout)) {
+			char errbuf[1024];
+
+			if (errno == ETIMEDOUT)
+				continue;
+			if (errno == EBADF) /* channel shut down */
+				break;
+
+			sdb_log(SDB_LOG_ERR, "frontend: Failed to read from "
+					"time-series channel: %s",
+					sdb_strerror(errno, errbuf, sizeof(errbuf)));
+			continue;
+		}
+
+		/* the query may have been finished already */
+		ts_fetch_jobs(SDB_OBJ_WRAPPER(obj)->data);
+		sdb_object_deref(obj);
+	}
+	return NULL;
+} /* ts_fetch_worker */
+
+static void
+json_string(sdb_strbuf_t *buf, const char *s)
+{
+	sdb_strbuf_append(buf, "\"");
+	for ( ; *s; ++s) {
+		if ((*s == '"') || (*s == '\\'))
+			sdb_strbuf_append(buf, "\\%c", *s);
+		else if (iscntrl((unsigned char)*s))
+			sdb_strbuf_append(buf, "\\u%04x", (unsigned char)*s);
+		else
+			sdb_strbuf_append(buf, "%c", *s);
+	}
+	sdb_strbuf_append(buf, "\"");
+} /* json_string */
+
+/*
+ * Aggregate all fetched time-series into a single one aligned to the
+ * requested resolution.
+ */
+static int
+ts_aggregate_tojson(ts_batch_t *batch, sdb_ast_timeseries_t *ts,
+		sdb_timeseries_opts_t *opts, sdb_strbuf_t *buf, sdb_strbuf_t *errbuf)
+{
+	const sdb_timeseries_t **series;
+	sdb_timeseries_t *res, *sampled = NULL;
+	sdb_time_t step = opts->resolution;
+	uint32_t res_type = htonl(SDB_CONNECTION_TIMESERIES);
+	size_t i;
+
+	if ((! step) && opts->max_points && (opts->end > opts->start))
+		step = (opts->end - opts->start) / (sdb_time_t)opts->max_points;
+
+	series = calloc(batch->jobs_num + 1, sizeof(*series));
+	if (! series) {
+		sdb_strbuf_sprintf(errbuf, "Out of memory");
+		return -1;
+	}
+	for (i = 0; i < batch->jobs_num; ++i) {
+		ts_job_t *job = batch->jobs + i;
+
+		/* failing to fetch a single time-series is not fatal */
+		if (job->series)
+			series[i] = TS_ENTRY(job->series)->series;
+		else
+			sdb_log(SDB_LOG_ERR, "frontend: Failed to fetch time-series "
+					"'%s/%s' - %s fetcher callback returned no data for '%s'",
+					job->hostname, job->name, job->type, job->id);
+	}
+
+	res = sdb_timeseries_aggregate(series, batch->jobs_num,
+			ts->aggregate, ts->percentile, step);
+	free(series);
+	if (! res) {
+		sdb_strbuf_sprintf(errbuf, "Failed to aggregate time-series: "
+				"no matching time-series available");
+		return -1;
+	}
+
+	/* aggregating aligns to the step; enforce the exact number of points */
+	if (opts->max_points && (res->data_len > opts->max_points)) {
+		sampled = sdb_timeseries_downsample(res, opts);
+		if (! sampled) {
+			sdb_timeseries_destroy(res);
+			sdb_strbuf_sprintf(errbuf, "Failed to downsample time-series");
+			return -1;
+		}
+	}
+
+	sdb_strbuf_memcpy(buf, &res_type, sizeof(res_type));
+	sdb_timeseries_tojson(sampled ? sampled : res, buf);
+	sdb_timeseries_destroy(sampled);
+	sdb_timeseries_destroy(res);
+	return SDB_CONNECTION_DATA;
+} /* ts_aggregate_tojson */
+
+static int
+exec_timeseries_multi(sdb_ast_timeseries_t *ts, sdb_timeseries_opts_t *opts,
+		sdb_strbuf_t *buf, sdb_strbuf_t *errbuf)
+{
+	ts_batch_t *batch;
+	sdb_object_t *obj;
+	uint32_t res_type = htonl(SDB_CONNECTION_TIMESERIES);
+	sdb_ast_node_t *lookup;
+	size_t i;
+	int status;
+
+	batch = calloc(1, sizeof(*batch));
+	if (! batch) {
+		sdb_strbuf_sprintf(errbuf, "Out of memory");
+		return -1;
+	}
+	pthread_mutex_init(&batch->lock, /* attr = */ NULL);
+	pthread_cond_init(&batch->cond, /* attr = */ NULL);
+	batch->opts = opts;
+	batch->max = ts_max_metrics;
+
+	obj = sdb_object_create_wrapper("timeseries-batch",
+			batch, ts_batch_destroy);
+	if (! obj) {
+		ts_batch_destroy(batch);
+		sdb_strbuf_sprintf(errbuf, "Out of memory");
+		return -1;
+	}
+
+	/* the lookup takes ownership of the matcher */
+	sdb_object_ref(SDB_OBJ(ts->matcher));
+	lookup = sdb_ast_lookup_create(SDB_METRIC, ts->matcher, /* filter = */ NULL);
+	if (! lookup) {
+		sdb_object_deref(SDB_OBJ(ts->matcher));
+		sdb_object_deref(obj);
+		sdb_strbuf_sprintf(errbuf, "Out of memory");
+		return -1;
+	}
+	status = sdb_plugin_query(lookup, &metric_collector, obj,
+			/* opts = */ NULL, errbuf);
+	sdb_object_deref(SDB_OBJ(lookup));
+	if (batch->exceeded) {
+		sdb_strbuf_sprintf(errbuf, "TIMESERIES: Query matches more than "
+				"%zu metrics; use a more specific condition", batch->max);
+		sdb_object_deref(obj);
+		return -1;
+	}
+	if (status < 0) {
+		sdb_log(SDB_LOG_ERR, "frontend: Failed to look up metrics "
+				"for time-series: %s", sdb_strbuf_string(errbuf));
+		sdb_object_deref(obj);
+		return -1;
+	}
+
+	/* let idle fetcher threads help out; the calling thread handles all
+	 * jobs itself if they are busy or if the queue is full */
+	for (i = 1; ts_chan && (i <= ts_workers_num) && (i < batch->jobs_num);
+			++i) {
+		sdb_object_ref(obj);
+		if (sdb_channel_write(ts_chan, &obj)) {
+			sdb_object_deref(obj);
+			break;
+		}
+	}
+	ts_fetch_jobs(batch);
+
+	/* wait for jobs picked up by fetcher threads */
+	pthread_mutex_lock(&batch->lock);
+	while (batch->done < batch->jobs_num)
+		pthread_cond_wait(&batch->cond, &batch->lock);
+	pthread_mutex_unlock(&batch->lock);
+
+	if (ts->aggregate != SDB_TIMESERIES_AGGR_NONE) {
+		status = ts_aggregate_tojson(batch, ts, opts, buf, errbuf);
+		sdb_object_deref(obj);
+		return status;
+	}
+
+	sdb_strbuf_memcpy(buf, &res_type, sizeof(res_type));
+	sdb_strbuf_append(buf, "[");
+	for (i = 0; i < batch->jobs_num; ++i) {
+		ts_job_t *job = batch->jobs + i;
+
+		sdb_strbuf_append(buf, "{\"host\": ");
+		json_string(buf, job->hostname);
+		sdb_strbuf_append(buf, ", \"metric\": ");
+		json_string(buf, job->name);
+		sdb_strbuf_append(buf, ", \"timeseries\": ");
+
+		/* failing to fetch a single time-series is not fatal */
+		if ((! job->series) || ts_tojson(job->series, opts, buf)) {
+			sdb_log(SDB_LOG_ERR, "frontend: Failed to fetch time-series "
+					"'%s/%s' - %s fetcher callback returned no data for '%s'",
+					job->hostname, job->name, job->type, job->id);
+			sdb_strbuf_append(buf, "null");
+		}
+		sdb_strbuf_append(buf, (i < batch->jobs_num - 1) ? "}," : "}");
+	}
+	sdb_strbuf_append(buf, "]");
+
+	sdb_object_deref(obj);
+	return SDB_CONNECTION_DATA;
+} /* exec_timeseries_multi */
+
 static int
 exec_timeseries(sdb_ast_timeseries_t *ts, sdb_strbuf_t *buf, sdb_strbuf_t *errbuf)
 {
 	metric_store_t st = { NULL, NULL, 0 };
 	sdb_object_wrapper_t obj = SDB_OBJECT_WRAPPER_STATIC(&st);
 	sdb_ast_fetch_t fetch = SDB_AST_FETCH_INIT;
-	sdb_timeseries_opts_t opts = { 0, 0, NULL, 0 };
-	sdb_timeseries_t *series = NULL;
+	sdb_timeseries_opts_t opts = SDB_TIMESERIES_OPTS_INIT;
+	sdb_object_t *series = NULL;
 	int status;
 
-	if ((! ts) || (! ts->hostname) || (! ts->metric))
+	if (! ts)
+		return -1;
+
+	opts.start = ts->start;
+	opts.end = ts->end;
+	opts.resolution = ts->resolution;
+	opts.max_points = ts->max_points;
+	opts.downsample = ts->downsample;
+
+	if (ts->matcher)
+		return exec_timeseries_multi(ts, &opts, buf, errbuf);
+	if ((! ts->hostname) || (! ts->metric))
 		return -1;
 
 	fetch.obj_type = SDB_METRIC;
@@ -249,8 +1081,6 @@ exec_timeseries(sdb_ast_timeseries_t *ts, sdb_strbuf_t *buf, sdb_strbuf_t *errbu
 	fetch.name = strdup(ts->metric);
 	opts.data_names = (const char * const *)ts->data_names;
 	opts.data_names_len = ts->data_names_len;
-	opts.start = ts->start;
-	opts.end = ts->end;
 
 	status = sdb_plugin_query(SDB_AST_NODE(&fetch),
 			&metric_fetcher, SDB_OBJ(&obj),
@@ -262,12 +1092,18 @@ exec_timeseries(sdb_ast_timeseries_t *ts, sdb_strbuf_t *buf, sdb_strbuf_t *errbu
 		status = -1;
 	}
 	if (status >= 0) {
-		series = sdb_plugin_fetch_timeseries(st.type, st.id, &opts);
+		series = ts_fetch(st.type, st.id, &opts);
 		if (series) {
 			uint32_t res_type = htonl(SDB_CONNECTION_TIMESERIES);
 			sdb_strbuf_memcpy(buf, &res_type, sizeof(res_type));
-			sdb_timeseries_tojson(series, buf);
-			sdb_timeseries_destroy(series);
+			if (ts_tojson(series, &opts, buf)) {
+				sdb_log(SDB_LOG_ERR, "frontend: Failed to downsample "
+						"time-series '%s/%s'", ts->hostname, ts->metric);
+				/* do not leave a partial reply behind */
+				sdb_strbuf_clear(buf);
+				status = -1;
+			}
+			sdb_object_deref(series);
 		}
 		else {
 			sdb_log(SDB_LOG_ERR, "frontend: Failed to fetch time-series '%s/%s' "
@@ -286,8 +1122,14 @@ exec_timeseries(sdb_ast_timeseries_t *ts, sdb_strbuf_t *buf, sdb_strbuf_t *errbu
 	return status;
 } /* exec_timeseries */
 
+/*
+ * Execute the specified command and send the reply to the client. If
+ * specified, 'prepared' has to be the prepared query for 'ast'. Results are
+ * added to the result cache if 'key' is not NULL.
+ */
 static int
-exec_cmd(sdb_conn_t *conn, sdb_ast_node_t *ast)
+exec_cmd(sdb_conn_t *conn, sdb_ast_node_t *ast, sdb_object_t *prepared,
+		sdb_strbuf_t *key)
 {
 	sdb_strbuf_t *buf;
 	int status;
@@ -307,8 +1149,23 @@ exec_cmd(sdb_conn_t *conn, sdb_ast_node_t *ast)
 		status = exec_store(SDB_AST_STORE(ast), buf, conn->errbuf);
 	else if (ast->type == SDB_AST_TYPE_TIMESERIES)
 		status = exec_timeseries(SDB_AST_TIMESERIES(ast), buf, conn->errbuf);
-	else
-		status = exec_query(ast, buf, conn->errbuf);
+	else {
+		const char *scope = cache_scope(ast);
+		/* determine the generation before executing the query to make sure
+		 * that concurrent updates invalidate the result */
+		uint64_t gen = (key && (! cache_time_dependent(ast)))
+			? sdb_plugin_query_generation(scope) : 0;
+
+		status = exec_query(ast, prepared, NULL, 0,
+				conn->result_format, buf, conn->errbuf);
+		if ((status >= 0) && gen) {
+			sdb_object_t *entry = sdb_object_create(sdb_strbuf_string(key),
+					cache_entry_type, scope, gen, status, buf);
+			if (entry)
+				sdb_lru_insert(result_cache, entry);
+			sdb_object_deref(entry);
+		}
+	}
 
 	if (status < 0) {
 		char query[conn->cmd_len + 1];
@@ -324,59 +1181,272 @@ exec_cmd(sdb_conn_t *conn, sdb_ast_node_t *ast)
 	return status < 0 ? status : 0;
 } /* exec_cmd */
 
+/*
+ * (Re-)create the specified cache, logging the statistics of the previous
+ * one, if any.
+ */
+static int
+cache_configure(sdb_lru_t **cache, size_t max_entries,
+		sdb_lru_valid_cb valid, const char *name)
+{
+	if (*cache) {
+		sdb_lru_stats_t stats;
+		uint64_t lookups;
+
+		sdb_lru_stats(*cache, &stats);
+		lookups = stats.hits + stats.misses;
+		sdb_log(SDB_LOG_INFO, "frontend: %c%s cache: %zu entries, "
+				"%"PRIu64" hits, %"PRIu64" misses (%.1f%% hit rate), "
+				"%"PRIu64" evictions", toupper((int)name[0]), name + 1,
+				stats.size, stats.hits, stats.misses,
+				lookups ? 100.0 * (double)stats.hits / (double)lookups : 0.0,
+				stats.evictions);
+		sdb_lru_destroy(*cache);
+		*cache = NULL;
+	}
+
+	if (! max_entries)
+		return 0;
+
+	*cache = sdb_lru_create(max_entries, valid);
+	if (! *cache) {
+		sdb_log(SDB_LOG_ERR, "frontend: Failed to create %s cache "
+				"of size %zu", name, max_entries);
+		return -1;
+	}
+	return 0;
+} /* cache_configure */
+
 /*
  * public API
  */
 
+int
+sdb_conn_cache_configure(size_t max_entries)
+{
+	return cache_configure(&result_cache, max_entries,
+			cache_entry_valid, "query result");
+} /* sdb_conn_cache_configure */
+
+void
+sdb_conn_cache_stats(sdb_lru_stats_t *stats)
+{
+	if (! stats)
+		return;
+
+	memset(stats, 0, sizeof(*stats));
+	sdb_lru_stats(result_cache, stats);
+} /* sdb_conn_cache_stats */
+
+int
+sdb_conn_plan_cache_configure(size_t max_entries)
+{
+	return cache_configure(&plan_cache, max_entries, NULL, "query plan");
+} /* sdb_conn_plan_cache_configure */
+
+void
+sdb_conn_plan_cache_stats(sdb_lru_stats_t *stats)
+{
+	if (! stats)
+		return;
+
+	memset(stats, 0, sizeof(*stats));
+	sdb_lru_stats(plan_cache, stats);
+} /* sdb_conn_plan_cache_stats */
+
+int
+sdb_conn_timeseries_cache_configure(size_t max_entries, sdb_time_t ttl)
+{
+	if (max_entries && (! ttl))
+		return -1;
+
+	ts_cache_ttl = ttl;
+	return cache_configure(&ts_cache, max_entries,
+			ts_entry_valid, "time-series");
+} /* sdb_conn_timeseries_cache_configure */
+
+void
+sdb_conn_timeseries_max_metrics_configure(size_t max_metrics)
+{
+	ts_max_metrics = max_metrics;
+} /* sdb_conn_timeseries_max_metrics_configure */
+
+int
+sdb_conn_timeseries_workers_start(size_t num)
+{
+	size_t i;
+
+	if (ts_chan)
+		return -1;
+	if (! num)
+		return 0;
+
+	ts_chan = sdb_channel_create(TS_FETCH_QUEUE_SIZE, sizeof(sdb_object_t *));
+	ts_workers = calloc(num, sizeof(*ts_workers));
+	if ((! ts_chan) || (! ts_workers)) {
+		sdb_log(SDB_LOG_ERR, "frontend: Failed to set up time-series "
+				"fetcher threads: Out of memory");
+		sdb_channel_destroy(ts_chan);
+		free(ts_workers);
+		ts_chan = NULL;
+		ts_workers = NULL;
+		return -1;
+	}
+
+	for (i = 0; i < num; ++i) {
+		errno = 0;
+		if (pthread_create(&ts_workers[i], /* attr = */ NULL,
+					ts_fetch_worker, /* arg = */ ts_chan)) {
+			char errbuf[1024];
+			sdb_log(SDB_LOG_ERR, "frontend: Failed to create "
+					"time-series fetcher thread: %s",
+					sdb_strerror(errno, errbuf, sizeof(errbuf)));
+			break;
+		}
+	}
+	ts_workers_num = i;
+
+	if (! ts_workers_num) {
+		sdb_conn_timeseries_workers_stop();
+		return -1;
+	}
+	sdb_log(SDB_LOG_INFO, "frontend: Started %zu time-series fetcher "
+			"thread%s", ts_workers_num, ts_workers_num == 1 ? "" : "s");
+	return 0;
+} /* sdb_conn_timeseries_workers_start */
+
+void
+sdb_conn_timeseries_workers_stop(void)
+{
+	size_t i;
+
+	if (! ts_chan)
+		return;
+
+	if (! sdb_channel_shutdown(ts_chan))
+		for (i = 0; i < ts_workers_num; ++i)
+			pthread_join(ts_workers[i], NULL);
+	/* else: we tried our best; let the operating system clean up */
+
+	sdb_channel_destroy(ts_chan);
+	free(ts_workers);
+	ts_chan = NULL;
+	ts_workers = NULL;
+	ts_workers_num = 0;
+} /* sdb_conn_timeseries_workers_stop */
+
+void
+sdb_conn_timeseries_cache_stats(sdb_lru_stats_t *stats)
+{
+	if (! stats)
+		return;
+
+	memset(stats, 0, sizeof(*stats));
+	sdb_lru_stats(ts_cache, stats);
+} /* sdb_conn_timeseries_cache_stats */
+
 int
 sdb_conn_query(sdb_conn_t *conn)
 {
 	sdb_llist_t *parsetree;
-	sdb_ast_node_t *ast = NULL;
+	sdb_strbuf_t *query, *key;
+	sdb_object_t *obj;
 	int status = 0;
 
 	if ((! conn) || (conn->cmd != SDB_CONNECTION_QUERY))
 		return -1;
 
+	query = cache_query(conn);
+	key = cache_key(conn, query);
+	if (key) {
+		obj = sdb_lru_lookup(result_cache, sdb_strbuf_string(key));
+		if (obj) {
+			cache_entry_t *entry = CACHE_ENTRY(obj);
+			sdb_connection_send(conn, entry->code,
+					(uint32_t)entry->data_len, entry->data);
+			sdb_object_deref(obj);
+			sdb_strbuf_destroy(query);
+			sdb_strbuf_destroy(key);
+			return 0;
+		}
+	}
+
+	/* skip parsing and preparing known queries */
+	obj = query ? sdb_lru_lookup(plan_cache, sdb_strbuf_string(query)) : NULL;
+	if (obj) {
+		status = exec_cmd(conn, STMT(obj)->ast, STMT(obj)->prepared, key);
+		sdb_object_deref(obj);
+		sdb_strbuf_destroy(query);
+		sdb_strbuf_destroy(key);
+		return status;
+	}
+
 	parsetree = sdb_parser_parse(sdb_strbuf_string(conn->buf),
 			(int)conn->cmd_len, conn->errbuf);
 	if (! parsetree) {
-		char query[conn->cmd_len + 1];
-		strncpy(query, sdb_strbuf_string(conn->buf), conn->cmd_len);
-		query[sizeof(query) - 1] = '\0';
+		char q[conn->cmd_len + 1];
+		strncpy(q, sdb_strbuf_string(conn->buf), conn->cmd_len);
+		q[sizeof(q) - 1] = '\0';
 		sdb_log(SDB_LOG_ERR, "frontend: Failed to parse query '%s': %s",
-				query, sdb_strbuf_string(conn->errbuf));
+				q, sdb_strbuf_string(conn->errbuf));
+		sdb_strbuf_destroy(query);
+		sdb_strbuf_destroy(key);
 		return -1;
 	}
 
-	switch (sdb_llist_len(parsetree)) {
-		case 0:
-			/* skipping empty command; send back an empty reply */
-			sdb_connection_send(conn, SDB_CONNECTION_DATA, 0, NULL);
-			break;
-		case 1:
-			ast = SDB_AST_NODE(sdb_llist_get(parsetree, 0));
-			break;
+	/* only single statements are cached */
+	if (sdb_llist_len(parsetree) != 1) {
+		sdb_strbuf_destroy(query);
+		sdb_strbuf_destroy(key);
+		query = key = NULL;
+	}
 
-		default:
-			{
-				char query[conn->cmd_len + 1];
-				strncpy(query, sdb_strbuf_string(conn->buf), conn->cmd_len);
-				query[sizeof(query) - 1] = '\0';
-				sdb_log(SDB_LOG_WARNING, "frontend: Ignoring %zu command%s "
-						"in multi-statement query '%s'",
-						sdb_llist_len(parsetree) - 1,
-						sdb_llist_len(parsetree) == 2 ? "" : "s",
-						query);
-				ast = SDB_AST_NODE(sdb_llist_get(parsetree, 0));
-			}
+	if (! sdb_llist_len(parsetree)) {
+		/* skipping empty command; send back an empty reply */
+		sdb_connection_send(conn, SDB_CONNECTION_DATA, 0, NULL);
 	}
+	else {
+		sdb_llist_iter_t *iter = sdb_llist_get_iter(parsetree);
+
+		/* execute all statements in order, sending one reply for each of
+		 * them; stop at the first failure which will be reported by the
+		 * caller as the reply to the failed statement */
+		while (sdb_llist_iter_has_next(iter)) {
+			sdb_ast_node_t *ast = SDB_AST_NODE(sdb_llist_iter_get_next(iter));
+			sdb_object_t *prepared = NULL;
+
+			/* there's no way to bind values to parameters of plain queries;
+			 * reject them before preparing (and caching) them */
+			if (sdb_ast_params_num(ast) > 0) {
+				sdb_strbuf_sprintf(conn->errbuf, "QUERY: Parameters are only "
+						"supported in prepared statements");
+				status = -1;
+				break;
+			}
 
-	if (ast) {
-		status = exec_cmd(conn, ast);
-		sdb_object_deref(SDB_OBJ(ast));
+			if (query && plan_cache) {
+				prepared = plan_prepare(sdb_strbuf_string(query),
+						ast, conn->errbuf);
+				if (! prepared) {
+					sdb_log(SDB_LOG_ERR, "frontend: Failed to prepare "
+							"query '%s': %s", sdb_strbuf_string(query),
+							sdb_strbuf_string(conn->errbuf));
+					status = -1;
+					break;
+				}
+			}
+
+			status = exec_cmd(conn, ast, prepared, key);
+			sdb_object_deref(prepared);
+			if (status)
+				break;
+		}
+		sdb_llist_iter_destroy(iter);
 	}
+
 	sdb_llist_destroy(parsetree);
+	sdb_strbuf_destroy(query);
+	sdb_strbuf_destroy(key);
 	return status;
 } /* sdb_conn_query */
 
@@ -413,7 +1483,7 @@ sdb_conn_fetch(sdb_conn_t *conn)
 			-1, NULL,
 			name[0] ? strdup(name) : NULL,
 			/* full */ 1, /* filter = */ NULL);
-	status = exec_cmd(conn, ast);
+	status = exec_cmd(conn, ast, NULL, NULL);
 	sdb_object_deref(SDB_OBJ(ast));
 	return status;
 } /* sdb_conn_fetch */
@@ -438,8 +1508,8 @@ sdb_conn_list(sdb_conn_t *conn)
 		return -1;
 	}
 
-	ast = sdb_ast_list_create((int)type, /* filter = */ NULL);
-	status = exec_cmd(conn, ast);
+	ast = sdb_ast_list_create((int)type, /* filter = */ NULL, /* since = */ -1);
+	status = exec_cmd(conn, ast, NULL, NULL);
 	sdb_object_deref(SDB_OBJ(ast));
 	return status;
 } /* sdb_conn_list */
@@ -483,7 +1553,7 @@ sdb_conn_lookup(sdb_conn_t *conn)
 	}
 
 	ast = sdb_ast_lookup_create((int)type, m, /* filter = */ NULL);
-	status = exec_cmd(conn, ast);
+	status = exec_cmd(conn, ast, NULL, NULL);
 	if (! ast)
 		sdb_object_deref(SDB_OBJ(m));
 	sdb_object_deref(SDB_OBJ(ast));
@@ -491,24 +1561,193 @@ sdb_conn_lookup(sdb_conn_t *conn)
 } /* sdb_conn_lookup */
 
 int
-sdb_conn_store(sdb_conn_t *conn)
+sdb_conn_prepare(sdb_conn_t *conn)
 {
-	sdb_ast_node_t *ast = NULL;
-	const char *buf = sdb_strbuf_string(conn->buf);
-	size_t len = conn->cmd_len;
-	uint32_t type;
+	sdb_llist_t *parsetree;
+	sdb_ast_node_t *ast;
+	sdb_object_t *prepared, *stmt;
+	const char *query;
+	size_t query_len;
+	char name[32];
+	uint32_t id;
+
+	if ((! conn) || (conn->cmd != SDB_CONNECTION_PREPARE))
+		return -1;
+
+	if (conn->cmd_len < sizeof(uint32_t)) {
+		sdb_log(SDB_LOG_ERR, "frontend: Invalid command length %d for "
+				"PREPARE command", conn->cmd_len);
+		sdb_strbuf_sprintf(conn->errbuf, "PREPARE: Invalid command length %d",
+				conn->cmd_len);
+		return -1;
+	}
+	sdb_proto_unmarshal_int32(SDB_STRBUF_STR(conn->buf), &id);
+	snprintf(name, sizeof(name), "%"PRIu32, id);
+
+	query = sdb_strbuf_string(conn->buf) + sizeof(uint32_t);
+	query_len = conn->cmd_len - sizeof(uint32_t);
+
+	if (! query_len) {
+		stmt = sdb_llist_remove_by_name(conn->prepared, name);
+		if (! stmt) {
+			sdb_strbuf_sprintf(conn->errbuf, "PREPARE: Unknown prepared "
+					"statement %s", name);
+			return -1;
+		}
+		sdb_object_deref(stmt);
+		sdb_connection_send(conn, SDB_CONNECTION_OK, 0, NULL);
+		return 0;
+	}
+
+	parsetree = sdb_parser_parse(query, (int)query_len, conn->errbuf);
+	if (! parsetree) {
+		char q[query_len + 1];
+		strncpy(q, query, query_len);
+		q[sizeof(q) - 1] = '\0';
+		sdb_log(SDB_LOG_ERR, "frontend: Failed to parse query '%s': %s",
+				q, sdb_strbuf_string(conn->errbuf));
+		return -1;
+	}
+	if (sdb_llist_len(parsetree) != 1) {
+		sdb_strbuf_sprintf(conn->errbuf, "PREPARE: Expected a single "
+				"statement, got %zu", sdb_llist_len(parsetree));
+		sdb_llist_destroy(parsetree);
+		return -1;
+	}
+
+	ast = SDB_AST_NODE(sdb_llist_get(parsetree, 0));
+	sdb_llist_destroy(parsetree);
+
+	prepared = sdb_plugin_prepare_query(ast, conn->errbuf);
+	if (! prepared) {
+		sdb_object_deref(SDB_OBJ(ast));
+		return -1;
+	}
+
+	stmt = sdb_object_create(name, stmt_type, ast, prepared);
+	sdb_object_deref(SDB_OBJ(ast));
+	sdb_object_deref(prepared);
+	if (! stmt) {
+		sdb_strbuf_sprintf(conn->errbuf, "Out of memory");
+		return -1;
+	}
+
+	/* replace any existing statement of the same name */
+	sdb_object_deref(sdb_llist_remove_by_name(conn->prepared, name));
+	if (sdb_llist_len(conn->prepared) >= MAX_PREPARED) {
+		sdb_strbuf_sprintf(conn->errbuf, "PREPARE: Too many prepared "
+				"statements (max: %d)", MAX_PREPARED);
+		sdb_object_deref(stmt);
+		return -1;
+	}
+
+	if (! conn->prepared)
+		conn->prepared = sdb_llist_create();
+	if ((! conn->prepared) || sdb_llist_append(conn->prepared, stmt)) {
+		sdb_strbuf_sprintf(conn->errbuf, "Out of memory");
+		sdb_object_deref(stmt);
+		return -1;
+	}
+	sdb_object_deref(stmt);
+
+	sdb_connection_send(conn, SDB_CONNECTION_OK, 0, NULL);
+	return 0;
+} /* sdb_conn_prepare */
+
+int
+sdb_conn_execute(sdb_conn_t *conn)
+{
+	sdb_data_t params[SDB_AST_MAX_PARAMS];
+	sdb_object_t *stmt;
+	sdb_strbuf_t *buf;
+	const char *data;
+	size_t data_len;
+	char name[32];
+
+	uint32_t id, params_num, i;
 	ssize_t n;
 	int status;
 
-	if ((! conn) || (conn->cmd != SDB_CONNECTION_STORE))
+	if ((! conn) || (conn->cmd != SDB_CONNECTION_EXECUTE))
+		return -1;
+
+	if (conn->cmd_len < 2 * sizeof(uint32_t)) {
+		sdb_log(SDB_LOG_ERR, "frontend: Invalid command length %d for "
+				"EXECUTE command", conn->cmd_len);
+		sdb_strbuf_sprintf(conn->errbuf, "EXECUTE: Invalid command length %d",
+				conn->cmd_len);
+		return -1;
+	}
+
+	data = sdb_strbuf_string(conn->buf);
+	data_len = conn->cmd_len;
+	sdb_proto_unmarshal_int32(data, data_len, &id);
+	sdb_proto_unmarshal_int32(data + sizeof(uint32_t),
+			data_len - sizeof(uint32_t), &params_num);
+	data += 2 * sizeof(uint32_t);
+	data_len -= 2 * sizeof(uint32_t);
+
+	snprintf(name, sizeof(name), "%"PRIu32, id);
+	stmt = sdb_llist_search_by_name(conn->prepared, name);
+	if (! stmt) {
+		sdb_strbuf_sprintf(conn->errbuf, "EXECUTE: Unknown prepared "
+				"statement %s", name);
+		return -1;
+	}
+	if (params_num > SDB_AST_MAX_PARAMS) {
+		sdb_strbuf_sprintf(conn->errbuf, "EXECUTE: Too many parameters "
+				"(%"PRIu32"; max: %d)", params_num, SDB_AST_MAX_PARAMS);
 		return -1;
+	}
 
-	if ((n = sdb_proto_unmarshal_int32(buf, len, &type)) < 0) {
+	for (i = 0; i < params_num; ++i) {
+		params[i] = (sdb_data_t)SDB_DATA_INIT;
+		n = sdb_proto_unmarshal_data(data, data_len, &params[i]);
+		if (n < 0)
+			break;
+		data += n;
+		data_len -= (size_t)n;
+	}
+	if ((i < params_num) || data_len) {
+		sdb_strbuf_sprintf(conn->errbuf, "EXECUTE: Invalid parameter "
+				"list for prepared statement %s", name);
+		params_num = i;
+		status = -1;
+	}
+	else if (! (buf = sdb_strbuf_create(1024))) {
+		sdb_strbuf_sprintf(conn->errbuf, "Out of memory");
+		status = -1;
+	}
+	else {
+		status = exec_query(STMT(stmt)->ast, STMT(stmt)->prepared,
+				params, params_num, conn->result_format, buf, conn->errbuf);
+		if (status < 0)
+			sdb_log(SDB_LOG_ERR, "frontend: Failed to execute prepared "
+					"statement %s: %s", name, sdb_strbuf_string(conn->errbuf));
+		else
+			sdb_connection_send(conn, status,
+					(uint32_t)sdb_strbuf_len(buf), sdb_strbuf_string(buf));
+		sdb_strbuf_destroy(buf);
+	}
+
+	for (i = 0; i < params_num; ++i)
+		sdb_data_free_datum(&params[i]);
+	return status < 0 ? status : 0;
+} /* sdb_conn_execute */
+
+/* parse a single object as sent by the STORE command */
+static sdb_ast_node_t *
+store_parse(const char *buf, size_t len, sdb_strbuf_t *errbuf)
+{
+	sdb_ast_node_t *ast = NULL;
+	uint32_t type;
+
+	if (sdb_proto_unmarshal_int32(buf, len, &type) < 0) {
 		sdb_log(SDB_LOG_ERR, "frontend: Invalid command length %zu for "
 				"STORE command", len);
-		sdb_strbuf_sprintf(conn->errbuf,
+		sdb_strbuf_sprintf(errbuf,
 				"STORE: Invalid command length %zu", len);
-		return -1;
+		return NULL;
 	}
 
 	switch (type) {
@@ -516,9 +1755,9 @@ sdb_conn_store(sdb_conn_t *conn)
 		{
 			sdb_proto_host_t host;
 			if (sdb_proto_unmarshal_host(buf, len, &host) < 0) {
-				sdb_strbuf_sprintf(conn->errbuf,
+				sdb_strbuf_sprintf(errbuf,
 						"STORE: Failed to unmarshal host object");
-				return -1;
+				return NULL;
 			}
 			ast = sdb_ast_store_create(SDB_HOST, /* host */ NULL,
 					/* parent */ 0, NULL, sstrdup(host.name), host.last_update,
@@ -530,9 +1769,9 @@ sdb_conn_store(sdb_conn_t *conn)
 		{
 			sdb_proto_service_t svc;
 			if (sdb_proto_unmarshal_service(buf, len, &svc) < 0) {
-				sdb_strbuf_sprintf(conn->errbuf,
+				sdb_strbuf_sprintf(errbuf,
 						"STORE: Failed to unmarshal service object");
-				return -1;
+				return NULL;
 			}
 			ast = sdb_ast_store_create(SDB_SERVICE, sstrdup(svc.hostname),
 					/* parent */ 0, NULL, sstrdup(svc.name), svc.last_update,
@@ -544,9 +1783,9 @@ sdb_conn_store(sdb_conn_t *conn)
 		{
 			sdb_proto_metric_t metric;
 			if (sdb_proto_unmarshal_metric(buf, len, &metric) < 0) {
-				sdb_strbuf_sprintf(conn->errbuf,
+				sdb_strbuf_sprintf(errbuf,
 						"STORE: Failed to unmarshal metric object");
-				return -1;
+				return NULL;
 			}
 			ast = sdb_ast_store_create(SDB_METRIC, sstrdup(metric.hostname),
 					/* parent */ 0, NULL, sstrdup(metric.name), metric.last_update,
@@ -561,9 +1800,9 @@ sdb_conn_store(sdb_conn_t *conn)
 		const char *hostname, *parent;
 		int parent_type;
 		if (sdb_proto_unmarshal_attribute(buf, len, &attr) < 0) {
-			sdb_strbuf_sprintf(conn->errbuf,
+			sdb_strbuf_sprintf(errbuf,
 					"STORE: Failed to unmarshal attribute object");
-			return -1;
+			return NULL;
 		}
 		if (attr.parent_type == SDB_HOST) {
 			hostname = attr.parent;
@@ -584,16 +1823,119 @@ sdb_conn_store(sdb_conn_t *conn)
 	if (! ast) {
 		sdb_log(SDB_LOG_ERR, "frontend: Invalid object type %d for "
 				"STORE COMMAND", type);
-		sdb_strbuf_sprintf(conn->errbuf, "STORE: Invalid object type %d", type);
-		return -1;
+		sdb_strbuf_sprintf(errbuf, "STORE: Invalid object type %d", type);
+		return NULL;
 	}
 
-	status = sdb_parser_analyze(ast, conn->errbuf);
-	if (! status)
-		status = exec_cmd(conn, ast);
+	if (sdb_parser_analyze(ast, errbuf)) {
+		sdb_object_deref(SDB_OBJ(ast));
+		return NULL;
+	}
+	return ast;
+} /* store_parse */
+
+int
+sdb_conn_store(sdb_conn_t *conn)
+{
+	sdb_ast_node_t *ast;
+	int status;
+
+	if ((! conn) || (conn->cmd != SDB_CONNECTION_STORE))
+		return -1;
+
+	ast = store_parse(sdb_strbuf_string(conn->buf), conn->cmd_len,
+			conn->errbuf);
+	if (! ast)
+		return -1;
+
+	status = exec_cmd(conn, ast, NULL, NULL);
 	sdb_object_deref(SDB_OBJ(ast));
 	return status;
 } /* sdb_conn_store */
 
+/* maximum number of failed records listed in the reply to a batch */
+#define STORE_BATCH_ERRORS_MAX 10
+
+int
+sdb_conn_store_batch(sdb_conn_t *conn)
+{
+	const char *buf;
+	size_t len;
+	sdb_strbuf_t *reply, *errors;
+	size_t records = 0, failed = 0;
+	int status = 0;
+
+	if ((! conn) || (conn->cmd != SDB_CONNECTION_STORE_BATCH))
+		return -1;
+
+	buf = sdb_strbuf_string(conn->buf);
+	len = conn->cmd_len;
+
+	reply = sdb_strbuf_create(128);
+	errors = sdb_strbuf_create(128);
+	if ((! reply) || (! errors)) {
+		sdb_strbuf_destroy(reply);
+		sdb_strbuf_destroy(errors);
+		sdb_strbuf_sprintf(conn->errbuf, "Out of memory");
+		return -1;
+	}
+
+	/* each record is stored independently of any others */
+	while (len > 0) {
+		sdb_ast_node_t *ast;
+		uint32_t rec_len = 0;
+		ssize_t n;
+		int rec_status = -1;
+
+		n = sdb_proto_unmarshal_int32(buf, len, &rec_len);
+		if ((n < 0) || ((size_t)rec_len > len - (size_t)n)) {
+			/* there's no way to find any further records */
+			sdb_strbuf_sprintf(conn->errbuf, "STORE_BATCH: Invalid length "
+					"of record %zu (%zu previous records processed, "
+					"%zu failed)", records + 1, records, failed);
+			status = -1;
+			break;
+		}
+		buf += n;
+		len -= (size_t)n;
+
+		sdb_strbuf_clear(conn->errbuf);
+		ast = store_parse(buf, rec_len, conn->errbuf);
+		if (ast) {
+			sdb_strbuf_clear(reply);
+			rec_status = exec_store(SDB_AST_STORE(ast), reply, conn->errbuf);
+			sdb_object_deref(SDB_OBJ(ast));
+		}
+		if (rec_status < 0) {
+			if (failed < STORE_BATCH_ERRORS_MAX)
+				sdb_strbuf_append(errors, "; record %zu: %s", records + 1,
+						sdb_strbuf_string(conn->errbuf));
+			else if (failed == STORE_BATCH_ERRORS_MAX)
+				sdb_strbuf_append(errors, "; ...");
+			++failed;
+		}
+
+		buf += rec_len;
+		len -= rec_len;
+		++records;
+	}
+
+	if ((status >= 0) && failed) {
+		sdb_strbuf_sprintf(conn->errbuf, "STORE_BATCH: Failed to store %zu "
+				"of %zu objects%s", failed, records,
+				sdb_strbuf_string(errors));
+		status = -1;
+	}
+	else if (status >= 0) {
+		sdb_strbuf_sprintf(reply, "Successfully stored %zu objects", records);
+		sdb_connection_send(conn, SDB_CONNECTION_OK,
+				(uint32_t)sdb_strbuf_len(reply), sdb_strbuf_string(reply));
+		status = 0;
+	}
+	sdb_strbuf_destroy(reply);
+	sdb_strbuf_destroy(errors);
+	return status;
+} /* sdb_conn_store_batch */
+
 /* vim: set tw=78 sw=4 ts=4 noexpandtab : */
 
@@ -0,0 +1,269 @@
+/*
+ * SysDB - src/frontend/replicate.c
+ * Copyright (C) 2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This module implements the server side of replication (see
+ * SDB_CONNECTION_REPLICATE). The replication stream is maintained by the
+ * store; each connection only keeps track of its position within the stream
+ * and sends any new entries whenever the connection is being handled.
+ */
+
+#ifdef HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
+#include "sysdb.h"
+
+#include "core/plugin.h"
+#include "frontend/connection-private.h"
+#include "utils/error.h"
+#include "utils/proto.h"
+#include "utils/strbuf.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* approximate maximum size of a message; a message exceeds this size only
+ * if a single entry does */
+#define REPLICATION_MSG_SIZE (1024 * 1024)
+
+/* sequence number + type + length */
+#define ENTRY_HEADER_LEN 16
+
+/* maximum number of messages sent each time the connection is handled */
+#define REPLICATION_MSGS_MAX 16
+
+/*
+ * private helper functions
+ */
+
+static void
+marshal_int64(char *buf, uint64_t v)
+{
+	sdb_proto_marshal_int32(buf, sizeof(uint32_t), (uint32_t)(v >> 32));
+	sdb_proto_marshal_int32(buf + sizeof(uint32_t), sizeof(uint32_t),
+			(uint32_t)(v & 0xffffffff));
+} /* marshal_int64 */
+
+static uint64_t
+unmarshal_int64(const char *buf)
+{
+	uint32_t hi, lo;
+
+	sdb_proto_unmarshal_int32(buf, sizeof(uint32_t), &hi);
+	sdb_proto_unmarshal_int32(buf + sizeof(uint32_t), sizeof(uint32_t), &lo);
+	return ((uint64_t)hi << 32) | lo;
+} /* unmarshal_int64 */
+
+/* returns the length of the longest sequence of complete entries at the
+ * beginning of 'data' not exceeding 'max' bytes (but at least one entry) */
+static size_t
+entries_chunk(const char *data, size_t len, size_t max)
+{
+	size_t pos = 0;
+
+	while (pos + ENTRY_HEADER_LEN <= len) {
+		uint32_t payload_len = 0;
+		size_t entry_len;
+
+		sdb_proto_unmarshal_int32(data + pos + 12, len - pos - 12,
+				&payload_len);
+		entry_len = ENTRY_HEADER_LEN + (size_t)payload_len;
+		if (pos && (pos + entry_len > max))
+			break;
+		pos += entry_len;
+	}
+	return pos < len ? pos : len;
+} /* entries_chunk */
+
+static int
+send_entries(sdb_conn_t *conn, sdb_strbuf_t *msg, uint64_t id, uint64_t seq,
+		const char *data, size_t len)
+{
+	char header[2 * sizeof(uint64_t)];
+
+	if (len > UINT32_MAX - sizeof(header)) {
+		sdb_log(SDB_LOG_ERR, "frontend: Replication entry of %zu bytes "
+				"exceeds the maximum message size", len);
+		return -1;
+	}
+
+	marshal_int64(header, id);
+	marshal_int64(header + sizeof(uint64_t), seq);
+	sdb_strbuf_memcpy(msg, header, sizeof(header));
+	sdb_strbuf_memappend(msg, data, len);
+	return (int)sdb_connection_send(conn, SDB_CONNECTION_REPLICATION,
+			(uint32_t)sdb_strbuf_len(msg), sdb_strbuf_string(msg));
+} /* send_entries */
+
+/* send a part of a full copy of the store in chunks of about
+ * REPLICATION_MSG_SIZE bytes; all but the very last chunk of the copy carry
+ * the position zero marking the copy as incomplete, the last one includes
+ * the end-of-copy marker and the position which the copy reflects */
+static int
+send_copy(sdb_conn_t *conn, sdb_strbuf_t *msg,
+		const sdb_store_repl_pos_t *pos, sdb_strbuf_t *entries)
+{
+	const char *data = sdb_strbuf_string(entries);
+	size_t len = sdb_strbuf_len(entries);
+
+	while (len > 0) {
+		size_t n = entries_chunk(data, len, REPLICATION_MSG_SIZE);
+		bool last = (n == len) && (! pos->copying);
+
+		if (send_entries(conn, msg, last ? pos->id : 0, last ? pos->seq : 0,
+					data, n) < 0)
+			return -1;
+		data += n;
+		len -= n;
+	}
+	return 0;
+} /* send_copy */
+
+/*
+ * public API
+ */
+
+int
+sdb_conn_replicate(sdb_conn_t *conn)
+{
+	sdb_store_repl_pos_t pos = SDB_STORE_REPL_POS_INIT;
+
+	if ((! conn) || (conn->cmd != SDB_CONNECTION_REPLICATE))
+		return -1;
+
+	if (conn->cmd_len && (conn->cmd_len != 2 * sizeof(uint64_t))) {
+		sdb_log(SDB_LOG_ERR, "frontend: Invalid command length %d for "
+				"REPLICATE command", conn->cmd_len);
+		sdb_strbuf_sprintf(conn->errbuf, "REPLICATE: Invalid command "
+				"length %d", conn->cmd_len);
+		return -1;
+	}
+	if (conn->cmd_len) {
+		pos.id = unmarshal_int64(sdb_strbuf_string(conn->buf));
+		pos.seq = unmarshal_int64(sdb_strbuf_string(conn->buf)
+				+ sizeof(uint64_t));
+	}
+
+	/* check for replication support before accepting the command */
+	if (sdb_plugin_replicate(&pos, /* buf = */ NULL, 0,
+				/* notify_fd = */ -1, conn->errbuf) < 0)
+		return -1;
+
+	conn->replicating = 1;
+	free(conn->repl_pos.copy_key);
+	conn->repl_pos = pos;
+
+	sdb_log(SDB_LOG_INFO, "frontend: Replicating to conn#%d "
+			"(stream %"PRIu64", position %"PRIu64")",
+			conn->fd, pos.id, pos.seq);
+	sdb_connection_send(conn, SDB_CONNECTION_OK, 0, NULL);
+	return 0;
+} /* sdb_conn_replicate */
+
+bool
+sdb_conn_replicate_pending(sdb_conn_t *conn)
+{
+	if ((! conn) || (! conn->replicating))
+		return 0;
+
+	/* the store will notify the main loop once anything new is available;
+	 * an incomplete copy is always pending */
+	return sdb_plugin_replicate(&conn->repl_pos, /* buf = */ NULL, 0,
+			conn->notify_fd, /* errbuf = */ NULL) != 0;
+} /* sdb_conn_replicate_pending */
+
+int
+sdb_conn_replicate_flush(sdb_conn_t *conn)
+{
+	sdb_strbuf_t *entries, *msg;
+	int n = 0;
+
+	if (! conn)
+		return -1;
+	if (! conn->replicating)
+		return 0;
+
+	entries = sdb_strbuf_create(REPLICATION_MSG_SIZE);
+	msg = sdb_strbuf_create(REPLICATION_MSG_SIZE);
+	if ((! entries) || (! msg)) {
+		sdb_strbuf_destroy(entries);
+		sdb_strbuf_destroy(msg);
+		return -1;
+	}
+
+	/* a full copy is sent in parts as well; the main loop handles the
+	 * connection again as long as the copy is incomplete */
+	while ((conn->fd >= 0) && (n < REPLICATION_MSGS_MAX)) {
+		sdb_store_repl_pos_t *pos = &conn->repl_pos;
+		bool copying = pos->copying;
+		int status;
+
+		sdb_strbuf_clear(entries);
+		status = sdb_plugin_replicate(pos, entries,
+				REPLICATION_MSG_SIZE, /* notify_fd = */ -1, conn->errbuf);
+		if (status < 0) {
+			sdb_log(SDB_LOG_ERR, "frontend: Failed to replicate to "
+					"conn#%d: %s", conn->fd, sdb_strbuf_string(conn->errbuf));
+			sdb_connection_send(conn, SDB_CONNECTION_ERROR,
+					(uint32_t)sdb_strbuf_len(conn->errbuf),
+					sdb_strbuf_string(conn->errbuf));
+			sdb_strbuf_clear(conn->errbuf);
+			conn->replicating = 0;
+			n = -1;
+			break;
+		}
+		if (! sdb_strbuf_len(entries))
+			break;
+
+		if ((status > 0) && (! copying))
+			sdb_log(SDB_LOG_INFO, "frontend: Sending full copy of the "
+					"store to conn#%d", conn->fd);
+
+		if (status > 0)
+			status = send_copy(conn, msg, pos, entries);
+		else
+			status = send_entries(conn, msg, pos->id, pos->seq,
+					SDB_STRBUF_STR(entries));
+		if (status < 0) {
+			/* the position has been advanced already; the replica has to
+			 * reconnect and continue from its own position */
+			sdb_connection_close(conn);
+			break;
+		}
+		++n;
+	}
+	sdb_strbuf_destroy(entries);
+	sdb_strbuf_destroy(msg);
+
+	if (conn->fd < 0)
+		return -1;
+	return n;
+} /* sdb_conn_replicate_flush */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
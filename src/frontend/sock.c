@@ -557,8 +557,10 @@ connection_handler(void *data)
 			continue;
 		}
 
+		errno = 0;
 		status = (int)sdb_connection_handle(conn);
-		if (status <= 0) {
+		/* EAGAIN: nothing to read, e.g. when only sending pending events */
+		if ((! status) || ((status < 0) && (errno != EAGAIN))) {
 			/* error or EOF -> close connection */
 			sdb_object_deref(SDB_OBJ(conn));
 			continue;
@@ -593,6 +595,9 @@ connection_accept(sdb_fe_socket_t *sock, listener_t *listener)
 	if (! obj)
 		return -1;
 
+	/* wake up the main loop when events are queued for the connection */
+	CONN(obj)->notify_fd = sock->trigger[TRIGGER_WRITE];
+
 	status = sdb_llist_append(sock->open_connections, obj);
 	if (status)
 		sdb_log(SDB_LOG_ERR, "frontend: Failed to append "
@@ -637,7 +642,9 @@ socket_handle_incoming(sdb_fe_socket_t *sock,
 			continue;
 		}
 
-		if (FD_ISSET(CONN(obj)->fd, ready)) {
+		if (FD_ISSET(CONN(obj)->fd, ready)
+				|| sdb_conn_watch_pending(CONN(obj))
+				|| sdb_conn_replicate_pending(CONN(obj))) {
 			sdb_llist_iter_remove_current(iter);
 			sdb_channel_write(sock->chan, &obj);
 		}
@@ -833,6 +840,11 @@ sdb_fe_sock_listen_and_serve(sdb_fe_socket_t *sock, sdb_fe_loop_t *loop)
 		}
 	}
 
+	/* failing to start these is not fatal; queries fetch time-series in the
+	 * connection handler threads in that case */
+	if (num_threads)
+		sdb_conn_timeseries_workers_start(loop->num_fetch_threads);
+
 	while (loop->do_loop && num_threads) {
 		struct timeval timeout = { 1, 0 }; /* one second */
 		sdb_llist_iter_t *iter;
@@ -910,6 +922,8 @@ sdb_fe_sock_listen_and_serve(sdb_fe_socket_t *sock, sdb_fe_loop_t *loop)
 	sdb_channel_destroy(sock->chan);
 	sock->chan = NULL;
 
+	sdb_conn_timeseries_workers_stop();
+
 	if (! num_threads)
 		return -1;
 	return 0;
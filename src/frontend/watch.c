@@ -0,0 +1,455 @@
+/*
+ * SysDB - src/frontend/watch.c
+ * Copyright (C) 2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This module implements subscriptions to store updates (see
+ * SDB_CONNECTION_WATCH). Updates are reported by the store reader from
+ * whichever thread stores an object. They are encoded right away and queued
+ * with the subscription; the connection handler sends them to the client
+ * later on. The queue is bounded and coalesces updates of the same object.
+ */
+
+#ifdef HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
+#include "sysdb.h"
+
+#include "core/plugin.h"
+#include "core/store.h"
+#include "frontend/connection-private.h"
+#include "parser/ast.h"
+#include "parser/parser.h"
+#include "utils/error.h"
+#include "utils/lru.h"
+#include "utils/proto.h"
+#include "utils/strbuf.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+
+/* maximum number of subscriptions per connection */
+#define MAX_WATCHES 16
+
+/* maximum number of pending events per subscription */
+#define WATCH_QUEUE_SIZE 1024
+
+/*
+ * private data types
+ */
+
+/* a subscription named by its decimal identifier */
+typedef struct {
+	sdb_object_t super;
+	uint32_t id;
+
+	/* pending events named by the updated object */
+	sdb_lru_t *events;
+	/* number of dropped events already reported to the client */
+	uint64_t dropped;
+
+	/* written to whenever an event is queued; may be -1 */
+	int notify_fd;
+
+	/* the subscription registered with the store (see sdb_plugin_watch) */
+	sdb_object_t *handle;
+} watch_t;
+#define WATCH(obj) ((watch_t *)(obj))
+
+/* a pending event holding the message body of an SDB_CONNECTION_EVENT */
+typedef struct {
+	sdb_object_t super;
+	sdb_strbuf_t *msg;
+} event_t;
+#define EVENT(obj) ((event_t *)(obj))
+
+static int
+watch_init(sdb_object_t *obj, va_list ap)
+{
+	WATCH(obj)->id = va_arg(ap, uint32_t);
+	WATCH(obj)->notify_fd = va_arg(ap, int);
+
+	WATCH(obj)->events = sdb_lru_create(WATCH_QUEUE_SIZE, NULL);
+	if (! WATCH(obj)->events)
+		return -1;
+	return 0;
+} /* watch_init */
+
+static void
+watch_destroy(sdb_object_t *obj)
+{
+	/* the handle references the watch itself, so it has been released by
+	 * watch_cancel already */
+	sdb_lru_destroy(WATCH(obj)->events);
+} /* watch_destroy */
+
+static sdb_type_t watch_type = {
+	/* size = */ sizeof(watch_t),
+	/* init = */ watch_init,
+	/* destroy = */ watch_destroy,
+};
+
+static void
+event_destroy(sdb_object_t *obj)
+{
+	sdb_strbuf_destroy(EVENT(obj)->msg);
+} /* event_destroy */
+
+/*
+ * private helper functions
+ */
+
+/* cancel the subscription such that no further events will be queued; this
+ * breaks the reference cycle between the watch and its store handle */
+static void
+watch_cancel(watch_t *watch)
+{
+	sdb_object_t *handle = watch->handle;
+
+	watch->handle = NULL;
+	sdb_object_deref(handle);
+} /* watch_cancel */
+
+/* create an event for the object identified by its type and names; the
+ * event is named by the object such that updates of the same object are
+ * coalesced when queuing them */
+static sdb_object_t *
+event_create(watch_t *watch, int type,
+		const char *hostname, const char *parent, const char *name)
+{
+	sdb_object_t *ev;
+	sdb_strbuf_t *key;
+	char id[sizeof(uint32_t)];
+
+	key = sdb_strbuf_create(64);
+	if (! key)
+		return NULL;
+	sdb_strbuf_sprintf(key, "%d\n%s\n%s\n%s", type,
+			hostname ? hostname : "", parent ? parent : "", name);
+
+	ev = sdb_object_create_simple(sdb_strbuf_string(key),
+			sizeof(event_t), event_destroy);
+	sdb_strbuf_destroy(key);
+	if (! ev)
+		return NULL;
+
+	EVENT(ev)->msg = sdb_strbuf_create(64);
+	if (! EVENT(ev)->msg) {
+		sdb_object_deref(ev);
+		return NULL;
+	}
+	sdb_proto_marshal_int32(id, sizeof(id), watch->id);
+	sdb_strbuf_memcpy(EVENT(ev)->msg, id, sizeof(id));
+	return ev;
+} /* event_create */
+
+/* queue an encoded event (unless encoding failed as indicated by 'status')
+ * and release it */
+static int
+event_queue(watch_t *watch, sdb_object_t *ev, int status)
+{
+	if (! status)
+		status = sdb_lru_insert(watch->events, ev);
+	sdb_object_deref(ev);
+	if (status)
+		return -1;
+
+	/* wake up the connection handler for every event; events may be queued
+	 * concurrently, so checking for the first pending one would be racy. The
+	 * trigger pipe is non-blocking and a full pipe means that the handler
+	 * is going to wake up anyway. */
+	if ((watch->notify_fd >= 0) && (write(watch->notify_fd, "", 1) <= 0)
+			&& (errno != EAGAIN) && (errno != EWOULDBLOCK))
+		sdb_log(SDB_LOG_DEBUG, "frontend: Failed to notify connection "
+				"handler about pending events");
+	return 0;
+} /* event_queue */
+
+/*
+ * store writer API
+ */
+
+#define ENCODE(ev, type, obj) \
+	do { \
+		sdb_store_binary_formatter_t *f; \
+		f = sdb_store_binary_formatter(EVENT(ev)->msg); \
+		status = f \
+			? sdb_store_binary_writer.store_##type((obj), SDB_OBJ(f)) \
+			: -1; \
+		sdb_object_deref(SDB_OBJ(f)); \
+	} while (0)
+
+static int
+watch_host(sdb_store_host_t *host, sdb_object_t *user_data)
+{
+	sdb_object_t *ev;
+	int status;
+
+	ev = event_create(WATCH(user_data), SDB_HOST, NULL, NULL, host->name);
+	if (! ev)
+		return -1;
+	ENCODE(ev, host, host);
+	return event_queue(WATCH(user_data), ev, status);
+} /* watch_host */
+
+static int
+watch_service(sdb_store_service_t *service, sdb_object_t *user_data)
+{
+	sdb_object_t *ev;
+	int status;
+
+	ev = event_create(WATCH(user_data), SDB_SERVICE,
+			service->hostname, NULL, service->name);
+	if (! ev)
+		return -1;
+	ENCODE(ev, service, service);
+	return event_queue(WATCH(user_data), ev, status);
+} /* watch_service */
+
+static int
+watch_metric(sdb_store_metric_t *metric, sdb_object_t *user_data)
+{
+	sdb_object_t *ev;
+	int status;
+
+	ev = event_create(WATCH(user_data), SDB_METRIC,
+			metric->hostname, NULL, metric->name);
+	if (! ev)
+		return -1;
+	ENCODE(ev, metric, metric);
+	return event_queue(WATCH(user_data), ev, status);
+} /* watch_metric */
+
+static int
+watch_attribute(sdb_store_attribute_t *attr, sdb_object_t *user_data)
+{
+	sdb_object_t *ev;
+	int status;
+
+	ev = event_create(WATCH(user_data), SDB_ATTRIBUTE | attr->parent_type,
+			attr->hostname, attr->parent, attr->key);
+	if (! ev)
+		return -1;
+	ENCODE(ev, attribute, attr);
+	return event_queue(WATCH(user_data), ev, status);
+} /* watch_attribute */
+
+#undef ENCODE
+
+static sdb_store_writer_t watch_writer = {
+	watch_host, watch_service, watch_metric, watch_attribute,
+};
+
+/*
+ * public API
+ */
+
+int
+sdb_conn_watch(sdb_conn_t *conn)
+{
+	sdb_llist_t *parsetree;
+	sdb_ast_node_t *ast;
+	sdb_object_t *watch;
+	const char *query;
+	size_t query_len;
+	char name[32];
+	uint32_t id;
+
+	if ((! conn) || (conn->cmd != SDB_CONNECTION_WATCH))
+		return -1;
+
+	if (conn->cmd_len < sizeof(uint32_t)) {
+		sdb_log(SDB_LOG_ERR, "frontend: Invalid command length %d for "
+				"WATCH command", conn->cmd_len);
+		sdb_strbuf_sprintf(conn->errbuf, "WATCH: Invalid command length %d",
+				conn->cmd_len);
+		return -1;
+	}
+	sdb_proto_unmarshal_int32(SDB_STRBUF_STR(conn->buf), &id);
+	snprintf(name, sizeof(name), "%"PRIu32, id);
+
+	query = sdb_strbuf_string(conn->buf) + sizeof(uint32_t);
+	query_len = conn->cmd_len - sizeof(uint32_t);
+
+	/* replace any existing subscription of the same name */
+	watch = sdb_llist_remove_by_name(conn->watches, name);
+	if (watch) {
+		watch_cancel(WATCH(watch));
+		sdb_object_deref(watch);
+	}
+	else if (! query_len) {
+		sdb_strbuf_sprintf(conn->errbuf, "WATCH: Unknown subscription %s",
+				name);
+		return -1;
+	}
+
+	if (! query_len) {
+		sdb_connection_send(conn, SDB_CONNECTION_OK, 0, NULL);
+		return 0;
+	}
+
+	if (sdb_llist_len(conn->watches) >= MAX_WATCHES) {
+		sdb_strbuf_sprintf(conn->errbuf, "WATCH: Too many subscriptions "
+				"(max: %d)", MAX_WATCHES);
+		return -1;
+	}
+
+	parsetree = sdb_parser_parse(query, (int)query_len, conn->errbuf);
+	if (! parsetree) {
+		char q[query_len + 1];
+		strncpy(q, query, query_len);
+		q[sizeof(q) - 1] = '\0';
+		sdb_log(SDB_LOG_ERR, "frontend: Failed to parse query '%s': %s",
+				q, sdb_strbuf_string(conn->errbuf));
+		return -1;
+	}
+	if (sdb_llist_len(parsetree) != 1) {
+		sdb_strbuf_sprintf(conn->errbuf, "WATCH: Expected a single "
+				"statement, got %zu", sdb_llist_len(parsetree));
+		sdb_llist_destroy(parsetree);
+		return -1;
+	}
+
+	ast = SDB_AST_NODE(sdb_llist_get(parsetree, 0));
+	sdb_llist_destroy(parsetree);
+
+	watch = sdb_object_create(name, watch_type, id, conn->notify_fd);
+	if (! watch) {
+		sdb_strbuf_sprintf(conn->errbuf, "Out of memory");
+		sdb_object_deref(SDB_OBJ(ast));
+		return -1;
+	}
+
+	WATCH(watch)->handle = sdb_plugin_watch(ast, &watch_writer, watch,
+			conn->errbuf);
+	sdb_object_deref(SDB_OBJ(ast));
+	if (! WATCH(watch)->handle) {
+		sdb_object_deref(watch);
+		return -1;
+	}
+
+	if (! conn->watches)
+		conn->watches = sdb_llist_create();
+	if ((! conn->watches) || sdb_llist_append(conn->watches, watch)) {
+		sdb_strbuf_sprintf(conn->errbuf, "Out of memory");
+		watch_cancel(WATCH(watch));
+		sdb_object_deref(watch);
+		return -1;
+	}
+	sdb_object_deref(watch);
+
+	sdb_connection_send(conn, SDB_CONNECTION_OK, 0, NULL);
+	return 0;
+} /* sdb_conn_watch */
+
+bool
+sdb_conn_watch_pending(sdb_conn_t *conn)
+{
+	sdb_llist_iter_t *iter;
+	bool pending = 0;
+
+	if ((! conn) || (! sdb_llist_len(conn->watches)))
+		return 0;
+
+	iter = sdb_llist_get_iter(conn->watches);
+	while (sdb_llist_iter_has_next(iter) && (! pending)) {
+		sdb_lru_stats_t stats;
+		sdb_lru_stats(WATCH(sdb_llist_iter_get_next(iter))->events, &stats);
+		pending = stats.size > 0;
+	}
+	sdb_llist_iter_destroy(iter);
+	return pending;
+} /* sdb_conn_watch_pending */
+
+int
+sdb_conn_watch_flush(sdb_conn_t *conn)
+{
+	sdb_llist_iter_t *iter;
+	int n = 0;
+
+	if (! conn)
+		return -1;
+	if (! sdb_llist_len(conn->watches))
+		return 0;
+
+	iter = sdb_llist_get_iter(conn->watches);
+	while (sdb_llist_iter_has_next(iter) && (conn->fd >= 0)) {
+		watch_t *watch = WATCH(sdb_llist_iter_get_next(iter));
+		sdb_lru_stats_t stats;
+		sdb_object_t *ev;
+
+		sdb_lru_stats(watch->events, &stats);
+		if (stats.evictions > watch->dropped) {
+			uint64_t dropped = stats.evictions - watch->dropped;
+			sdb_strbuf_t *msg = sdb_strbuf_create(64);
+			char prio[sizeof(uint32_t)];
+
+			watch->dropped = stats.evictions;
+			sdb_proto_marshal_int32(prio, sizeof(prio), SDB_LOG_WARNING);
+			sdb_strbuf_memcpy(msg, prio, sizeof(prio));
+			sdb_strbuf_append(msg, "Subscription %s dropped %"PRIu64" "
+					"event%s; client is not keeping up",
+					SDB_OBJ(watch)->name, dropped, dropped == 1 ? "" : "s");
+			sdb_connection_send(conn, SDB_CONNECTION_LOG,
+					(uint32_t)sdb_strbuf_len(msg), sdb_strbuf_string(msg));
+			sdb_strbuf_destroy(msg);
+		}
+
+		while ((conn->fd >= 0) && (ev = sdb_lru_shift(watch->events))) {
+			if (sdb_connection_send(conn, SDB_CONNECTION_EVENT,
+						(uint32_t)sdb_strbuf_len(EVENT(ev)->msg),
+						sdb_strbuf_string(EVENT(ev)->msg)) > 0)
+				++n;
+			sdb_object_deref(ev);
+		}
+	}
+	sdb_llist_iter_destroy(iter);
+
+	if (conn->fd < 0)
+		return -1;
+	return n;
+} /* sdb_conn_watch_flush */
+
+void
+sdb_conn_watch_clear(sdb_conn_t *conn)
+{
+	sdb_object_t *watch;
+
+	if (! conn)
+		return;
+
+	while ((watch = sdb_llist_shift(conn->watches))) {
+		watch_cancel(WATCH(watch));
+		sdb_object_deref(watch);
+	}
+	sdb_llist_destroy(conn->watches);
+	conn->watches = NULL;
+} /* sdb_conn_watch_clear */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
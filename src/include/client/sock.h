@@ -87,6 +87,36 @@ sdb_client_set_ssl_options(sdb_client_t *client, const sdb_ssl_options_t *opts);
 int
 sdb_client_connect(sdb_client_t *client, const char *username);
 
+/*
+ * sdb_client_set_compression:
+ * Request compression of large messages using the specified algorithm (see
+ * sdb_conn_compression_t). Compression is negotiated with the server when
+ * connecting; if the server does not support it, the connection continues
+ * uncompressed. The setting applies to all subsequent connections.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value if the algorithm is not supported by this build
+ */
+int
+sdb_client_set_compression(sdb_client_t *client, uint32_t algo);
+
+/*
+ * sdb_client_set_option:
+ * Change a setting of the current connection (see SDB_CONNECTION_SET_OPTION
+ * and sdb_conn_option_t). For example, setting
+ * SDB_CONNECTION_OPTION_RESULT_FORMAT to SDB_CONNECTION_RESULT_BINARY
+ * switches query results to the binary format which may be decoded using
+ * sdb_proto_unmarshal_object. Settings have to be applied again after
+ * reconnecting.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else, e.g., if the server does not support the setting
+ */
+int
+sdb_client_set_option(sdb_client_t *client, uint32_t opt, uint32_t value);
+
 /*
  * sdb_client_sockfd:
  * Return the client socket's file descriptor.
@@ -168,6 +198,16 @@ sdb_client_recv(sdb_client_t *client,
 bool
 sdb_client_eof(sdb_client_t *client);
 
+/*
+ * sdb_client_pending:
+ * Returns true if data received from the server has been buffered already,
+ * that is, if it may be read without the client socket becoming readable.
+ * This is meant to be used when waiting for the socket using select() or
+ * similar.
+ */
+bool
+sdb_client_pending(sdb_client_t *client);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
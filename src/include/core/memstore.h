@@ -37,6 +37,7 @@
 #include "utils/strbuf.h"
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 
 #ifdef __cplusplus
@@ -104,11 +105,18 @@ extern sdb_store_writer_t sdb_memstore_writer;
 extern sdb_store_reader_t sdb_memstore_reader;
 
 /*
- * sdb_memstore_create:
- * Allocate a new in-memory store.
+ * sdb_memstore_create, sdb_memstore_create_sharded:
+ * Allocate a new in-memory store. A sharded store partitions all hosts into
+ * the specified number of shards based on a hash of the hostname. Each shard
+ * is protected by its own lock such that updates of hosts in different shards
+ * may happen in parallel. Scans merge the objects of all shards in order;
+ * large stores are scanned using one thread per shard.
+ * sdb_memstore_create creates a store using a single shard.
  */
 sdb_memstore_t *
 sdb_memstore_create(void);
+sdb_memstore_t *
+sdb_memstore_create_sharded(size_t shards);
 
 /*
  * sdb_memstore_host, sdb_memstore_service, sdb_memstore_metric,
@@ -149,6 +157,17 @@ sdb_memstore_metric_attr(sdb_memstore_t *store, const char *hostname,
 sdb_memstore_obj_t *
 sdb_memstore_get_host(sdb_memstore_t *store, const char *name);
 
+/*
+ * sdb_memstore_generation:
+ * Return the current generation of the store. The generation is incremented
+ * on each successful update and may be used to detect whether any stored
+ * objects changed. If 'hostname' is specified and refers to a known host,
+ * the generation of the last update of that host or any of its children is
+ * returned instead. The first update of a store results in generation 1.
+ */
+uint64_t
+sdb_memstore_generation(sdb_memstore_t *store, const char *hostname);
+
 /*
  * sdb_memstore_get_child:
  * Retrieve an object's child object of the specified type and name. The
@@ -236,6 +255,32 @@ sdb_memstore_query_prepare(sdb_ast_node_t *ast);
 sdb_memstore_matcher_t *
 sdb_memstore_query_prepare_matcher(sdb_ast_node_t *ast);
 
+/*
+ * sdb_memstore_query_params:
+ * Returns the number of parameters expected by the query, that is, the
+ * highest placeholder index ($1, $2, ...) referenced in the query.
+ */
+size_t
+sdb_memstore_query_params(sdb_memstore_query_t *q);
+
+/*
+ * sdb_memstore_query_bind:
+ * Bind the specified values to the query's placeholders; values[i] is used
+ * for placeholder $(i+1). Exactly as many values as returned by
+ * sdb_memstore_query_params have to be provided. A query referencing any
+ * placeholders may only be executed after binding values to them. Binding
+ * values modifies the query; callers have to make sure that it is not
+ * executed concurrently. Binding zero values to a query without placeholders
+ * is a no-op. Any errors are written to 'errbuf'.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else
+ */
+int
+sdb_memstore_query_bind(sdb_memstore_query_t *q,
+		const sdb_data_t *values, size_t values_num, sdb_strbuf_t *errbuf);
+
 /*
  * sdb_memstore_query_execute:
  * Execute a previously prepared query in the specified store. The query
@@ -249,6 +294,38 @@ int
 sdb_memstore_query_execute(sdb_memstore_t *store, sdb_memstore_query_t *m,
 		sdb_store_writer_t *w, sdb_object_t *wd, sdb_strbuf_t *errbuf);
 
+/*
+ * sdb_memstore_watch:
+ * Subscribe to updates of stored objects matching the specified (prepared)
+ * LOOKUP query. Whenever a matching object or any of its (filtered)
+ * attributes is changed, the updated object is sent to the specified store
+ * writer; updates of the timestamp only are not reported. The writer is
+ * called while holding the store's lock; it must not block or access the
+ * store. Queries using placeholders cannot be watched. Any errors are
+ * written to 'errbuf'.
+ *
+ * Returns:
+ *  - a watch object to be passed to sdb_memstore_unwatch() on success
+ *  - NULL else
+ */
+sdb_object_t *
+sdb_memstore_watch(sdb_memstore_t *store, sdb_memstore_query_t *q,
+		sdb_store_writer_t *w, sdb_object_t *wd, sdb_strbuf_t *errbuf);
+
+/*
+ * sdb_memstore_unwatch:
+ * Cancel a subscription registered using sdb_memstore_watch(). No further
+ * updates will be sent once this function returns. The caller still has to
+ * release the watch object.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a positive value if the watch is not registered with the store
+ *  - a negative value else
+ */
+int
+sdb_memstore_unwatch(sdb_memstore_t *store, sdb_object_t *watch);
+
 /*
  * sdb_memstore_expr_create:
  * Creates an arithmetic expression implementing the specified operator on the
@@ -299,6 +376,18 @@ sdb_memstore_expr_fieldvalue(int field);
 sdb_memstore_expr_t *
 sdb_memstore_expr_attrvalue(const char *name);
 
+/*
+ * sdb_memstore_expr_param:
+ * Creates an expression which evaluates to a query parameter. The value is
+ * provided when binding values to the query using sdb_memstore_query_bind.
+ *
+ * Returns:
+ *  - an expression object on success
+ *  - NULL else
+ */
+sdb_memstore_expr_t *
+sdb_memstore_expr_param(void);
+
 /*
  * sdb_memstore_expr_constvalue:
  * Creates an expression which evaluates to the specified constant value.
@@ -501,6 +590,24 @@ sdb_memstore_scan(sdb_memstore_t *store, int type,
 		sdb_memstore_matcher_t *m, sdb_memstore_matcher_t *filter,
 		sdb_memstore_lookup_cb cb, void *user_data);
 
+/*
+ * sdb_memstore_scan_changed:
+ * Look up objects of the specified type which changed after the modification
+ * sequence number 'since' (see the 'sequence' field). Other than that, it
+ * behaves like sdb_memstore_scan but only visits the changed objects, making
+ * the cost proportional to the number of changes rather than the size of the
+ * store. Objects are passed to the callback in the same order as by
+ * sdb_memstore_scan.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else
+ */
+int
+sdb_memstore_scan_changed(sdb_memstore_t *store, int type, uint64_t since,
+		sdb_memstore_matcher_t *m, sdb_memstore_matcher_t *filter,
+		sdb_memstore_lookup_cb cb, void *user_data);
+
 /*
  * sdb_memstore_emit:
  * Send a single object to the specified store writer. Attributes or any child
@@ -528,6 +635,169 @@ int
 sdb_memstore_emit_full(sdb_memstore_obj_t *obj, sdb_memstore_matcher_t *filter,
 		sdb_store_writer_t *w, sdb_object_t *wd);
 
+/*
+ * sdb_memstore_snapshot:
+ * Write a snapshot of all objects of the store to the specified file. The
+ * store is serialized one shard at a time and written in parts of a bounded
+ * size; only the lock of the current shard is held while serializing a part
+ * and none while writing it. Each host is serialized from a consistent view
+ * while other hosts may be updated in the meantime. The file atomically
+ * replaces any previous snapshot once it has been written completely.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else
+ */
+int
+sdb_memstore_snapshot(sdb_memstore_t *store, const char *filename);
+
+/*
+ * sdb_memstore_load_snapshot:
+ * Load all objects from the specified snapshot file into the store. Objects
+ * are merged with the store's contents using the regular update semantics.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a positive value if the file does not exist
+ *  - a negative value else
+ */
+int
+sdb_memstore_load_snapshot(sdb_memstore_t *store, const char *filename);
+
+/*
+ * A write-ahead log records all updates of an in-memory store such that they
+ * may be replayed on top of the latest snapshot after a restart. Records are
+ * written by a background thread; concurrent updates are committed to disk
+ * as a group.
+ */
+struct sdb_memstore_wal;
+typedef struct sdb_memstore_wal sdb_memstore_wal_t;
+
+/*
+ * Sync policies of a write-ahead log:
+ *  - SDB_MEMSTORE_WAL_SYNC_NONE: leave it to the operating system to flush
+ *    written records to disk
+ *  - SDB_MEMSTORE_WAL_SYNC_INTERVAL: flush records to disk periodically
+ *  - SDB_MEMSTORE_WAL_SYNC_ALWAYS: flush records to disk before
+ *    acknowledging an update
+ */
+enum {
+	SDB_MEMSTORE_WAL_SYNC_NONE = 0,
+	SDB_MEMSTORE_WAL_SYNC_INTERVAL,
+	SDB_MEMSTORE_WAL_SYNC_ALWAYS,
+};
+
+/*
+ * sdb_memstore_wal_writer:
+ * A store writer implementation which applies all updates to an in-memory
+ * store and appends them to a write-ahead log. It expects a write-ahead log
+ * object as its user-data argument.
+ */
+extern sdb_store_writer_t sdb_memstore_wal_writer;
+
+/*
+ * sdb_memstore_wal_create:
+ * Open a write-ahead log for the specified store, appending to any existing
+ * file. The sync interval is used by the SDB_MEMSTORE_WAL_SYNC_INTERVAL
+ * policy only. Replay the log using sdb_memstore_wal_replay before opening
+ * it.
+ *
+ * Returns:
+ *  - a write-ahead log object on success
+ *  - NULL else
+ */
+sdb_memstore_wal_t *
+sdb_memstore_wal_create(sdb_memstore_t *store, const char *filename,
+		int sync, sdb_time_t sync_interval);
+
+/*
+ * sdb_memstore_wal_replay:
+ * Apply all updates recorded in the specified write-ahead log to the store.
+ * Updates older than the stored objects are skipped, making it safe to
+ * replay the log on top of a snapshot including some of the updates. Torn
+ * or corrupt records at the end of the log are discarded.
+ *
+ * Returns:
+ *  - 0 on success (including a missing log file)
+ *  - a negative value else
+ */
+int
+sdb_memstore_wal_replay(sdb_memstore_t *store, const char *filename);
+
+/*
+ * sdb_memstore_wal_checkpoint:
+ * Compact the write-ahead log by writing a snapshot of its store to the
+ * specified file (see sdb_memstore_snapshot) and discarding all records
+ * included in the snapshot.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else
+ */
+int
+sdb_memstore_wal_checkpoint(sdb_memstore_wal_t *wal, const char *snapshot);
+
+/*
+ * Replication: a store may record recent updates in a backlog of bounded size
+ * from which replicas read a stream of entries, each describing the state of
+ * an object after an update. Entries are identified by the stream's
+ * identifier and their (increasing) sequence number. A replica which is not
+ * able to resume from its last position (e.g., because the backlog no longer
+ * includes it) first receives a full copy of the store.
+ */
+
+/*
+ * sdb_memstore_enable_replication:
+ * Start recording updates of the store in a backlog of about the specified
+ * size (in bytes). Each call to this function starts a new replication
+ * stream; it is meant to be called before storing any objects.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else
+ */
+int
+sdb_memstore_enable_replication(sdb_memstore_t *store, size_t backlog_size);
+
+/*
+ * sdb_memstore_replicate:
+ * Append all entries of the replication stream following the position 'pos'
+ * to 'buf' (up to about 'max' bytes) and advance the position accordingly.
+ * If the position is not available, start a full copy of the store instead:
+ * one entry (with sequence number zero) for each object, followed by an
+ * empty entry (of type zero) carrying the position which the copy reflects.
+ * The copy is written in parts of about 'max' bytes, one part per call,
+ * while 'pos' keeps track of its progress; only a single shard is locked at
+ * a time. Once the copy is complete, 'pos' refers to the position which it
+ * reflects. If 'buf' is NULL, only check whether any entries are pending.
+ * Unless there are, a byte will be written to 'notify_fd' (if not negative)
+ * as soon as there are.
+ *
+ * Returns:
+ *  - zero if the stream continues at the requested position (or no entries
+ *    are pending)
+ *  - a positive value if a part of a full copy of the store was written (or
+ *    entries are pending); the copy is complete once pos->copying is false
+ *  - a negative value on error, e.g. if replication is not enabled
+ */
+int
+sdb_memstore_replicate(sdb_memstore_t *store, sdb_store_repl_pos_t *pos,
+		sdb_strbuf_t *buf, size_t max, int notify_fd);
+
+/*
+ * sdb_memstore_apply_replication:
+ * Apply the entries of a replication stream (as written by
+ * sdb_memstore_replicate) to the store. 'seq' is set to the position of the
+ * last entry carrying a sequence number.
+ *
+ * Returns:
+ *  - the number of applied entries on success
+ *  - a negative value if the entries are malformed
+ */
+int
+sdb_memstore_apply_replication(sdb_memstore_t *store,
+		const char *buf, size_t len, uint64_t *seq);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -33,6 +33,7 @@
 #include "core/store.h"
 #include "core/time.h"
 #include "core/timeseries.h"
+#include "utils/lru.h"
 
 #include "liboconfig/oconfig.h"
 
@@ -45,8 +46,12 @@ extern "C" {
 
 typedef struct {
 	sdb_time_t interval;
+
+	/* the maximum run-time of a collector before a warning will be logged;
+	 * zero disables the check */
+	sdb_time_t timeout;
 } sdb_plugin_ctx_t;
-#define SDB_PLUGIN_CTX_INIT { 0 }
+#define SDB_PLUGIN_CTX_INIT { 0, 0 }
 
 typedef struct {
 	char *plugin_name;
@@ -74,8 +79,28 @@ typedef struct {
 typedef struct {
 	bool do_loop;
 	sdb_time_t default_interval;
+
+	/* the number of threads used to run collectors concurrently;
+	 * zero runs all collectors sequentially in the loop's thread */
+	size_t num_threads;
 } sdb_plugin_loop_t;
-#define SDB_PLUGIN_LOOP_INIT { 1, 0 }
+#define SDB_PLUGIN_LOOP_INIT { 1, 0, 0 }
+
+/*
+ * sdb_plugin_collector_stats_t:
+ * Run-time statistics of a collector callback.
+ */
+typedef struct {
+	size_t runs;
+	size_t failures;
+	size_t timeouts;
+	/* the number of times iterations were skipped to keep up */
+	size_t overruns;
+
+	sdb_time_t last_runtime;
+	sdb_time_t max_runtime;
+	sdb_time_t total_runtime;
+} sdb_plugin_collector_stats_t;
 
 /*
  * sdb_plugin_load:
@@ -273,6 +298,36 @@ int
 sdb_plugin_register_writer(const char *name,
 		sdb_store_writer_t *writer, sdb_object_t *user_data);
 
+/*
+ * sdb_plugin_writer_opts_t:
+ * Options controlling which updates are passed on to a store writer. Backends
+ * usually re-submit all of their objects periodically, most of which only
+ * refresh the objects' update timestamps.
+ */
+typedef struct {
+	/* If enabled, only pass on updates which actually change an object, that
+	 * is, new objects, new backends, changed attribute values, or new metric
+	 * data-stores. */
+	bool changes_only;
+
+	/* If 'changes_only' is enabled, also pass on an unchanged object about
+	 * once per heartbeat interval to keep its update timestamp recent;
+	 * zero disables heartbeats. */
+	sdb_time_t heartbeat;
+} sdb_plugin_writer_opts_t;
+#define SDB_DEFAULT_WRITER_OPTS { false, 0 }
+
+/*
+ * sdb_plugin_register_writer_opts:
+ * Register a "writer" implementation like sdb_plugin_register_writer but
+ * using the specified options rather than the default options which pass on
+ * all updates.
+ */
+int
+sdb_plugin_register_writer_opts(const char *name,
+		sdb_store_writer_t *writer, const sdb_plugin_writer_opts_t *opts,
+		sdb_object_t *user_data);
+
 /*
  * sdb_plugin_register_reader:
  * Register a "reader" implementation for querying the store. It is invalid to
@@ -379,8 +434,13 @@ sdb_plugin_shutdown_all(void);
 
 /*
  * sdb_plugin_collector_loop:
- * Loop until loop->do_loop is false, calling the next collector function on
- * each iteration and once its next update interval is passed.
+ * Loop until loop->do_loop is false, calling each collector function once
+ * its next update interval is passed. If loop->num_threads is non-zero,
+ * collectors are dispatched to a pool of that many threads and run
+ * concurrently. A collector is never run again before its previous run has
+ * finished. Runs exceeding the collector's timeout are reported but not
+ * interrupted. Statistics about all collectors are logged when the loop
+ * terminates.
  *
  * Returns:
  *  - 0 on success
@@ -389,16 +449,91 @@ sdb_plugin_shutdown_all(void);
 int
 sdb_plugin_collector_loop(sdb_plugin_loop_t *loop);
 
+/*
+ * sdb_plugin_get_collector_stats:
+ * Retrieve the run-time statistics of the collector callback registered
+ * under the specified name.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value if no such collector exists
+ */
+int
+sdb_plugin_get_collector_stats(const char *name,
+		sdb_plugin_collector_stats_t *stats);
+
 /*
  * sdb_plugin_cname:
  * Returns the canonicalized hostname. The given hostname argument has to
  * point to dynamically allocated memory and might be freed by the function.
  * The return value will also be dynamically allocated (but it might be
- * unchanged) and has to be freed by the caller.
+ * unchanged) and has to be freed by the caller. If enabled, results are
+ * looked up from the cname cache first (see
+ * sdb_plugin_cname_cache_configure).
  */
 char *
 sdb_plugin_cname(char *hostname);
 
+/*
+ * sdb_plugin_cname_cache_opts_t:
+ * Options controlling the cache of canonicalized hostnames.
+ *
+ *  - size: the maximum number of cached hostnames; zero disables the cache
+ *  - ttl: the time for which a hostname changed by any cname callback is
+ *    cached
+ *  - negative_ttl: the time for which a hostname left unchanged by all
+ *    cname callbacks (for example, due to a failed lookup) is cached
+ *  - num_threads: the number of resolver threads; if non-zero, expired
+ *    entries are still used while being refreshed in the background and
+ *    uncached hostnames are resolved in the background as well
+ *  - timeout: the maximum time to wait for a resolver thread when looking
+ *    up an uncached hostname; the hostname is used unchanged on timeout
+ */
+typedef struct {
+	size_t size;
+	sdb_time_t ttl;
+	sdb_time_t negative_ttl;
+	size_t num_threads;
+	sdb_time_t timeout;
+} sdb_plugin_cname_cache_opts_t;
+#define SDB_PLUGIN_CNAME_CACHE_OPTS_INIT { \
+	0, SECS_TO_SDB_TIME(3600), SECS_TO_SDB_TIME(60), \
+	0, SECS_TO_SDB_TIME(1) }
+
+/*
+ * sdb_plugin_cname_cache_stats_t:
+ * Usage statistics of the cname cache.
+ */
+typedef struct {
+	sdb_lru_stats_t lru;
+
+	/* expired entries used while being refreshed */
+	uint64_t stale;
+	/* lookups for which no resolver thread answered in time */
+	uint64_t timeouts;
+} sdb_plugin_cname_cache_stats_t;
+
+/*
+ * sdb_plugin_cname_cache_configure:
+ * (Re-)create the cname cache based on the specified options. Any previously
+ * cached names are dropped and the statistics of the previous cache are
+ * logged. Passing NULL disables the cache.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else
+ */
+int
+sdb_plugin_cname_cache_configure(const sdb_plugin_cname_cache_opts_t *opts);
+
+/*
+ * sdb_plugin_cname_cache_stats:
+ * Retrieve usage statistics of the cname cache. All values are zero if the
+ * cache is disabled.
+ */
+void
+sdb_plugin_cname_cache_stats(sdb_plugin_cname_cache_stats_t *stats);
+
 /*
  * sdb_plugin_log:
  * Log the specified message using all registered log callbacks. The message
@@ -473,12 +608,178 @@ sdb_plugin_query(sdb_ast_node_t *ast,
 		sdb_store_writer_t *w, sdb_object_t *wd,
 		sdb_query_opts_t *opts, sdb_strbuf_t *errbuf);
 
+/*
+ * sdb_plugin_prepare_query:
+ * Prepare the query specified by 'ast' for (repeated) execution using all
+ * registered store readers. The query may reference placeholders ($1, $2,
+ * ...) which have to be bound when executing it. Any errors will be written
+ * to 'errbuf'.
+ *
+ * If multiple readers are registered, the query will be executed by all of
+ * them in parallel (federated query). The hosts are expected to be
+ * partitioned across the readers. The results are merged in host order; if
+ * a host is returned by more than one reader anyway, the most recently
+ * updated copy will be used. A FETCH query succeeds if any of the readers
+ * finds the requested object while LIST and LOOKUP queries fail if any of
+ * the readers fails.
+ *
+ * Returns:
+ *  - a prepared query object on success
+ *  - NULL else
+ */
+sdb_object_t *
+sdb_plugin_prepare_query(sdb_ast_node_t *ast, sdb_strbuf_t *errbuf);
+
+/*
+ * sdb_plugin_execute_query:
+ * Bind the specified parameters to a query prepared using
+ * sdb_plugin_prepare_query and execute it. The result will be written to the
+ * specified store writer and any errors will be written to 'errbuf'. A
+ * prepared query using placeholders must not be executed concurrently;
+ * queries without placeholders may be shared.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else
+ */
+int
+sdb_plugin_execute_query(sdb_object_t *prepared,
+		const sdb_data_t *params, size_t params_num,
+		sdb_store_writer_t *w, sdb_object_t *wd,
+		sdb_query_opts_t *opts, sdb_strbuf_t *errbuf);
+
+/*
+ * sdb_plugin_watch:
+ * Subscribe to updates of objects matching the LOOKUP query specified by
+ * 'ast' using all registered store readers. Each update of a matching object
+ * (or any of its attributes) will be sent to the specified store writer as
+ * it is being stored. The writer may be called from any thread storing
+ * objects and must not block. Releasing the returned object (using
+ * sdb_object_deref) cancels the subscription. Any errors will be written to
+ * 'errbuf'.
+ *
+ * Returns:
+ *  - a subscription object on success
+ *  - NULL else
+ */
+sdb_object_t *
+sdb_plugin_watch(sdb_ast_node_t *ast,
+		sdb_store_writer_t *w, sdb_object_t *wd, sdb_strbuf_t *errbuf);
+
+/*
+ * sdb_plugin_query_generation:
+ * Query the generation of the store as reported by the registered readers
+ * (see the reader's 'generation' callback for details). Results of queries
+ * for the specified host (or all hosts, if NULL) remain valid as long as the
+ * generation does not change. If multiple readers are registered, the sum of
+ * their generations is returned; it is unknown if any reader does not know
+ * its generation.
+ *
+ * Returns:
+ *  - the current generation
+ *  - zero if it is unknown
+ */
+uint64_t
+sdb_plugin_query_generation(const char *hostname);
+
+/*
+ * sdb_plugin_replicate:
+ * Read from the replication stream of the first registered store reader
+ * supporting replication (see the reader's 'replicate' callback). Any errors
+ * will be written to 'errbuf'.
+ *
+ * Returns:
+ *  - zero if the stream continues at the requested position (or, if 'buf'
+ *    is NULL, nothing is pending)
+ *  - a positive value if (a part of) a full copy of the store was written
+ *    (or something is pending)
+ *  - a negative value else
+ */
+int
+sdb_plugin_replicate(sdb_store_repl_pos_t *pos,
+		sdb_strbuf_t *buf, size_t max, int notify_fd, sdb_strbuf_t *errbuf);
+
+/*
+ * sdb_plugin_ingest_opts_t:
+ * Options controlling the asynchronous ingest pipeline.
+ *
+ *  - num_threads: the number of writer threads; each has its own queue and
+ *    handles all objects belonging to a subset of the hosts
+ *  - queue_size: the maximum number of objects queued for each thread;
+ *    storing an object blocks while the respective queue is full
+ *  - batch_size: the maximum number of objects handled by a writer thread
+ *    in one go
+ */
+typedef struct {
+	size_t num_threads;
+	size_t queue_size;
+	size_t batch_size;
+} sdb_plugin_ingest_opts_t;
+#define SDB_PLUGIN_INGEST_OPTS_INIT { 0, 1024, 64 }
+
+/*
+ * sdb_plugin_ingest_stats_t:
+ * Statistics about the asynchronous ingest pipeline (summed up over all
+ * queues).
+ */
+typedef struct {
+	/* number of objects currently queued and the maximum
+	 * number of objects queued in any queue at any time */
+	size_t queued;
+	size_t max_queued;
+
+	size_t enqueued;
+	size_t processed;
+	size_t failed;
+	size_t batches;
+
+	/* the number of times storing an object had to wait for a full queue */
+	size_t stalls;
+} sdb_plugin_ingest_stats_t;
+
+/*
+ * sdb_plugin_ingest_start:
+ * Start the asynchronous ingest pipeline. While running, all
+ * sdb_plugin_store_* functions queue the objects to be stored and return
+ * immediately. The queued objects are sent to the registered store writers
+ * by separate writer threads. Objects belonging to the same host are
+ * always handled by the same thread in the order they were queued. Does
+ * nothing if opts->num_threads is zero.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else
+ */
+int
+sdb_plugin_ingest_start(const sdb_plugin_ingest_opts_t *opts);
+
+/*
+ * sdb_plugin_ingest_stop:
+ * Stop the asynchronous ingest pipeline after handling all queued objects.
+ * Statistics about the pipeline are logged before shutting it down. Any
+ * further objects will be stored synchronously.
+ */
+void
+sdb_plugin_ingest_stop(void);
+
+/*
+ * sdb_plugin_get_ingest_stats:
+ * Retrieve statistics about the running ingest pipeline.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value if the pipeline is not running
+ */
+int
+sdb_plugin_get_ingest_stats(sdb_plugin_ingest_stats_t *stats);
+
 /*
  * sdb_plugin_store_host, sdb_plugin_store_service, sdb_plugin_store_metric,
  * sdb_plugin_store_attribute, sdb_plugin_store_service_attribute,
  * sdb_plugin_store_metric_attribute:
  * Store an object in the database by sending it to all registered store
- * writer plugins.
+ * writer plugins. If the ingest pipeline is running, the object is queued
+ * instead and any errors storing it are logged by the writer threads.
  *
  * Returns:
  *  - 0 on success
@@ -36,6 +36,7 @@
 #include "parser/ast.h"
 #include "utils/strbuf.h"
 
+#include <stdint.h>
 #include <stdio.h>
 
 #ifdef __cplusplus
@@ -63,6 +64,7 @@ enum {
 	SDB_FIELD_BACKEND,       /* type: array of strings */
 	SDB_FIELD_VALUE,         /* attributes only;  type: type of the value */
 	SDB_FIELD_TIMESERIES,    /* metrics only;  type: boolean */
+	SDB_FIELD_SEQUENCE,      /* type: integer */
 };
 #define SDB_STORE_TYPE_TO_NAME(t) \
 	(((t) == SDB_HOST) ? "host" \
@@ -83,6 +85,7 @@ enum {
 		: ((f) == SDB_FIELD_BACKEND) ? "backend" \
 		: ((f) == SDB_FIELD_VALUE) ? "value" \
 		: ((f) == SDB_FIELD_TIMESERIES) ? "timeseries" \
+		: ((f) == SDB_FIELD_SEQUENCE) ? "sequence" \
 		: "unknown")
 
 #define SDB_FIELD_TYPE(f) \
@@ -93,6 +96,7 @@ enum {
 		: ((f) == SDB_FIELD_BACKEND) ? (SDB_TYPE_ARRAY | SDB_TYPE_STRING) \
 		: ((f) == SDB_FIELD_VALUE) ? -1 /* unknown */ \
 		: ((f) == SDB_FIELD_TIMESERIES) ? SDB_TYPE_BOOLEAN \
+		: ((f) == SDB_FIELD_SEQUENCE) ? SDB_TYPE_INTEGER \
 		: -1)
 
 /*
@@ -105,8 +109,11 @@ typedef struct {
 	sdb_time_t interval;
 	const char * const *backends;
 	size_t backends_num;
+
+	/* modification sequence number; 0 if unknown */
+	uint64_t seq;
 } sdb_store_host_t;
-#define SDB_STORE_HOST_INIT { NULL, 0, 0, NULL, 0 }
+#define SDB_STORE_HOST_INIT { NULL, 0, 0, NULL, 0, 0 }
 
 /*
  * sdb_store_service_t represents the meta-data of a stored service object.
@@ -119,8 +126,10 @@ typedef struct {
 	sdb_time_t interval;
 	const char * const *backends;
 	size_t backends_num;
+
+	uint64_t seq;
 } sdb_store_service_t;
-#define SDB_STORE_SERVICE_INIT { NULL, NULL, 0, 0, NULL, 0 }
+#define SDB_STORE_SERVICE_INIT { NULL, NULL, 0, 0, NULL, 0, 0 }
 
 /*
  * sdb_metric_store_t specifies how to access a metric's data.
@@ -148,8 +157,10 @@ typedef struct {
 	sdb_time_t interval;
 	const char * const *backends;
 	size_t backends_num;
+
+	uint64_t seq;
 } sdb_store_metric_t;
-#define SDB_STORE_METRIC_INIT { NULL, NULL, NULL, 0, 0, 0, NULL, 0 }
+#define SDB_STORE_METRIC_INIT { NULL, NULL, NULL, 0, 0, 0, NULL, 0, 0 }
 
 /*
  * sdb_store_attribute_t represents a stored attribute.
@@ -165,8 +176,30 @@ typedef struct {
 	sdb_time_t interval;
 	const char * const *backends;
 	size_t backends_num;
+
+	uint64_t seq;
 } sdb_store_attribute_t;
-#define SDB_STORE_ATTRIBUTE_INIT { NULL, 0, NULL, NULL, SDB_DATA_INIT, 0, 0, NULL, 0 }
+#define SDB_STORE_ATTRIBUTE_INIT { NULL, 0, NULL, NULL, SDB_DATA_INIT, 0, 0, NULL, 0, 0 }
+
+/*
+ * sdb_store_repl_pos_t represents a position within the replication stream
+ * of a store. While a full copy of the store is being read in multiple steps
+ * (see the reader's 'replicate' callback), it also keeps track of the
+ * progress of the copy. 'copy_key' is managed by the store; it has to be
+ * released using free() once the position is no longer used.
+ */
+typedef struct {
+	/* identifier of the stream and sequence number of the last entry */
+	uint64_t id;
+	uint64_t seq;
+
+	/* progress of a full copy reflecting the above position: the current
+	 * partition of the store and the name of the last host copied */
+	bool copying;
+	size_t copy_part;
+	char *copy_key;
+} sdb_store_repl_pos_t;
+#define SDB_STORE_REPL_POS_INIT { 0, 0, 0, 0, NULL }
 
 /*
  * A JSON formatter converts stored objects into the JSON format.
@@ -178,6 +211,20 @@ typedef struct {
 struct sdb_store_json_formatter;
 typedef struct sdb_store_json_formatter sdb_store_json_formatter_t;
 
+/*
+ * A binary formatter converts stored objects into a compact binary format
+ * based on the wire format used by the frontend protocol (see utils/proto.h).
+ * Each object is written as a record as expected by
+ * sdb_proto_unmarshal_object. Only the basic information of each object
+ * (name, parent names, last-update timestamp, metric stores, and attribute
+ * values) is included.
+ *
+ * A binary formatter object inherits from sdb_object_t and, thus, may safely
+ * be cast to a generic object.
+ */
+struct sdb_store_binary_formatter;
+typedef struct sdb_store_binary_formatter sdb_store_binary_formatter_t;
+
 /*
  * A store writer describes the interface for plugins implementing a store.
  *
@@ -249,13 +296,68 @@ typedef struct {
 	int (*execute_query)(sdb_object_t *q,
 			sdb_store_writer_t *w, sdb_object_t *wd,
 			sdb_strbuf_t *errbuf, sdb_object_t *user_data);
+
+	/*
+	 * generation (optional):
+	 * Return a counter which changes whenever any stored object changes. If
+	 * 'hostname' is specified, it is sufficient for the counter to change
+	 * whenever the specified host or any of its children change. Query
+	 * results may be reused as long as the generation does not change. A
+	 * return value of zero means that the generation is unknown.
+	 */
+	uint64_t (*generation)(const char *hostname, sdb_object_t *user_data);
+
+	/*
+	 * bind_query (optional):
+	 * Bind the specified values to the placeholders ($1, $2, ...) of a
+	 * previously prepared query before executing it. values[i] is bound to
+	 * placeholder $(i+1). Readers without this callback do not support
+	 * query parameters. Binding zero values to a query without placeholders
+	 * must not modify the query since it may be executed concurrently.
+	 */
+	int (*bind_query)(sdb_object_t *q,
+			const sdb_data_t *values, size_t values_num,
+			sdb_strbuf_t *errbuf, sdb_object_t *user_data);
+
+	/*
+	 * watch (optional):
+	 * Subscribe to updates of objects matching a previously prepared LOOKUP
+	 * query. Each update of a matching object or any of its attributes is
+	 * sent to the specified writer as it is being stored; the writer must
+	 * not block. The returned watch object is passed to the 'unwatch'
+	 * callback to cancel the subscription. Readers without this callback
+	 * do not support watching queries.
+	 */
+	sdb_object_t *(*watch)(sdb_object_t *q,
+			sdb_store_writer_t *w, sdb_object_t *wd,
+			sdb_strbuf_t *errbuf, sdb_object_t *user_data);
+
+	/*
+	 * unwatch (optional; required if 'watch' is set):
+	 * Cancel a subscription. No further updates may be sent to its writer
+	 * once this callback returns.
+	 */
+	int (*unwatch)(sdb_object_t *watch, sdb_object_t *user_data);
+
+	/*
+	 * replicate (optional):
+	 * Read from the store's replication stream, starting after the position
+	 * 'pos', or check whether there is anything to read if 'buf' is NULL
+	 * (see sdb_memstore_replicate for details). Readers without this
+	 * callback do not support replication.
+	 */
+	int (*replicate)(sdb_store_repl_pos_t *pos,
+			sdb_strbuf_t *buf, size_t max, int notify_fd,
+			sdb_object_t *user_data);
 } sdb_store_reader_t;
 
 /*
  * Flags for JSON formatting.
  */
 enum {
-	SDB_WANT_ARRAY = 1 << 0,
+	SDB_WANT_ARRAY    = 1 << 0,
+	/* include the modification sequence number of each object */
+	SDB_WANT_SEQUENCE = 1 << 1,
 };
 
 /*
@@ -281,6 +383,20 @@ sdb_store_json_finish(sdb_store_json_formatter_t *f);
  */
 extern sdb_store_writer_t sdb_store_json_writer;
 
+/*
+ * sdb_store_binary_formatter:
+ * Create a binary formatter appending all objects to the specified buffer.
+ */
+sdb_store_binary_formatter_t *
+sdb_store_binary_formatter(sdb_strbuf_t *buf);
+
+/*
+ * sdb_store_binary_writer:
+ * A store writer implementation that generates binary output. It expects a
+ * store binary formatter as its user-data argument.
+ */
+extern sdb_store_writer_t sdb_store_binary_writer;
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -65,17 +65,14 @@ void
 sdb_timeseries_info_destroy(sdb_timeseries_info_t *ts_info);
 
 /*
- * A data-point describes a datum at a certain point of time.
- */
-typedef struct {
-	sdb_time_t timestamp;
-	double value;
-} sdb_data_point_t;
-
-/*
- * A timeseries describes one or more sequences of data-points. Multiple
- * sequences will have a name each and share the same start and end times and
- * number of data points.
+ * A timeseries describes one or more sequences of data-points (data-sources).
+ * Multiple sequences will have a name each and share the same start and end
+ * times, number of data points, and time-stamps.
+ *
+ * The data is stored in columns: a single array of time-stamps shared by all
+ * data-sources and a contiguous array of values for each data-source, that
+ * is, the i-th data-point of the j-th data-source is made up of timestamps[i]
+ * and data[j][i]. All arrays are part of a single allocation.
  *
  * Start and end times may diverge slightly from the requested start and end
  * times depending on the resolution available in the backend data-store.
@@ -84,12 +81,54 @@ typedef struct {
 	sdb_time_t start;
 	sdb_time_t end;
 
-	sdb_data_point_t **data;
+	sdb_time_t *timestamps;
+	double **data;
 	size_t data_len;
 	char **data_names;
 	size_t data_names_len;
 } sdb_timeseries_t;
 
+/*
+ * Downsampling methods supported by sdb_timeseries_downsample.
+ */
+enum {
+	SDB_TIMESERIES_AVERAGE = 0, /* average of all data-points of a bucket */
+	SDB_TIMESERIES_MIN,         /* minimum of all data-points of a bucket */
+	SDB_TIMESERIES_MAX,         /* maximum of all data-points of a bucket */
+	SDB_TIMESERIES_LTTB,        /* largest-triangle-three-buckets */
+};
+
+#define SDB_TIMESERIES_DOWNSAMPLE_TO_STRING(m) \
+	(((m) == SDB_TIMESERIES_AVERAGE) ? "avg" \
+		: ((m) == SDB_TIMESERIES_MIN) ? "min" \
+		: ((m) == SDB_TIMESERIES_MAX) ? "max" \
+		: ((m) == SDB_TIMESERIES_LTTB) ? "lttb" : "UNKNOWN")
+
+/*
+ * Aggregation functions supported by sdb_timeseries_aggregate.
+ */
+enum {
+	SDB_TIMESERIES_AGGR_NONE = 0,
+	SDB_TIMESERIES_AGGR_SUM,        /* sum of all values */
+	SDB_TIMESERIES_AGGR_AVG,        /* average of all values */
+	SDB_TIMESERIES_AGGR_MIN,        /* minimum of all values */
+	SDB_TIMESERIES_AGGR_MAX,        /* maximum of all values */
+	SDB_TIMESERIES_AGGR_PERCENTILE, /* the n-th percentile of all values */
+};
+
+#define SDB_TIMESERIES_AGGR_TO_STRING(f) \
+	(((f) == SDB_TIMESERIES_AGGR_NONE) ? "none" \
+		: ((f) == SDB_TIMESERIES_AGGR_SUM) ? "sum" \
+		: ((f) == SDB_TIMESERIES_AGGR_AVG) ? "avg" \
+		: ((f) == SDB_TIMESERIES_AGGR_MIN) ? "min" \
+		: ((f) == SDB_TIMESERIES_AGGR_MAX) ? "max" \
+		: ((f) == SDB_TIMESERIES_AGGR_PERCENTILE) ? "percentile" : "UNKNOWN")
+
+/*
+ * The maximum number of data-points returned by sdb_timeseries_aggregate.
+ */
+#define SDB_TIMESERIES_AGGR_MAX_POINTS 10000
+
 /*
  * Time-series options specify generic parameters to be used when fetching
  * time-series data from a data-store.
@@ -101,12 +140,24 @@ typedef struct {
 	/* If specified, only fetch time-series with these names. */
 	const char * const *data_names;
 	size_t data_names_len;
+
+	/* If non-zero, limit the time-series to data-points which are about
+	 * 'resolution' apart and / or to 'max_points' data-points, combining
+	 * data-points using the specified downsampling method. Data-stores may
+	 * use these as a hint; the exact limits are applied by
+	 * sdb_timeseries_downsample. */
+	sdb_time_t resolution;
+	size_t max_points;
+	int downsample;
 } sdb_timeseries_opts_t;
+#define SDB_TIMESERIES_OPTS_INIT \
+	{ 0, 0, NULL, 0, 0, 0, SDB_TIMESERIES_AVERAGE }
 
 /*
  * sdb_timeseries_create:
  * Allocate a time-series object, pre-populating the data_names information
- * and allocating the data field.
+ * and allocating (zero-initialized) space for 'data_len' time-stamps and
+ * values of each data-source.
  *
  * Returns:
  *  - a newly allocated time-series object on success
@@ -144,6 +195,73 @@ typedef struct {
 			sdb_timeseries_opts_t *opts, sdb_object_t *user_data);
 } sdb_timeseries_fetcher_t;
 
+/*
+ * sdb_timeseries_parse_downsample:
+ * Parse the name of a downsampling method (case-insensitive).
+ *
+ * Returns:
+ *  - the ID of the method
+ *  - a negative value in case the method does not exist
+ */
+int
+sdb_timeseries_parse_downsample(const char *name);
+
+/*
+ * sdb_timeseries_downsample:
+ * Create a copy of a time-series downsampled according to the resolution,
+ * max_points, and downsample fields of the specified options. The data-points
+ * of each data-source are split into equally sized buckets and each bucket is
+ * replaced by a single data-point (by the first and last data-point of the
+ * time-series and a single selected data-point for each bucket in between
+ * when using LTTB). NaN values are ignored. All data-sources keep sharing the
+ * same time-stamps; LTTB selects data-points based on all data-sources.
+ *
+ * Returns:
+ *  - a newly allocated time-series object on success
+ *  - NULL else
+ */
+sdb_timeseries_t *
+sdb_timeseries_downsample(const sdb_timeseries_t *ts,
+		const sdb_timeseries_opts_t *opts);
+
+/*
+ * sdb_timeseries_parse_aggregate:
+ * Parse the name of an aggregation function (case-insensitive): sum, avg,
+ * min, max, median, or p<n> for the n-th percentile (0 <= n <= 100). The
+ * percentile is stored in the location pointed to by 'percentile' (if
+ * specified).
+ *
+ * Returns:
+ *  - the ID of the function
+ *  - a negative value in case the function does not exist
+ */
+int
+sdb_timeseries_parse_aggregate(const char *name, double *percentile);
+
+/*
+ * sdb_timeseries_aggregate:
+ * Aggregate multiple time-series into a single one using the specified
+ * aggregation function (and percentile, if applicable). All time-series are
+ * aligned to a common grid of 'step' intervals (multiples of 'step' since
+ * the epoch), each data-point being time-stamped by the start of its
+ * interval. Multiple data-points of a time-series falling into the same
+ * interval are averaged before aggregating them. The step is never less than
+ * the coarsest (average) interval between the data-points of any of the
+ * time-series; a zero step selects that interval. The step is increased as
+ * necessary for the result not to exceed SDB_TIMESERIES_AGGR_MAX_POINTS
+ * data-points. NULL time-series are ignored. The result uses the
+ * data-sources of the first time-series; time-series lacking any of them are
+ * ignored for that data-source. NaN values are ignored; intervals without
+ * any values are NaN.
+ *
+ * Returns:
+ *  - a newly allocated time-series object on success
+ *  - NULL else
+ */
+sdb_timeseries_t *
+sdb_timeseries_aggregate(const sdb_timeseries_t * const *ts, size_t ts_num,
+		int function, double percentile, sdb_time_t step);
+
 /*
  * sdb_timeseries_tojson:
  * Serialize a time-series to JSON written to the specified string buffer.
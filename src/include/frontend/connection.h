@@ -31,6 +31,7 @@
 #include "frontend/proto.h"
 #include "core/store.h"
 #include "utils/llist.h"
+#include "utils/lru.h"
 #include "utils/strbuf.h"
 #include "utils/proto.h"
 
@@ -103,11 +104,13 @@ sdb_connection_close(sdb_conn_t *conn);
 /*
  * sdb_connection_handle:
  * Read from an open connection until reading would block and handle all
- * incoming commands.
+ * incoming commands. Afterwards, send any pending events (see
+ * SDB_CONNECTION_WATCH).
  *
  * Returns:
  *  - the number of bytes read (0 on EOF)
- *  - a negative value on error
+ *  - a negative value on error; errno is set to EAGAIN if no data was
+ *    available, in which case the connection remains open
  */
 ssize_t
 sdb_connection_handle(sdb_conn_t *conn);
@@ -146,6 +149,18 @@ sdb_connection_ping(sdb_conn_t *conn);
 int
 sdb_connection_server_version(sdb_conn_t *conn);
 
+/*
+ * sdb_connection_set_option:
+ * Apply the connection setting sent by the client (see
+ * SDB_CONNECTION_SET_OPTION) and acknowledge it.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else
+ */
+int
+sdb_connection_set_option(sdb_conn_t *conn);
+
 /*
  * session handling
  */
@@ -172,6 +187,9 @@ sdb_conn_session_start(sdb_conn_t *conn);
  * SDB_CONNECTION_LOOKUP, and SDB_CONNECTION_STORE commands respectively. It
  * is expected that the current command has been initialized already.
  *
+ * sdb_conn_query executes all statements of a multi-statement query in order
+ * and sends one reply for each of them. It stops at the first failure.
+ *
  * Returns:
  *  - 0 on success
  *  - a negative value else
@@ -187,6 +205,215 @@ sdb_conn_lookup(sdb_conn_t *conn);
 int
 sdb_conn_store(sdb_conn_t *conn);
 
+/*
+ * sdb_conn_store_batch:
+ * Handle the SDB_CONNECTION_STORE_BATCH command. All objects are stored in
+ * order and a single reply is sent for the whole batch. Processing stops at
+ * the first failure. It is expected that the current command has been
+ * initialized already.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else
+ */
+int
+sdb_conn_store_batch(sdb_conn_t *conn);
+
+/*
+ * sdb_conn_prepare, sdb_conn_execute:
+ * Handle the SDB_CONNECTION_PREPARE and SDB_CONNECTION_EXECUTE commands
+ * respectively. Prepared statements are parsed and prepared once and stored
+ * with the connection; executing them only binds the specified parameters
+ * before running the query. It is expected that the current command has
+ * been initialized already.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else
+ */
+int
+sdb_conn_prepare(sdb_conn_t *conn);
+int
+sdb_conn_execute(sdb_conn_t *conn);
+
+/*
+ * sdb_conn_watch:
+ * Handle the SDB_CONNECTION_WATCH command. Updates matching a subscription
+ * are queued with the connection as they are being stored and have to be
+ * sent using sdb_conn_watch_flush. It is expected that the current command
+ * has been initialized already.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else
+ */
+int
+sdb_conn_watch(sdb_conn_t *conn);
+
+/*
+ * sdb_conn_watch_pending:
+ * Check whether any events are waiting to be sent to the client.
+ */
+bool
+sdb_conn_watch_pending(sdb_conn_t *conn);
+
+/*
+ * sdb_conn_watch_flush:
+ * Send all pending events to the client. Dropped events are reported to the
+ * client as a log message.
+ *
+ * Returns:
+ *  - the number of events sent
+ *  - a negative value on error
+ */
+int
+sdb_conn_watch_flush(sdb_conn_t *conn);
+
+/*
+ * sdb_conn_watch_clear:
+ * Cancel all subscriptions of the connection and discard any pending
+ * events.
+ */
+void
+sdb_conn_watch_clear(sdb_conn_t *conn);
+
+/*
+ * sdb_conn_replicate:
+ * Handle the SDB_CONNECTION_REPLICATE command. New entries of the
+ * replication stream have to be sent using sdb_conn_replicate_flush. It is
+ * expected that the current command has been initialized already.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else
+ */
+int
+sdb_conn_replicate(sdb_conn_t *conn);
+
+/*
+ * sdb_conn_replicate_pending:
+ * Check whether any entries of the replication stream are waiting to be
+ * sent to the replica.
+ */
+bool
+sdb_conn_replicate_pending(sdb_conn_t *conn);
+
+/*
+ * sdb_conn_replicate_flush:
+ * Send pending entries of the replication stream to the replica (or a full
+ * copy of the store if the replica's position is no longer available).
+ *
+ * Returns:
+ *  - the number of messages sent
+ *  - a negative value on error
+ */
+int
+sdb_conn_replicate_flush(sdb_conn_t *conn);
+
+/*
+ * sdb_conn_cache_configure:
+ * (Re-)create the cache for query results, holding up to 'max_entries'
+ * replies to FETCH, LIST, and LOOKUP queries. Cached replies are reused for
+ * queries of the same user which are identical (except for whitespace) as
+ * long as the queried objects did not change. A size of zero disables the
+ * cache. Any previously cached results are dropped. This function must not be
+ * called while any connections are being handled.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else
+ */
+int
+sdb_conn_cache_configure(size_t max_entries);
+
+/*
+ * sdb_conn_cache_stats:
+ * Retrieve usage statistics of the query result cache. All values are zero
+ * if the cache is disabled.
+ */
+void
+sdb_conn_cache_stats(sdb_lru_stats_t *stats);
+
+/*
+ * sdb_conn_plan_cache_configure:
+ * (Re-)create the cache for parsed and prepared queries, holding up to
+ * 'max_entries' FETCH, LIST, and LOOKUP queries shared by all connections.
+ * Cached plans are reused for queries which are identical (except for
+ * whitespace) to skip parsing, analyzing, and preparing them. A size of zero
+ * disables the cache. Any previously cached plans are dropped; this has to
+ * be done whenever the store readers change. This function must not be
+ * called while any connections are being handled.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else
+ */
+int
+sdb_conn_plan_cache_configure(size_t max_entries);
+
+/*
+ * sdb_conn_plan_cache_stats:
+ * Retrieve usage statistics of the query plan cache. All values are zero if
+ * the cache is disabled.
+ */
+void
+sdb_conn_plan_cache_stats(sdb_lru_stats_t *stats);
+
+/*
+ * sdb_conn_timeseries_cache_configure:
+ * (Re-)create the cache for time-series fetched from data-stores, holding up
+ * to 'max_entries' time-series shared by all connections. Cached time-series
+ * are reused for TIMESERIES queries of the same data sources for up to 'ttl'
+ * and requested time ranges are rounded down to multiples of 'ttl' for that
+ * purpose, such that repeated requests for the most recent data share
+ * entries. A size of zero disables the cache. Any previously cached
+ * time-series are dropped. This function must not be called while any
+ * connections are being handled.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else (including a zero TTL for a non-empty cache)
+ */
+int
+sdb_conn_timeseries_cache_configure(size_t max_entries, sdb_time_t ttl);
+
+/*
+ * sdb_conn_timeseries_max_metrics_configure:
+ * Set the maximum number of metrics a single TIMESERIES query may select by
+ * a MATCHING condition. Queries matching more metrics fail with an error
+ * rather than fetching all of their time-series. A value of zero disables
+ * the limit. Defaults to SDB_CONN_TIMESERIES_MAX_METRICS_DEFAULT.
+ */
+#define SDB_CONN_TIMESERIES_MAX_METRICS_DEFAULT 100
+void
+sdb_conn_timeseries_max_metrics_configure(size_t max_metrics);
+
+/*
+ * sdb_conn_timeseries_workers_start, sdb_conn_timeseries_workers_stop:
+ * Start or stop a pool of 'num' threads shared by all connections for
+ * fetching the time-series of TIMESERIES queries matching multiple metrics
+ * concurrently. The thread handling a query always fetches time-series
+ * itself as well, such that queries succeed without (or with a busy) pool.
+ * These functions must not be called while any connections are being
+ * handled.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else (including when the pool is running already)
+ */
+int
+sdb_conn_timeseries_workers_start(size_t num);
+void
+sdb_conn_timeseries_workers_stop(void);
+
+/*
+ * sdb_conn_timeseries_cache_stats:
+ * Retrieve usage statistics of the time-series cache. All values are zero if
+ * the cache is disabled.
+ */
+void
+sdb_conn_timeseries_cache_stats(sdb_lru_stats_t *stats);
+
 /*
  * sdb_conn_store_host, sdb_conn_store_service, sdb_conn_store_metric,
  * sdb_conn_store_attribute:
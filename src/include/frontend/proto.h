@@ -123,6 +123,56 @@ typedef enum {
 	 * | ...                           |
 	 */
 	SDB_CONNECTION_DATA = 100,
+
+	/*
+	 * SDB_CONNECTION_EVENT:
+	 * Notifies the client about an update of an object matching one of its
+	 * subscriptions (see SDB_CONNECTION_WATCH). Events are sent
+	 * asynchronously between replies to other commands. The message body
+	 * contains the subscription identifier (32bit integer in network
+	 * byte-order) followed by a single record describing the updated object
+	 * as used by the SDB_CONNECTION_RESULT_BINARY result format.
+	 *
+	 * 0               32              64
+	 * +---------------+---------------+
+	 * | EVENT         | length        |
+	 * +---------------+---------------+
+	 * | watch id      | record length |
+	 * +---------------+---------------+
+	 * | object ...                    |
+	 */
+	SDB_CONNECTION_EVENT,
+
+	/*
+	 * SDB_CONNECTION_REPLICATION:
+	 * Sends the next part of the server's replication stream to a replica
+	 * (see SDB_CONNECTION_REPLICATE). Messages are sent asynchronously
+	 * between replies to other commands. The message body contains the
+	 * identifier of the stream and the position following the included
+	 * entries (both 64bit integers in network byte-order) followed by the
+	 * entries. Each entry consists of its sequence number (64bit integer in
+	 * network byte-order), its type and the length of its payload (both
+	 * 32bit integers in network byte-order), and the payload describing the
+	 * state of an updated object. When resynchronizing a replica, the server
+	 * sends a full copy of its store split into multiple messages; entries of
+	 * the copy carry the sequence number zero. All but the last message of a
+	 * copy carry the stream identifier and position zero, which means that
+	 * the copy is incomplete. The last message ends with an end-of-copy
+	 * marker: an entry of type zero (without payload) carrying the position
+	 * which the copy reflects. Any other entries of type zero shall be
+	 * ignored as well.
+	 *
+	 * 0               32              64
+	 * +---------------+---------------+
+	 * | REPLICATION   | length        |
+	 * +---------------+---------------+
+	 * | stream id                     |
+	 * +---------------+---------------+
+	 * | sequence number               |
+	 * +---------------+---------------+
+	 * | entries ...                   |
+	 */
+	SDB_CONNECTION_REPLICATION,
 } sdb_conn_status_t;
 
 /* accepted commands / state of the connection */
@@ -176,9 +226,11 @@ typedef enum {
 
 	/*
 	 * SDB_CONNECTION_QUERY:
-	 * Execute a query in the server. The message body shall include a single
-	 * query command as a text string. Multiple commands are ignored by the
-	 * server entirely to protect against injection attacks.
+	 * Execute a query in the server. The message body shall include one or
+	 * more query commands, separated by semicolons, as a text string. The
+	 * commands are executed in order and the server sends one reply per
+	 * command. Execution stops at the first failing command for which an
+	 * error reply is sent instead.
 	 *
 	 * 0               32              64
 	 * +---------------+---------------+
@@ -245,6 +297,104 @@ typedef enum {
 	 */
 	SDB_CONNECTION_TIMESERIES,
 
+	/*
+	 * Prepared statements.
+	 */
+
+	/*
+	 * SDB_CONNECTION_PREPARE:
+	 * Prepare a query for repeated execution. The message body shall include
+	 * a statement identifier chosen by the client, encoded as a 32bit integer
+	 * in network byte-order, and a single FETCH, LIST, or LOOKUP command as a
+	 * text string. The query may use placeholders ($1, $2, ...) wherever
+	 * constant values are allowed in expressions. The server parses and
+	 * prepares the query once and replies with SDB_CONNECTION_OK. Preparing a
+	 * statement using an existing identifier replaces the previous statement;
+	 * an empty query string discards it. Prepared statements are local to the
+	 * connection.
+	 *
+	 * 0               32              64
+	 * +---------------+---------------+
+	 * | PREPARE       | length        |
+	 * +---------------+---------------+
+	 * | statement id  | query string  |
+	 * +---------------+               |
+	 * | ...                           |
+	 */
+	SDB_CONNECTION_PREPARE = 20,
+
+	/*
+	 * SDB_CONNECTION_EXECUTE:
+	 * Execute a prepared statement. The message body shall include the
+	 * statement identifier and the number of parameters, both encoded as
+	 * 32bit integers in network byte-order, followed by the parameter values.
+	 * Values are encoded as their type (32bit integer in network byte-order),
+	 * and their content as implemented by sdb_proto_marshal_data. The number
+	 * of parameters has to match the highest placeholder used in the
+	 * statement. The server replies the same way as it does to the respective
+	 * query sent using SDB_CONNECTION_QUERY.
+	 *
+	 * 0               32              64
+	 * +---------------+---------------+
+	 * | EXECUTE       | length        |
+	 * +---------------+---------------+
+	 * | statement id  | num params    |
+	 * +---------------+---------------+
+	 * | param values ...              |
+	 */
+	SDB_CONNECTION_EXECUTE,
+
+	/*
+	 * Subscriptions.
+	 */
+
+	/*
+	 * SDB_CONNECTION_WATCH:
+	 * Subscribe to updates of stored objects. The message body shall include
+	 * a subscription identifier chosen by the client, encoded as a 32bit
+	 * integer in network byte-order, and a single LOOKUP command as a text
+	 * string. The server replies with SDB_CONNECTION_OK and, from then on,
+	 * sends an SDB_CONNECTION_EVENT message whenever a matching object or
+	 * any of its attributes (subject to the FILTER clause) is updated.
+	 * Pending updates of the same object are coalesced such that only its
+	 * latest state is sent. If the client does not keep up, the oldest
+	 * pending events are dropped and a warning is sent as a log message.
+	 * Subscribing using an existing identifier replaces the previous
+	 * subscription; an empty query string cancels it. Subscriptions are
+	 * local to the connection.
+	 *
+	 * 0               32              64
+	 * +---------------+---------------+
+	 * | WATCH         | length        |
+	 * +---------------+---------------+
+	 * | watch id      | query string  |
+	 * +---------------+               |
+	 * | ...                           |
+	 */
+	SDB_CONNECTION_WATCH = 30,
+
+	/*
+	 * SDB_CONNECTION_REPLICATE:
+	 * Subscribe to the server's replication stream. The message body may
+	 * include the identifier of the stream and the position (both 64bit
+	 * integers in network byte-order) of the last entry received previously
+	 * (see SDB_CONNECTION_REPLICATION). The server replies with
+	 * SDB_CONNECTION_OK and, from then on, sends all entries following that
+	 * position. If the position is not available any longer (or if the body
+	 * is empty), the server sends a full copy of its store first. Requires a
+	 * store supporting replication.
+	 *
+	 * 0               32              64
+	 * +---------------+---------------+
+	 * | REPLICATE     | length        |
+	 * +---------------+---------------+
+	 * | stream id                     |
+	 * +---------------+---------------+
+	 * | sequence number               |
+	 * +---------------+---------------+
+	 */
+	SDB_CONNECTION_REPLICATE,
+
 	/*
 	 * SDB_CONNECTION_STORE:
 	 * Execute the 'STORE' command in the server. The message body shall
@@ -283,6 +433,32 @@ typedef enum {
 	SDB_CONNECTION_STORE_METRIC,
 	SDB_CONNECTION_STORE_ATTRIBUTE,
 
+	/*
+	 * SDB_CONNECTION_STORE_BATCH:
+	 * Execute the 'STORE' command for multiple objects at once. The message
+	 * body shall include a list of records, each of which consists of its
+	 * length (32bit integer in network byte-order) followed by an object
+	 * encoded as described for SDB_CONNECTION_STORE. Objects are stored in
+	 * order, each of them independently of any others. The server sends a
+	 * single reply for the whole batch. If any records could not be stored,
+	 * it sends an error reporting the number of failed records and listing
+	 * (the first few of) them; all other records have been stored. If the
+	 * length of a record is invalid, no further records are processed.
+	 *
+	 * 0               32              64
+	 * +---------------+---------------+
+	 * | STORE_BATCH   | length        |
+	 * +---------------+---------------+
+	 * | record length | object type   |
+	 * +---------------+---------------+
+	 * | last_update                   |
+	 * +---------------+---------------+
+	 * | fields        | ...           |
+	 * +---------------+               |
+	 * | ...                           |
+	 */
+	SDB_CONNECTION_STORE_BATCH = 60,
+
 	/*
 	 * Command subcomponents.
 	 */
@@ -299,6 +475,28 @@ typedef enum {
 	 */
 	SDB_CONNECTION_EXPR,
 
+	/*
+	 * Connection settings.
+	 */
+
+	/*
+	 * SDB_CONNECTION_SET_OPTION:
+	 * Change a setting of the current connection. The message body shall
+	 * include the option (see sdb_conn_option_t) and its new value, both
+	 * encoded as unsigned 32bit integers in network byte-order. The server
+	 * replies with SDB_CONNECTION_OK if the option was applied or with
+	 * SDB_CONNECTION_ERROR if the option or value is not supported. In the
+	 * latter case, the setting remains unchanged.
+	 *
+	 * 0               32              64
+	 * +---------------+---------------+
+	 * | SET_OPTION    | 8             |
+	 * +---------------+---------------+
+	 * | option        | value         |
+	 * +---------------+---------------+
+	 */
+	SDB_CONNECTION_SET_OPTION = 200,
+
 	/*
 	 * Server status queries.
 	 */
@@ -317,8 +515,96 @@ typedef enum {
 	 * +---------------+---------------+
 	 */
 	SDB_CONNECTION_SERVER_VERSION = 1000,
+
+	/*
+	 * Transport.
+	 */
+
+	/*
+	 * SDB_CONNECTION_COMPRESSED:
+	 * Wraps a compressed command or reply once compression has been enabled
+	 * (see SDB_CONNECTION_OPTION_COMPRESSION); this code is used in both
+	 * directions. The message body contains the code and length of the
+	 * original message (both 32bit integers in network byte-order) followed
+	 * by its compressed body. All compressed messages sent in one direction
+	 * of a connection form a single compressed stream and have to be
+	 * decompressed in order. Small messages are sent uncompressed.
+	 *
+	 * 0               32              64
+	 * +---------------+---------------+
+	 * | COMPRESSED    | length        |
+	 * +---------------+---------------+
+	 * | code          | orig. length  |
+	 * +---------------+---------------+
+	 * | compressed body ...           |
+	 */
+	SDB_CONNECTION_COMPRESSED = 2000,
 } sdb_conn_state_t;
 
+/* connection options (see SDB_CONNECTION_SET_OPTION) */
+typedef enum {
+	/*
+	 * SDB_CONNECTION_OPTION_RESULT_FORMAT:
+	 * The encoding of query results in DATA messages (see
+	 * sdb_conn_result_format_t). The default is JSON.
+	 */
+	SDB_CONNECTION_OPTION_RESULT_FORMAT = 1,
+
+	/*
+	 * SDB_CONNECTION_OPTION_COMPRESSION:
+	 * The algorithm used to compress large messages in both directions (see
+	 * sdb_conn_compression_t and SDB_CONNECTION_COMPRESSED). The server
+	 * starts compressing replies after acknowledging the option; the client
+	 * may send compressed commands once it received the acknowledgment. The
+	 * default is not to compress any messages.
+	 */
+	SDB_CONNECTION_OPTION_COMPRESSION = 2,
+} sdb_conn_option_t;
+
+/* compression algorithms (see SDB_CONNECTION_OPTION_COMPRESSION) */
+typedef enum {
+	SDB_CONNECTION_COMPRESSION_NONE = 0,
+
+	/*
+	 * SDB_CONNECTION_COMPRESSION_DEFLATE:
+	 * A zlib (RFC 1950) stream with each message flushed using a sync flush.
+	 * Only available if built with zlib.
+	 */
+	SDB_CONNECTION_COMPRESSION_DEFLATE,
+} sdb_conn_compression_t;
+
+/* result formats (see SDB_CONNECTION_OPTION_RESULT_FORMAT) */
+typedef enum {
+	/*
+	 * SDB_CONNECTION_RESULT_JSON:
+	 * Query results are encoded as a JSON string.
+	 */
+	SDB_CONNECTION_RESULT_JSON = 0,
+
+	/*
+	 * SDB_CONNECTION_RESULT_BINARY:
+	 * FETCH, LIST, and LOOKUP results are encoded as a sequence of object
+	 * records. Each record consists of its length (32bit integer in network
+	 * byte-order) followed by the object encoded like the body of a STORE
+	 * command. Other than that, metrics include all of their data stores
+	 * prefixed by the number of stores (32bit integer), each one encoded as
+	 * its type, identifier, and last-update timestamp. Objects are fully
+	 * qualified by their parent names and are sent in the order in which
+	 * they were found (parents before their children). Only the basic
+	 * information of each object is included. All other results continue to
+	 * be sent as JSON. See sdb_proto_unmarshal_object for a decoding helper.
+	 *
+	 * 0               32              64
+	 * +---------------+---------------+
+	 * | record length | object type   |
+	 * +---------------+---------------+
+	 * | last_update                   |
+	 * +---------------+---------------+
+	 * | fields ...                    |
+	 */
+	SDB_CONNECTION_RESULT_BINARY,
+} sdb_conn_result_format_t;
+
 #define SDB_CONN_MSGTYPE_TO_STRING(t) \
 	(((t) == SDB_CONNECTION_IDLE) ? "IDLE" \
 		: ((t) == SDB_CONNECTION_PING) ? "PING" \
@@ -328,7 +614,14 @@ typedef enum {
 		: ((t) == SDB_CONNECTION_LIST) ? "LIST" \
 		: ((t) == SDB_CONNECTION_LOOKUP) ? "LOOKUP" \
 		: ((t) == SDB_CONNECTION_TIMESERIES) ? "TIMESERIES" \
+		: ((t) == SDB_CONNECTION_PREPARE) ? "PREPARE" \
+		: ((t) == SDB_CONNECTION_EXECUTE) ? "EXECUTE" \
+		: ((t) == SDB_CONNECTION_WATCH) ? "WATCH" \
+		: ((t) == SDB_CONNECTION_REPLICATE) ? "REPLICATE" \
 		: ((t) == SDB_CONNECTION_STORE) ? "STORE" \
+		: ((t) == SDB_CONNECTION_STORE_BATCH) ? "STORE_BATCH" \
+		: ((t) == SDB_CONNECTION_SET_OPTION) ? "SET_OPTION" \
+		: ((t) == SDB_CONNECTION_COMPRESSED) ? "COMPRESSED" \
 		: "UNKNOWN")
 
 #ifdef __cplusplus
@@ -42,10 +42,13 @@ typedef struct {
 	/* number of handler threads to create */
 	size_t num_threads;
 
+	/* number of threads fetching time-series for all connections */
+	size_t num_fetch_threads;
+
 	/* front-end listener shuts down when this is set to false */
 	bool do_loop;
 } sdb_fe_loop_t;
-#define SDB_FE_LOOP_INIT { 5, 1 }
+#define SDB_FE_LOOP_INIT { 5, 7, 1 }
 
 /*
  * sdb_fe_socket_t:
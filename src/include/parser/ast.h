@@ -34,6 +34,7 @@
 
 #include "core/data.h"
 #include "core/time.h"
+#include "core/timeseries.h"
 #include "core/object.h"
 
 #include <assert.h>
@@ -60,6 +61,7 @@ typedef enum {
 	/* values */
 	SDB_AST_TYPE_CONST      = 200,
 	SDB_AST_TYPE_VALUE      = 201,
+	SDB_AST_TYPE_PARAM      = 202,
 
 	SDB_AST_TYPE_TYPED      = 210,
 } sdb_ast_node_type_t;
@@ -97,6 +99,7 @@ typedef enum {
 #define SDB_AST_IS_ARITHMETIC(n) \
 	(((n)->type == SDB_AST_TYPE_CONST) \
 		|| ((n)->type == SDB_AST_TYPE_VALUE) \
+		|| ((n)->type == SDB_AST_TYPE_PARAM) \
 		|| ((n)->type == SDB_AST_TYPE_TYPED) \
 		|| (((n)->type == SDB_AST_TYPE_OPERATOR) \
 			&& ((SDB_AST_ADD <= SDB_AST_OP(n)->kind) \
@@ -163,6 +166,7 @@ typedef enum {
 		: ((n)->type == SDB_AST_TYPE_ITERATOR) ? "ITERATOR" \
 		: ((n)->type == SDB_AST_TYPE_CONST) ? "CONSTANT" \
 		: ((n)->type == SDB_AST_TYPE_VALUE) ? "VALUE" \
+		: ((n)->type == SDB_AST_TYPE_PARAM) ? "PARAMETER" \
 		: ((n)->type == SDB_AST_TYPE_TYPED) ? "TYPED VALUE" \
 		: "UNKNOWN")
 
@@ -250,6 +254,21 @@ typedef struct {
 #define SDB_AST_VALUE_INIT \
 	{ { SDB_OBJECT_INIT, SDB_AST_TYPE_VALUE, -1 }, -1, NULL }
 
+/*
+ * sdb_ast_param_t represents a placeholder ($1, $2, ...) for a value to be
+ * provided when executing a prepared statement.
+ */
+typedef struct {
+	sdb_ast_node_t super;
+	int index; /* starting at 1 */
+} sdb_ast_param_t;
+#define SDB_AST_PARAM(obj) ((sdb_ast_param_t *)(obj))
+#define SDB_AST_PARAM_INIT \
+	{ { SDB_OBJECT_INIT, SDB_AST_TYPE_PARAM, -1 }, 0 }
+
+/* maximum number of parameters of a single statement */
+#define SDB_AST_MAX_PARAMS 64
+
 /*
  * sdb_ast_fetch_t represents a FETCH command.
  */
@@ -276,10 +295,13 @@ typedef struct {
 	sdb_ast_node_t super;
 	int obj_type;
 	sdb_ast_node_t *filter; /* optional */
+	/* only list objects changed after this modification sequence number;
+	 * a negative value lists all objects */
+	int64_t since;
 } sdb_ast_list_t;
 #define SDB_AST_LIST(obj) ((sdb_ast_list_t *)(obj))
 #define SDB_AST_LIST_INIT \
-	{ { SDB_OBJECT_INIT, SDB_AST_TYPE_LIST, -1 }, -1, NULL }
+	{ { SDB_OBJECT_INIT, SDB_AST_TYPE_LIST, -1 }, -1, NULL, -1 }
 
 /*
  * sdb_ast_lookup_t represents a LOOKUP command.
@@ -326,14 +348,27 @@ typedef struct {
 	sdb_ast_node_t super;
 	char *hostname;
 	char *metric;
+	/* select all metrics matching this condition instead of a single one */
+	sdb_ast_node_t *matcher;
 	char **data_names;
 	size_t data_names_len;
 	sdb_time_t start;
 	sdb_time_t end;
+
+	/* downsampling options; see sdb_timeseries_opts_t */
+	sdb_time_t resolution;
+	size_t max_points;
+	int downsample;
+
+	/* aggregate all matching metrics; see sdb_timeseries_aggregate */
+	int aggregate;
+	double percentile;
 } sdb_ast_timeseries_t;
 #define SDB_AST_TIMESERIES(obj) ((sdb_ast_timeseries_t *)(obj))
 #define SDB_AST_TIMESERIES_INIT \
-	{ { SDB_OBJECT_INIT, SDB_AST_TYPE_TIMESERIES, -1 }, NULL, NULL, NULL, 0, 0, 0 }
+	{ { SDB_OBJECT_INIT, SDB_AST_TYPE_TIMESERIES, -1 }, \
+		NULL, NULL, NULL, NULL, 0, 0, 0, 0, 0, SDB_TIMESERIES_AVERAGE, \
+		SDB_TIMESERIES_AGGR_NONE, 0.0 }
 
 /*
  * AST constructors:
@@ -386,6 +421,14 @@ sdb_ast_const_create(sdb_data_t value);
 sdb_ast_node_t *
 sdb_ast_value_create(int type, char *name);
 
+/*
+ * sdb_ast_param_create:
+ * Creates an AST node representing the placeholder of the parameter with the
+ * specified index (starting at 1).
+ */
+sdb_ast_node_t *
+sdb_ast_param_create(int index);
+
 /*
  * sdb_ast_fetch_create:
  * Creates an AST node representing a FETCH command. The newly created node
@@ -399,10 +442,12 @@ sdb_ast_fetch_create(int obj_type, char *hostname,
 /*
  * sdb_ast_list_create:
  * Creates an AST node representing a LIST command. The newly created node
- * takes ownership of the filter node.
+ * takes ownership of the filter node. A non-negative value of 'since'
+ * restricts the command to objects changed after that modification sequence
+ * number.
  */
 sdb_ast_node_t *
-sdb_ast_list_create(int obj_type, sdb_ast_node_t *filter);
+sdb_ast_list_create(int obj_type, sdb_ast_node_t *filter, int64_t since);
 
 /*
  * sdb_ast_lookup_create:
@@ -426,13 +471,29 @@ sdb_ast_store_create(int obj_type, char *hostname,
 
 /*
  * sdb_ast_timeseries_create:
- * Creates an AST node representing a TIMESERIES command. The newly created
- * node takes ownership of the strings and string vectors.
+ * Creates an AST node representing a TIMESERIES command, selecting either
+ * the specified host's metric or all metrics matching the specified matcher
+ * (optionally aggregated into a single time-series). The newly created node
+ * takes ownership of the strings, string vectors, and the matcher.
  */
 sdb_ast_node_t *
 sdb_ast_timeseries_create(char *hostname, char *metric,
-		char **data_names, size_t data_names_len,
-		sdb_time_t start, sdb_time_t end);
+		sdb_ast_node_t *matcher, char **data_names, size_t data_names_len,
+		sdb_time_t start, sdb_time_t end,
+		sdb_time_t resolution, size_t max_points, int downsample,
+		int aggregate, double percentile);
+
+/*
+ * sdb_ast_params_num:
+ * Determine the number of parameters used by the specified node and all of
+ * its child nodes, that is, the highest index of any parameter placeholder.
+ *
+ * Returns:
+ *  - the number of parameters
+ *  - 0 if the node does not use any parameters
+ */
+int
+sdb_ast_params_num(sdb_ast_node_t *node);
 
 #ifdef __cplusplus
 } /* extern "C" */
@@ -113,6 +113,16 @@ sdb_avltree_iter_has_next(sdb_avltree_iter_t *iter);
 sdb_object_t *
 sdb_avltree_iter_get_next(sdb_avltree_iter_t *iter);
 
+/*
+ * sdb_avltree_get_iter_after:
+ * Create an iterator starting at the smallest node following the node named
+ * 'name' (which does not have to exist in the tree). This allows to resume
+ * an iteration after the tree has been modified. If 'name' is NULL, this is
+ * the same as sdb_avltree_get_iter.
+ */
+sdb_avltree_iter_t *
+sdb_avltree_get_iter_after(sdb_avltree_t *tree, const char *name);
+
 /*
  * sdb_avltree_iter_peek_next:
  * Peek at the next node, if there is one. This is similar to has_next() but
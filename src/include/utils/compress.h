@@ -0,0 +1,115 @@
+/*
+ * SysDB - src/include/utils/compress.h
+ * Copyright (C) 2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SDB_UTILS_COMPRESS_H
+#define SDB_UTILS_COMPRESS_H 1
+
+#include "utils/strbuf.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A compression context holds the state of the compressed streams of one
+ * connection: one for each direction. Messages exceeding a size threshold
+ * are compressed and sent as SDB_CONNECTION_COMPRESSED messages; all of them
+ * are part of the same stream, such that later messages benefit from the
+ * data seen before. Hence, messages have to be decompressed in the order in
+ * which they have been compressed and a context must not be shared between
+ * connections. Contexts are not thread-safe.
+ */
+struct sdb_compress;
+typedef struct sdb_compress sdb_compress_t;
+
+/* messages smaller than this are never compressed */
+#define SDB_COMPRESS_MIN_SIZE 512
+
+/*
+ * sdb_compress_supported:
+ * Returns true if the specified algorithm (see sdb_conn_compression_t) is
+ * supported by this build.
+ */
+bool
+sdb_compress_supported(uint32_t algo);
+
+/*
+ * sdb_compress_create:
+ * Create a new compression context using the specified algorithm.
+ *
+ * Returns:
+ *  - the context on success
+ *  - NULL if the algorithm is not supported or on error
+ */
+sdb_compress_t *
+sdb_compress_create(uint32_t algo);
+
+/*
+ * sdb_compress_destroy:
+ * Destroy a compression context.
+ */
+void
+sdb_compress_destroy(sdb_compress_t *c);
+
+/*
+ * sdb_compress_message:
+ * Append a message (header and body) to 'buf'. If 'c' is not NULL and the
+ * body is large enough, the message is wrapped in an SDB_CONNECTION_COMPRESSED
+ * message.
+ *
+ * Returns:
+ *  - the number of bytes appended to 'buf'
+ *  - a negative value on error
+ */
+ssize_t
+sdb_compress_message(sdb_compress_t *c, sdb_strbuf_t *buf,
+		uint32_t code, uint32_t msg_len, const char *msg);
+
+/*
+ * sdb_decompress_message:
+ * Decompress the body of an SDB_CONNECTION_COMPRESSED message, appending the
+ * original message body to 'buf' and storing its code in 'code'.
+ *
+ * Returns:
+ *  - the length of the original message body
+ *  - a negative value if the message is invalid or on error
+ */
+ssize_t
+sdb_decompress_message(sdb_compress_t *c, const char *data, size_t len,
+		uint32_t *code, sdb_strbuf_t *buf);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* ! SDB_UTILS_COMPRESS_H */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
@@ -0,0 +1,160 @@
+/*
+ * SysDB - src/include/utils/lru.h
+ * Copyright (C) 2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SDB_UTILS_LRU_H
+#define SDB_UTILS_LRU_H 1
+
+#include "core/object.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * An LRU cache stores a bounded number of objects indexed by their names
+ * (compared case-sensitively). Once the cache is full, inserting a new object
+ * evicts the least recently used one. All operations are thread-safe and run
+ * in (amortized) constant time.
+ */
+struct sdb_lru;
+typedef struct sdb_lru sdb_lru_t;
+
+/*
+ * sdb_lru_valid_cb:
+ * A callback used to check whether a cached object may still be used. It is
+ * called on every lookup without holding the cache's lock; invalid objects
+ * are dropped from the cache (unless replaced in the meantime) and the lookup
+ * is accounted for as a miss.
+ */
+typedef bool (*sdb_lru_valid_cb)(sdb_object_t *obj);
+
+/*
+ * sdb_lru_stats_t:
+ * Usage statistics of an LRU cache.
+ */
+typedef struct {
+	size_t size;
+	size_t capacity;
+
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+} sdb_lru_stats_t;
+
+/*
+ * sdb_lru_create:
+ * Creates an LRU cache holding up to 'capacity' objects. The optional
+ * 'valid' callback will be used to check cached objects on lookup.
+ */
+sdb_lru_t *
+sdb_lru_create(size_t capacity, sdb_lru_valid_cb valid);
+
+/*
+ * sdb_lru_destroy:
+ * Destroy the specified cache and release all included objects (decrement
+ * the ref-count).
+ */
+void
+sdb_lru_destroy(sdb_lru_t *lru);
+
+/*
+ * sdb_lru_clear:
+ * Remove all objects from the cache, releasing them (decrement the
+ * ref-count). Usage statistics are left untouched.
+ */
+void
+sdb_lru_clear(sdb_lru_t *lru);
+
+/*
+ * sdb_lru_insert:
+ * Insert an object into the cache, replacing any object of the same name. The
+ * cache takes its own reference to the object. If the cache is full, the
+ * least recently used object will be evicted.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else
+ */
+int
+sdb_lru_insert(sdb_lru_t *lru, sdb_object_t *obj);
+
+/*
+ * sdb_lru_lookup:
+ * Lookup an object from the cache by name and mark it as most recently used.
+ * The caller receives a new reference to the object which has to be released
+ * using sdb_object_deref() when no longer needed.
+ *
+ * Returns:
+ *  - the requested object
+ *  - NULL if no such (valid) object exists
+ */
+sdb_object_t *
+sdb_lru_lookup(sdb_lru_t *lru, const char *name);
+
+/*
+ * sdb_lru_remove:
+ * Remove an object from the cache by name.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a positive value if no such object exists
+ *  - a negative value else
+ */
+int
+sdb_lru_remove(sdb_lru_t *lru, const char *name);
+
+/*
+ * sdb_lru_shift:
+ * Remove the least recently used object from the cache and return it. This
+ * allows to use the cache as a bounded queue which coalesces objects of the
+ * same name. The caller receives the reference previously held by the cache
+ * and has to release it using sdb_object_deref() when no longer needed.
+ *
+ * Returns:
+ *  - the least recently used object
+ *  - NULL if the cache is empty
+ */
+sdb_object_t *
+sdb_lru_shift(sdb_lru_t *lru);
+
+/*
+ * sdb_lru_stats:
+ * Retrieve usage statistics of the cache.
+ */
+void
+sdb_lru_stats(sdb_lru_t *lru, sdb_lru_stats_t *stats);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* ! SDB_UTILS_LRU_H */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
@@ -129,6 +129,18 @@ sdb_select(int fd, int type);
 ssize_t
 sdb_write(int fd, size_t msg_len, const void *msg);
 
+/*
+ * sdb_sync_dir:
+ * Flush the directory containing the specified file to disk. This ensures
+ * that a newly created, renamed, or removed directory entry is persisted.
+ *
+ * Returns:
+ *  - 0 on success
+ *  - a negative value else
+ */
+int
+sdb_sync_dir(const char *pathname);
+
 enum {
 	SDB_NET_TCP = 1 << 0,
 	SDB_NET_UDP = 1 << 1,
@@ -75,6 +75,40 @@ typedef struct {
 } sdb_proto_attribute_t;
 #define SDB_PROTO_ATTRIBUTE_INIT { 0, 0, NULL, NULL, NULL, SDB_DATA_INIT }
 
+/*
+ * sdb_proto_metric_store:
+ * A data store of a metric as included in binary query results.
+ */
+typedef struct {
+	const char *type;
+	const char *id;
+	sdb_time_t last_update;
+} sdb_proto_metric_store_t;
+
+/*
+ * sdb_proto_object:
+ * A generic representation of any of the above objects as used in binary
+ * query results. The type is one of SDB_HOST, SDB_SERVICE, SDB_METRIC, or
+ * the parent type bitwise ORed with SDB_ATTRIBUTE and specifies which of the
+ * union members is valid.
+ *
+ * Metrics include all of their data stores; the store information of the
+ * metric object itself is ignored when encoding a record and refers to the
+ * first store (if any) when decoding one.
+ */
+typedef struct {
+	int type;
+	union {
+		sdb_proto_host_t host;
+		sdb_proto_service_t service;
+		sdb_proto_metric_t metric;
+		sdb_proto_attribute_t attribute;
+	} data;
+
+	sdb_proto_metric_store_t *stores;
+	size_t stores_num;
+} sdb_proto_object_t;
+
 /*
  * sdb_proto_marshal:
  * Encode the message into the wire format by adding an appropriate header.
@@ -147,6 +181,26 @@ ssize_t
 sdb_proto_marshal_attribute(char *buf, size_t buf_len,
 		const sdb_proto_attribute_t *attr);
 
+/*
+ * sdb_proto_marshal_object:
+ * Encode the object as a record of a binary query result, that is, its
+ * length (32bit integer in network byte-order) followed by the encoded
+ * object. Other than sdb_proto_marshal_metric, metric records include the
+ * number of data stores (32bit integer) followed by the type, identifier,
+ * and last-update timestamp of each store. See sdb_proto_unmarshal_object
+ * for the reverse operation.
+ *
+ * Returns:
+ *  - The number of bytes of the full record on success. The function does
+ *    not write more than 'buf_len' bytes. If the output was truncated then
+ *    the return value is the number of bytes which would have been written
+ *    if enough space had been available.
+ *  - a negative value else
+ */
+ssize_t
+sdb_proto_marshal_object(char *buf, size_t buf_len,
+		const sdb_proto_object_t *obj);
+
 /*
  * sdb_proto_unmarshal_header:
  * Read and decode a message header from the specified string.
@@ -206,6 +260,30 @@ ssize_t
 sdb_proto_unmarshal_attribute(const char *buf, size_t len,
 		sdb_proto_attribute_t *attr);
 
+/*
+ * sdb_proto_unmarshal_object:
+ * Read and decode a single object record of a binary query result from the
+ * specified string as encoded by sdb_proto_marshal_object. Any strings will
+ * point into the specified buffer. Attribute values and the list of metric
+ * stores will be allocated dynamically and have to be free'd using
+ * sdb_proto_free_object.
+ *
+ * Returns:
+ *  - the number of bytes read on success
+ *  - a negative value else
+ */
+ssize_t
+sdb_proto_unmarshal_object(const char *buf, size_t len,
+		sdb_proto_object_t *obj);
+
+/*
+ * sdb_proto_free_object:
+ * Free any dynamically allocated data of an object decoded by
+ * sdb_proto_unmarshal_object.
+ */
+void
+sdb_proto_free_object(sdb_proto_object_t *obj);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -29,6 +29,7 @@
 #define SDB_UTILS_SSL_H 1
 
 #include <sys/types.h>
+#include <stdbool.h>
 #include <stddef.h>
 
 #ifdef __cplusplus
@@ -153,6 +154,14 @@ sdb_ssl_session_write(sdb_ssl_session_t *session, const void *buf, size_t n);
 ssize_t
 sdb_ssl_session_read(sdb_ssl_session_t *session, void *buf, size_t n);
 
+/*
+ * sdb_ssl_session_pending:
+ * Returns true if data has been received and decrypted already, that is, if
+ * it may be read without waiting for the underlying socket.
+ */
+bool
+sdb_ssl_session_pending(sdb_ssl_session_t *session);
+
 /*
  * sdb_ssl_free_options:
  * Free all strings stored in the specified options. All fields will be set to
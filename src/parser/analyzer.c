@@ -33,6 +33,7 @@
 #include "utils/strbuf.h"
 
 #include <assert.h>
+#include <inttypes.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <string.h>
@@ -484,6 +485,9 @@ analyze_node(context_t ctx, sdb_ast_node_t *node, sdb_strbuf_t *errbuf)
 		return analyze_const(ctx, SDB_AST_CONST(node), errbuf);
 	else if (node->type == SDB_AST_TYPE_VALUE)
 		return analyze_value(ctx, SDB_AST_VALUE(node), errbuf);
+	else if (node->type == SDB_AST_TYPE_PARAM)
+		/* the type is not known before binding a value */
+		return 0;
 	else if (node->type == SDB_AST_TYPE_TYPED)
 		return analyze_typed(ctx, SDB_AST_TYPED(node), errbuf);
 
@@ -520,6 +524,11 @@ analyze_list(sdb_ast_list_t *list, sdb_strbuf_t *errbuf)
 				"in LIST command", list->obj_type);
 		return -1;
 	}
+	if (list->since < -1) {
+		sdb_strbuf_sprintf(errbuf, "Invalid modification sequence number "
+				"%"PRId64" in LIST command", list->since);
+		return -1;
+	}
 	if (list->filter)
 		return analyze_node(FILTER_CTX, list->filter, errbuf);
 	return 0;
@@ -586,14 +595,35 @@ analyze_store(sdb_ast_store_t *st, sdb_strbuf_t *errbuf)
 static int
 analyze_timeseries(sdb_ast_timeseries_t *ts, sdb_strbuf_t *errbuf)
 {
-	if (! ts->hostname) {
+	if (ts->matcher) {
+		context_t ctx = { SDB_METRIC, 0 };
+		if (ts->hostname || ts->metric) {
+			sdb_strbuf_sprintf(errbuf, "Unexpected metric name and matcher "
+					"in TIMESERIES command");
+			return -1;
+		}
+		if (analyze_node(ctx, ts->matcher, errbuf))
+			return -1;
+	}
+	else if (! ts->hostname) {
 		sdb_strbuf_sprintf(errbuf, "Missing hostname in TIMESERIES command");
 		return -1;
 	}
-	if (! ts->metric) {
+	else if (! ts->metric) {
 		sdb_strbuf_sprintf(errbuf, "Missing metric name in TIMESERIES command");
 		return -1;
 	}
+	if ((ts->aggregate < SDB_TIMESERIES_AGGR_NONE)
+			|| (ts->aggregate > SDB_TIMESERIES_AGGR_PERCENTILE)) {
+		sdb_strbuf_sprintf(errbuf, "Invalid aggregation function %d "
+				"in TIMESERIES command", ts->aggregate);
+		return -1;
+	}
+	if ((ts->aggregate != SDB_TIMESERIES_AGGR_NONE) && (! ts->matcher)) {
+		sdb_strbuf_sprintf(errbuf, "Unexpected aggregation of a single "
+				"time-series in TIMESERIES command");
+		return -1;
+	}
 	if (ts->end <= ts->start) {
 		char start_str[64], end_str[64];
 		sdb_strftime(start_str, sizeof(start_str), ts->start);
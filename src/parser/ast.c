@@ -25,6 +25,7 @@
  * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include "sysdb.h"
 #include "core/store.h"
 
 #include "parser/ast.h"
@@ -149,6 +150,8 @@ timeseries_destroy(sdb_object_t *obj)
 		timeseries->data_names = NULL;
 	}
 	timeseries->hostname = timeseries->metric = NULL;
+	sdb_object_deref(SDB_OBJ(timeseries->matcher));
+	timeseries->matcher = NULL;
 } /* timeseries_destroy */
 
 static sdb_type_t op_type = {
@@ -181,6 +184,12 @@ static sdb_type_t value_type = {
 	/* destroy */ value_destroy,
 };
 
+static sdb_type_t param_type = {
+	/* size */ sizeof(sdb_ast_param_t),
+	/* init */ NULL,
+	/* destroy */ NULL,
+};
+
 static sdb_type_t fetch_type = {
 	/* size */ sizeof(sdb_ast_fetch_t),
 	/* init */ NULL,
@@ -297,6 +306,20 @@ sdb_ast_value_create(int type, char *name)
 	return SDB_AST_NODE(value);
 } /* sdb_ast_value_create */
 
+sdb_ast_node_t *
+sdb_ast_param_create(int index)
+{
+	sdb_ast_param_t *param;
+	param = SDB_AST_PARAM(sdb_object_create("PARAM", param_type));
+	if (! param)
+		return NULL;
+
+	param->super.type = SDB_AST_TYPE_PARAM;
+
+	param->index = index;
+	return SDB_AST_NODE(param);
+} /* sdb_ast_param_create */
+
 sdb_ast_node_t *
 sdb_ast_fetch_create(int obj_type, char *hostname,
 		int parent_type, char *parent, char *name,
@@ -320,7 +343,7 @@ sdb_ast_fetch_create(int obj_type, char *hostname,
 } /* sdb_ast_fetch_create */
 
 sdb_ast_node_t *
-sdb_ast_list_create(int obj_type, sdb_ast_node_t *filter)
+sdb_ast_list_create(int obj_type, sdb_ast_node_t *filter, int64_t since)
 {
 	sdb_ast_list_t *list;
 	list = SDB_AST_LIST(sdb_object_create("LIST", list_type));
@@ -331,6 +354,7 @@ sdb_ast_list_create(int obj_type, sdb_ast_node_t *filter)
 
 	list->obj_type = obj_type;
 	list->filter = filter;
+	list->since = since;
 	return SDB_AST_NODE(list);
 } /* sdb_ast_list_create */
 
@@ -379,8 +403,10 @@ sdb_ast_store_create(int obj_type, char *hostname,
 
 sdb_ast_node_t *
 sdb_ast_timeseries_create(char *hostname, char *metric,
-		char **data_names, size_t data_names_len,
-		sdb_time_t start, sdb_time_t end)
+		sdb_ast_node_t *matcher, char **data_names, size_t data_names_len,
+		sdb_time_t start, sdb_time_t end,
+		sdb_time_t resolution, size_t max_points, int downsample,
+		int aggregate, double percentile)
 {
 	sdb_ast_timeseries_t *timeseries;
 	timeseries = SDB_AST_TIMESERIES(sdb_object_create("TIMESERIES", ts_type));
@@ -391,11 +417,56 @@ sdb_ast_timeseries_create(char *hostname, char *metric,
 
 	timeseries->hostname = hostname;
 	timeseries->metric = metric;
+	timeseries->matcher = matcher;
 	timeseries->data_names = data_names;
 	timeseries->data_names_len = data_names_len;
 	timeseries->start = start;
 	timeseries->end = end;
+	timeseries->resolution = resolution;
+	timeseries->max_points = max_points;
+	timeseries->downsample = downsample;
+	timeseries->aggregate = aggregate;
+	timeseries->percentile = percentile;
 	return SDB_AST_NODE(timeseries);
 } /* sdb_ast_timeseries_create */
 
+int
+sdb_ast_params_num(sdb_ast_node_t *node)
+{
+	int n = 0, m = 0;
+
+	if (! node)
+		return 0;
+
+	switch (node->type) {
+	case SDB_AST_TYPE_PARAM:
+		return SDB_AST_PARAM(node)->index;
+	case SDB_AST_TYPE_OPERATOR:
+		n = sdb_ast_params_num(SDB_AST_OP(node)->left);
+		m = sdb_ast_params_num(SDB_AST_OP(node)->right);
+		break;
+	case SDB_AST_TYPE_ITERATOR:
+		n = sdb_ast_params_num(SDB_AST_ITER(node)->iter);
+		m = sdb_ast_params_num(SDB_AST_ITER(node)->expr);
+		break;
+	case SDB_AST_TYPE_TYPED:
+		n = sdb_ast_params_num(SDB_AST_TYPED(node)->expr);
+		break;
+	case SDB_AST_TYPE_FETCH:
+		n = sdb_ast_params_num(SDB_AST_FETCH(node)->filter);
+		break;
+	case SDB_AST_TYPE_LIST:
+		n = sdb_ast_params_num(SDB_AST_LIST(node)->filter);
+		break;
+	case SDB_AST_TYPE_LOOKUP:
+		n = sdb_ast_params_num(SDB_AST_LOOKUP(node)->matcher);
+		m = sdb_ast_params_num(SDB_AST_LOOKUP(node)->filter);
+		break;
+	case SDB_AST_TYPE_TIMESERIES:
+		n = sdb_ast_params_num(SDB_AST_TIMESERIES(node)->matcher);
+		break;
+	}
+	return SDB_MAX(n, m);
+} /* sdb_ast_params_num */
+
 /* vim: set tw=78 sw=4 ts=4 noexpandtab : */
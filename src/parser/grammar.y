@@ -43,6 +43,7 @@
 
 #include <assert.h>
 
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -97,6 +98,7 @@ sdb_parser_yyerrorf(YYLTYPE *lval, sdb_parser_yyscan_t scanner, const char *fmt,
 %union {
 	char *str;
 	int integer;
+	int64_t sequence;
 
 	sdb_data_t data;
 	sdb_time_t datetime;
@@ -105,6 +107,12 @@ sdb_parser_yyerrorf(YYLTYPE *lval, sdb_parser_yyscan_t scanner, const char *fmt,
 	sdb_ast_node_t *node;
 
 	struct { char *type; char *id; sdb_time_t last_update; } metric_store;
+	struct {
+		sdb_time_t resolution;
+		size_t max_points;
+		int downsample;
+	} resolution;
+	struct { int function; double percentile; } aggregate;
 }
 
 %start statements
@@ -118,12 +126,16 @@ sdb_parser_yyerrorf(YYLTYPE *lval, sdb_parser_yyscan_t scanner, const char *fmt,
 
 %token HOST_T HOSTS_T SERVICE_T SERVICES_T METRIC_T METRICS_T
 %token ATTRIBUTE_T ATTRIBUTES_T
-%token NAME_T LAST_UPDATE_T AGE_T INTERVAL_T BACKEND_T VALUE_T
+%token NAME_T LAST_UPDATE_T AGE_T INTERVAL_T BACKEND_T VALUE_T SEQUENCE_T
 
 %token LAST UPDATE
 
+%token CHANGED SINCE
+
 %token START END
 
+%token RESOLUTION POINTS USING AGGREGATE
+
 /* NULL token */
 %token NULL_T
 
@@ -135,6 +147,8 @@ sdb_parser_yyerrorf(YYLTYPE *lval, sdb_parser_yyscan_t scanner, const char *fmt,
 
 %token <data> INTEGER FLOAT
 
+%token <integer> PARAM
+
 %token <datetime> DATE TIME
 
 /* Precedence (lowest first): */
@@ -179,6 +193,12 @@ sdb_parser_yyerrorf(YYLTYPE *lval, sdb_parser_yyscan_t scanner, const char *fmt,
 
 %type <metric_store> metric_store_clause
 
+%type <resolution> resolution_clause
+%type <integer> downsample_clause
+%type <aggregate> aggregate_clause
+
+%type <sequence> changed_clause
+
 %destructor { free($$); } <str>
 %destructor { sdb_object_deref(SDB_OBJ($$)); } <node>
 %destructor { sdb_data_free_datum(&$$); } <data>
@@ -293,14 +313,15 @@ fetch_statement:
 	;
 
 /*
- * LIST <type> [FILTER <condition>];
+ * LIST <type> [CHANGED SINCE <sequence>] [FILTER <condition>];
  *
- * Returns a list of all objects in the store.
+ * Returns a list of all objects in the store (changed after the specified
+ * modification sequence number).
  */
 list_statement:
-	LIST object_type_plural filter_clause
+	LIST object_type_plural changed_clause filter_clause
 		{
-			$$ = sdb_ast_list_create($2, $3);
+			$$ = sdb_ast_list_create($2, $4, $3);
 			CK_OOM($$);
 		}
 	;
@@ -328,6 +349,20 @@ filter_clause:
 	|
 	/* empty */ { $$ = NULL; }
 
+changed_clause:
+	CHANGED SINCE INTEGER
+		{
+			if ($3.data.integer < 0) {
+				sdb_parser_yyerrorf(&yylloc, scanner,
+						YY_("syntax error, invalid modification "
+							"sequence number %"PRId64), $3.data.integer);
+				YYABORT;
+			}
+			$$ = $3.data.integer;
+		}
+	|
+	/* empty */ { $$ = -1; }
+
 /*
  * STORE <type> <name>|<host>.<name> [LAST UPDATE <datetime>];
  * STORE METRIC <host>.<name> STORE <type> <id> [LAST UPDATE <datetime>];
@@ -392,18 +427,34 @@ metric_store_clause:
 	/* empty */ { $$.type = $$.id = NULL; $$.last_update = 0; }
 
 /*
- * TIMESERIES <host>.<metric>[<data-source>...] [START <datetime>] [END <datetime>];
+ * TIMESERIES <host>.<metric>[<data-source>...] [START <datetime>] [END <datetime>]
+ *   [RESOLUTION <interval> | RESOLUTION <n> POINTS [USING <method>]];
+ * TIMESERIES metrics MATCHING <condition> [START <datetime>] [END <datetime>]
+ *   [RESOLUTION <interval> | RESOLUTION <n> POINTS [USING <method>]]
+ *   [AGGREGATE <function>];
  *
- * Returns a time-series for the specified host's metric.
+ * Returns a time-series for the specified host's metric or for all metrics
+ * matching the specified condition, optionally aggregated into a single one.
  */
 timeseries_statement:
-	TIMESERIES STRING '.' STRING start_clause end_clause
+	TIMESERIES STRING '.' STRING start_clause end_clause resolution_clause
+		{
+			$$ = sdb_ast_timeseries_create($2, $4, NULL, NULL, 0, $5, $6,
+					$7.resolution, $7.max_points, $7.downsample,
+					SDB_TIMESERIES_AGGR_NONE, 0.0);
+			CK_OOM($$);
+		}
+	|
+	TIMESERIES METRICS_T MATCHING condition
+		start_clause end_clause resolution_clause aggregate_clause
 		{
-			$$ = sdb_ast_timeseries_create($2, $4, NULL, 0, $5, $6);
+			$$ = sdb_ast_timeseries_create(NULL, NULL, $4, NULL, 0, $5, $6,
+					$7.resolution, $7.max_points, $7.downsample,
+					$8.function, $8.percentile);
 			CK_OOM($$);
 		}
 	|
-	TIMESERIES STRING '.' STRING array start_clause end_clause
+	TIMESERIES STRING '.' STRING array start_clause end_clause resolution_clause
 		{
 			char **ds;
 			size_t ds_num;
@@ -421,7 +472,9 @@ timeseries_statement:
 			ds = $5.data.array.values;
 			ds_num = $5.data.array.length;
 
-			$$ = sdb_ast_timeseries_create($2, $4, ds, ds_num, $6, $7);
+			$$ = sdb_ast_timeseries_create($2, $4, NULL, ds, ds_num, $6, $7,
+					$8.resolution, $8.max_points, $8.downsample,
+					SDB_TIMESERIES_AGGR_NONE, 0.0);
 			CK_OOM($$);
 		}
 	;
@@ -436,6 +489,78 @@ end_clause:
 	|
 	/* empty */ { $$ = sdb_gettime(); }
 
+resolution_clause:
+	RESOLUTION interval downsample_clause
+		{
+			if (! $2.data.datetime) {
+				sdb_parser_yyerror(&yylloc, scanner,
+						YY_("syntax error, resolution has to be positive"));
+				YYABORT;
+			}
+			$$.resolution = $2.data.datetime;
+			$$.max_points = 0;
+			$$.downsample = $3;
+		}
+	|
+	RESOLUTION INTEGER POINTS downsample_clause
+		{
+			if ($2.data.integer <= 0) {
+				sdb_parser_yyerrorf(&yylloc, scanner,
+						YY_("syntax error, invalid number of points %"PRId64),
+						$2.data.integer);
+				YYABORT;
+			}
+			$$.resolution = 0;
+			$$.max_points = (size_t)$2.data.integer;
+			$$.downsample = $4;
+		}
+	|
+	/* empty */
+		{
+			$$.resolution = 0;
+			$$.max_points = 0;
+			$$.downsample = SDB_TIMESERIES_AVERAGE;
+		}
+	;
+
+downsample_clause:
+	USING IDENTIFIER
+		{
+			$$ = sdb_timeseries_parse_downsample($2);
+			if ($$ < 0) {
+				sdb_parser_yyerrorf(&yylloc, scanner,
+						YY_("syntax error, unknown downsampling method %s"),
+						$2);
+				free($2); $2 = NULL;
+				YYABORT;
+			}
+			free($2); $2 = NULL;
+		}
+	|
+	/* empty */ { $$ = SDB_TIMESERIES_AVERAGE; }
+	;
+
+aggregate_clause:
+	AGGREGATE IDENTIFIER
+		{
+			$$.function = sdb_timeseries_parse_aggregate($2, &$$.percentile);
+			if ($$.function < 0) {
+				sdb_parser_yyerrorf(&yylloc, scanner,
+						YY_("syntax error, unknown aggregation function %s"),
+						$2);
+				free($2); $2 = NULL;
+				YYABORT;
+			}
+			free($2); $2 = NULL;
+		}
+	|
+	/* empty */
+		{
+			$$.function = SDB_TIMESERIES_AGGR_NONE;
+			$$.percentile = 0.0;
+		}
+	;
+
 /*
  * Basic expressions.
  */
@@ -602,6 +727,12 @@ expression:
 			$$ = sdb_ast_const_create($1);
 			CK_OOM($$);
 		}
+	|
+	PARAM
+		{
+			$$ = sdb_ast_param_create($1);
+			CK_OOM($$);
+		}
 	;
 
 object_expression:
@@ -660,6 +791,8 @@ field:
 	VALUE_T { $$ = SDB_FIELD_VALUE; }
 	|
 	TIMESERIES { $$ = SDB_FIELD_TIMESERIES; }
+	|
+	SEQUENCE_T { $$ = SDB_FIELD_SEQUENCE; }
 	;
 
 cmp:
@@ -33,49 +33,581 @@
 #include "core/plugin.h"
 #include "core/memstore.h"
 #include "core/store.h"
+#include "client/sock.h"
+#include "frontend/proto.h"
 #include "utils/error.h"
+#include "utils/os.h"
+#include "utils/proto.h"
+#include "utils/ssl.h"
+
+#include "liboconfig/utils.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <sys/socket.h>
+
+#include <pthread.h>
 
 SDB_PLUGIN_MAGIC;
 
+/* store singleton; it survives reconfiguration of the daemon */
+static sdb_memstore_t *store = NULL;
+static size_t store_shards = 0;
+static sdb_memstore_wal_t *wal = NULL;
+
+/* configured number of shards */
+static size_t shards = 1;
+
+/* snapshot file and interval (zero uses the global interval) */
+static char *snapshot_file = NULL;
+static sdb_time_t snapshot_interval = 0;
+
+/* write-ahead log file and sync policy */
+static char *wal_file = NULL;
+static int wal_sync = SDB_MEMSTORE_WAL_SYNC_INTERVAL;
+static sdb_time_t wal_sync_interval = 0;
+#define WAL_SYNC_INTERVAL_DEFAULT SECS_TO_SDB_TIME(1)
+
+/* size of the replication backlog in bytes (zero disables replication) */
+static size_t backlog_size = 0;
+
+/* the primary server to replicate from (see <ReplicaOf>) */
+static struct {
+	/* configuration */
+	char *addr;
+	char *username;
+	sdb_ssl_options_t ssl_opts;
+
+	sdb_client_t *client;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool shutdown;
+
+	pthread_t thread;
+	bool running;
+
+	/* position within the primary's replication stream; it survives
+	 * reconnects and reconfiguration */
+	uint64_t id;
+	uint64_t seq;
+} replica = {
+	NULL, NULL, { NULL, NULL, NULL, NULL }, NULL,
+	PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, false,
+	0, false, 0, 0,
+};
+
+/* delay before reconnecting to the primary server */
+#define REPLICA_RETRY_MIN SECS_TO_SDB_TIME(1)
+#define REPLICA_RETRY_MAX SECS_TO_SDB_TIME(60)
+
 /*
- * plugin API
+ * replica thread
  */
 
+static uint64_t
+unmarshal_int64(const char *buf)
+{
+	uint32_t hi, lo;
+
+	sdb_proto_unmarshal_int32(buf, sizeof(uint32_t), &hi);
+	sdb_proto_unmarshal_int32(buf + sizeof(uint32_t), sizeof(uint32_t), &lo);
+	return ((uint64_t)hi << 32) | lo;
+} /* unmarshal_int64 */
+
+static void
+marshal_int64(char *buf, uint64_t v)
+{
+	sdb_proto_marshal_int32(buf, sizeof(uint32_t), (uint32_t)(v >> 32));
+	sdb_proto_marshal_int32(buf + sizeof(uint32_t), sizeof(uint32_t),
+			(uint32_t)(v & 0xffffffff));
+} /* marshal_int64 */
+
+/* returns true if the replica thread is supposed to stop */
+static bool
+replica_stopping(void)
+{
+	bool stop;
+
+	pthread_mutex_lock(&replica.lock);
+	stop = replica.shutdown;
+	pthread_mutex_unlock(&replica.lock);
+	return stop;
+} /* replica_stopping */
+
+/* subscribe to the primary's replication stream and apply all received
+ * entries until the connection breaks; returns the number of applied
+ * messages or a negative value if the subscription failed */
 static int
-mem_init(sdb_object_t *user_data)
+replica_session(sdb_strbuf_t *buf)
 {
-	sdb_memstore_t *store = SDB_MEMSTORE(user_data);
+	char pos[2 * sizeof(uint64_t)];
+	uint32_t rstatus = 0;
+	int n = 0;
 
-	if (! store) {
-		sdb_log(SDB_LOG_ERR, "Failed to allocate store");
+	if (sdb_client_connect(replica.client, replica.username)) {
+		sdb_log(SDB_LOG_ERR, "Failed to connect to primary SysDB at %s "
+				"as user %s", replica.addr, replica.username);
 		return -1;
 	}
-	if (sdb_plugin_register_writer("memstore",
-				&sdb_memstore_writer, SDB_OBJ(store))) {
-		sdb_object_deref(SDB_OBJ(store));
+	if (replica_stopping())
+		return 0;
+
+	marshal_int64(pos, replica.id);
+	marshal_int64(pos + sizeof(uint64_t), replica.seq);
+	sdb_strbuf_clear(buf);
+	if ((sdb_client_rpc(replica.client, SDB_CONNECTION_REPLICATE,
+					replica.id ? (uint32_t)sizeof(pos) : 0, pos,
+					&rstatus, buf) < 0)
+			|| (rstatus != SDB_CONNECTION_OK)) {
+		sdb_log(SDB_LOG_ERR, "Failed to subscribe to replication stream "
+				"of SysDB at %s: %s", replica.addr,
+				sdb_strbuf_len(buf) ? sdb_strbuf_string(buf) : "I/O error");
 		return -1;
 	}
-	if (sdb_plugin_register_reader("memstore",
-				&sdb_memstore_reader, SDB_OBJ(store))) {
-		sdb_object_deref(SDB_OBJ(store));
+	sdb_log(SDB_LOG_INFO, "Replicating from SysDB at %s", replica.addr);
+
+	while (42) {
+		ssize_t status;
+
+		sdb_strbuf_clear(buf);
+		status = sdb_client_recv(replica.client, &rstatus, buf);
+		if ((status < 0) || ((! status) && sdb_client_eof(replica.client)))
+			break;
+
+		if (rstatus == SDB_CONNECTION_LOG) {
+			uint32_t prio = 0;
+			if (sdb_proto_unmarshal_int32(SDB_STRBUF_STR(buf), &prio) < 0)
+				sdb_log(SDB_LOG_ERR, "%s", sdb_strbuf_string(buf));
+			else
+				sdb_log((int)prio, "%s",
+						sdb_strbuf_string(buf) + sizeof(prio));
+			continue;
+		}
+		if (rstatus != SDB_CONNECTION_REPLICATION) {
+			sdb_log(SDB_LOG_ERR, "Replication from SysDB at %s failed: %s",
+					replica.addr, rstatus == SDB_CONNECTION_ERROR
+						? sdb_strbuf_string(buf) : "unexpected message");
+			break;
+		}
+
+		if ((sdb_strbuf_len(buf) < sizeof(pos))
+				|| (sdb_memstore_apply_replication(store,
+						sdb_strbuf_string(buf) + sizeof(pos),
+						sdb_strbuf_len(buf) - sizeof(pos),
+						&replica.seq) < 0)) {
+			/* the store may be incomplete; start over */
+			sdb_log(SDB_LOG_ERR, "Received malformed replication stream "
+					"from SysDB at %s; resynchronizing", replica.addr);
+			replica.id = replica.seq = 0;
+			break;
+		}
+		/* keep the previous position until a full copy is complete */
+		if (unmarshal_int64(sdb_strbuf_string(buf))) {
+			replica.id = unmarshal_int64(sdb_strbuf_string(buf));
+			replica.seq = unmarshal_int64(sdb_strbuf_string(buf)
+					+ sizeof(uint64_t));
+		}
+		++n;
+	}
+
+	if (! replica_stopping())
+		sdb_log(SDB_LOG_WARNING, "Lost connection to primary SysDB at %s",
+				replica.addr);
+	return n;
+} /* replica_session */
+
+static void *
+replica_main(void __attribute__((unused)) *arg)
+{
+	sdb_time_t delay = REPLICA_RETRY_MIN;
+	sdb_strbuf_t *buf;
+
+	buf = sdb_strbuf_create(1024);
+	if (! buf) {
+		sdb_log(SDB_LOG_ERR, "Failed to allocate replication buffer");
+		return NULL;
+	}
+
+	while (! replica_stopping()) {
+		struct timespec ts;
+		sdb_time_t deadline;
+
+		if (replica_session(buf) > 0)
+			delay = REPLICA_RETRY_MIN;
+		sdb_client_close(replica.client);
+
+		/* wait before reconnecting unless asked to stop */
+		deadline = sdb_gettime() + delay;
+		ts.tv_sec = (time_t)SDB_TIME_TO_SECS(deadline);
+		ts.tv_nsec = (long)(deadline % SECS_TO_SDB_TIME(1));
+		pthread_mutex_lock(&replica.lock);
+		if (! replica.shutdown)
+			pthread_cond_timedwait(&replica.cond, &replica.lock, &ts);
+		pthread_mutex_unlock(&replica.lock);
+
+		delay *= 2;
+		if (delay > REPLICA_RETRY_MAX)
+			delay = REPLICA_RETRY_MAX;
+	}
+
+	sdb_strbuf_destroy(buf);
+	return NULL;
+} /* replica_main */
+
+static int
+replica_start(void)
+{
+	if (replica.running || (! replica.addr))
+		return 0;
+
+	if (! replica.client) {
+		replica.client = sdb_client_create(replica.addr);
+		if (! replica.client) {
+			char errbuf[1024];
+			sdb_log(SDB_LOG_ERR, "Failed to create client connecting to "
+					"'%s': %s", replica.addr,
+					sdb_strerror(errno, errbuf, sizeof(errbuf)));
+			return -1;
+		}
+		if (sdb_client_set_ssl_options(replica.client, &replica.ssl_opts)) {
+			sdb_log(SDB_LOG_ERR, "Failed to apply SSL options");
+			sdb_client_destroy(replica.client);
+			replica.client = NULL;
+			return -1;
+		}
+	}
+
+	replica.shutdown = false;
+	if (pthread_create(&replica.thread, /* attr = */ NULL,
+				replica_main, NULL)) {
+		char errbuf[1024];
+		sdb_log(SDB_LOG_ERR, "Failed to start replica thread: %s",
+				sdb_strerror(errno, errbuf, sizeof(errbuf)));
 		return -1;
 	}
+	replica.running = true;
 	return 0;
+} /* replica_start */
+
+static void
+replica_stop(void)
+{
+	if (! replica.running)
+		return;
+
+	/* shutting down the socket interrupts any blocking reads */
+	pthread_mutex_lock(&replica.lock);
+	replica.shutdown = true;
+	pthread_cond_signal(&replica.cond);
+	sdb_client_shutdown(replica.client, SHUT_RDWR);
+	pthread_mutex_unlock(&replica.lock);
+
+	pthread_join(replica.thread, NULL);
+	replica.running = false;
+
+	sdb_client_destroy(replica.client);
+	replica.client = NULL;
+} /* replica_stop */
+
+static void
+replica_reset(void)
+{
+	if (replica.addr)
+		free(replica.addr);
+	replica.addr = NULL;
+	if (replica.username)
+		free(replica.username);
+	replica.username = NULL;
+	sdb_ssl_free_options(&replica.ssl_opts);
+} /* replica_reset */
+
+/*
+ * plugin API
+ */
+
+static int
+mem_snapshot(sdb_object_t __attribute__((unused)) *user_data)
+{
+	if (! (store && snapshot_file))
+		return 0;
+	if (wal)
+		return sdb_memstore_wal_checkpoint(wal, snapshot_file);
+	return sdb_memstore_snapshot(store, snapshot_file);
+} /* mem_snapshot */
+
+static int
+mem_init(sdb_object_t __attribute__((unused)) *user_data)
+{
+	sdb_store_writer_t *writer = &sdb_memstore_writer;
+	sdb_object_t *writer_data;
+
+	if (wal_file && (! snapshot_file)) {
+		sdb_log(SDB_LOG_ERR, "WriteAheadLog requires Snapshot to be "
+				"configured as well");
+		return -1;
+	}
+
+	if (! store) {
+		store = sdb_memstore_create_sharded(shards);
+		if (! store) {
+			sdb_log(SDB_LOG_ERR, "Failed to allocate store");
+			return -1;
+		}
+		store_shards = shards;
+
+		if (backlog_size
+				&& sdb_memstore_enable_replication(store, backlog_size)) {
+			sdb_log(SDB_LOG_ERR, "Failed to enable replication");
+			return -1;
+		}
+
+		/* the store is populated from the snapshot before any collectors
+		 * start; this only happens on startup; records loaded before an
+		 * error are kept since they are valid nonetheless */
+		if (snapshot_file
+				&& (sdb_memstore_load_snapshot(store, snapshot_file) < 0))
+			sdb_log(SDB_LOG_WARNING, "Failed to load snapshot '%s'; "
+					"starting with the objects loaded before the error "
+					"(if any)", snapshot_file);
+
+		if (wal_file) {
+			if (sdb_memstore_wal_replay(store, wal_file) < 0)
+				sdb_log(SDB_LOG_WARNING, "Failed to replay write-ahead "
+						"log '%s'", wal_file);
+			wal = sdb_memstore_wal_create(store, wal_file, wal_sync,
+					wal_sync_interval ? wal_sync_interval
+						: WAL_SYNC_INTERVAL_DEFAULT);
+			if (! wal) {
+				sdb_log(SDB_LOG_ERR, "Failed to open write-ahead log '%s'",
+						wal_file);
+				return -1;
+			}
+		}
+	}
+	else if (store_shards != shards)
+		sdb_log(SDB_LOG_WARNING, "Cannot change the number of shards "
+				"of the store from %zu to %zu without restarting the daemon",
+				store_shards, shards);
+
+	writer_data = SDB_OBJ(store);
+	if (wal) {
+		writer = &sdb_memstore_wal_writer;
+		writer_data = SDB_OBJ(wal);
+	}
+	if (sdb_plugin_register_writer("memstore", writer, writer_data))
+		return -1;
+	if (sdb_plugin_register_reader("memstore",
+				&sdb_memstore_reader, SDB_OBJ(store)))
+		return -1;
+
+	if (snapshot_file) {
+		if (sdb_plugin_register_collector("snapshot", mem_snapshot,
+					snapshot_interval ? &snapshot_interval : NULL, NULL))
+			return -1;
+	}
+	return replica_start();
 } /* mem_init */
 
 static int
-mem_shutdown(sdb_object_t *user_data)
+mem_shutdown(sdb_object_t __attribute__((unused)) *user_data)
 {
-	sdb_object_deref(user_data);
+	replica_stop();
+	mem_snapshot(NULL);
+	sdb_object_deref(SDB_OBJ(wal));
+	wal = NULL;
+	sdb_object_deref(SDB_OBJ(store));
+	store = NULL;
 	return 0;
 } /* mem_shutdown */
 
+static int
+mem_config_replica(oconfig_item_t *ci)
+{
+	char *addr = NULL;
+	int i;
+
+	if (oconfig_get_string(ci, &addr)) {
+		sdb_log(SDB_LOG_ERR, "ReplicaOf requires a single string argument\n"
+				"\tUsage: <ReplicaOf ADDRESS>");
+		return -1;
+	}
+	if (replica.addr) {
+		sdb_log(SDB_LOG_ERR, "Cannot replicate from more than one server "
+				"(%s and %s)", replica.addr, addr);
+		return -1;
+	}
+
+	replica.addr = strdup(addr);
+	if (! replica.addr) {
+		sdb_log(SDB_LOG_ERR, "Failed to allocate memory");
+		return -1;
+	}
+
+	for (i = 0; i < ci->children_num; ++i) {
+		oconfig_item_t *child = ci->children + i;
+		char **target = NULL;
+		char *tmp = NULL;
+
+		if (! strcasecmp(child->key, "Username"))
+			target = &replica.username;
+		else if (! strcasecmp(child->key, "SSLCertificate"))
+			target = &replica.ssl_opts.cert_file;
+		else if (! strcasecmp(child->key, "SSLCertificateKey"))
+			target = &replica.ssl_opts.key_file;
+		else if (! strcasecmp(child->key, "SSLCACertificates"))
+			target = &replica.ssl_opts.ca_file;
+		else {
+			sdb_log(SDB_LOG_WARNING, "Ignoring unknown config option '%s' "
+					"inside <ReplicaOf %s>.", child->key, replica.addr);
+			continue;
+		}
+
+		if (oconfig_get_string(child, &tmp)) {
+			sdb_log(SDB_LOG_ERR, "%s requires a single string argument",
+					child->key);
+			replica_reset();
+			return -1;
+		}
+		if (*target)
+			free(*target);
+		*target = strdup(tmp);
+		if (! *target) {
+			sdb_log(SDB_LOG_ERR, "Failed to allocate memory");
+			replica_reset();
+			return -1;
+		}
+	}
+
+	if (! replica.username)
+		replica.username = sdb_get_current_user();
+	return 0;
+} /* mem_config_replica */
+
+static int
+mem_config(oconfig_item_t *ci)
+{
+	int i;
+
+	if (! ci) {
+		/* reset to defaults on deconfigure */
+		shards = 1;
+		if (snapshot_file)
+			free(snapshot_file);
+		snapshot_file = NULL;
+		snapshot_interval = 0;
+		if (wal_file)
+			free(wal_file);
+		wal_file = NULL;
+		wal_sync = SDB_MEMSTORE_WAL_SYNC_INTERVAL;
+		wal_sync_interval = 0;
+		backlog_size = 0;
+
+		/* the replica thread uses the current configuration */
+		replica_stop();
+		replica_reset();
+		return 0;
+	}
+
+	for (i = 0; i < ci->children_num; ++i) {
+		oconfig_item_t *child = ci->children + i;
+
+		if (! strcasecmp(child->key, "Shards")) {
+			double n = 0.0;
+			if (oconfig_get_number(child, &n) || (n < 1.0)) {
+				sdb_log(SDB_LOG_ERR, "Shards requires a single positive "
+						"numeric argument\n\tUsage: Shards N");
+				return -1;
+			}
+			shards = (size_t)n;
+		}
+		else if (! strcasecmp(child->key, "Snapshot")) {
+			char *filename = NULL;
+			if (oconfig_get_string(child, &filename)) {
+				sdb_log(SDB_LOG_ERR, "Snapshot requires a single string "
+						"argument\n\tUsage: Snapshot FILENAME");
+				return -1;
+			}
+			if (snapshot_file)
+				free(snapshot_file);
+			snapshot_file = strdup(filename);
+			if (! snapshot_file) {
+				sdb_log(SDB_LOG_ERR, "Failed to allocate memory");
+				return -1;
+			}
+		}
+		else if (! strcasecmp(child->key, "SnapshotInterval")) {
+			double n = 0.0;
+			if (oconfig_get_number(child, &n) || (n <= 0.0)) {
+				sdb_log(SDB_LOG_ERR, "SnapshotInterval requires a single "
+						"positive numeric argument\n"
+						"\tUsage: SnapshotInterval SECONDS");
+				return -1;
+			}
+			snapshot_interval = DOUBLE_TO_SDB_TIME(n);
+		}
+		else if (! strcasecmp(child->key, "WriteAheadLog")) {
+			char *filename = NULL;
+			if (oconfig_get_string(child, &filename)) {
+				sdb_log(SDB_LOG_ERR, "WriteAheadLog requires a single string "
+						"argument\n\tUsage: WriteAheadLog FILENAME");
+				return -1;
+			}
+			if (wal_file)
+				free(wal_file);
+			wal_file = strdup(filename);
+			if (! wal_file) {
+				sdb_log(SDB_LOG_ERR, "Failed to allocate memory");
+				return -1;
+			}
+		}
+		else if (! strcasecmp(child->key, "WriteAheadLogSync")) {
+			char *policy = NULL;
+			double n = 0.0;
+			if (! oconfig_get_number(child, &n) && (n > 0.0)) {
+				wal_sync = SDB_MEMSTORE_WAL_SYNC_INTERVAL;
+				wal_sync_interval = DOUBLE_TO_SDB_TIME(n);
+			}
+			else if (! oconfig_get_string(child, &policy)
+					&& (! strcasecmp(policy, "always")))
+				wal_sync = SDB_MEMSTORE_WAL_SYNC_ALWAYS;
+			else if (policy && (! strcasecmp(policy, "none")))
+				wal_sync = SDB_MEMSTORE_WAL_SYNC_NONE;
+			else {
+				sdb_log(SDB_LOG_ERR, "WriteAheadLogSync requires a single "
+						"argument\n\tUsage: WriteAheadLogSync "
+						"always|none|SECONDS");
+				return -1;
+			}
+		}
+		else if (! strcasecmp(child->key, "ReplicationBacklog")) {
+			double n = 0.0;
+			if (oconfig_get_number(child, &n) || (n <= 0.0)) {
+				sdb_log(SDB_LOG_ERR, "ReplicationBacklog requires a single "
+						"positive numeric argument\n"
+						"\tUsage: ReplicationBacklog MEGABYTES");
+				return -1;
+			}
+			backlog_size = (size_t)(n * 1024.0 * 1024.0);
+		}
+		else if (! strcasecmp(child->key, "ReplicaOf")) {
+			if (mem_config_replica(child))
+				return -1;
+		}
+		else
+			sdb_log(SDB_LOG_WARNING, "Ignoring unknown config option '%s'.",
+					child->key);
+	}
+	return 0;
+} /* mem_config */
+
 int
 sdb_module_init(sdb_plugin_info_t *info)
 {
-	/* store singleton */
-	static sdb_memstore_t *store;
-
 	sdb_plugin_set_info(info, SDB_PLUGIN_INFO_DESC, "in-memory object store");
 	sdb_plugin_set_info(info, SDB_PLUGIN_INFO_COPYRIGHT,
 			"Copyright (C) 2015 Sebastian 'tokkee' Harl <sh@tokkee.org>");
@@ -83,15 +615,9 @@ sdb_module_init(sdb_plugin_info_t *info)
 	sdb_plugin_set_info(info, SDB_PLUGIN_INFO_VERSION, SDB_VERSION);
 	sdb_plugin_set_info(info, SDB_PLUGIN_INFO_PLUGIN_VERSION, SDB_VERSION);
 
-	if (! store) {
-		if (! (store = sdb_memstore_create())) {
-			sdb_log(SDB_LOG_ERR, "Failed to create store object");
-			return -1;
-		}
-	}
-
-	sdb_plugin_register_init("main", mem_init, SDB_OBJ(store));
-	sdb_plugin_register_shutdown("main", mem_shutdown, SDB_OBJ(store));
+	sdb_plugin_register_config(mem_config);
+	sdb_plugin_register_init("main", mem_init, NULL);
+	sdb_plugin_register_shutdown("main", mem_shutdown, NULL);
 	return 0;
 } /* sdb_module_init */
 
@@ -31,6 +31,7 @@
 
 #include "sysdb.h"
 #include "core/plugin.h"
+#include "core/time.h"
 #include "client/sock.h"
 #include "utils/error.h"
 #include "utils/proto.h"
@@ -39,86 +40,668 @@
 
 #include "liboconfig/utils.h"
 
+#include <assert.h>
+#include <ctype.h>
 #include <errno.h>
 
+#include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <unistd.h>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/select.h>
 
 SDB_PLUGIN_MAGIC;
 
+/* default number of outstanding requests and objects per request */
+#define WINDOW_DEFAULT 16
+#define BATCH_SIZE_DEFAULT 256
+/* start a new request once a batch exceeds this size */
+#define BATCH_MAX_BYTES (64 * 1024)
+/* give up on outstanding requests after this many failed attempts */
+#define MAX_RETRIES 3
+/* delay before the second attempt; it doubles with each further attempt */
+#define RETRY_DELAY SECS_TO_SDB_TIME(1)
+/* number of points per server on the hash ring of a shard set */
+#define RING_POINTS 128
+
 /*
  * private data types
  */
 
+/* a single request; it holds one or more encoded objects */
+typedef struct frame {
+	struct frame *next;
+	uint32_t cmd;
+	size_t objects;
+	sdb_strbuf_t *data;
+} frame_t;
+
+typedef struct {
+	frame_t *head;
+	frame_t *tail;
+	size_t len;
+} frame_list_t;
+#define FRAME_LIST_INIT { NULL, NULL, 0 }
+
 typedef struct {
 	sdb_client_t *client;
 	char *addr;
 	char *username;
 	sdb_ssl_options_t ssl_opts;
-} user_data_t;
-#define UD(obj) SDB_OBJ_WRAPPER(obj)->data
+
+	/* maximum number of outstanding requests and objects per request */
+	size_t window;
+	size_t batch_size;
+
+	/* The sender thread owns the client connection. Writers append objects
+	 * to the current batch which is queued once it is full. The sender thread
+	 * picks up partial batches whenever there are no outstanding requests.
+	 * While waiting for replies, it waits for the socket and the wakeup pipe
+	 * at the same time; writers use the latter to signal new requests. */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_cond_t space_cond;
+	frame_t *batch;
+	frame_list_t queue;
+	bool shutdown;
+	bool waiting;
+	int wakeup[2];
+
+	/* only accessed by the sender thread */
+	frame_list_t in_flight;
+	int failures;
+
+	pthread_t sender;
+	bool sender_running;
+} server_t;
+
+typedef struct {
+	uint32_t hash;
+	size_t server;
+} ring_point_t;
+
+/* A set of servers sharing all objects between them. Each host, along with
+ * all of its children, is sent to the 'replicas' servers following the
+ * hash of its name on the ring. A plain server is a set of a single server
+ * with a single replica. */
+typedef struct {
+	server_t **servers;
+	size_t servers_num;
+	size_t replicas;
+
+	/* sorted by hash */
+	ring_point_t *ring;
+	size_t ring_num;
+
+	/* configured using <ShardSet>; its servers may be unavailable on
+	 * startup */
+	bool is_shard_set;
+
+	sdb_plugin_writer_opts_t writer_opts;
+} shard_set_t;
+#define UD(obj) ((shard_set_t *)SDB_OBJ_WRAPPER(obj)->data)
 
 static void
-user_data_destroy(void *obj)
+frame_destroy(frame_t *frame)
 {
-	user_data_t *ud = obj;
+	if (! frame)
+		return;
+	sdb_strbuf_destroy(frame->data);
+	free(frame);
+} /* frame_destroy */
 
-	if (! ud)
+static void
+frame_list_append(frame_list_t *list, frame_t *frame)
+{
+	frame->next = NULL;
+	if (list->tail)
+		list->tail->next = frame;
+	else
+		list->head = frame;
+	list->tail = frame;
+	++list->len;
+} /* frame_list_append */
+
+static frame_t *
+frame_list_shift(frame_list_t *list)
+{
+	frame_t *frame = list->head;
+
+	if (! frame)
+		return NULL;
+	list->head = frame->next;
+	if (! list->head)
+		list->tail = NULL;
+	--list->len;
+	frame->next = NULL;
+	return frame;
+} /* frame_list_shift */
+
+/* returns the number of discarded objects */
+static size_t
+frame_list_clear(frame_list_t *list)
+{
+	size_t objects = 0;
+	frame_t *frame;
+
+	while ((frame = frame_list_shift(list))) {
+		objects += frame->objects;
+		frame_destroy(frame);
+	}
+	return objects;
+} /* frame_list_clear */
+
+static void sender_stop(server_t *srv);
+
+static void
+server_destroy(server_t *srv)
+{
+	if (! srv)
 		return;
 
-	if (ud->client)
-		sdb_client_destroy(ud->client);
-	ud->client = NULL;
-	if (ud->addr)
-		free(ud->addr);
-	ud->addr = NULL;
-	if (ud->username)
-		free(ud->username);
-	ud->username = NULL;
+	sender_stop(srv);
+	frame_destroy(srv->batch);
+	srv->batch = NULL;
+	frame_list_clear(&srv->queue);
+	frame_list_clear(&srv->in_flight);
+	pthread_mutex_destroy(&srv->lock);
+	pthread_cond_destroy(&srv->cond);
+	pthread_cond_destroy(&srv->space_cond);
+	if (srv->wakeup[0] >= 0)
+		close(srv->wakeup[0]);
+	if (srv->wakeup[1] >= 0)
+		close(srv->wakeup[1]);
+
+	if (srv->client)
+		sdb_client_destroy(srv->client);
+	srv->client = NULL;
+	if (srv->addr)
+		free(srv->addr);
+	srv->addr = NULL;
+	if (srv->username)
+		free(srv->username);
+	srv->username = NULL;
+
+	sdb_ssl_free_options(&srv->ssl_opts);
+
+	free(srv);
+} /* server_destroy */
 
-	sdb_ssl_free_options(&ud->ssl_opts);
+static void
+shard_set_destroy(void *obj)
+{
+	shard_set_t *set = obj;
+	size_t i;
+
+	if (! set)
+		return;
 
-	free(ud);
-} /* user_data_destroy */
+	for (i = 0; i < set->servers_num; ++i)
+		server_destroy(set->servers[i]);
+	if (set->servers)
+		free(set->servers);
+	set->servers = NULL;
+	if (set->ring)
+		free(set->ring);
+	set->ring = NULL;
+	free(set);
+} /* shard_set_destroy */
 
 /*
- * store writer implementation
+ * sender thread
  */
 
+/* wake up the sender thread if it is waiting for replies; expects the lock
+ * to be held */
+static void
+sender_wakeup(server_t *srv)
+{
+	if (! srv->waiting)
+		return;
+	srv->waiting = false;
+	/* a full pipe will wake up the thread as well */
+	if (write(srv->wakeup[1], "", 1) <= 0)
+		sdb_log(SDB_LOG_DEBUG, "Failed to wake up sender thread for SysDB "
+				"at %s", srv->addr);
+} /* sender_wakeup */
+
+static int
+reconnect(server_t *srv)
+{
+	sdb_client_close(srv->client);
+	if (sdb_client_connect(srv->client, srv->username)) {
+		sdb_log(SDB_LOG_ERR, "Failed to reconnect to SysDB "
+				"at %s as user %s", srv->addr, srv->username);
+		return -1;
+	}
+	sdb_log(SDB_LOG_INFO, "Successfully reconnected to SysDB "
+			"at %s as user %s", srv->addr, srv->username);
+	return 0;
+} /* reconnect */
+
+/* wait for the specified amount of time or until shutting down */
+static void
+retry_wait(server_t *srv, sdb_time_t delay)
+{
+	sdb_time_t deadline = sdb_gettime() + delay;
+	struct timespec ts;
+
+	ts.tv_sec = (time_t)SDB_TIME_TO_SECS(deadline);
+	ts.tv_nsec = (long)(deadline % SECS_TO_SDB_TIME(1));
+
+	/* the condition is signaled for new objects as well */
+	pthread_mutex_lock(&srv->lock);
+	while ((! srv->shutdown) && (sdb_gettime() < deadline))
+		if (pthread_cond_timedwait(&srv->cond, &srv->lock, &ts) == ETIMEDOUT)
+			break;
+	pthread_mutex_unlock(&srv->lock);
+} /* retry_wait */
+
+/* handle a broken connection: all outstanding requests are sent again after
+ * reconnecting; failed reconnects count towards the same limit of attempts
+ * and all pending objects are dropped once that has been exhausted */
+static void
+connection_failed(server_t *srv)
+{
+	frame_list_t empty = FRAME_LIST_INIT;
+	size_t dropped;
+
+	while (srv->failures < MAX_RETRIES) {
+		/* back off unless this is the first attempt after a success */
+		if (srv->failures)
+			retry_wait(srv, RETRY_DELAY << (srv->failures - 1));
+		++srv->failures;
+
+		if (reconnect(srv))
+			continue;
+
+		/* re-queue outstanding requests in front of any queued ones */
+		pthread_mutex_lock(&srv->lock);
+		if (srv->in_flight.head) {
+			srv->in_flight.tail->next = srv->queue.head;
+			if (! srv->queue.tail)
+				srv->queue.tail = srv->in_flight.tail;
+			srv->queue.head = srv->in_flight.head;
+			srv->queue.len += srv->in_flight.len;
+			srv->in_flight = empty;
+		}
+		pthread_mutex_unlock(&srv->lock);
+		return;
+	}
+
+	srv->failures = 0;
+	pthread_mutex_lock(&srv->lock);
+	dropped = frame_list_clear(&srv->in_flight) + frame_list_clear(&srv->queue);
+	pthread_cond_broadcast(&srv->space_cond);
+	pthread_mutex_unlock(&srv->lock);
+	sdb_log(SDB_LOG_ERR, "Dropped %zu objects to be sent to SysDB at %s",
+			dropped, srv->addr);
+} /* connection_failed */
+
+/* wait until a reply may be received or until being woken up to send
+ * further requests; returns a positive value in the former case */
+static int
+wait_reply(server_t *srv)
+{
+	int fd = sdb_client_sockfd(srv->client);
+	fd_set ready;
+	char buf[32];
+
+	/* further replies may have been received along with a previous one */
+	if (sdb_client_pending(srv->client))
+		return 1;
+	if (fd < 0)
+		return -1;
+
+	while (42) {
+		FD_ZERO(&ready);
+		FD_SET(fd, &ready);
+		FD_SET(srv->wakeup[0], &ready);
+
+		if (select(SDB_MAX(fd, srv->wakeup[0]) + 1, &ready,
+					NULL, NULL, NULL) >= 0)
+			break;
+		if (errno != EINTR) {
+			char errbuf[1024];
+			sdb_log(SDB_LOG_ERR, "Failed to wait for reply from SysDB "
+					"at %s: %s", srv->addr,
+					sdb_strerror(errno, errbuf, sizeof(errbuf)));
+			return -1;
+		}
+	}
+
+	if (FD_ISSET(srv->wakeup[0], &ready))
+		while (read(srv->wakeup[0], buf, sizeof(buf)) > 0)
+			/* drain the pipe */;
+	return FD_ISSET(fd, &ready) ? 1 : 0;
+} /* wait_reply */
+
+/* receive the reply to the oldest outstanding request */
 static int
-store_rpc(user_data_t *ud, const char *msg, size_t msg_len)
+recv_reply(server_t *srv)
 {
 	sdb_strbuf_t *buf = sdb_strbuf_create(128);
+	frame_t *frame;
 	uint32_t rstatus = 0;
 	ssize_t status;
 
-	if (sdb_client_eof(ud->client)) {
-		sdb_client_close(ud->client);
-		if (sdb_client_connect(ud->client, ud->username)) {
-			sdb_log(SDB_LOG_ERR, "Failed to reconnect to SysDB "
-					"at %s as user %s", ud->addr, ud->username);
+	if (! buf)
+		return -1;
+
+	while (42) {
+		sdb_strbuf_clear(buf);
+		status = sdb_client_recv(srv->client, &rstatus, buf);
+		if ((status < 0) || ((! status) && sdb_client_eof(srv->client))) {
+			char errbuf[1024];
+			sdb_log(SDB_LOG_ERR, "Failed to receive reply from SysDB "
+					"at %s: %s", srv->addr,
+					sdb_strerror(errno, errbuf, sizeof(errbuf)));
+			sdb_strbuf_destroy(buf);
 			return -1;
 		}
-		sdb_log(SDB_LOG_INFO, "Successfully reconnected to SysDB "
-				"at %s as user %s", ud->addr, ud->username);
+
+		if (rstatus == SDB_CONNECTION_LOG) {
+			uint32_t prio = 0;
+			if (sdb_proto_unmarshal_int32(SDB_STRBUF_STR(buf), &prio) < 0)
+				sdb_log(SDB_LOG_ERR, "%s", sdb_strbuf_string(buf));
+			else
+				sdb_log((int)prio, "%s",
+						sdb_strbuf_string(buf) + sizeof(prio));
+			continue;
+		}
+		break;
 	}
 
-	status = sdb_client_rpc(ud->client, SDB_CONNECTION_STORE,
-			(uint32_t)msg_len, msg, &rstatus, buf);
-	if (status < 0)
-		sdb_log(SDB_LOG_ERR, "%s", sdb_strbuf_string(buf));
-	else if (rstatus != SDB_CONNECTION_OK) {
-		sdb_log(SDB_LOG_ERR, "Failed to send object: %s",
+	srv->failures = 0;
+	frame = frame_list_shift(&srv->in_flight);
+	assert(frame);
+	if (rstatus != SDB_CONNECTION_OK)
+		sdb_log(SDB_LOG_ERR, "Server reported errors while storing "
+				"%zu object%s: %s",
+				frame->objects, frame->objects == 1 ? "" : "s",
 				sdb_strbuf_string(buf));
+	frame_destroy(frame);
+	sdb_strbuf_destroy(buf);
+	return 0;
+} /* recv_reply */
+
+static void *
+sender(void *arg)
+{
+	server_t *srv = arg;
+
+	pthread_mutex_lock(&srv->lock);
+	while (42) {
+		frame_t *frame = NULL;
+
+		if (srv->in_flight.len < srv->window) {
+			frame = frame_list_shift(&srv->queue);
+			/* ship partial batches right away if the connection is idle;
+			 * objects accumulate in larger batches otherwise */
+			if ((! frame) && srv->batch
+					&& ((! srv->in_flight.len) || srv->shutdown)) {
+				frame = srv->batch;
+				srv->batch = NULL;
+			}
+		}
+
+		if (frame) {
+			pthread_cond_broadcast(&srv->space_cond);
+			pthread_mutex_unlock(&srv->lock);
+
+			/* the request is retried on failure */
+			frame_list_append(&srv->in_flight, frame);
+			if (sdb_client_eof(srv->client)
+					|| (sdb_client_send(srv->client, frame->cmd,
+							(uint32_t)sdb_strbuf_len(frame->data),
+							sdb_strbuf_string(frame->data)) < 0))
+				connection_failed(srv);
+
+			pthread_mutex_lock(&srv->lock);
+			continue;
+		}
+
+		/* keep sending new requests (up to the window size) while waiting
+		 * for replies */
+		if (srv->in_flight.len) {
+			int status;
+
+			srv->waiting = true;
+			pthread_mutex_unlock(&srv->lock);
+			status = wait_reply(srv);
+			if ((status > 0) && recv_reply(srv))
+				status = -1;
+			if (status < 0)
+				connection_failed(srv);
+			pthread_mutex_lock(&srv->lock);
+			srv->waiting = false;
+			continue;
+		}
+
+		if (srv->shutdown && (! srv->queue.len) && (! srv->batch))
+			break;
+		pthread_cond_wait(&srv->cond, &srv->lock);
+	}
+	pthread_mutex_unlock(&srv->lock);
+	return NULL;
+} /* sender */
+
+static int
+sender_start(server_t *srv)
+{
+	if (srv->sender_running)
+		return 0;
+
+	srv->shutdown = false;
+	if (pthread_create(&srv->sender, /* attr = */ NULL, sender, srv)) {
+		char errbuf[1024];
+		sdb_log(SDB_LOG_ERR, "Failed to start sender thread: %s",
+				sdb_strerror(errno, errbuf, sizeof(errbuf)));
+		return -1;
+	}
+	srv->sender_running = true;
+	return 0;
+} /* sender_start */
+
+/* send all pending objects and stop the sender thread */
+static void
+sender_stop(server_t *srv)
+{
+	if (! srv->sender_running)
+		return;
+
+	pthread_mutex_lock(&srv->lock);
+	srv->shutdown = true;
+	pthread_cond_signal(&srv->cond);
+	pthread_cond_broadcast(&srv->space_cond);
+	sender_wakeup(srv);
+	pthread_mutex_unlock(&srv->lock);
+
+	pthread_join(srv->sender, NULL);
+	srv->sender_running = false;
+} /* sender_stop */
+
+/*
+ * object queue
+ */
+
+/* queue an encoded object for sending it to the server */
+static int
+store_object(server_t *srv, const char *msg, size_t msg_len)
+{
+	char len[sizeof(uint32_t)];
+	int status = 0;
+
+	pthread_mutex_lock(&srv->lock);
+	/* apply back-pressure if the server cannot keep up */
+	while (srv->sender_running && (! srv->shutdown)
+			&& (srv->queue.len >= 2 * srv->window))
+		pthread_cond_wait(&srv->space_cond, &srv->lock);
+
+	if ((! srv->sender_running) || srv->shutdown) {
+		sdb_log(SDB_LOG_ERR, "Not connected to SysDB at %s", srv->addr);
+		pthread_mutex_unlock(&srv->lock);
+		return -1;
+	}
+
+	if (! srv->batch) {
+		srv->batch = calloc(1, sizeof(*srv->batch));
+		if (srv->batch)
+			srv->batch->data = sdb_strbuf_create(srv->batch_size > 1
+					? 1024 : msg_len);
+		if ((! srv->batch) || (! srv->batch->data)) {
+			frame_destroy(srv->batch);
+			srv->batch = NULL;
+			pthread_mutex_unlock(&srv->lock);
+			return -1;
+		}
+		/* a batch size of 1 falls back to the plain STORE command */
+		srv->batch->cmd = srv->batch_size > 1
+			? SDB_CONNECTION_STORE_BATCH : SDB_CONNECTION_STORE;
+	}
+
+	if (srv->batch->cmd == SDB_CONNECTION_STORE_BATCH) {
+		sdb_proto_marshal_int32(len, sizeof(len), (uint32_t)msg_len);
+		if (sdb_strbuf_memappend(srv->batch->data, len, sizeof(len)) < 0)
+			status = -1;
+	}
+	if ((! status)
+			&& (sdb_strbuf_memappend(srv->batch->data, msg, msg_len) < 0))
 		status = -1;
+
+	if (! status) {
+		++srv->batch->objects;
+		if ((srv->batch->objects >= srv->batch_size)
+				|| (sdb_strbuf_len(srv->batch->data) >= BATCH_MAX_BYTES)) {
+			frame_list_append(&srv->queue, srv->batch);
+			srv->batch = NULL;
+			sender_wakeup(srv);
+		}
+		pthread_cond_signal(&srv->cond);
 	}
+	pthread_mutex_unlock(&srv->lock);
+	return status;
+} /* store_object */
 
-	sdb_strbuf_destroy(buf);
-	if (status < 0)
+/*
+ * shard sets
+ */
+
+/* case-insensitive FNV-1a hash; the final mixing step spreads similar names
+ * (as used for the ring points) across the whole ring */
+static uint32_t
+hash_name(const char *name)
+{
+	uint32_t hash = 2166136261U;
+
+	for ( ; *name; ++name) {
+		hash ^= (uint32_t)tolower((unsigned char)*name);
+		hash *= 16777619U;
+	}
+
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bU;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35U;
+	hash ^= hash >> 16;
+	return hash;
+} /* hash_name */
+
+static int
+cmp_ring_points(const void *a, const void *b)
+{
+	const ring_point_t *p1 = a;
+	const ring_point_t *p2 = b;
+
+	if (p1->hash != p2->hash)
+		return p1->hash < p2->hash ? -1 : 1;
+	if (p1->server != p2->server)
+		return p1->server < p2->server ? -1 : 1;
+	return 0;
+} /* cmp_ring_points */
+
+/* The points of a server only depend on its address, so the placement of
+ * hosts does not depend on the order of the servers and adding or removing
+ * a server only moves the hosts assigned to that server. */
+static int
+shard_set_build_ring(shard_set_t *set)
+{
+	size_t i, j;
+
+	set->ring_num = set->servers_num * RING_POINTS;
+	set->ring = calloc(set->ring_num, sizeof(*set->ring));
+	if (! set->ring)
 		return -1;
+
+	for (i = 0; i < set->servers_num; ++i) {
+		char point[strlen(set->servers[i]->addr) + 32];
+
+		for (j = 0; j < RING_POINTS; ++j) {
+			ring_point_t *p = set->ring + i * RING_POINTS + j;
+
+			snprintf(point, sizeof(point), "%s#%zu",
+					set->servers[i]->addr, j);
+			p->hash = hash_name(point);
+			p->server = i;
+		}
+	}
+	qsort(set->ring, set->ring_num, sizeof(*set->ring), cmp_ring_points);
 	return 0;
-} /* store_rpc */
+} /* shard_set_build_ring */
+
+/* send an object belonging to the specified host to all of its servers */
+static int
+shard_set_store(shard_set_t *set, const char *hostname,
+		const char *msg, size_t msg_len)
+{
+	bool used[set->servers_num];
+	size_t lo = 0, hi = set->ring_num;
+	size_t i, n;
+	uint32_t hash;
+	int status = 0;
+
+	if (set->replicas >= set->servers_num) {
+		for (i = 0; i < set->servers_num; ++i)
+			if (store_object(set->servers[i], msg, msg_len))
+				status = -1;
+		return status;
+	}
+
+	/* find the first point at or after the host's hash */
+	hash = hash_name(hostname ? hostname : "");
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (set->ring[mid].hash < hash)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	/* walk the ring until finding enough distinct servers; this terminates
+	 * since each server has points on the ring */
+	memset(used, 0, sizeof(used));
+	for (i = lo, n = 0; n < set->replicas; ++i) {
+		ring_point_t *p = set->ring + (i % set->ring_num);
+
+		if (used[p->server])
+			continue;
+		used[p->server] = true;
+		++n;
+
+		if (store_object(set->servers[p->server], msg, msg_len))
+			status = -1;
+	}
+	return status;
+} /* shard_set_store */
+
+/*
+ * store writer implementation
+ */
 
 static int
 store_host(sdb_store_host_t *host, sdb_object_t *user_data)
@@ -128,7 +711,7 @@ store_host(sdb_store_host_t *host, sdb_object_t *user_data)
 	char buf[len];
 
 	sdb_proto_marshal_host(buf, len, &h);
-	return store_rpc(UD(user_data), buf, len);
+	return shard_set_store(UD(user_data), host->name, buf, len);
 } /* store_host */
 
 static int
@@ -141,7 +724,7 @@ store_service(sdb_store_service_t *service, sdb_object_t *user_data)
 	char buf[len];
 
 	sdb_proto_marshal_service(buf, len, &s);
-	return store_rpc(UD(user_data), buf, len);
+	return shard_set_store(UD(user_data), service->hostname, buf, len);
 } /* store_service */
 
 static int
@@ -158,7 +741,7 @@ store_metric(sdb_store_metric_t *metric, sdb_object_t *user_data)
 	char buf[len];
 
 	sdb_proto_marshal_metric(buf, len, &m);
-	return store_rpc(UD(user_data), buf, len);
+	return shard_set_store(UD(user_data), metric->hostname, buf, len);
 } /* store_metric */
 
 static int
@@ -168,11 +751,15 @@ store_attr(sdb_store_attribute_t *attr, sdb_object_t *user_data)
 		attr->last_update, attr->parent_type, attr->hostname, attr->parent,
 		attr->key, attr->value,
 	};
+	const char *hostname = attr->hostname;
 	size_t len = sdb_proto_marshal_attribute(NULL, 0, &a);
 	char buf[len];
 
+	if (attr->parent_type == SDB_HOST)
+		hostname = attr->parent;
+
 	sdb_proto_marshal_attribute(buf, len, &a);
-	return store_rpc(UD(user_data), buf, len);
+	return shard_set_store(UD(user_data), hostname, buf, len);
 } /* store_attr */
 
 static sdb_store_writer_t store_impl = {
@@ -186,59 +773,126 @@ static sdb_store_writer_t store_impl = {
 static int
 store_init(sdb_object_t *user_data)
 {
-	user_data_t *ud;
+	shard_set_t *set;
+	size_t i;
 
 	if (! user_data)
 		return -1;
 
-	ud = SDB_OBJ_WRAPPER(user_data)->data;
-	if (sdb_client_connect(ud->client, ud->username)) {
-		sdb_log(SDB_LOG_ERR, "Failed to connect to SysDB "
-				"at %s as user %s", ud->addr, ud->username);
-		return -1;
-	}
+	set = UD(user_data);
+	for (i = 0; i < set->servers_num; ++i) {
+		server_t *srv = set->servers[i];
 
-	sdb_log(SDB_LOG_INFO, "Successfully connected to SysDB "
-			"at %s as user %s", ud->addr, ud->username);
+		if (sdb_client_connect(srv->client, srv->username)) {
+			sdb_log(set->is_shard_set ? SDB_LOG_WARNING : SDB_LOG_ERR,
+					"Failed to connect to SysDB at %s as user %s",
+					srv->addr, srv->username);
+			/* the other servers of a shard set continue to work while
+			 * this one is handled like a broken connection, that is,
+			 * the sender reconnects when sending the first request */
+			if (! set->is_shard_set)
+				return -1;
+		}
+		else
+			sdb_log(SDB_LOG_INFO, "Successfully connected to SysDB "
+					"at %s as user %s", srv->addr, srv->username);
+
+		if (sender_start(srv))
+			return -1;
+	}
 	return 0;
 } /* store_init */
 
 static int
-store_config_server(oconfig_item_t *ci)
+store_shutdown(sdb_object_t *user_data)
 {
-	sdb_object_t *user_data;
-	user_data_t *ud;
+	shard_set_t *set;
+	size_t i;
+
+	if (! user_data)
+		return -1;
+
+	set = UD(user_data);
+	for (i = 0; i < set->servers_num; ++i)
+		sender_stop(set->servers[i]);
+	return 0;
+} /* store_shutdown */
+
+static int
+store_config_writer_opt(oconfig_item_t *ci, sdb_plugin_writer_opts_t *opts)
+{
+	if (! strcasecmp(ci->key, "ChangesOnly")) {
+		if (oconfig_get_boolean(ci, &opts->changes_only))
+			return -1;
+	}
+	else if (! strcasecmp(ci->key, "Heartbeat")) {
+		double heartbeat;
+		if (oconfig_get_number(ci, &heartbeat) || (heartbeat < 0.0)) {
+			sdb_log(SDB_LOG_ERR, "Heartbeat requires a single, non-negative "
+					"numeric argument\n\tUsage: Heartbeat SECONDS");
+			return -1;
+		}
+		opts->heartbeat = DOUBLE_TO_SDB_TIME(heartbeat);
+	}
+	else
+		return -1;
+	return 0;
+} /* store_config_writer_opt */
+
+/* Parse a server block. Writer options are not accepted for servers
+ * belonging to a shard set (writer_opts == NULL). */
+static server_t *
+store_config_server_opts(oconfig_item_t *ci,
+		sdb_plugin_writer_opts_t *writer_opts)
+{
+	server_t *srv;
 	int ret = 0;
 	int i;
 
-	ud = calloc(1, sizeof(*ud));
-	if (! ud) {
+	srv = calloc(1, sizeof(*srv));
+	if (! srv) {
 		char errbuf[1024];
-		sdb_log(SDB_LOG_ERR, "Failed to allocate a user-data object: %s",
+		sdb_log(SDB_LOG_ERR, "Failed to allocate a server object: %s",
 				sdb_strerror(errno, errbuf, sizeof(errbuf)));
-		return -1;
+		return NULL;
+	}
+	srv->window = WINDOW_DEFAULT;
+	srv->batch_size = BATCH_SIZE_DEFAULT;
+	pthread_mutex_init(&srv->lock, /* attr = */ NULL);
+	pthread_cond_init(&srv->cond, /* attr = */ NULL);
+	pthread_cond_init(&srv->space_cond, /* attr = */ NULL);
+
+	srv->wakeup[0] = srv->wakeup[1] = -1;
+	if (pipe(srv->wakeup)
+			|| fcntl(srv->wakeup[0], F_SETFL, O_NONBLOCK)
+			|| fcntl(srv->wakeup[1], F_SETFL, O_NONBLOCK)) {
+		char errbuf[1024];
+		sdb_log(SDB_LOG_ERR, "Failed to create wakeup pipe: %s",
+				sdb_strerror(errno, errbuf, sizeof(errbuf)));
+		server_destroy(srv);
+		return NULL;
 	}
 
-	if (oconfig_get_string(ci, &ud->addr)) {
+	if (oconfig_get_string(ci, &srv->addr)) {
 		sdb_log(SDB_LOG_ERR, "Server requires a single string argument\n"
 				"\tUsage: <Server ADDRESS>");
-		user_data_destroy(ud);
-		return -1;
+		server_destroy(srv);
+		return NULL;
 	}
-	ud->addr = strdup(ud->addr);
-	if (! ud->addr) {
+	srv->addr = strdup(srv->addr);
+	if (! srv->addr) {
 		sdb_log(SDB_LOG_ERR, "Failed to duplicate a string");
-		user_data_destroy(ud);
-		return -1;
+		server_destroy(srv);
+		return NULL;
 	}
 
-	ud->client = sdb_client_create(ud->addr);
-	if (! ud->client) {
+	srv->client = sdb_client_create(srv->addr);
+	if (! srv->client) {
 		char errbuf[1024];
 		sdb_log(SDB_LOG_ERR, "Failed to create client connecting to '%s': %s",
-				ud->addr, sdb_strerror(errno, errbuf, sizeof(errbuf)));
-		user_data_destroy(ud);
-		return -1;
+				srv->addr, sdb_strerror(errno, errbuf, sizeof(errbuf)));
+		server_destroy(srv);
+		return NULL;
 	}
 
 	for (i = 0; i < ci->children_num; ++i) {
@@ -250,63 +904,262 @@ store_config_server(oconfig_item_t *ci)
 				ret = -1;
 				break;
 			}
-			ud->username = strdup(tmp);
+			srv->username = strdup(tmp);
 		}
 		else if (! strcasecmp(child->key, "SSLCertificate")) {
 			if (oconfig_get_string(child, &tmp)) {
 				ret = -1;
 				break;
 			}
-			ud->ssl_opts.cert_file = strdup(tmp);
+			srv->ssl_opts.cert_file = strdup(tmp);
 		}
 		else if (! strcasecmp(child->key, "SSLCertificateKey")) {
 			if (oconfig_get_string(child, &tmp)) {
 				ret = -1;
 				break;
 			}
-			ud->ssl_opts.key_file = strdup(tmp);
+			srv->ssl_opts.key_file = strdup(tmp);
 		}
 		else if (! strcasecmp(child->key, "SSLCACertificates")) {
 			if (oconfig_get_string(child, &tmp)) {
 				ret = -1;
 				break;
 			}
-			ud->ssl_opts.ca_file = strdup(tmp);
+			srv->ssl_opts.ca_file = strdup(tmp);
+		}
+		else if ((! strcasecmp(child->key, "ChangesOnly"))
+				|| (! strcasecmp(child->key, "Heartbeat"))) {
+			if (! writer_opts) {
+				sdb_log(SDB_LOG_ERR, "%s has to be specified for the whole "
+						"shard set rather than inside <Server %s>",
+						child->key, srv->addr);
+				ret = -1;
+				break;
+			}
+			if (store_config_writer_opt(child, writer_opts)) {
+				ret = -1;
+				break;
+			}
+		}
+		else if (! strcasecmp(child->key, "Window")) {
+			double n = 0.0;
+			if (oconfig_get_number(child, &n) || (n < 1.0)) {
+				sdb_log(SDB_LOG_ERR, "Window requires a single positive "
+						"numeric argument\n\tUsage: Window N");
+				ret = -1;
+				break;
+			}
+			srv->window = (size_t)n;
+		}
+		else if (! strcasecmp(child->key, "Compression")) {
+			uint32_t algo;
+			if (oconfig_get_string(child, &tmp)) {
+				ret = -1;
+				break;
+			}
+			if (! strcasecmp(tmp, "deflate"))
+				algo = SDB_CONNECTION_COMPRESSION_DEFLATE;
+			else if (! strcasecmp(tmp, "none"))
+				algo = SDB_CONNECTION_COMPRESSION_NONE;
+			else {
+				sdb_log(SDB_LOG_ERR, "Unknown compression algorithm '%s'\n"
+						"\tUsage: Compression deflate|none", tmp);
+				ret = -1;
+				break;
+			}
+			if (sdb_client_set_compression(srv->client, algo)) {
+				ret = -1;
+				break;
+			}
+		}
+		else if (! strcasecmp(child->key, "BatchSize")) {
+			double n = 0.0;
+			if (oconfig_get_number(child, &n) || (n < 1.0)) {
+				sdb_log(SDB_LOG_ERR, "BatchSize requires a single positive "
+						"numeric argument\n\tUsage: BatchSize N");
+				ret = -1;
+				break;
+			}
+			srv->batch_size = (size_t)n;
 		}
 		else
 			sdb_log(SDB_LOG_WARNING, "Ignoring unknown config option '%s' "
-					"inside <Server %s>.", child->key, ud->addr);
+					"inside <Server %s>.", child->key, srv->addr);
 	}
 
 	if (ret) {
-		user_data_destroy(ud);
-		return ret;
+		server_destroy(srv);
+		return NULL;
 	}
-	if (! ud->username)
-		ud->username = sdb_get_current_user();
+	if (! srv->username)
+		srv->username = sdb_get_current_user();
 
-	if (sdb_client_set_ssl_options(ud->client, &ud->ssl_opts)) {
+	if (sdb_client_set_ssl_options(srv->client, &srv->ssl_opts)) {
 		sdb_log(SDB_LOG_ERR, "Failed to apply SSL options");
-		user_data_destroy(ud);
+		server_destroy(srv);
+		return NULL;
+	}
+	return srv;
+} /* store_config_server_opts */
+
+/* register the callbacks of a shard set; this takes ownership of 'set' */
+static int
+store_register(const char *name, shard_set_t *set)
+{
+	sdb_object_t *user_data;
+
+	if (shard_set_build_ring(set)) {
+		sdb_log(SDB_LOG_ERR, "Failed to allocate the hash ring of %s", name);
+		shard_set_destroy(set);
 		return -1;
 	}
 
-	user_data = sdb_object_create_wrapper("store-network-userdata", ud,
-			user_data_destroy);
+	user_data = sdb_object_create_wrapper("store-network-userdata", set,
+			shard_set_destroy);
 	if (! user_data) {
 		char errbuf[1024];
 		sdb_log(SDB_LOG_ERR, "Failed to allocate a user-data wrapper object: %s",
 				sdb_strerror(errno, errbuf, sizeof(errbuf)));
-		user_data_destroy(ud);
+		shard_set_destroy(set);
 		return -1;
 	}
 
-	sdb_plugin_register_init(ud->addr, store_init, user_data);
-	sdb_plugin_register_writer(ud->addr, &store_impl, user_data);
+	sdb_plugin_register_init(name, store_init, user_data);
+	sdb_plugin_register_shutdown(name, store_shutdown, user_data);
+	if (set->writer_opts.heartbeat && (! set->writer_opts.changes_only))
+		sdb_log(SDB_LOG_WARNING, "Heartbeat has no effect without ChangesOnly "
+				"inside %s.", name);
+	sdb_plugin_register_writer_opts(name, &store_impl,
+			&set->writer_opts, user_data);
 	sdb_object_deref(user_data);
 	return 0;
+} /* store_register */
+
+static int
+store_config_server(oconfig_item_t *ci)
+{
+	shard_set_t *set;
+
+	set = calloc(1, sizeof(*set));
+	if (set)
+		set->servers = calloc(1, sizeof(*set->servers));
+	if ((! set) || (! set->servers)) {
+		char errbuf[1024];
+		sdb_log(SDB_LOG_ERR, "Failed to allocate a user-data object: %s",
+				sdb_strerror(errno, errbuf, sizeof(errbuf)));
+		shard_set_destroy(set);
+		return -1;
+	}
+
+	set->servers[0] = store_config_server_opts(ci, &set->writer_opts);
+	if (! set->servers[0]) {
+		shard_set_destroy(set);
+		return -1;
+	}
+	set->servers_num = 1;
+	set->replicas = 1;
+	return store_register(set->servers[0]->addr, set);
 } /* store_config_server */
 
+static int
+store_config_shard_set(oconfig_item_t *ci)
+{
+	shard_set_t *set;
+	char *name = NULL;
+	int ret = 0;
+	int i;
+
+	if (oconfig_get_string(ci, &name)) {
+		sdb_log(SDB_LOG_ERR, "ShardSet requires a single string argument\n"
+				"\tUsage: <ShardSet NAME>");
+		return -1;
+	}
+
+	set = calloc(1, sizeof(*set));
+	if (! set) {
+		char errbuf[1024];
+		sdb_log(SDB_LOG_ERR, "Failed to allocate a user-data object: %s",
+				sdb_strerror(errno, errbuf, sizeof(errbuf)));
+		return -1;
+	}
+	set->replicas = 1;
+	set->is_shard_set = true;
+
+	for (i = 0; i < ci->children_num; ++i) {
+		oconfig_item_t *child = ci->children + i;
+
+		if (! strcasecmp(child->key, "Server")) {
+			server_t **tmp;
+			server_t *srv;
+			size_t j;
+
+			srv = store_config_server_opts(child, NULL);
+			if (! srv) {
+				ret = -1;
+				break;
+			}
+			for (j = 0; j < set->servers_num; ++j)
+				if (! strcasecmp(set->servers[j]->addr, srv->addr))
+					break;
+			if (j < set->servers_num) {
+				sdb_log(SDB_LOG_ERR, "Duplicate server %s in <ShardSet %s>",
+						srv->addr, name);
+				server_destroy(srv);
+				ret = -1;
+				break;
+			}
+
+			tmp = realloc(set->servers,
+					(set->servers_num + 1) * sizeof(*set->servers));
+			if (! tmp) {
+				sdb_log(SDB_LOG_ERR, "Failed to allocate memory");
+				server_destroy(srv);
+				ret = -1;
+				break;
+			}
+			set->servers = tmp;
+			set->servers[set->servers_num] = srv;
+			++set->servers_num;
+		}
+		else if (! strcasecmp(child->key, "Replicas")) {
+			double n = 0.0;
+			if (oconfig_get_number(child, &n) || (n < 1.0)) {
+				sdb_log(SDB_LOG_ERR, "Replicas requires a single positive "
+						"numeric argument\n\tUsage: Replicas N");
+				ret = -1;
+				break;
+			}
+			set->replicas = (size_t)n;
+		}
+		else if ((! strcasecmp(child->key, "ChangesOnly"))
+				|| (! strcasecmp(child->key, "Heartbeat"))) {
+			if (store_config_writer_opt(child, &set->writer_opts)) {
+				ret = -1;
+				break;
+			}
+		}
+		else
+			sdb_log(SDB_LOG_WARNING, "Ignoring unknown config option '%s' "
+					"inside <ShardSet %s>.", child->key, name);
+	}
+
+	if ((! ret) && (! set->servers_num)) {
+		sdb_log(SDB_LOG_ERR, "<ShardSet %s> requires at least one server",
+				name);
+		ret = -1;
+	}
+	if ((! ret) && (set->replicas > set->servers_num)) {
+		sdb_log(SDB_LOG_ERR, "<ShardSet %s> has %zu replicas but only "
+				"%zu servers", name, set->replicas, set->servers_num);
+		ret = -1;
+	}
+	if (ret) {
+		shard_set_destroy(set);
+		return ret;
+	}
+	return store_register(name, set);
+} /* store_config_shard_set */
+
 static int
 store_config(oconfig_item_t *ci)
 {
@@ -320,6 +1173,8 @@ store_config(oconfig_item_t *ci)
 
 		if (! strcasecmp(child->key, "Server"))
 			store_config_server(child);
+		else if (! strcasecmp(child->key, "ShardSet"))
+			store_config_shard_set(child);
 		else
 			sdb_log(SDB_LOG_WARNING, "Ignoring unknown config option '%s'.",
 					child->key);
@@ -164,8 +164,6 @@ copy_data(sdb_timeseries_t *ts, rrd_value_t *data, time_t step,
 		size_t ds_cnt, char **ds_names)
 {
 	time_t start = SDB_TIME_TO_SECS(ts->start);
-	time_t end = SDB_TIME_TO_SECS(ts->end);
-	time_t t;
 
 	ssize_t ds_target[ds_cnt];
 	size_t i, j;
@@ -199,15 +197,14 @@ copy_data(sdb_timeseries_t *ts, rrd_value_t *data, time_t step,
 		}
 	}
 
-	for (t = start; t <= end; t += step) {
-		i = (size_t)(t - start) / (size_t)step;
+	/* RRDtool returns rows of values of all data-sources; all of them share
+	 * the same time-stamps */
+	for (i = 0; i < ts->data_len; ++i) {
+		ts->timestamps[i] = SECS_TO_SDB_TIME(start + (time_t)i * step);
 
 		for (j = 0; j < ds_cnt; ++j) {
-			if (ds_target[j] >= 0) {
-				size_t x = (size_t)ds_target[j];
-				ts->data[x][i].timestamp = SECS_TO_SDB_TIME(t);
-				ts->data[x][i].value = *data;
-			}
+			if (ds_target[j] >= 0)
+				ts->data[(size_t)ds_target[j]][i] = *data;
 			++data;
 		}
 	}
@@ -223,7 +220,7 @@ sdb_rrd_fetch(const char *id, sdb_timeseries_opts_t *opts,
 	time_t start = (time_t)SDB_TIME_TO_SECS(opts->start);
 	time_t end = (time_t)SDB_TIME_TO_SECS(opts->end);
 
-	unsigned long step = 0;
+	unsigned long step = 0, points;
 	unsigned long ds_cnt = 0;
 	unsigned long val_cnt = 0;
 	char **ds_namv = NULL;
@@ -254,9 +251,17 @@ sdb_rrd_fetch(const char *id, sdb_timeseries_opts_t *opts,
 		rrd_freemem(data); \
 	} while (0)
 
-	/* limit to about 1000 data-points for now
-	 * TODO: make this configurable */
-	step = (end - start) / 1000;
+	/* limit to about 1000 data-points unless requested otherwise; RRDtool
+	 * only consolidates data by averaging, so leave anything else to the
+	 * generic downsampling applied by the core */
+	points = 1000;
+	if (opts->max_points && ((opts->max_points > points)
+				|| (opts->downsample == SDB_TIMESERIES_AVERAGE)))
+		points = (unsigned long)opts->max_points;
+	step = (end - start) / points;
+	if ((opts->downsample == SDB_TIMESERIES_AVERAGE)
+			&& (opts->resolution > SECS_TO_SDB_TIME(step)))
+		step = (unsigned long)SDB_TIME_TO_SECS(opts->resolution);
 
 	if (rrd_fetch_r(id, "AVERAGE", &start, &end, &step,
 				&ds_cnt, &ds_namv, &data)) {
@@ -34,6 +34,7 @@
 #include "sysdb.h"
 #include "core/plugin.h"
 #include "core/time.h"
+#include "frontend/connection.h"
 #include "utils/error.h"
 
 #include "liboconfig/oconfig.h"
@@ -65,6 +66,7 @@ enum {
  */
 
 static sdb_time_t default_interval = 0;
+static sdb_time_t default_timeout = 0;
 static char *plugin_dir = NULL;
 
 /*
@@ -96,6 +98,31 @@ config_get_interval(oconfig_item_t *ci, sdb_time_t *interval)
 	return 0;
 } /* config_get_interval */
 
+static int
+config_get_timeout(oconfig_item_t *ci, sdb_time_t *timeout)
+{
+	double timeout_dbl = 0.0;
+
+	assert(ci && timeout);
+
+	if (oconfig_get_number(ci, &timeout_dbl)) {
+		sdb_log(SDB_LOG_ERR, "config: Timeout requires "
+				"a single numeric argument\n"
+				"\tUsage: Timeout SECONDS");
+		return ERR_INVALID_ARG;
+	}
+
+	if (timeout_dbl < 0.0) {
+		sdb_log(SDB_LOG_ERR, "config: Invalid timeout: %f\n"
+				"\tTimeout may not be less than zero.",
+				timeout_dbl);
+		return ERR_INVALID_ARG;
+	}
+
+	*timeout = DOUBLE_TO_SDB_TIME(timeout_dbl);
+	return 0;
+} /* config_get_timeout */
+
 /*
  * public parse results
  */
@@ -103,6 +130,21 @@ config_get_interval(oconfig_item_t *ci, sdb_time_t *interval)
 daemon_listener_t *listen_addresses = NULL;
 size_t listen_addresses_num = 0;
 
+size_t query_cache_size = 0;
+size_t query_plan_cache_size = DEFAULT_QUERY_PLAN_CACHE_SIZE;
+
+size_t timeseries_cache_size = 0;
+sdb_time_t timeseries_cache_ttl = DEFAULT_TIMESERIES_CACHE_TTL;
+size_t timeseries_max_metrics = SDB_CONN_TIMESERIES_MAX_METRICS_DEFAULT;
+
+size_t collector_threads = 0;
+
+size_t ingest_threads = 0;
+size_t ingest_queue_size = DEFAULT_INGEST_QUEUE_SIZE;
+
+sdb_plugin_cname_cache_opts_t cname_cache_opts =
+	SDB_PLUGIN_CNAME_CACHE_OPTS_INIT;
+
 /*
  * token parser
  */
@@ -194,6 +236,245 @@ daemon_set_interval(oconfig_item_t *ci)
 	return config_get_interval(ci, &default_interval);
 } /* daemon_set_interval */
 
+static int
+daemon_set_timeout(oconfig_item_t *ci)
+{
+	return config_get_timeout(ci, &default_timeout);
+} /* daemon_set_timeout */
+
+static int
+daemon_set_collector_threads(oconfig_item_t *ci)
+{
+	double threads = 0.0;
+
+	if (oconfig_get_number(ci, &threads)) {
+		sdb_log(SDB_LOG_ERR, "config: CollectorThreads requires "
+				"a single numeric argument\n"
+				"\tUsage: CollectorThreads THREADS");
+		return ERR_INVALID_ARG;
+	}
+
+	if (threads < 0.0) {
+		sdb_log(SDB_LOG_ERR, "config: Invalid number of collector "
+				"threads: %f\n"
+				"\tThe number of threads may not be less than zero.",
+				threads);
+		return ERR_INVALID_ARG;
+	}
+
+	collector_threads = (size_t)threads;
+	return 0;
+} /* daemon_set_collector_threads */
+
+static int
+daemon_set_ingest_threads(oconfig_item_t *ci)
+{
+	double threads = 0.0;
+
+	if (oconfig_get_number(ci, &threads)) {
+		sdb_log(SDB_LOG_ERR, "config: IngestThreads requires "
+				"a single numeric argument\n"
+				"\tUsage: IngestThreads THREADS");
+		return ERR_INVALID_ARG;
+	}
+
+	if (threads < 0.0) {
+		sdb_log(SDB_LOG_ERR, "config: Invalid number of ingest "
+				"threads: %f\n"
+				"\tThe number of threads may not be less than zero.",
+				threads);
+		return ERR_INVALID_ARG;
+	}
+
+	ingest_threads = (size_t)threads;
+	return 0;
+} /* daemon_set_ingest_threads */
+
+static int
+daemon_set_ingest_queue_size(oconfig_item_t *ci)
+{
+	double size = 0.0;
+
+	if (oconfig_get_number(ci, &size)) {
+		sdb_log(SDB_LOG_ERR, "config: IngestQueueSize requires "
+				"a single numeric argument\n"
+				"\tUsage: IngestQueueSize ENTRIES");
+		return ERR_INVALID_ARG;
+	}
+
+	if (size < 1.0) {
+		sdb_log(SDB_LOG_ERR, "config: Invalid ingest queue size: %f\n"
+				"\tThe queue size may not be less than one.", size);
+		return ERR_INVALID_ARG;
+	}
+
+	ingest_queue_size = (size_t)size;
+	return 0;
+} /* daemon_set_ingest_queue_size */
+
+static int
+daemon_set_cname_cache(oconfig_item_t *ci)
+{
+	sdb_plugin_cname_cache_opts_t opts = SDB_PLUGIN_CNAME_CACHE_OPTS_INIT;
+	double value = 0.0;
+	int i;
+
+	if (oconfig_get_number(ci, &value)) {
+		sdb_log(SDB_LOG_ERR, "config: CnameCache requires "
+				"a single numeric argument\n"
+				"\tUsage: CnameCache ENTRIES");
+		return ERR_INVALID_ARG;
+	}
+
+	if (value < 0.0) {
+		sdb_log(SDB_LOG_ERR, "config: Invalid cname cache size: %f\n"
+				"\tThe cache size may not be less than zero.", value);
+		return ERR_INVALID_ARG;
+	}
+	opts.size = (size_t)value;
+
+	for (i = 0; i < ci->children_num; ++i) {
+		oconfig_item_t *child = ci->children + i;
+		sdb_time_t *t = NULL;
+
+		if (! strcasecmp(child->key, "TTL"))
+			t = &opts.ttl;
+		else if (! strcasecmp(child->key, "NegativeTTL"))
+			t = &opts.negative_ttl;
+		else if (! strcasecmp(child->key, "ResolverTimeout"))
+			t = &opts.timeout;
+		else if (strcasecmp(child->key, "ResolverThreads")) {
+			sdb_log(SDB_LOG_WARNING, "config: Unknown option '%s' "
+					"inside 'CnameCache' -- see the documentation for "
+					"details.", child->key);
+			continue;
+		}
+
+		if (oconfig_get_number(child, &value) || (value < 0.0)) {
+			sdb_log(SDB_LOG_ERR, "config: %s requires a single "
+					"non-negative numeric argument", child->key);
+			return ERR_INVALID_ARG;
+		}
+
+		if (t)
+			*t = DOUBLE_TO_SDB_TIME(value);
+		else
+			opts.num_threads = (size_t)value;
+	}
+
+	cname_cache_opts = opts;
+	return 0;
+} /* daemon_set_cname_cache */
+
+static int
+daemon_set_query_cache_size(oconfig_item_t *ci)
+{
+	double size = 0.0;
+
+	if (oconfig_get_number(ci, &size)) {
+		sdb_log(SDB_LOG_ERR, "config: QueryCacheSize requires "
+				"a single numeric argument\n"
+				"\tUsage: QueryCacheSize ENTRIES");
+		return ERR_INVALID_ARG;
+	}
+
+	if (size < 0.0) {
+		sdb_log(SDB_LOG_ERR, "config: Invalid query cache size: %f\n"
+				"\tThe cache size may not be less than zero.", size);
+		return ERR_INVALID_ARG;
+	}
+
+	query_cache_size = (size_t)size;
+	return 0;
+} /* daemon_set_query_cache_size */
+
+static int
+daemon_set_query_plan_cache_size(oconfig_item_t *ci)
+{
+	double size = 0.0;
+
+	if (oconfig_get_number(ci, &size)) {
+		sdb_log(SDB_LOG_ERR, "config: QueryPlanCacheSize requires "
+				"a single numeric argument\n"
+				"\tUsage: QueryPlanCacheSize ENTRIES");
+		return ERR_INVALID_ARG;
+	}
+
+	if (size < 0.0) {
+		sdb_log(SDB_LOG_ERR, "config: Invalid query plan cache size: %f\n"
+				"\tThe cache size may not be less than zero.", size);
+		return ERR_INVALID_ARG;
+	}
+
+	query_plan_cache_size = (size_t)size;
+	return 0;
+} /* daemon_set_query_plan_cache_size */
+
+static int
+daemon_set_timeseries_cache(oconfig_item_t *ci)
+{
+	sdb_time_t ttl = DEFAULT_TIMESERIES_CACHE_TTL;
+	double value = 0.0;
+	int i;
+
+	if (oconfig_get_number(ci, &value)) {
+		sdb_log(SDB_LOG_ERR, "config: TimeseriesCache requires "
+				"a single numeric argument\n"
+				"\tUsage: TimeseriesCache ENTRIES");
+		return ERR_INVALID_ARG;
+	}
+
+	if (value < 0.0) {
+		sdb_log(SDB_LOG_ERR, "config: Invalid time-series cache size: %f\n"
+				"\tThe cache size may not be less than zero.", value);
+		return ERR_INVALID_ARG;
+	}
+	timeseries_cache_size = (size_t)value;
+
+	for (i = 0; i < ci->children_num; ++i) {
+		oconfig_item_t *child = ci->children + i;
+
+		if (strcasecmp(child->key, "TTL")) {
+			sdb_log(SDB_LOG_WARNING, "config: Unknown option '%s' "
+					"inside 'TimeseriesCache' -- see the documentation for "
+					"details.", child->key);
+			continue;
+		}
+
+		if (oconfig_get_number(child, &value) || (value <= 0.0)) {
+			sdb_log(SDB_LOG_ERR, "config: TTL requires a single "
+					"positive numeric argument");
+			return ERR_INVALID_ARG;
+		}
+		ttl = DOUBLE_TO_SDB_TIME(value);
+	}
+
+	timeseries_cache_ttl = ttl;
+	return 0;
+} /* daemon_set_timeseries_cache */
+
+static int
+daemon_set_timeseries_max_metrics(oconfig_item_t *ci)
+{
+	double max = 0.0;
+
+	if (oconfig_get_number(ci, &max)) {
+		sdb_log(SDB_LOG_ERR, "config: TimeseriesMaxMetrics requires "
+				"a single numeric argument\n"
+				"\tUsage: TimeseriesMaxMetrics NUM");
+		return ERR_INVALID_ARG;
+	}
+
+	if (max < 0.0) {
+		sdb_log(SDB_LOG_ERR, "config: Invalid maximum number of metrics: "
+				"%f\n\tThe limit may not be less than zero.", max);
+		return ERR_INVALID_ARG;
+	}
+
+	timeseries_max_metrics = (size_t)max;
+	return 0;
+} /* daemon_set_timeseries_max_metrics */
+
 static int
 daemon_set_plugindir(oconfig_item_t *ci)
 {
@@ -245,6 +526,7 @@ daemon_load_backend(oconfig_item_t *ci)
 	int i;
 
 	ctx.interval = default_interval;
+	ctx.timeout = default_timeout;
 
 	if (oconfig_get_string(ci, &name)) {
 		sdb_log(SDB_LOG_ERR, "config: LoadBackend requires a single "
@@ -262,6 +544,10 @@ daemon_load_backend(oconfig_item_t *ci)
 			if (config_get_interval(child, &ctx.interval))
 				return ERR_INVALID_ARG;
 		}
+		else if (! strcasecmp(child->key, "Timeout")) {
+			if (config_get_timeout(child, &ctx.timeout))
+				return ERR_INVALID_ARG;
+		}
 		else {
 			sdb_log(SDB_LOG_WARNING, "config: Unknown option '%s' "
 					"inside 'LoadBackend' -- see the documentation for "
@@ -299,6 +585,15 @@ daemon_configure_plugin(oconfig_item_t *ci)
 static token_parser_t token_parser_list[] = {
 	{ "Listen", daemon_add_listener },
 	{ "Interval", daemon_set_interval },
+	{ "Timeout", daemon_set_timeout },
+	{ "CollectorThreads", daemon_set_collector_threads },
+	{ "IngestThreads", daemon_set_ingest_threads },
+	{ "IngestQueueSize", daemon_set_ingest_queue_size },
+	{ "CnameCache", daemon_set_cname_cache },
+	{ "QueryCacheSize", daemon_set_query_cache_size },
+	{ "QueryPlanCacheSize", daemon_set_query_plan_cache_size },
+	{ "TimeseriesCache", daemon_set_timeseries_cache },
+	{ "TimeseriesMaxMetrics", daemon_set_timeseries_max_metrics },
 	{ "PluginDir", daemon_set_plugindir },
 	{ "LoadPlugin", daemon_load_plugin },
 	{ "LoadBackend", daemon_load_backend },
@@ -25,6 +25,7 @@
  * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include "core/plugin.h"
 #include "utils/ssl.h"
 
 #include <unistd.h>
@@ -44,6 +45,35 @@ typedef struct {
 extern daemon_listener_t *listen_addresses;
 extern size_t listen_addresses_num;
 
+/* maximum number of cached query results; zero disables the cache */
+extern size_t query_cache_size;
+
+/* maximum number of cached query plans; zero disables the cache */
+#define DEFAULT_QUERY_PLAN_CACHE_SIZE 128
+extern size_t query_plan_cache_size;
+
+/* maximum number of cached time-series and the time for which they are
+ * cached; zero entries disables the cache */
+#define DEFAULT_TIMESERIES_CACHE_TTL SECS_TO_SDB_TIME(60)
+extern size_t timeseries_cache_size;
+extern sdb_time_t timeseries_cache_ttl;
+
+/* maximum number of metrics selected by a single TIMESERIES query; zero
+ * disables the limit */
+extern size_t timeseries_max_metrics;
+
+/* number of threads running collectors; zero runs them sequentially */
+extern size_t collector_threads;
+
+/* number of threads handling stored objects asynchronously and the size
+ * of each thread's queue; zero threads stores objects synchronously */
+#define DEFAULT_INGEST_QUEUE_SIZE 1024
+extern size_t ingest_threads;
+extern size_t ingest_queue_size;
+
+/* cache of canonicalized hostnames; zero size disables the cache */
+extern sdb_plugin_cname_cache_opts_t cname_cache_opts;
+
 void
 daemon_free_listen_addresses(void);
 
@@ -200,6 +200,21 @@ configure(void)
 		listen_addresses = default_listen_addresses;
 		listen_addresses_num = SDB_STATIC_ARRAY_LEN(default_listen_addresses);
 	}
+
+	/* (re-)creating the caches drops all previously cached results and
+	 * plans; the latter refer to the store readers which may have changed */
+	if (sdb_conn_cache_configure(query_cache_size))
+		return 1;
+	if (sdb_conn_plan_cache_configure(query_plan_cache_size))
+		return 1;
+	if (sdb_conn_timeseries_cache_configure(timeseries_cache_size,
+				timeseries_cache_ttl))
+		return 1;
+	sdb_conn_timeseries_max_metrics_configure(timeseries_max_metrics);
+	if (sdb_plugin_cname_cache_configure(&cname_cache_opts))
+		return 1;
+
+	plugin_main_loop.num_threads = collector_threads;
 	return 0;
 } /* configure */
 
@@ -213,6 +228,12 @@ do_reconfigure(void)
 	if (listen_addresses != default_listen_addresses)
 		daemon_free_listen_addresses();
 	listen_addresses = NULL;
+	query_cache_size = 0;
+	query_plan_cache_size = DEFAULT_QUERY_PLAN_CACHE_SIZE;
+	collector_threads = 0;
+	ingest_threads = 0;
+	ingest_queue_size = DEFAULT_INGEST_QUEUE_SIZE;
+	memset(&cname_cache_opts, 0, sizeof(cname_cache_opts));
 
 	sdb_plugin_reconfigure_init();
 	if ((status = configure()))
@@ -239,12 +260,23 @@ main_loop(void)
 	int status = 0;
 
 	while (status == 0) {
+		sdb_plugin_ingest_opts_t ingest_opts = SDB_PLUGIN_INGEST_OPTS_INIT;
 		size_t i;
 
 		plugin_main_loop.do_loop = 1;
 		frontend_main_loop.do_loop = 1;
 
 		memset(&backend_thread, 0, sizeof(backend_thread));
+
+		ingest_opts.num_threads = ingest_threads;
+		ingest_opts.queue_size = ingest_queue_size;
+		if (sdb_plugin_ingest_start(&ingest_opts)) {
+			sdb_log(SDB_LOG_ERR, "Failed to start ingest threads");
+			plugin_main_loop.do_loop = 0;
+			status = 1;
+			break;
+		}
+
 		if (pthread_create(&backend_thread, /* attr = */ NULL,
 					backend_handler, /* arg = */ NULL)) {
 			char buf[1024];
@@ -282,6 +314,9 @@ main_loop(void)
 		pthread_kill(backend_thread, SIGINT);
 		pthread_join(backend_thread, NULL);
 
+		/* store all pending objects before (possibly) reconfiguring */
+		sdb_plugin_ingest_stop();
+
 		if (! reconfigure)
 			break;
 
@@ -299,6 +334,7 @@ main_loop(void)
 	frontend_main_loop.do_loop = 0;
 	pthread_kill(backend_thread, SIGINT);
 	pthread_join(backend_thread, NULL);
+	sdb_plugin_ingest_stop();
 
 	sdb_fe_sock_destroy(sock);
 	return status;
@@ -393,6 +429,10 @@ main(int argc, char **argv)
 
 	sdb_log(SDB_LOG_INFO, "Shutting down SysDB daemon "SDB_VERSION_STRING
 			SDB_VERSION_EXTRA" (pid %i)", (int)getpid());
+	sdb_conn_cache_configure(0);
+	sdb_conn_plan_cache_configure(0);
+	sdb_conn_timeseries_cache_configure(0, 0);
+	sdb_plugin_cname_cache_configure(NULL);
 	sdb_plugin_shutdown_all();
 	sdb_plugin_unregister_all();
 	sdb_ssl_shutdown();
@@ -425,6 +425,41 @@ sdb_avltree_get_iter(sdb_avltree_t *tree)
 	return iter;
 } /* sdb_avltree_get_iter */
 
+sdb_avltree_iter_t *
+sdb_avltree_get_iter_after(sdb_avltree_t *tree, const char *name)
+{
+	sdb_avltree_iter_t *iter;
+	node_t *n;
+
+	if (! name)
+		return sdb_avltree_get_iter(tree);
+	if (! tree)
+		return NULL;
+
+	iter = malloc(sizeof(*iter));
+	if (! iter)
+		return NULL;
+
+	pthread_rwlock_rdlock(&tree->lock);
+
+	iter->tree = tree;
+	iter->node = NULL;
+
+	/* find the smallest node greater than 'name' */
+	n = tree->root;
+	while (n) {
+		if (strcasecmp(n->obj->name, name) > 0) {
+			iter->node = n;
+			n = n->left;
+		}
+		else
+			n = n->right;
+	}
+
+	pthread_rwlock_unlock(&tree->lock);
+	return iter;
+} /* sdb_avltree_get_iter_after */
+
 void
 sdb_avltree_iter_destroy(sdb_avltree_iter_t *iter)
 {
@@ -0,0 +1,267 @@
+/*
+ * SysDB - src/utils/compress.c
+ * Copyright (C) 2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if HAVE_CONFIG_H
+#	include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include "frontend/proto.h"
+#include "utils/compress.h"
+#include "utils/error.h"
+#include "utils/proto.h"
+#include "utils/strbuf.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_LIBZ
+#	define ZLIB_CONST 1
+#	include <zlib.h>
+#endif
+
+/* size of the chunks written to the output buffer at once */
+#define CHUNK_SIZE 16384
+
+/*
+ * private data types
+ */
+
+struct sdb_compress {
+	uint32_t algo;
+
+	/* scratch buffer holding the compressed body of a message */
+	sdb_strbuf_t *buf;
+
+#ifdef HAVE_LIBZ
+	z_stream deflate;
+	z_stream inflate;
+#endif
+};
+
+/*
+ * private helper functions
+ */
+
+static ssize_t
+append_plain(sdb_strbuf_t *buf, uint32_t code, uint32_t msg_len,
+		const char *msg)
+{
+	char header[2 * sizeof(uint32_t)];
+
+	sdb_proto_marshal_int32(header, sizeof(header), code);
+	sdb_proto_marshal_int32(header + sizeof(uint32_t), sizeof(uint32_t),
+			msg_len);
+	if ((sdb_strbuf_memappend(buf, header, sizeof(header)) < 0)
+			|| (msg_len && (sdb_strbuf_memappend(buf, msg, msg_len) < 0)))
+		return -1;
+	return (ssize_t)(sizeof(header) + msg_len);
+} /* append_plain */
+
+#ifdef HAVE_LIBZ
+/* compress the data as part of the current stream, flushing all output such
+ * that the receiver is able to decompress it right away */
+static int
+deflate_data(z_stream *strm, const char *data, size_t len, sdb_strbuf_t *out)
+{
+	char chunk[CHUNK_SIZE];
+
+	strm->next_in = (const Bytef *)data;
+	strm->avail_in = (uInt)len;
+	do {
+		strm->next_out = (Bytef *)chunk;
+		strm->avail_out = sizeof(chunk);
+		if (deflate(strm, Z_SYNC_FLUSH) == Z_STREAM_ERROR)
+			return -1;
+		if (sdb_strbuf_memappend(out, chunk,
+					sizeof(chunk) - strm->avail_out) < 0)
+			return -1;
+	} while (! strm->avail_out);
+	return 0;
+} /* deflate_data */
+
+static ssize_t
+inflate_data(z_stream *strm, const char *data, size_t len,
+		size_t max, sdb_strbuf_t *out)
+{
+	char chunk[CHUNK_SIZE];
+	size_t total = 0;
+
+	strm->next_in = (const Bytef *)data;
+	strm->avail_in = (uInt)len;
+	do {
+		size_t n;
+		int status;
+
+		strm->next_out = (Bytef *)chunk;
+		strm->avail_out = sizeof(chunk);
+		status = inflate(strm, Z_SYNC_FLUSH);
+		if ((status != Z_OK) && (status != Z_BUF_ERROR))
+			return -1;
+
+		n = sizeof(chunk) - strm->avail_out;
+		if ((! n) && (status == Z_BUF_ERROR)) {
+			/* no progress possible: either done or truncated input */
+			if (strm->avail_in)
+				return -1;
+			break;
+		}
+
+		/* never produce more than announced by the sender */
+		total += n;
+		if ((total > max) || (sdb_strbuf_memappend(out, chunk, n) < 0))
+			return -1;
+	} while (strm->avail_in || (! strm->avail_out));
+	return (ssize_t)total;
+} /* inflate_data */
+#endif /* HAVE_LIBZ */
+
+/*
+ * public API
+ */
+
+bool
+sdb_compress_supported(uint32_t algo)
+{
+#ifdef HAVE_LIBZ
+	return algo == SDB_CONNECTION_COMPRESSION_DEFLATE;
+#else
+	(void)algo;
+	return 0;
+#endif
+} /* sdb_compress_supported */
+
+sdb_compress_t *
+sdb_compress_create(uint32_t algo)
+{
+	sdb_compress_t *c;
+
+	if (! sdb_compress_supported(algo))
+		return NULL;
+
+	c = calloc(1, sizeof(*c));
+	if (! c)
+		return NULL;
+	c->algo = algo;
+
+	c->buf = sdb_strbuf_create(CHUNK_SIZE);
+	if (! c->buf) {
+		free(c);
+		return NULL;
+	}
+
+#ifdef HAVE_LIBZ
+	/* use a moderate compression level; messages are compressed in the
+	 * critical path of handling requests */
+	if (deflateInit(&c->deflate, 3) != Z_OK) {
+		sdb_strbuf_destroy(c->buf);
+		free(c);
+		return NULL;
+	}
+	if (inflateInit(&c->inflate) != Z_OK) {
+		deflateEnd(&c->deflate);
+		sdb_strbuf_destroy(c->buf);
+		free(c);
+		return NULL;
+	}
+#endif
+	return c;
+} /* sdb_compress_create */
+
+void
+sdb_compress_destroy(sdb_compress_t *c)
+{
+	if (! c)
+		return;
+
+#ifdef HAVE_LIBZ
+	deflateEnd(&c->deflate);
+	inflateEnd(&c->inflate);
+#endif
+	sdb_strbuf_destroy(c->buf);
+	free(c);
+} /* sdb_compress_destroy */
+
+ssize_t
+sdb_compress_message(sdb_compress_t *c, sdb_strbuf_t *buf,
+		uint32_t code, uint32_t msg_len, const char *msg)
+{
+	char header[2 * sizeof(uint32_t)];
+	ssize_t n;
+
+	if (! buf)
+		return -1;
+	if ((! c) || (msg_len < SDB_COMPRESS_MIN_SIZE))
+		return append_plain(buf, code, msg_len, msg);
+
+	/* the compressed body starts with the original code and length */
+	sdb_proto_marshal_int32(header, sizeof(header), code);
+	sdb_proto_marshal_int32(header + sizeof(uint32_t), sizeof(uint32_t),
+			msg_len);
+	sdb_strbuf_memcpy(c->buf, header, sizeof(header));
+
+#ifdef HAVE_LIBZ
+	if (deflate_data(&c->deflate, msg, msg_len, c->buf))
+		return -1;
+#else
+	return -1;
+#endif
+
+	n = append_plain(buf, SDB_CONNECTION_COMPRESSED,
+			(uint32_t)sdb_strbuf_len(c->buf), sdb_strbuf_string(c->buf));
+	return n;
+} /* sdb_compress_message */
+
+ssize_t
+sdb_decompress_message(sdb_compress_t *c, const char *data, size_t len,
+		uint32_t *code, sdb_strbuf_t *buf)
+{
+	uint32_t msg_len = 0;
+	ssize_t n = -1;
+
+	if ((! c) || (! data) || (! code) || (! buf))
+		return -1;
+	if (len < 2 * sizeof(uint32_t))
+		return -1;
+
+	sdb_proto_unmarshal_int32(data, len, code);
+	sdb_proto_unmarshal_int32(data + sizeof(uint32_t),
+			len - sizeof(uint32_t), &msg_len);
+	data += 2 * sizeof(uint32_t);
+	len -= 2 * sizeof(uint32_t);
+
+#ifdef HAVE_LIBZ
+	n = inflate_data(&c->inflate, data, len, msg_len, buf);
+#endif
+	if ((n < 0) || ((size_t)n != msg_len)) {
+		sdb_log(SDB_LOG_ERR, "compress: Failed to decompress message "
+				"(code: %u, len: %u)", *code, msg_len);
+		return -1;
+	}
+	return n;
+} /* sdb_decompress_message */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
@@ -0,0 +1,333 @@
+/*
+ * SysDB - src/utils/lru.c
+ * Copyright (C) 2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if HAVE_CONFIG_H
+#	include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include "sysdb.h"
+#include "utils/lru.h"
+
+#include <assert.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/*
+ * private data types
+ */
+
+struct entry;
+typedef struct entry entry_t;
+
+struct entry {
+	sdb_object_t *obj;
+
+	/* hash bucket chain */
+	entry_t *next_in_bucket;
+
+	/* usage list; most recently used first */
+	entry_t *prev;
+	entry_t *next;
+};
+
+struct sdb_lru {
+	pthread_mutex_t lock;
+
+	entry_t **buckets;
+	size_t buckets_num; /* power of two */
+
+	entry_t *head;
+	entry_t *tail;
+
+	size_t size;
+	size_t capacity;
+	sdb_lru_valid_cb valid;
+
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+};
+
+/*
+ * private helper functions
+ */
+
+/* FNV-1a */
+static size_t
+hash(const char *name)
+{
+	uint32_t h = 2166136261U;
+	for ( ; *name; ++name) {
+		h ^= (unsigned char)*name;
+		h *= 16777619U;
+	}
+	return (size_t)h;
+} /* hash */
+
+static entry_t **
+find(sdb_lru_t *lru, const char *name)
+{
+	entry_t **e = &lru->buckets[hash(name) & (lru->buckets_num - 1)];
+	while (*e && strcmp((*e)->obj->name, name))
+		e = &(*e)->next_in_bucket;
+	return e;
+} /* find */
+
+static void
+list_unlink(sdb_lru_t *lru, entry_t *e)
+{
+	if (e->prev)
+		e->prev->next = e->next;
+	else
+		lru->head = e->next;
+	if (e->next)
+		e->next->prev = e->prev;
+	else
+		lru->tail = e->prev;
+	e->prev = e->next = NULL;
+} /* list_unlink */
+
+static void
+list_push(sdb_lru_t *lru, entry_t *e)
+{
+	e->prev = NULL;
+	e->next = lru->head;
+	if (lru->head)
+		lru->head->prev = e;
+	else
+		lru->tail = e;
+	lru->head = e;
+} /* list_push */
+
+/* remove the entry referenced by the bucket slot 'slot' */
+static void
+entry_remove(sdb_lru_t *lru, entry_t **slot)
+{
+	entry_t *e = *slot;
+
+	*slot = e->next_in_bucket;
+	list_unlink(lru, e);
+	--lru->size;
+
+	sdb_object_deref(e->obj);
+	free(e);
+} /* entry_remove */
+
+static void
+lru_clear(sdb_lru_t *lru)
+{
+	while (lru->tail)
+		entry_remove(lru, find(lru, lru->tail->obj->name));
+	assert(! lru->size);
+} /* lru_clear */
+
+/*
+ * public API
+ */
+
+sdb_lru_t *
+sdb_lru_create(size_t capacity, sdb_lru_valid_cb valid)
+{
+	sdb_lru_t *lru;
+
+	if (! capacity)
+		return NULL;
+
+	lru = calloc(1, sizeof(*lru));
+	if (! lru)
+		return NULL;
+
+	/* keep the load factor below one */
+	lru->buckets_num = 8;
+	while (lru->buckets_num < capacity)
+		lru->buckets_num <<= 1;
+	lru->buckets = calloc(lru->buckets_num, sizeof(*lru->buckets));
+	if (! lru->buckets) {
+		free(lru);
+		return NULL;
+	}
+
+	pthread_mutex_init(&lru->lock, /* attr = */ NULL);
+	lru->capacity = capacity;
+	lru->valid = valid;
+	return lru;
+} /* sdb_lru_create */
+
+void
+sdb_lru_destroy(sdb_lru_t *lru)
+{
+	if (! lru)
+		return;
+
+	lru_clear(lru);
+	pthread_mutex_destroy(&lru->lock);
+	free(lru->buckets);
+	free(lru);
+} /* sdb_lru_destroy */
+
+void
+sdb_lru_clear(sdb_lru_t *lru)
+{
+	if (! lru)
+		return;
+
+	pthread_mutex_lock(&lru->lock);
+	lru_clear(lru);
+	pthread_mutex_unlock(&lru->lock);
+} /* sdb_lru_clear */
+
+int
+sdb_lru_insert(sdb_lru_t *lru, sdb_object_t *obj)
+{
+	entry_t **slot;
+	entry_t *e;
+
+	if ((! lru) || (! obj) || (! obj->name))
+		return -1;
+
+	e = malloc(sizeof(*e));
+	if (! e)
+		return -1;
+
+	sdb_object_ref(obj);
+	e->obj = obj;
+
+	pthread_mutex_lock(&lru->lock);
+	slot = find(lru, obj->name);
+	if (*slot)
+		entry_remove(lru, slot);
+	else if (lru->size >= lru->capacity) {
+		entry_remove(lru, find(lru, lru->tail->obj->name));
+		++lru->evictions;
+		/* the removal may have changed the chain */
+		slot = find(lru, obj->name);
+	}
+
+	e->next_in_bucket = *slot;
+	*slot = e;
+	list_push(lru, e);
+	++lru->size;
+	pthread_mutex_unlock(&lru->lock);
+	return 0;
+} /* sdb_lru_insert */
+
+sdb_object_t *
+sdb_lru_lookup(sdb_lru_t *lru, const char *name)
+{
+	sdb_object_t *obj = NULL;
+	entry_t **slot;
+
+	if ((! lru) || (! name))
+		return NULL;
+
+	pthread_mutex_lock(&lru->lock);
+	slot = find(lru, name);
+	if (*slot) {
+		obj = (*slot)->obj;
+		sdb_object_ref(obj);
+		list_unlink(lru, *slot);
+		list_push(lru, *slot);
+		++lru->hits;
+	}
+	else
+		++lru->misses;
+	pthread_mutex_unlock(&lru->lock);
+
+	/* The validity check may be expensive (e.g. acquire other locks), so run
+	 * it without holding the lock; the entry may have been replaced or
+	 * removed in the meantime, in which case it's left alone. */
+	if (obj && lru->valid && (! lru->valid(obj))) {
+		pthread_mutex_lock(&lru->lock);
+		slot = find(lru, name);
+		if (*slot && ((*slot)->obj == obj))
+			entry_remove(lru, slot);
+		--lru->hits;
+		++lru->misses;
+		pthread_mutex_unlock(&lru->lock);
+
+		sdb_object_deref(obj);
+		obj = NULL;
+	}
+	return obj;
+} /* sdb_lru_lookup */
+
+int
+sdb_lru_remove(sdb_lru_t *lru, const char *name)
+{
+	entry_t **slot;
+	int status = 0;
+
+	if ((! lru) || (! name))
+		return -1;
+
+	pthread_mutex_lock(&lru->lock);
+	slot = find(lru, name);
+	if (*slot)
+		entry_remove(lru, slot);
+	else
+		status = 1;
+	pthread_mutex_unlock(&lru->lock);
+	return status;
+} /* sdb_lru_remove */
+
+sdb_object_t *
+sdb_lru_shift(sdb_lru_t *lru)
+{
+	sdb_object_t *obj = NULL;
+
+	if (! lru)
+		return NULL;
+
+	pthread_mutex_lock(&lru->lock);
+	if (lru->tail) {
+		obj = lru->tail->obj;
+		/* keep the reference owned by the cache for the caller */
+		sdb_object_ref(obj);
+		entry_remove(lru, find(lru, obj->name));
+	}
+	pthread_mutex_unlock(&lru->lock);
+	return obj;
+} /* sdb_lru_shift */
+
+void
+sdb_lru_stats(sdb_lru_t *lru, sdb_lru_stats_t *stats)
+{
+	if ((! lru) || (! stats))
+		return;
+
+	pthread_mutex_lock(&lru->lock);
+	stats->size = lru->size;
+	stats->capacity = lru->capacity;
+	stats->hits = lru->hits;
+	stats->misses = lru->misses;
+	stats->evictions = lru->evictions;
+	pthread_mutex_unlock(&lru->lock);
+} /* sdb_lru_stats */
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
@@ -33,6 +33,7 @@
 #include "utils/error.h"
 
 #include <errno.h>
+#include <fcntl.h>
 
 #include <sys/types.h>
 #include <sys/select.h>
@@ -307,6 +308,30 @@ sdb_write(int fd, size_t msg_len, const void *msg)
 	return (ssize_t)msg_len;
 } /* sdb_write */
 
+int
+sdb_sync_dir(const char *pathname)
+{
+	char *tmp, *dir;
+	int fd, status;
+
+	if (! pathname)
+		return -1;
+
+	tmp = strdup(pathname);
+	if (! tmp)
+		return -1;
+	dir = dirname(tmp);
+
+	fd = open(dir, O_RDONLY);
+	free(tmp);
+	if (fd < 0)
+		return -1;
+
+	status = fsync(fd);
+	close(fd);
+	return status;
+} /* sdb_sync_dir */
+
 int
 sdb_resolve(int network, const char *address, struct addrinfo **res)
 {
@@ -265,6 +265,134 @@ unmarshal_obj_header(const char *buf, size_t len,
 	return OBJ_HEADER_LEN;
 } /* unmarshal_obj_header */
 
+/* encode a metric including all of its data stores as used in binary query
+ * results */
+static ssize_t
+marshal_metric_record(char *buf, size_t buf_len,
+		const sdb_proto_metric_t *metric,
+		const sdb_proto_metric_store_t *stores, size_t stores_num)
+{
+	size_t len, i;
+	ssize_t n;
+
+	if ((! metric) || (! metric->hostname) || (! metric->name)
+			|| (stores_num && (! stores)) || (stores_num > UINT32_MAX))
+		return -1;
+
+	len = OBJ_HEADER_LEN + strlen(metric->hostname) + strlen(metric->name) + 2
+		+ sizeof(uint32_t);
+	for (i = 0; i < stores_num; ++i) {
+		if ((! stores[i].type) || (! stores[i].id))
+			return -1;
+		len += strlen(stores[i].type) + strlen(stores[i].id) + 2
+			+ sizeof(sdb_time_t);
+	}
+	if (buf_len < len)
+		return len;
+
+	n = marshal_obj_header(buf, buf_len, SDB_METRIC, metric->last_update);
+	buf += n; buf_len -= n;
+	n = marshal_string(buf, buf_len, metric->hostname);
+	buf += n; buf_len -= n;
+	n = marshal_string(buf, buf_len, metric->name);
+	buf += n; buf_len -= n;
+	n = sdb_proto_marshal_int32(buf, buf_len, (uint32_t)stores_num);
+	buf += n; buf_len -= n;
+	for (i = 0; i < stores_num; ++i) {
+		n = marshal_string(buf, buf_len, stores[i].type);
+		buf += n; buf_len -= n;
+		n = marshal_string(buf, buf_len, stores[i].id);
+		buf += n; buf_len -= n;
+		n = marshal_datetime(buf, buf_len, stores[i].last_update);
+		buf += n; buf_len -= n;
+	}
+	return len;
+} /* marshal_metric_record */
+
+static ssize_t
+unmarshal_metric_record(const char *buf, size_t len, sdb_proto_object_t *obj)
+{
+	sdb_proto_metric_t m = SDB_PROTO_METRIC_INIT;
+	sdb_proto_metric_store_t *stores = NULL;
+	uint32_t stores_num = 0, i;
+	int type = 0;
+	ssize_t l = 0, n;
+
+	if ((n = unmarshal_obj_header(buf, len, &type, &m.last_update)) < 0)
+		return n;
+	if (type != SDB_METRIC)
+		return -1;
+	buf += n; len -= n; l += n;
+	if ((n = unmarshal_string(buf, len, &m.hostname)) < 0)
+		return n;
+	buf += n; len -= n; l += n;
+	if ((n = unmarshal_string(buf, len, &m.name)) < 0)
+		return n;
+	buf += n; len -= n; l += n;
+	if ((n = sdb_proto_unmarshal_int32(buf, len, &stores_num)) < 0)
+		return n;
+	buf += n; len -= n; l += n;
+
+	/* each store requires at least two bytes for its strings and its
+	 * timestamp; don't trust the count before allocating any memory */
+	if ((size_t)stores_num > len / (2 + sizeof(sdb_time_t)))
+		return -1;
+	if (obj && stores_num) {
+		stores = calloc(stores_num, sizeof(*stores));
+		if (! stores)
+			return -1;
+	}
+
+	for (i = 0; i < stores_num; ++i) {
+		sdb_proto_metric_store_t s = { NULL, NULL, 0 };
+
+		if ((n = unmarshal_string(buf, len, &s.type)) < 0)
+			goto error;
+		buf += n; len -= n; l += n;
+		if ((n = unmarshal_string(buf, len, &s.id)) < 0)
+			goto error;
+		buf += n; len -= n; l += n;
+		if ((n = unmarshal_datetime(buf, len, &s.last_update)) < 0)
+			goto error;
+		buf += n; len -= n; l += n;
+		if (stores)
+			stores[i] = s;
+	}
+
+	if (obj) {
+		if (stores_num) {
+			m.store_type = stores[0].type;
+			m.store_id = stores[0].id;
+			m.store_last_update = stores[0].last_update;
+		}
+		obj->data.metric = m;
+		obj->stores = stores;
+		obj->stores_num = (size_t)stores_num;
+	}
+	return l;
+
+error:
+	free(stores);
+	return -1;
+} /* unmarshal_metric_record */
+
+/* encode the object's data without the record's length */
+static ssize_t
+marshal_object_data(char *buf, size_t buf_len, const sdb_proto_object_t *obj)
+{
+	if (obj->type == SDB_HOST)
+		return sdb_proto_marshal_host(buf, buf_len, &obj->data.host);
+	if (obj->type == SDB_SERVICE)
+		return sdb_proto_marshal_service(buf, buf_len, &obj->data.service);
+	if (obj->type == SDB_METRIC)
+		return marshal_metric_record(buf, buf_len, &obj->data.metric,
+				obj->stores, obj->stores_num);
+	if (obj->type == (obj->data.attribute.parent_type | SDB_ATTRIBUTE))
+		return sdb_proto_marshal_attribute(buf, buf_len,
+				&obj->data.attribute);
+	return -1;
+} /* marshal_object_data */
+
 /*
  * public API
  */
@@ -533,6 +661,27 @@ sdb_proto_marshal_attribute(char *buf, size_t buf_len,
 	return len;
 } /* sdb_proto_marshal_attribute */
 
+ssize_t
+sdb_proto_marshal_object(char *buf, size_t buf_len,
+		const sdb_proto_object_t *obj)
+{
+	ssize_t n;
+
+	if (! obj)
+		return -1;
+
+	n = marshal_object_data(NULL, 0, obj);
+	if ((n < 0) || ((uint64_t)n > UINT32_MAX))
+		return -1;
+	if (buf_len < sizeof(uint32_t) + (size_t)n)
+		return sizeof(uint32_t) + (size_t)n;
+
+	sdb_proto_marshal_int32(buf, buf_len, (uint32_t)n);
+	marshal_object_data(buf + sizeof(uint32_t), buf_len - sizeof(uint32_t),
+			obj);
+	return sizeof(uint32_t) + (size_t)n;
+} /* sdb_proto_marshal_object */
+
 ssize_t
 sdb_proto_unmarshal_header(const char *buf, size_t buf_len,
 		uint32_t *code, uint32_t *msg_len)
@@ -844,5 +993,62 @@ sdb_proto_unmarshal_attribute(const char *buf, size_t len,
 	return l + n;
 } /* sdb_proto_unmarshal_attribute */
 
+ssize_t
+sdb_proto_unmarshal_object(const char *buf, size_t len,
+		sdb_proto_object_t *obj)
+{
+	uint32_t rec_len, type;
+	ssize_t n;
+
+	if ((n = sdb_proto_unmarshal_int32(buf, len, &rec_len)) < 0)
+		return n;
+	buf += n; len -= n;
+	if (len < (size_t)rec_len)
+		return -1;
+
+	/* peek at the type from the object header */
+	if (sdb_proto_unmarshal_int32(buf, rec_len, &type) < 0)
+		return -1;
+
+	if (obj) {
+		obj->stores = NULL;
+		obj->stores_num = 0;
+	}
+
+	if (type == SDB_HOST)
+		n = sdb_proto_unmarshal_host(buf, rec_len,
+				obj ? &obj->data.host : NULL);
+	else if (type == SDB_SERVICE)
+		n = sdb_proto_unmarshal_service(buf, rec_len,
+				obj ? &obj->data.service : NULL);
+	else if (type == SDB_METRIC)
+		n = unmarshal_metric_record(buf, rec_len, obj);
+	else if (type & SDB_ATTRIBUTE)
+		n = sdb_proto_unmarshal_attribute(buf, rec_len,
+				obj ? &obj->data.attribute : NULL);
+	else
+		return -1;
+
+	if (n < 0)
+		return n;
+	if (obj)
+		obj->type = (int)type;
+	return sizeof(rec_len) + (ssize_t)rec_len;
+} /* sdb_proto_unmarshal_object */
+
+void
+sdb_proto_free_object(sdb_proto_object_t *obj)
+{
+	if (! obj)
+		return;
+
+	if (obj->type & SDB_ATTRIBUTE)
+		sdb_data_free_datum(&obj->data.attribute.value);
+	if (obj->stores)
+		free(obj->stores);
+	obj->stores = NULL;
+	obj->stores_num = 0;
+} /* sdb_proto_free_object */
+
 /* vim: set tw=78 sw=4 ts=4 noexpandtab : */
 
@@ -593,6 +593,14 @@ sdb_ssl_session_read(sdb_ssl_session_t *session, void *buf, size_t n)
 	return -1;
 } /* sdb_ssl_session_read */
 
+bool
+sdb_ssl_session_pending(sdb_ssl_session_t *session)
+{
+	if (! session)
+		return 0;
+	return SSL_pending(session->ssl) > 0;
+} /* sdb_ssl_session_pending */
+
 void
 sdb_ssl_free_options(sdb_ssl_options_t *opts)
 {
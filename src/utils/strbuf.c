@@ -36,6 +36,11 @@
 #include <string.h>
 
 #include <unistd.h>
+#include <sys/uio.h>
+
+/* maximum number of bytes read into a temporary stack buffer when there's
+ * not enough room in the buffer; see sdb_strbuf_read */
+#define SPILL_SIZE 4096
 
 /* free memory if most of the buffer is unused */
 #define CHECK_SHRINK(buf) \
@@ -55,6 +60,10 @@ struct sdb_strbuf {
 	size_t size;
 	size_t pos;
 
+	/* offset of the first byte of the content; skipping data from the front
+	 * of the buffer only advances this offset */
+	size_t start;
+
 	/* min size to shrink the buffer to */
 	size_t min_size;
 };
@@ -90,6 +99,38 @@ strbuf_resize(sdb_strbuf_t *buf, size_t new_size)
 	return 0;
 } /* strbuf_resize */
 
+/* move the content to the front of the buffer */
+static void
+strbuf_compact(sdb_strbuf_t *buf)
+{
+	if (! buf->start)
+		return;
+
+	memmove(buf->string, buf->string + buf->start, buf->pos - buf->start);
+	buf->pos -= buf->start;
+	buf->start = 0;
+	buf->string[buf->pos] = '\0';
+} /* strbuf_compact */
+
+/* make sure there's room for at least 'n' more bytes (including the
+ * terminating nul-byte) at the end of the buffer */
+static int
+strbuf_reserve(sdb_strbuf_t *buf, size_t n)
+{
+	if (buf->pos + n <= buf->size)
+		return 0;
+
+	/* Only move data around if at least as much space has been consumed as
+	 * is still in use; this keeps the cost of compacting proportional to the
+	 * number of bytes skipped before. Else, simply grow the buffer. */
+	if (buf->start && (buf->start >= buf->pos - buf->start)) {
+		strbuf_compact(buf);
+		if (buf->pos + n <= buf->size)
+			return 0;
+	}
+	return strbuf_resize(buf, buf->pos + n);
+} /* strbuf_reserve */
+
 /*
  * public API
  */
@@ -117,8 +158,9 @@ sdb_strbuf_create(size_t size)
 	else
 		buf->min_size = 64;
 
-	buf->size = size;
-	buf->pos  = 0;
+	buf->size  = size;
+	buf->pos   = 0;
+	buf->start = 0;
 
 	return buf;
 } /* sdb_strbuf_create */
@@ -151,9 +193,12 @@ sdb_strbuf_vappend(sdb_strbuf_t *buf, const char *fmt, va_list ap)
 			return -1;
 	}
 	/* make sure to reserve space for the nul-byte */
-	else if (buf->pos >= buf->size - 1)
-		if (strbuf_resize(buf, 2 * buf->size))
-			return -1;
+	else if (buf->pos >= buf->size - 1) {
+		strbuf_compact(buf);
+		if (buf->pos >= buf->size - 1)
+			if (strbuf_resize(buf, 2 * buf->size))
+				return -1;
+	}
 
 	assert(buf->size && buf->string);
 	assert(buf->pos < buf->size);
@@ -170,7 +215,7 @@ sdb_strbuf_vappend(sdb_strbuf_t *buf, const char *fmt, va_list ap)
 
 	/* 'status' does not include nul-byte */
 	if ((size_t)status >= buf->size - buf->pos) {
-		if (strbuf_resize(buf, buf->pos + (size_t)status + 1)) {
+		if (strbuf_reserve(buf, (size_t)status + 1)) {
 			va_end(aq);
 			return -1;
 		}
@@ -214,6 +259,7 @@ sdb_strbuf_vsprintf(sdb_strbuf_t *buf, const char *fmt, va_list ap)
 		buf->string[0] = '\0';
 		buf->pos = 0;
 	}
+	buf->start = 0;
 
 	return sdb_strbuf_vappend(buf, fmt, ap);
 } /* sdb_strbuf_vsprintf */
@@ -239,10 +285,8 @@ sdb_strbuf_memappend(sdb_strbuf_t *buf, const void *data, size_t n)
 
 	assert((buf->size == 0) || (buf->string[buf->pos] == '\0'));
 
-	if (buf->pos + n + 1 > buf->size) {
-		if (strbuf_resize(buf, buf->pos + n + 1))
-			return -1;
-	}
+	if (strbuf_reserve(buf, n + 1))
+		return -1;
 
 	assert(buf->size && buf->string);
 	assert(buf->pos < buf->size);
@@ -268,6 +312,7 @@ sdb_strbuf_memcpy(sdb_strbuf_t *buf, const void *data, size_t n)
 		buf->string[0] = '\0';
 		buf->pos = 0;
 	}
+	buf->start = 0;
 
 	return sdb_strbuf_memappend(buf, data, n);
 } /* sdb_strbuf_memcpy */
@@ -275,18 +320,66 @@ sdb_strbuf_memcpy(sdb_strbuf_t *buf, const void *data, size_t n)
 ssize_t
 sdb_strbuf_read(sdb_strbuf_t *buf, int fd, size_t n)
 {
+	struct iovec iov[2];
+	size_t avail;
 	ssize_t ret;
 
 	if (! buf)
 		return -1;
+	if (! n)
+		return 0;
 
-	if (buf->pos + n + 1 >= buf->size)
-		if (strbuf_resize(buf, buf->pos + n + 1))
+	/* use all of the free space first, then compact if that's cheap */
+	if ((! buf->size) || (buf->pos + 1 >= buf->size)
+			|| (buf->start >= buf->pos - buf->start))
+		if (strbuf_reserve(buf, SDB_MIN(n, buf->min_size) + 1))
 			return -1;
 
-	ret = read(fd, buf->string + buf->pos, n);
-	if (ret > 0)
-		buf->pos += (size_t)ret;
+	avail = buf->size - buf->pos - 1;
+
+	/* Larger reads (e.g. full replies of a known size) go straight into the
+	 * buffer; only small excesses are spilled through the stack. */
+	if (n - SDB_MIN(avail, n) > SPILL_SIZE) {
+		if (strbuf_reserve(buf, n + 1))
+			return -1;
+		avail = buf->size - buf->pos - 1;
+	}
+
+	if (avail >= n) {
+		ret = read(fd, buf->string + buf->pos, n);
+		if (ret > 0) {
+			buf->pos += (size_t)ret;
+			buf->string[buf->pos] = '\0';
+		}
+		return ret;
+	}
+
+	{
+		/* Read whatever fits into the buffer and spill the rest into a
+		 * temporary buffer; this way, the buffer only grows if there's
+		 * actually more data available. */
+		char spill[SPILL_SIZE];
+
+		iov[0].iov_base = buf->string + buf->pos;
+		iov[0].iov_len = avail;
+		iov[1].iov_base = spill;
+		iov[1].iov_len = n - avail;
+
+		ret = readv(fd, iov, 2);
+		if (ret <= 0)
+			return ret;
+
+		if ((size_t)ret <= avail) {
+			buf->pos += (size_t)ret;
+			buf->string[buf->pos] = '\0';
+			return ret;
+		}
+
+		buf->pos += avail;
+		buf->string[buf->pos] = '\0';
+		if (sdb_strbuf_memappend(buf, spill, (size_t)ret - avail) < 0)
+			return -1;
+	}
 	return ret;
 } /* sdb_strbuf_read */
 
@@ -301,7 +394,7 @@ sdb_strbuf_chomp(sdb_strbuf_t *buf)
 	assert((!buf->size) || (buf->pos < buf->size));
 	assert(buf->pos <= buf->size);
 
-	while ((buf->pos > 0)
+	while ((buf->pos > buf->start)
 			&& (buf->string[buf->pos - 1] == '\n')) {
 		--buf->pos;
 		buf->string[buf->pos] = '\0';
@@ -320,21 +413,29 @@ sdb_strbuf_skip(sdb_strbuf_t *buf, size_t offset, size_t n)
 	if ((! buf) || (! n))
 		return;
 
-	if (offset >= buf->pos)
+	if (offset >= buf->pos - buf->start)
 		return;
 
-	len = buf->pos - offset;
+	len = buf->pos - buf->start - offset;
 
 	if (n >= len) {
-		buf->string[offset] = '\0';
-		buf->pos = offset;
+		buf->pos = buf->start + offset;
+		if (buf->pos == buf->start)
+			buf->pos = buf->start = 0;
+		buf->string[buf->pos] = '\0';
+		return;
+	}
+
+	if (! offset) {
+		/* consume data from the front by advancing the start offset; the
+		 * remaining data will be moved when making room for new data */
+		buf->start += n;
 		return;
 	}
 
-	assert(offset + n < buf->pos);
-	assert(offset < buf->pos);
+	assert(n < len);
 
-	start = buf->string + offset;
+	start = buf->string + buf->start + offset;
 	memmove(start, start + n, len - n);
 	buf->pos -= n;
 	buf->string[buf->pos] = '\0';
@@ -350,6 +451,7 @@ sdb_strbuf_clear(sdb_strbuf_t *buf)
 
 	buf->string[0] = '\0';
 	buf->pos = 0;
+	buf->start = 0;
 
 	/* don't resize now but wait for the next write to avoid churn */
 } /* sdb_strbuf_clear */
@@ -361,7 +463,7 @@ sdb_strbuf_string(sdb_strbuf_t *buf)
 		return NULL;
 	if (! buf->size)
 		return "";
-	return buf->string;
+	return buf->string + buf->start;
 } /* sdb_strbuf_string */
 
 size_t
@@ -369,7 +471,7 @@ sdb_strbuf_len(sdb_strbuf_t *buf)
 {
 	if (! buf)
 		return 0;
-	return buf->pos;
+	return buf->pos - buf->start;
 } /* sdb_strbuf_string */
 
 size_t
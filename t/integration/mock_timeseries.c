@@ -90,11 +90,9 @@ mock_fetch_ts(const char *id, sdb_timeseries_opts_t *opts,
 	ts->end = opts->end;
 
 	for (i = 0; i < 10; ++i) {
-		for (j = 0; j < SDB_STATIC_ARRAY_LEN(names); ++j) {
-			ts->data[j][i].timestamp = ts->start
-				+ i * (ts->end - ts->start) / 10;
-			ts->data[j][i].value = (double)(i + j);
-		}
+		ts->timestamps[i] = ts->start + i * (ts->end - ts->start) / 10;
+		for (j = 0; j < SDB_STATIC_ARRAY_LEN(names); ++j)
+			ts->data[j][i] = (double)(i + j);
 	}
 	return ts;
 } /* mock_fetch_ts */
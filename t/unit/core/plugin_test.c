@@ -0,0 +1,720 @@
+/*
+ * SysDB - t/unit/core/plugin_test.c
+ * Copyright (C) 2014 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ */
+
+#if HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
+#include "core/memstore.h"
+#include "core/plugin.h"
+#include "core/time.h"
+#include "frontend/proto.h"
+#include "parser/parser.h"
+#include "testutils.h"
+
+#include <check.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * collector loop
+ */
+
+typedef struct {
+	sdb_object_t super;
+	sdb_time_t runtime;
+
+	pthread_mutex_t lock;
+	int in_flight;
+	int max_in_flight;
+} collector_data_t;
+
+static collector_data_t slow = {
+	SDB_OBJECT_STATIC("slow"), SECS_TO_SDB_TIME(1) / 5,
+	PTHREAD_MUTEX_INITIALIZER, 0, 0,
+};
+static collector_data_t fast = {
+	SDB_OBJECT_STATIC("fast"), 0,
+	PTHREAD_MUTEX_INITIALIZER, 0, 0,
+};
+
+static int
+collect(sdb_object_t *user_data)
+{
+	collector_data_t *data = (collector_data_t *)user_data;
+
+	pthread_mutex_lock(&data->lock);
+	++data->in_flight;
+	if (data->in_flight > data->max_in_flight)
+		data->max_in_flight = data->in_flight;
+	pthread_mutex_unlock(&data->lock);
+
+	if (data->runtime)
+		sdb_sleep(data->runtime, NULL);
+
+	pthread_mutex_lock(&data->lock);
+	--data->in_flight;
+	pthread_mutex_unlock(&data->lock);
+	return 0;
+} /* collect */
+
+static void *
+run_loop(void *data)
+{
+	sdb_plugin_collector_loop(data);
+	return NULL;
+} /* run_loop */
+
+static void
+setup(void)
+{
+	sdb_time_t interval;
+
+	interval = SECS_TO_SDB_TIME(1) / 20;
+	ck_assert(sdb_plugin_register_collector("slow", collect,
+				&interval, SDB_OBJ(&slow)) == 0);
+	interval = SECS_TO_SDB_TIME(1) / 50;
+	ck_assert(sdb_plugin_register_collector("fast", collect,
+				&interval, SDB_OBJ(&fast)) == 0);
+} /* setup */
+
+static void
+teardown(void)
+{
+	sdb_plugin_unregister_all();
+} /* teardown */
+
+START_TEST(test_collector_pool)
+{
+	sdb_plugin_loop_t loop = SDB_PLUGIN_LOOP_INIT;
+	sdb_plugin_collector_stats_t slow_stats, fast_stats;
+	pthread_t thread;
+	int check;
+
+	loop.num_threads = 2;
+	ck_assert(pthread_create(&thread, NULL, run_loop, &loop) == 0);
+	sdb_sleep(SECS_TO_SDB_TIME(1) / 2, NULL);
+	loop.do_loop = 0;
+	pthread_join(thread, NULL);
+
+	check = sdb_plugin_get_collector_stats("core::slow", &slow_stats);
+	ck_assert_msg(check == 0,
+			"sdb_plugin_get_collector_stats(core::slow) = %d; expected: 0",
+			check);
+	check = sdb_plugin_get_collector_stats("core::fast", &fast_stats);
+	ck_assert_msg(check == 0,
+			"sdb_plugin_get_collector_stats(core::fast) = %d; expected: 0",
+			check);
+	check = sdb_plugin_get_collector_stats("core::unknown", &fast_stats);
+	ck_assert_msg(check < 0,
+			"sdb_plugin_get_collector_stats(core::unknown) = %d; "
+			"expected: <0", check);
+
+	/* the slow collector must not block the fast one */
+	ck_assert_msg(fast_stats.runs >= 10,
+			"fast collector ran %zu times; expected: >= 10",
+			fast_stats.runs);
+	ck_assert_msg((slow_stats.runs >= 1) && (slow_stats.runs <= 3),
+			"slow collector ran %zu times; expected: 1-3",
+			slow_stats.runs);
+	ck_assert_msg(slow_stats.overruns > 0,
+			"slow collector overran %zu times; expected: > 0",
+			slow_stats.overruns);
+	ck_assert_msg(slow_stats.max_runtime >= slow.runtime,
+			"slow collector max. run-time = %"PRIsdbTIME"; "
+			"expected: >= %"PRIsdbTIME,
+			slow_stats.max_runtime, slow.runtime);
+	ck_assert_msg(slow_stats.failures == 0,
+			"slow collector failed %zu times; expected: 0",
+			slow_stats.failures);
+
+	/* never run any collector concurrently with itself */
+	ck_assert_msg(slow.max_in_flight == 1,
+			"slow collector had up to %d concurrent runs; expected: 1",
+			slow.max_in_flight);
+	ck_assert_msg(fast.max_in_flight == 1,
+			"fast collector had up to %d concurrent runs; expected: 1",
+			fast.max_in_flight);
+}
+END_TEST
+
+/*
+ * ingest pipeline
+ */
+
+static sdb_memstore_t *store = NULL;
+
+static void
+setup_store(void)
+{
+	store = sdb_memstore_create();
+	ck_assert(store != NULL);
+	ck_assert(sdb_plugin_register_writer("test-writer",
+				&sdb_memstore_writer, SDB_OBJ(store)) == 0);
+	ck_assert(sdb_plugin_register_reader("test-reader",
+				&sdb_memstore_reader, SDB_OBJ(store)) == 0);
+} /* setup_store */
+
+static void
+teardown_store(void)
+{
+	sdb_plugin_ingest_stop();
+	sdb_plugin_unregister_all();
+	sdb_object_deref(SDB_OBJ(store));
+	store = NULL;
+} /* teardown_store */
+
+#define HOSTS 20
+#define SERVICES 10
+
+START_TEST(test_ingest)
+{
+	sdb_plugin_ingest_opts_t opts = SDB_PLUGIN_INGEST_OPTS_INIT;
+	sdb_plugin_ingest_stats_t stats;
+	sdb_data_t value = { SDB_TYPE_INTEGER, { .integer = 42 } };
+	size_t expected = 0;
+	sdb_memstore_obj_t *host;
+	int check, i, j;
+
+	check = sdb_plugin_get_ingest_stats(&stats);
+	ck_assert_msg(check < 0,
+			"sdb_plugin_get_ingest_stats() = %d before starting the "
+			"pipeline; expected: <0", check);
+
+	opts.num_threads = 3;
+	opts.queue_size = 4; /* enforce backpressure */
+	opts.batch_size = 8;
+	check = sdb_plugin_ingest_start(&opts);
+	ck_assert_msg(check == 0,
+			"sdb_plugin_ingest_start() = %d; expected: 0", check);
+	check = sdb_plugin_ingest_start(&opts);
+	ck_assert_msg(check < 0,
+			"sdb_plugin_ingest_start() = %d while running; expected: <0",
+			check);
+
+	for (i = 0; i < HOSTS; ++i) {
+		char hostname[32];
+
+		snprintf(hostname, sizeof(hostname), "host%02d", i);
+		/* children may only be stored after their parent */
+		check = sdb_plugin_store_host(hostname, SECS_TO_SDB_TIME(1));
+		ck_assert_msg(check == 0,
+				"sdb_plugin_store_host(%s) = %d; expected: 0",
+				hostname, check);
+		check = sdb_plugin_store_attribute(hostname, "k", &value,
+				SECS_TO_SDB_TIME(1));
+		ck_assert_msg(check == 0,
+				"sdb_plugin_store_attribute(%s, k) = %d; expected: 0",
+				hostname, check);
+		expected += 2;
+
+		for (j = 0; j < SERVICES; ++j) {
+			char svc[32];
+
+			snprintf(svc, sizeof(svc), "svc%02d", j);
+			check = sdb_plugin_store_service(hostname, svc,
+					SECS_TO_SDB_TIME(1));
+			ck_assert_msg(check == 0,
+					"sdb_plugin_store_service(%s, %s) = %d; expected: 0",
+					hostname, svc, check);
+			check = sdb_plugin_store_service_attribute(hostname, svc,
+					"k", &value, SECS_TO_SDB_TIME(1));
+			ck_assert_msg(check == 0,
+					"sdb_plugin_store_service_attribute(%s, %s, k) = %d; "
+					"expected: 0", hostname, svc, check);
+			expected += 2;
+		}
+	}
+
+	check = sdb_plugin_get_ingest_stats(&stats);
+	ck_assert_msg(check == 0,
+			"sdb_plugin_get_ingest_stats() = %d; expected: 0", check);
+	ck_assert_msg(stats.enqueued == expected,
+			"ingest stats: enqueued = %zu; expected: %zu",
+			stats.enqueued, expected);
+	/* queued objects include those currently being stored */
+	ck_assert_msg(stats.max_queued <= opts.queue_size + opts.batch_size + 1,
+			"ingest stats: max_queued = %zu; expected: <= %zu",
+			stats.max_queued, opts.queue_size + opts.batch_size + 1);
+
+	/* wait for the pipeline to drain */
+	while (stats.processed < expected) {
+		sdb_sleep(SECS_TO_SDB_TIME(1) / 100, NULL);
+		check = sdb_plugin_get_ingest_stats(&stats);
+		ck_assert(check == 0);
+	}
+	ck_assert_msg(stats.queued == 0,
+			"ingest stats: queued = %zu; expected: 0", stats.queued);
+	ck_assert_msg(stats.failed == 0,
+			"ingest stats: failed = %zu; expected: 0", stats.failed);
+	ck_assert_msg(stats.batches <= stats.processed,
+			"ingest stats: batches = %zu; expected: <= %zu",
+			stats.batches, stats.processed);
+
+	sdb_plugin_ingest_stop();
+	check = sdb_plugin_get_ingest_stats(&stats);
+	ck_assert_msg(check < 0,
+			"sdb_plugin_get_ingest_stats() = %d after stopping the "
+			"pipeline; expected: <0", check);
+
+	for (i = 0; i < HOSTS; ++i) {
+		sdb_memstore_obj_t *svc;
+		char name[32];
+
+		snprintf(name, sizeof(name), "host%02d", i);
+		host = sdb_memstore_get_host(store, name);
+		ck_assert_msg(host != NULL,
+				"sdb_memstore_get_host(%s) = NULL; expected: <host>", name);
+
+		for (j = 0; j < SERVICES; ++j) {
+			snprintf(name, sizeof(name), "svc%02d", j);
+			svc = sdb_memstore_get_child(host, SDB_SERVICE, name);
+			ck_assert_msg(svc != NULL,
+					"sdb_memstore_get_child(host%02d, service, %s) = NULL; "
+					"expected: <service>", i, name);
+			sdb_object_deref(SDB_OBJ(svc));
+		}
+		sdb_object_deref(SDB_OBJ(host));
+	}
+
+	/* objects are stored synchronously again */
+	check = sdb_plugin_store_host("sync", SECS_TO_SDB_TIME(1));
+	ck_assert_msg(check == 0,
+			"sdb_plugin_store_host(sync) = %d; expected: 0", check);
+	host = sdb_memstore_get_host(store, "sync");
+	ck_assert_msg(host != NULL,
+			"sdb_memstore_get_host(sync) = NULL; expected: <host>");
+	sdb_object_deref(SDB_OBJ(host));
+}
+END_TEST
+
+/*
+ * cname cache
+ */
+
+static int cname_calls = 0;
+static sdb_time_t cname_delay = 0;
+
+/* canonicalize all names starting with 'h' */
+static char *
+test_cname(const char *name, sdb_object_t __attribute__((unused)) *ud)
+{
+	char *cname;
+
+	++cname_calls;
+	if (cname_delay)
+		sdb_sleep(cname_delay, NULL);
+
+	if (name[0] != 'h')
+		return NULL;
+	cname = malloc(strlen(name) + sizeof(".example.com"));
+	if (cname)
+		sprintf(cname, "%s.example.com", name);
+	return cname;
+} /* test_cname */
+
+static void
+setup_cname(void)
+{
+	cname_calls = 0;
+	cname_delay = 0;
+	ck_assert(sdb_plugin_register_cname("test-cname",
+				test_cname, NULL) == 0);
+} /* setup_cname */
+
+static void
+teardown_cname(void)
+{
+	sdb_plugin_cname_cache_configure(NULL);
+	sdb_plugin_unregister_all();
+} /* teardown_cname */
+
+static void
+check_cname(const char *name, const char *expected, int calls)
+{
+	char *cname = sdb_plugin_cname(strdup(name));
+
+	ck_assert_msg(cname && (! strcmp(cname, expected)),
+			"sdb_plugin_cname(%s) = %s; expected: %s",
+			name, cname, expected);
+	ck_assert_msg(cname_calls == calls,
+			"sdb_plugin_cname(%s) called cname callback %d times "
+			"in total; expected: %d", name, cname_calls, calls);
+	free(cname);
+} /* check_cname */
+
+START_TEST(test_cname_cache)
+{
+	sdb_plugin_cname_cache_opts_t opts = SDB_PLUGIN_CNAME_CACHE_OPTS_INIT;
+	sdb_plugin_cname_cache_stats_t stats;
+
+	/* no cache */
+	check_cname("h1", "h1.example.com", 1);
+	check_cname("h1", "h1.example.com", 2);
+
+	opts.size = 2;
+	opts.negative_ttl = 0;
+	ck_assert(sdb_plugin_cname_cache_configure(&opts) == 0);
+
+	check_cname("h1", "h1.example.com", 3);
+	check_cname("h1", "h1.example.com", 3);
+	/* negative results expire right away (and count as misses) */
+	check_cname("x1", "x1", 4);
+	check_cname("x1", "x1", 5);
+	/* h1 is evicted */
+	check_cname("h2", "h2.example.com", 6);
+	check_cname("h1", "h1.example.com", 7);
+	check_cname("h2", "h2.example.com", 7);
+
+	sdb_plugin_cname_cache_stats(&stats);
+	ck_assert_msg((stats.lru.hits == 2) && (stats.lru.evictions >= 1),
+			"cname cache stats: hits = %"PRIu64", evictions = %"PRIu64"; "
+			"expected: 2, >=1", stats.lru.hits, stats.lru.evictions);
+
+	ck_assert(sdb_plugin_cname_cache_configure(NULL) == 0);
+	sdb_plugin_cname_cache_stats(&stats);
+	ck_assert_msg(stats.lru.capacity == 0,
+			"cname cache stats: capacity = %zu after disabling the cache; "
+			"expected: 0", stats.lru.capacity);
+}
+END_TEST
+
+START_TEST(test_cname_resolver)
+{
+	sdb_plugin_cname_cache_opts_t opts = SDB_PLUGIN_CNAME_CACHE_OPTS_INIT;
+	sdb_plugin_cname_cache_stats_t stats;
+	char *cname;
+	int i;
+
+	opts.size = 10;
+	opts.ttl = 0;
+	opts.num_threads = 2;
+	ck_assert(sdb_plugin_cname_cache_configure(&opts) == 0);
+
+	/* wait for the initial lookup */
+	check_cname("h1", "h1.example.com", 1);
+	/* expired entries are used while refreshing them in the background */
+	cname = sdb_plugin_cname(strdup("h1"));
+	ck_assert_msg(cname && (! strcmp(cname, "h1.example.com")),
+			"sdb_plugin_cname(h1) = %s; expected: h1.example.com", cname);
+	free(cname);
+	for (i = 0; i < 100; ++i) {
+		if (cname_calls >= 2)
+			break;
+		sdb_sleep(SECS_TO_SDB_TIME(1) / 100, NULL);
+	}
+	ck_assert_msg(cname_calls >= 2,
+			"cname callback called %d times; expected: >= 2", cname_calls);
+
+	sdb_plugin_cname_cache_stats(&stats);
+	ck_assert_msg(stats.stale >= 1,
+			"cname cache stats: stale = %"PRIu64"; expected: >= 1",
+			stats.stale);
+
+	/* don't wait for slow lookups */
+	opts.timeout = SECS_TO_SDB_TIME(1) / 20;
+	ck_assert(sdb_plugin_cname_cache_configure(&opts) == 0);
+	cname_delay = SECS_TO_SDB_TIME(1) / 2;
+	cname = sdb_plugin_cname(strdup("h2"));
+	ck_assert_msg(cname && (! strcmp(cname, "h2")),
+			"sdb_plugin_cname(h2) = %s; expected: h2 (timeout)", cname);
+	free(cname);
+
+	sdb_plugin_cname_cache_stats(&stats);
+	ck_assert_msg(stats.timeouts == 1,
+			"cname cache stats: timeouts = %"PRIu64"; expected: 1",
+			stats.timeouts);
+}
+END_TEST
+
+/*
+ * federated queries
+ */
+
+static sdb_memstore_t *shards[2] = { NULL, NULL };
+
+static void
+setup_shards(void)
+{
+	sdb_metric_store_t ms = { "dummy", "/var/lib/m1", NULL, 0 };
+	sdb_data_t datum = { SDB_TYPE_STRING, { .string = "v1" } };
+	size_t i;
+
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(shards); ++i) {
+		char name[16];
+
+		shards[i] = sdb_memstore_create();
+		ck_assert(shards[i] != NULL);
+		snprintf(name, sizeof(name), "shard%zu", i);
+		ck_assert(sdb_plugin_register_reader(name,
+					&sdb_memstore_reader, SDB_OBJ(shards[i])) == 0);
+	}
+
+	/* hosts are partitioned except for 'h3' which is newer in shards[1] */
+	sdb_memstore_host(shards[0], "h1", 1, 0);
+	sdb_memstore_attribute(shards[0], "h1", "k1", &datum, 1, 0);
+	sdb_memstore_service(shards[0], "h1", "s1", 1, 0);
+	sdb_memstore_host(shards[0], "h3", 1, 0);
+	sdb_memstore_service(shards[0], "h3", "s1", 1, 0);
+	sdb_memstore_host(shards[0], "h5", 1, 0);
+	sdb_memstore_host(shards[1], "h2", 2, 0);
+	sdb_memstore_metric(shards[1], "h2", "m1", &ms, 2, 0);
+	sdb_memstore_host(shards[1], "h3", 2, 0);
+	sdb_memstore_service(shards[1], "h3", "s2", 2, 0);
+	sdb_memstore_host(shards[1], "h4", 2, 0);
+} /* setup_shards */
+
+static void
+teardown_shards(void)
+{
+	size_t i;
+
+	sdb_plugin_unregister_all();
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(shards); ++i) {
+		sdb_object_deref(SDB_OBJ(shards[i]));
+		shards[i] = NULL;
+	}
+} /* teardown_shards */
+
+/* a writer recording a summary of all objects */
+typedef struct {
+	sdb_object_t super;
+	sdb_strbuf_t *buf;
+} recorder_t;
+#define RECORDER(obj) ((recorder_t *)(obj))
+
+static int
+record_host(sdb_store_host_t *host, sdb_object_t *user_data)
+{
+	sdb_strbuf_append(RECORDER(user_data)->buf, "%s;", host->name);
+	return 0;
+} /* record_host */
+
+static int
+record_service(sdb_store_service_t *service, sdb_object_t *user_data)
+{
+	sdb_strbuf_append(RECORDER(user_data)->buf, "%s.%s;",
+			service->hostname, service->name);
+	return 0;
+} /* record_service */
+
+static int
+record_metric(sdb_store_metric_t *metric, sdb_object_t *user_data)
+{
+	sdb_strbuf_append(RECORDER(user_data)->buf, "%s.%s(%s);",
+			metric->hostname, metric->name,
+			metric->stores_num ? metric->stores[0].id : "");
+	return 0;
+} /* record_metric */
+
+static int
+record_attribute(sdb_store_attribute_t *attr, sdb_object_t *user_data)
+{
+	char value[32];
+
+	sdb_data_format(&attr->value, value, sizeof(value), SDB_UNQUOTED);
+	sdb_strbuf_append(RECORDER(user_data)->buf, "%s.%s=%s;",
+			attr->parent, attr->key, value);
+	return 0;
+} /* record_attribute */
+
+static sdb_store_writer_t recorder = {
+	record_host, record_service, record_metric, record_attribute,
+};
+
+static struct {
+	const char *query;
+	int expected;
+	const char *result;
+} federated_query_data[] = {
+	{ "LIST hosts", SDB_CONNECTION_DATA, "h1;h2;h3;h4;h5;" },
+	{ "LIST services", SDB_CONNECTION_DATA, "h1;h1.s1;h3;h3.s2;" },
+	{ "LIST metrics", SDB_CONNECTION_DATA, "h2;h2.m1(/var/lib/m1);" },
+	{ "FETCH host 'h1'", SDB_CONNECTION_DATA, "h1;h1.k1=v1;h1.s1;" },
+	{ "FETCH host 'h2'", SDB_CONNECTION_DATA, "h2;h2.m1(/var/lib/m1);" },
+	{ "FETCH host 'h3'", SDB_CONNECTION_DATA, "h3;h3.s2;" },
+	{ "FETCH host 'x'", -1, "" },
+	{ "LOOKUP hosts MATCHING name =~ 'h[1245]'", SDB_CONNECTION_DATA,
+		"h1;h1.k1=v1;h1.s1;h2;h2.m1(/var/lib/m1);h4;h5;" },
+	{ "LOOKUP services MATCHING name = 's2'", SDB_CONNECTION_DATA,
+		"h3;h3.s2;" },
+};
+
+START_TEST(test_federated_query)
+{
+	recorder_t rec = { SDB_OBJECT_INIT, NULL };
+	sdb_strbuf_t *errbuf = sdb_strbuf_create(64);
+	sdb_llist_t *parsed;
+	sdb_ast_node_t *ast;
+	int status;
+
+	rec.buf = sdb_strbuf_create(64);
+	parsed = sdb_parser_parse(federated_query_data[_i].query, -1, errbuf);
+	ck_assert_msg(parsed && (sdb_llist_len(parsed) == 1),
+			"sdb_parser_parse(%s) failed: %s", federated_query_data[_i].query,
+			sdb_strbuf_string(errbuf));
+	ast = SDB_AST_NODE(sdb_llist_get(parsed, 0));
+
+	status = sdb_plugin_query(ast, &recorder, SDB_OBJ(&rec),
+			/* opts = */ NULL, errbuf);
+	ck_assert_msg(status == federated_query_data[_i].expected,
+			"sdb_plugin_query(%s) = %d; expected: %d (err: %s)",
+			federated_query_data[_i].query, status, federated_query_data[_i].expected,
+			sdb_strbuf_string(errbuf));
+	ck_assert_msg(! strcmp(sdb_strbuf_string(rec.buf),
+				federated_query_data[_i].result),
+			"sdb_plugin_query(%s) returned '%s'; expected: '%s'",
+			federated_query_data[_i].query, sdb_strbuf_string(rec.buf),
+			federated_query_data[_i].result);
+
+	sdb_object_deref(SDB_OBJ(ast));
+	sdb_llist_destroy(parsed);
+	sdb_strbuf_destroy(rec.buf);
+	sdb_strbuf_destroy(errbuf);
+}
+END_TEST
+
+/*
+ * writer options
+ */
+
+static struct {
+	int hosts, services, metrics, attributes;
+} written;
+
+static int
+count_host(sdb_store_host_t __attribute__((unused)) *host,
+		sdb_object_t __attribute__((unused)) *user_data)
+{
+	++written.hosts;
+	return 0;
+} /* count_host */
+
+static int
+count_service(sdb_store_service_t __attribute__((unused)) *service,
+		sdb_object_t __attribute__((unused)) *user_data)
+{
+	++written.services;
+	return 0;
+} /* count_service */
+
+static int
+count_metric(sdb_store_metric_t __attribute__((unused)) *metric,
+		sdb_object_t __attribute__((unused)) *user_data)
+{
+	++written.metrics;
+	return 0;
+} /* count_metric */
+
+static int
+count_attribute(sdb_store_attribute_t __attribute__((unused)) *attr,
+		sdb_object_t __attribute__((unused)) *user_data)
+{
+	++written.attributes;
+	return 0;
+} /* count_attribute */
+
+static sdb_store_writer_t count_writer = {
+	count_host, count_service, count_metric, count_attribute,
+};
+
+START_TEST(test_writer_opts)
+{
+	sdb_plugin_writer_opts_t opts = { true, 60 * SDB_INTERVAL_SECOND };
+	sdb_metric_store_t ms = { "t", "id", NULL, 0 };
+	sdb_data_t datum = { SDB_TYPE_STRING, { .string = "v1" } };
+
+	sdb_plugin_store_host("h1", 1 * SDB_INTERVAL_SECOND);
+	sdb_plugin_store_attribute("h1", "k1", &datum, 1 * SDB_INTERVAL_SECOND);
+	sdb_plugin_store_metric("h1", "m1", /* store */ NULL,
+			2 * SDB_INTERVAL_SECOND);
+
+	memset(&written, 0, sizeof(written));
+	ck_assert(sdb_plugin_register_writer_opts("count-writer",
+				&count_writer, &opts, NULL) == 0);
+
+	/* unchanged objects are skipped */
+	sdb_plugin_store_host("h1", 20 * SDB_INTERVAL_SECOND);
+	sdb_plugin_store_attribute("h1", "k1", &datum, 30 * SDB_INTERVAL_SECOND);
+	fail_unless((written.hosts == 0) && (written.attributes == 0),
+			"changes-only writer received %d host(s), %d attribute(s) for "
+			"unchanged objects; expected: 0, 0",
+			written.hosts, written.attributes);
+
+	/* new objects and changed values are passed on */
+	sdb_plugin_store_host("h3", 20 * SDB_INTERVAL_SECOND);
+	datum.data.string = "v9";
+	sdb_plugin_store_attribute("h1", "k1", &datum, 31 * SDB_INTERVAL_SECOND);
+	sdb_plugin_store_metric("h1", "m1", &ms, 50 * SDB_INTERVAL_SECOND);
+	sdb_plugin_store_metric("h1", "m1", &ms, 55 * SDB_INTERVAL_SECOND);
+	fail_unless((written.hosts == 1) && (written.attributes == 1)
+				&& (written.metrics == 1),
+			"changes-only writer received %d host(s), %d attribute(s), "
+			"%d metric(s); expected: 1, 1, 1", written.hosts,
+			written.attributes, written.metrics);
+
+	/* unchanged objects are passed on once per heartbeat interval */
+	sdb_plugin_store_host("h1", 61 * SDB_INTERVAL_SECOND);
+	sdb_plugin_store_host("h1", 62 * SDB_INTERVAL_SECOND);
+	fail_unless(written.hosts == 2,
+			"changes-only writer received %d host(s) after heartbeat; "
+			"expected: 2", written.hosts);
+}
+END_TEST
+
+TEST_MAIN("core::plugin")
+{
+	TCase *tc = tcase_create("core");
+	tcase_add_checked_fixture(tc, setup, teardown);
+	tcase_add_test(tc, test_collector_pool);
+	ADD_TCASE(tc);
+
+	tc = tcase_create("ingest");
+	tcase_add_checked_fixture(tc, setup_store, teardown_store);
+	tcase_add_test(tc, test_ingest);
+	ADD_TCASE(tc);
+
+	tc = tcase_create("cname");
+	tcase_add_checked_fixture(tc, setup_cname, teardown_cname);
+	tcase_add_test(tc, test_cname_cache);
+	tcase_add_test(tc, test_cname_resolver);
+	ADD_TCASE(tc);
+
+	tc = tcase_create("federated");
+	tcase_add_checked_fixture(tc, setup_shards, teardown_shards);
+	TC_ADD_LOOP_TEST(tc, federated_query);
+	ADD_TCASE(tc);
+
+	tc = tcase_create("writer");
+	tcase_add_checked_fixture(tc, setup_store, teardown_store);
+	tcase_add_test(tc, test_writer_opts);
+	ADD_TCASE(tc);
+}
+TEST_MAIN_END
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
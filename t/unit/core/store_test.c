@@ -35,8 +35,14 @@
 #include "testutils.h"
 
 #include <check.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
 
 static sdb_memstore_t *store;
 
@@ -802,6 +808,716 @@ START_TEST(test_scan)
 }
 END_TEST
 
+START_TEST(test_generation)
+{
+	sdb_memstore_t *st = sdb_memstore_create();
+	sdb_data_t datum = { SDB_TYPE_INTEGER, { .integer = 42 } };
+	uint64_t gen, h1_gen, h2_gen;
+
+	ck_assert(st != NULL);
+
+	gen = sdb_memstore_generation(st, NULL);
+	fail_unless(gen == 0,
+			"sdb_memstore_generation(<empty store>, NULL) = %"PRIu64"; "
+			"expected: 0", gen);
+
+	sdb_memstore_host(st, "h1", 1, 0);
+	sdb_memstore_host(st, "h2", 1, 0);
+	gen = sdb_memstore_generation(st, NULL);
+	h1_gen = sdb_memstore_generation(st, "h1");
+	h2_gen = sdb_memstore_generation(st, "h2");
+	fail_unless((gen == 2) && (h1_gen == 1) && (h2_gen == 2),
+			"sdb_memstore_generation(<store>, NULL|h1|h2) = %"PRIu64", "
+			"%"PRIu64", %"PRIu64"; expected: 2, 1, 2", gen, h1_gen, h2_gen);
+
+	/* unknown hosts fall back to the global generation */
+	gen = sdb_memstore_generation(st, "x");
+	fail_unless(gen == 2,
+			"sdb_memstore_generation(<store>, x) = %"PRIu64"; expected: 2",
+			gen);
+
+	/* updates of children update the host's generation */
+	sdb_memstore_service(st, "h1", "s1", 1, 0);
+	sdb_memstore_metric(st, "h1", "m1", /* store */ NULL, 1, 0);
+	sdb_memstore_service_attr(st, "h1", "s1", "k1", &datum, 1, 0);
+	h1_gen = sdb_memstore_generation(st, "h1");
+	h2_gen = sdb_memstore_generation(st, "h2");
+	fail_unless((h1_gen == 5) && (h2_gen == 2),
+			"sdb_memstore_generation(<store>, h1|h2) = %"PRIu64", %"PRIu64
+			"; expected: 5, 2", h1_gen, h2_gen);
+
+	/* failed updates do not change the generation */
+	sdb_memstore_service(st, "x", "s1", 1, 0);
+	gen = sdb_memstore_generation(st, NULL);
+	fail_unless(gen == 5,
+			"sdb_memstore_generation(<store>, NULL) = %"PRIu64" after "
+			"failed update; expected: 5", gen);
+
+	sdb_object_deref(SDB_OBJ(st));
+}
+END_TEST
+
+static int
+scan_names(sdb_memstore_obj_t *obj,
+		sdb_memstore_matcher_t __attribute__((unused)) *filter,
+		void *user_data)
+{
+	sdb_strbuf_t *buf = user_data;
+
+	if (obj->parent)
+		sdb_strbuf_append(buf, "%s.", SDB_OBJ(obj->parent)->name);
+	sdb_strbuf_append(buf, "%s ", SDB_OBJ(obj)->name);
+	return 0;
+} /* scan_names */
+
+static uint64_t
+get_seq(sdb_memstore_t *st, const char *hostname, int type, const char *name)
+{
+	sdb_memstore_obj_t *host, *obj;
+	sdb_data_t seq = SDB_DATA_INIT;
+
+	host = sdb_memstore_get_host(st, hostname);
+	obj = host;
+	if (name)
+		obj = sdb_memstore_get_child(host, type, name);
+	ck_assert(obj != NULL);
+	ck_assert(sdb_memstore_get_field(obj, SDB_FIELD_SEQUENCE, &seq) == 0);
+	ck_assert(seq.type == SDB_TYPE_INTEGER);
+
+	if (obj != host)
+		sdb_object_deref(SDB_OBJ(obj));
+	sdb_object_deref(SDB_OBJ(host));
+	return (uint64_t)seq.data.integer;
+} /* get_seq */
+
+static struct {
+	int type;
+	uint64_t since;
+	const char *expected;
+} changed_data[] = {
+	{ SDB_HOST,    0, "h1 h2 " },
+	{ SDB_HOST,    2, "h2 " },
+	{ SDB_HOST,    8, "" },
+	{ SDB_SERVICE, 0, "h1.s2 h2.s1 " },
+	{ SDB_SERVICE, 3, "h1.s2 " },
+	{ SDB_METRIC,  0, "h1.m1 " },
+	{ SDB_METRIC,  7, "h1.m1 " },
+	{ SDB_METRIC,  8, "" },
+};
+
+START_TEST(test_changed)
+{
+	sdb_memstore_t *st = sdb_memstore_create();
+	sdb_data_t datum = { SDB_TYPE_INTEGER, { .integer = 42 } };
+	sdb_metric_store_t ms = { "t", "id", NULL, 1 };
+	sdb_strbuf_t *buf = sdb_strbuf_create(0);
+	const char *backends[] = { "b1" };
+	sdb_store_host_t host = { "h1", 3, 0, backends, 1, 0 };
+	uint64_t seq;
+	size_t i;
+	int check;
+
+	ck_assert((st != NULL) && (buf != NULL));
+
+	sdb_memstore_host(st, "h1", 1, 0);
+	sdb_memstore_host(st, "h2", 1, 0);
+	sdb_memstore_service(st, "h2", "s1", 1, 0);
+	sdb_memstore_service(st, "h1", "s2", 1, 0);
+	sdb_memstore_metric(st, "h1", "m1", /* store */ NULL, 1, 0);
+	fail_unless((get_seq(st, "h1", SDB_HOST, NULL) == 1)
+			&& (get_seq(st, "h1", SDB_METRIC, "m1") == 5),
+			"new objects did not receive sequence numbers 1 and 5");
+
+	/* updating the timestamps only is not a change */
+	sdb_memstore_host(st, "h1", 2, 0);
+	seq = get_seq(st, "h1", SDB_HOST, NULL);
+	fail_unless(seq == 1,
+			"sequence of h1 = %"PRIu64" after updating its timestamp; "
+			"expected: 1", seq);
+
+	/* an attribute change is a change of its parent */
+	sdb_memstore_attribute(st, "h2", "k1", &datum, 1, 0);
+	sdb_memstore_attribute(st, "h2", "k1", &datum, 2, 0);
+	seq = get_seq(st, "h2", SDB_HOST, NULL);
+	fail_unless(seq == 7,
+			"sequence of h2 = %"PRIu64" after storing an attribute; "
+			"expected: 7", seq);
+
+	/* new data stores are changes */
+	sdb_memstore_metric(st, "h1", "m1", &ms, 2, 0);
+	sdb_memstore_metric(st, "h1", "m1", &ms, 3, 0);
+	seq = get_seq(st, "h1", SDB_METRIC, "m1");
+	fail_unless(seq == 8,
+			"sequence of h1.m1 = %"PRIu64" after adding a data store; "
+			"expected: 8", seq);
+
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(changed_data); ++i) {
+		sdb_strbuf_clear(buf);
+		check = sdb_memstore_scan_changed(st, changed_data[i].type,
+				changed_data[i].since, /* m, filter = */ NULL, NULL,
+				scan_names, buf);
+		fail_unless(check == 0,
+				"sdb_memstore_scan_changed(%s, %"PRIu64") = %d; expected: 0",
+				SDB_STORE_TYPE_TO_NAME(changed_data[i].type),
+				changed_data[i].since, check);
+		fail_unless(! strcmp(sdb_strbuf_string(buf), changed_data[i].expected),
+				"sdb_memstore_scan_changed(%s, %"PRIu64") visited '%s'; "
+				"expected: '%s'", SDB_STORE_TYPE_TO_NAME(changed_data[i].type),
+				changed_data[i].since, sdb_strbuf_string(buf),
+				changed_data[i].expected);
+	}
+
+	/* a new backend is a change, moving the object to the end */
+	sdb_memstore_writer.store_host(&host, SDB_OBJ(st));
+	sdb_strbuf_clear(buf);
+	sdb_memstore_scan_changed(st, SDB_HOST, 8, NULL, NULL, scan_names, buf);
+	fail_unless(! strcmp(sdb_strbuf_string(buf), "h1 "),
+			"sdb_memstore_scan_changed(host, 8) visited '%s' after adding "
+			"a backend; expected: 'h1 '", sdb_strbuf_string(buf));
+
+	check = sdb_memstore_scan_changed(st, SDB_ATTRIBUTE, 0, NULL, NULL,
+			scan_names, buf);
+	fail_unless(check < 0,
+			"sdb_memstore_scan_changed(attribute) = %d; expected: <0", check);
+
+	sdb_strbuf_destroy(buf);
+	sdb_object_deref(SDB_OBJ(st));
+}
+END_TEST
+
+#define SHARDED_HOSTS 2000
+
+/* verify that objects are visited in scan order */
+static int
+scan_ordered(sdb_memstore_obj_t *obj,
+		sdb_memstore_matcher_t __attribute__((unused)) *filter,
+		void *user_data)
+{
+	sdb_strbuf_t *buf = user_data;
+	char name[64];
+
+	snprintf(name, sizeof(name), "%s%s%s",
+			obj->parent ? SDB_OBJ(obj->parent)->name : "",
+			obj->parent ? "." : "", SDB_OBJ(obj)->name);
+	fail_unless(strcasecmp(sdb_strbuf_string(buf), name) < 0,
+			"sdb_memstore_scan visited '%s' after '%s'; expected ascending "
+			"order", name, sdb_strbuf_string(buf));
+	sdb_strbuf_sprintf(buf, "%s", name);
+	return 0;
+} /* scan_ordered */
+
+START_TEST(test_sharded)
+{
+	sdb_memstore_t *st = sdb_memstore_create_sharded(4);
+	sdb_strbuf_t *buf = sdb_strbuf_create(0);
+	sdb_memstore_obj_t *host;
+	intptr_t i = 0;
+	int n, check;
+
+	ck_assert((st != NULL) && (buf != NULL));
+	fail_unless(sdb_memstore_create_sharded(0) == NULL,
+			"sdb_memstore_create_sharded(0) = <store>; expected: NULL");
+
+	/* insert in an order different from the scan order */
+	for (n = 0; n < SHARDED_HOSTS; ++n) {
+		char name[16];
+		snprintf(name, sizeof(name), "h%04d", (n * 7) % SHARDED_HOSTS);
+		ck_assert(sdb_memstore_host(st, name, 1, 0) == 0);
+		ck_assert(sdb_memstore_service(st, name, "s1", 1, 0) == 0);
+	}
+
+	host = sdb_memstore_get_host(st, "H0042");
+	fail_unless(host != NULL,
+			"sdb_memstore_get_host(<sharded store>, H0042) = NULL; "
+			"expected: <host>");
+	sdb_object_deref(SDB_OBJ(host));
+
+	check = sdb_memstore_scan(st, SDB_HOST, /* m, filter = */ NULL, NULL,
+			scan_count, &i);
+	fail_unless((check == 0) && (i == SHARDED_HOSTS),
+			"sdb_memstore_scan(<sharded store>, HOST) = %d, called callback "
+			"%d times; expected: 0, %d", check, (int)i, SHARDED_HOSTS);
+
+	check = sdb_memstore_scan(st, SDB_HOST, /* m, filter = */ NULL, NULL,
+			scan_ordered, buf);
+	fail_unless(check == 0,
+			"sdb_memstore_scan(<sharded store>, HOST) = %d; expected: 0",
+			check);
+	sdb_strbuf_clear(buf);
+	check = sdb_memstore_scan(st, SDB_SERVICE, /* m, filter = */ NULL, NULL,
+			scan_ordered, buf);
+	fail_unless(check == 0,
+			"sdb_memstore_scan(<sharded store>, SERVICE) = %d; expected: 0",
+			check);
+
+	i = 0;
+	check = sdb_memstore_scan(st, SDB_HOST, /* m, filter = */ NULL, NULL,
+			scan_error, &i);
+	fail_unless((check == -1) && (i == 1),
+			"sdb_memstore_scan(<sharded store>, HOST), error callback = %d, "
+			"called callback %d times; expected: -1, 1", check, (int)i);
+
+	/* sequence numbers are global across all shards */
+	sdb_strbuf_clear(buf);
+	check = sdb_memstore_scan_changed(st, SDB_HOST,
+			2 * SHARDED_HOSTS - 4, /* m, filter = */ NULL, NULL,
+			scan_names, buf);
+	fail_unless((check == 0)
+				&& (! strcmp(sdb_strbuf_string(buf), "h1986 h1993 ")),
+			"sdb_memstore_scan_changed(<sharded store>, HOST, %d) = %d, "
+			"visited '%s'; expected: 0, 'h1986 h1993 '",
+			2 * SHARDED_HOSTS - 4, check, sdb_strbuf_string(buf));
+
+	fail_unless(sdb_memstore_generation(st, NULL) == 2 * SHARDED_HOSTS,
+			"sdb_memstore_generation(<sharded store>, NULL) = %"PRIu64"; "
+			"expected: %d", sdb_memstore_generation(st, NULL),
+			2 * SHARDED_HOSTS);
+
+	sdb_strbuf_destroy(buf);
+	sdb_object_deref(SDB_OBJ(st));
+}
+END_TEST
+
+static int
+dump_obj(sdb_memstore_obj_t *obj,
+		sdb_memstore_matcher_t __attribute__((unused)) *filter,
+		void *user_data)
+{
+	return sdb_memstore_emit_full(obj, /* filter = */ NULL,
+			&sdb_store_json_writer, user_data);
+} /* dump_obj */
+
+static void
+dump_store(sdb_memstore_t *st, sdb_strbuf_t *buf)
+{
+	sdb_store_json_formatter_t *f;
+
+	sdb_strbuf_clear(buf);
+	f = sdb_store_json_formatter(buf, SDB_HOST, SDB_WANT_ARRAY);
+	ck_assert(f != NULL);
+	ck_assert(sdb_memstore_scan(st, SDB_HOST, /* m, filter = */ NULL, NULL,
+				dump_obj, f) == 0);
+	sdb_store_json_finish(f);
+	sdb_object_deref(SDB_OBJ(f));
+} /* dump_store */
+
+START_TEST(test_snapshot)
+{
+	sdb_metric_store_t m_store = { "dummy-type", "dummy-id", NULL, 4 };
+	sdb_strbuf_t *expected = sdb_strbuf_create(0);
+	sdb_strbuf_t *got = sdb_strbuf_create(0);
+	char tmp_file[] = "store_test_snapshot.XXXXXX";
+	char value[8192];
+	sdb_data_t datum;
+	sdb_memstore_t *st;
+	FILE *fh;
+	size_t i;
+	int fd, check;
+
+	populate();
+	sdb_memstore_metric(store, "h1", "m3", &m_store, 4, 0);
+	sdb_memstore_host(store, "h1", 6, 0);
+	dump_store(store, expected);
+
+	fd = mkstemp(tmp_file);
+	ck_assert(fd >= 0);
+	close(fd);
+
+	check = sdb_memstore_snapshot(store, tmp_file);
+	fail_unless(check == 0,
+			"sdb_memstore_snapshot(<store>, %s) = %d; expected: 0",
+			tmp_file, check);
+
+	st = sdb_memstore_create_sharded(3);
+	ck_assert(st != NULL);
+	check = sdb_memstore_load_snapshot(st, tmp_file);
+	fail_unless(check == 0,
+			"sdb_memstore_load_snapshot(<store>, %s) = %d; expected: 0",
+			tmp_file, check);
+	dump_store(st, got);
+	fail_unless(! strcmp(sdb_strbuf_string(got),
+				sdb_strbuf_string(expected)),
+			"sdb_memstore_load_snapshot() restored store:\n%s\n"
+			"expected:\n%s", sdb_strbuf_string(got),
+			sdb_strbuf_string(expected));
+	sdb_object_deref(SDB_OBJ(st));
+
+	/* a large, sharded store is written in multiple parts */
+	st = sdb_memstore_create_sharded(3);
+	ck_assert(st != NULL);
+	memset(value, 'x', sizeof(value) - 1);
+	value[sizeof(value) - 1] = '\0';
+	datum.type = SDB_TYPE_STRING;
+	datum.data.string = value;
+	for (i = 0; i < 300; ++i) {
+		char name[32];
+		snprintf(name, sizeof(name), "h%zu", i);
+		sdb_memstore_host(st, name, 1, 0);
+		sdb_memstore_attribute(st, name, "k", &datum, 1, 0);
+	}
+	dump_store(st, expected);
+	check = sdb_memstore_snapshot(st, tmp_file);
+	fail_unless(check == 0,
+			"sdb_memstore_snapshot(<large store>, %s) = %d; expected: 0",
+			tmp_file, check);
+	sdb_object_deref(SDB_OBJ(st));
+
+	st = sdb_memstore_create();
+	ck_assert(st != NULL);
+	check = sdb_memstore_load_snapshot(st, tmp_file);
+	dump_store(st, got);
+	fail_unless((check == 0) && (! strcmp(sdb_strbuf_string(got),
+					sdb_strbuf_string(expected))),
+			"sdb_memstore_load_snapshot(<large store>) = %d; "
+			"restored %zu bytes of JSON, expected: 0, %zu bytes", check,
+			sdb_strbuf_len(got), sdb_strbuf_len(expected));
+	sdb_object_deref(SDB_OBJ(st));
+
+	/* truncated file */
+	ck_assert(truncate(tmp_file, 100) == 0);
+	st = sdb_memstore_create();
+	check = sdb_memstore_load_snapshot(st, tmp_file);
+	fail_unless(check < 0,
+			"sdb_memstore_load_snapshot(<truncated file>) = %d; "
+			"expected: <0", check);
+	sdb_object_deref(SDB_OBJ(st));
+
+	/* invalid file */
+	fh = fopen(tmp_file, "w");
+	ck_assert(fh != NULL);
+	fprintf(fh, "this is not a snapshot file");
+	fclose(fh);
+	st = sdb_memstore_create();
+	check = sdb_memstore_load_snapshot(st, tmp_file);
+	fail_unless(check < 0,
+			"sdb_memstore_load_snapshot(<invalid file>) = %d; "
+			"expected: <0", check);
+
+	unlink(tmp_file);
+	check = sdb_memstore_load_snapshot(st, tmp_file);
+	fail_unless(check > 0,
+			"sdb_memstore_load_snapshot(<missing file>) = %d; "
+			"expected: >0", check);
+	sdb_object_deref(SDB_OBJ(st));
+
+	sdb_strbuf_destroy(expected);
+	sdb_strbuf_destroy(got);
+}
+END_TEST
+
+static void
+wal_populate(sdb_memstore_wal_t *wal, sdb_time_t last_update)
+{
+	const char *backends[] = { "b1", "b2" };
+	sdb_metric_store_t m_stores[] = {
+		{ "dummy-type", "dummy-id", NULL, 0 },
+		{ "dummy-type", "dummy-id2", NULL, 0 },
+	};
+	sdb_store_host_t host = SDB_STORE_HOST_INIT;
+	sdb_store_service_t svc = SDB_STORE_SERVICE_INIT;
+	sdb_store_metric_t metric = SDB_STORE_METRIC_INIT;
+	sdb_store_attribute_t attr = SDB_STORE_ATTRIBUTE_INIT;
+
+	host.name = "h1";
+	host.last_update = last_update;
+	host.interval = 10;
+	host.backends = backends;
+	host.backends_num = 2;
+	ck_assert(sdb_memstore_wal_writer.store_host(&host, SDB_OBJ(wal)) == 0);
+
+	svc.hostname = "h1";
+	svc.name = "s1";
+	svc.last_update = last_update;
+	ck_assert(sdb_memstore_wal_writer.store_service(&svc,
+				SDB_OBJ(wal)) == 0);
+
+	m_stores[0].last_update = m_stores[1].last_update = last_update;
+	metric.hostname = "h1";
+	metric.name = "m1";
+	metric.stores = m_stores;
+	metric.stores_num = SDB_STATIC_ARRAY_LEN(m_stores);
+	metric.last_update = last_update;
+	ck_assert(sdb_memstore_wal_writer.store_metric(&metric,
+				SDB_OBJ(wal)) == 0);
+
+	attr.parent_type = SDB_SERVICE;
+	attr.hostname = "h1";
+	attr.parent = "s1";
+	attr.key = "k1";
+	attr.value.type = SDB_TYPE_INTEGER;
+	attr.value.data.integer = (int64_t)last_update;
+	attr.last_update = last_update;
+	ck_assert(sdb_memstore_wal_writer.store_attribute(&attr,
+				SDB_OBJ(wal)) == 0);
+
+	attr.parent_type = SDB_HOST;
+	attr.hostname = NULL;
+	attr.parent = "h1";
+	attr.value.type = SDB_TYPE_STRING;
+	attr.value.data.string = "v1";
+	ck_assert(sdb_memstore_wal_writer.store_attribute(&attr,
+				SDB_OBJ(wal)) == 0);
+} /* wal_populate */
+
+START_TEST(test_wal)
+{
+	sdb_strbuf_t *expected = sdb_strbuf_create(0);
+	sdb_strbuf_t *got = sdb_strbuf_create(0);
+	char wal_file[] = "store_test_wal.XXXXXX";
+	char snapshot[sizeof(wal_file) + 5];
+	char old_file[sizeof(wal_file) + 4];
+	sdb_memstore_wal_t *wal;
+	sdb_memstore_obj_t *host;
+	sdb_memstore_t *st;
+	struct stat st_buf;
+	off_t size;
+	FILE *fh;
+	int fd, check;
+
+	fd = mkstemp(wal_file);
+	ck_assert(fd >= 0);
+	close(fd);
+	snprintf(snapshot, sizeof(snapshot), "%s.snap", wal_file);
+	snprintf(old_file, sizeof(old_file), "%s.old", wal_file);
+
+	fail_unless(sdb_memstore_wal_create(store, wal_file,
+				SDB_MEMSTORE_WAL_SYNC_INTERVAL, 0) == NULL,
+			"sdb_memstore_wal_create(<store>, <file>, INTERVAL, 0) = <wal>; "
+			"expected: NULL");
+
+	/* all updates are recorded */
+	wal = sdb_memstore_wal_create(store, wal_file,
+			SDB_MEMSTORE_WAL_SYNC_ALWAYS, 0);
+	ck_assert(wal != NULL);
+	wal_populate(wal, 1);
+	wal_populate(wal, 2);
+	sdb_object_deref(SDB_OBJ(wal));
+	dump_store(store, expected);
+
+	st = sdb_memstore_create_sharded(2);
+	check = sdb_memstore_wal_replay(st, wal_file);
+	dump_store(st, got);
+	fail_unless((check == 0) && (! strcmp(sdb_strbuf_string(got),
+					sdb_strbuf_string(expected))),
+			"sdb_memstore_wal_replay() = %d; restored store:\n%s\n"
+			"expected: 0;\n%s", check, sdb_strbuf_string(got),
+			sdb_strbuf_string(expected));
+	sdb_object_deref(SDB_OBJ(st));
+
+	/* updates after a checkpoint are replayed on top of the snapshot */
+	wal = sdb_memstore_wal_create(store, wal_file,
+			SDB_MEMSTORE_WAL_SYNC_NONE, 0);
+	ck_assert(wal != NULL);
+	check = sdb_memstore_wal_checkpoint(wal, snapshot);
+	fail_unless(check == 0,
+			"sdb_memstore_wal_checkpoint() = %d; expected: 0", check);
+	fail_unless(access(old_file, F_OK) != 0,
+			"sdb_memstore_wal_checkpoint() left '%s' behind", old_file);
+	wal_populate(wal, 3);
+	sdb_memstore_host(store, "h2", 3, 0);
+	sdb_object_deref(SDB_OBJ(wal));
+	dump_store(store, expected);
+
+	/* sdb_memstore_host() bypasses the log */
+	st = sdb_memstore_create();
+	ck_assert(sdb_memstore_load_snapshot(st, snapshot) == 0);
+	sdb_memstore_host(st, "h2", 3, 0);
+	check = sdb_memstore_wal_replay(st, wal_file);
+	dump_store(st, got);
+	fail_unless((check == 0) && (! strcmp(sdb_strbuf_string(got),
+					sdb_strbuf_string(expected))),
+			"sdb_memstore_wal_replay() after checkpoint = %d; "
+			"restored store:\n%s\nexpected: 0;\n%s", check,
+			sdb_strbuf_string(got), sdb_strbuf_string(expected));
+	sdb_object_deref(SDB_OBJ(st));
+
+	/* stale records are skipped */
+	st = sdb_memstore_create();
+	sdb_memstore_host(st, "h1", 5, 0);
+	check = sdb_memstore_wal_replay(st, wal_file);
+	host = sdb_memstore_get_host(st, "h1");
+	ck_assert(host != NULL);
+	fail_unless((check == 0) && (host->last_update == 5),
+			"sdb_memstore_wal_replay(<newer store>) = %d, h1.last_update = "
+			"%"PRIsdbTIME"; expected: 0, 5", check, host->last_update);
+	sdb_object_deref(SDB_OBJ(host));
+	sdb_object_deref(SDB_OBJ(st));
+
+	/* a torn record at the end of the log is discarded */
+	ck_assert(stat(wal_file, &st_buf) == 0);
+	size = st_buf.st_size;
+	fh = fopen(wal_file, "a");
+	ck_assert(fh != NULL);
+	fwrite("\0\0\1\0torn", 1, 8, fh);
+	fclose(fh);
+	st = sdb_memstore_create();
+	ck_assert(sdb_memstore_load_snapshot(st, snapshot) == 0);
+	sdb_memstore_host(st, "h2", 3, 0);
+	check = sdb_memstore_wal_replay(st, wal_file);
+	dump_store(st, got);
+	fail_unless((check == 0) && (! strcmp(sdb_strbuf_string(got),
+					sdb_strbuf_string(expected))),
+			"sdb_memstore_wal_replay(<torn log>) = %d; "
+			"restored store:\n%s\nexpected: 0;\n%s", check,
+			sdb_strbuf_string(got), sdb_strbuf_string(expected));
+	sdb_object_deref(SDB_OBJ(st));
+	ck_assert(stat(wal_file, &st_buf) == 0);
+	fail_unless(st_buf.st_size == size,
+			"sdb_memstore_wal_replay(<torn log>) left %lld bytes; "
+			"expected: %lld", (long long)st_buf.st_size, (long long)size);
+
+	unlink(wal_file);
+	unlink(snapshot);
+	sdb_strbuf_destroy(expected);
+	sdb_strbuf_destroy(got);
+}
+END_TEST
+
+START_TEST(test_replication)
+{
+	sdb_strbuf_t *expected = sdb_strbuf_create(0);
+	sdb_strbuf_t *got = sdb_strbuf_create(0);
+	sdb_strbuf_t *buf = sdb_strbuf_create(0);
+	sdb_store_repl_pos_t r = SDB_STORE_REPL_POS_INIT;
+	uint64_t pos = 0;
+	size_t parts = 0;
+	sdb_data_t datum;
+	sdb_memstore_t *replica;
+	int fds[2];
+	char c;
+	int check;
+
+	check = sdb_memstore_replicate(store, &r, buf, 1024, -1);
+	fail_unless(check < 0,
+			"sdb_memstore_replicate(<replication disabled>) = %d; "
+			"expected: <0", check);
+
+	ck_assert(sdb_memstore_enable_replication(store, 1024 * 1024) == 0);
+	populate();
+	dump_store(store, expected);
+
+	/* unknown stream: full copy, written in parts of about one byte each,
+	 * that is, one host per call */
+	do {
+		check = sdb_memstore_replicate(store, &r, buf, 1, -1);
+		++parts;
+		if ((check > 0) && r.copying)
+			fail_unless(sdb_memstore_replicate(store, &r, NULL, 0, -1) > 0,
+					"sdb_memstore_replicate(<incomplete copy>, NULL) = 0; "
+					"expected: >0");
+	} while ((check > 0) && r.copying && (parts < 100));
+	fail_unless((check > 0) && (! r.copying) && (parts == 3)
+				&& (r.id != 0) && (r.seq > 0) && (! r.copy_key),
+			"sdb_memstore_replicate(<unknown stream>) = %d (id=%"PRIu64", "
+			"seq=%"PRIu64", parts=%zu); expected: >0 (id!=0, seq>0, "
+			"parts=3)", check, r.id, r.seq, parts);
+
+	replica = sdb_memstore_create();
+	ck_assert(replica != NULL);
+	check = sdb_memstore_apply_replication(replica,
+			sdb_strbuf_string(buf), sdb_strbuf_len(buf), &pos);
+	dump_store(replica, got);
+	fail_unless((check > 0) && (pos == r.seq)
+				&& (! strcmp(sdb_strbuf_string(got),
+						sdb_strbuf_string(expected))),
+			"sdb_memstore_apply_replication(<full copy>) = %d (seq=%"PRIu64"); "
+			"restored store:\n%s\nexpected: >0 (seq=%"PRIu64");\n%s",
+			check, pos, sdb_strbuf_string(got), r.seq,
+			sdb_strbuf_string(expected));
+
+	/* nothing pending */
+	ck_assert(pipe(fds) == 0);
+	check = sdb_memstore_replicate(store, &r, NULL, 0, fds[1]);
+	fail_unless(check == 0,
+			"sdb_memstore_replicate(<up-to-date>, NULL) = %d; expected: 0",
+			check);
+
+	/* updates following the copy */
+	datum.type = SDB_TYPE_STRING;
+	datum.data.string = "v4";
+	sdb_memstore_attribute(store, "h1", "k1", &datum, 5, 0);
+	sdb_memstore_host(store, "h3", 5, 0);
+	sdb_memstore_service(store, "h3", "s1", 5, 0);
+	dump_store(store, expected);
+
+	fail_unless(read(fds[0], &c, 1) == 1,
+			"sdb_memstore_replicate() did not notify about new entries");
+	check = sdb_memstore_replicate(store, &r, NULL, 0, -1);
+	fail_unless(check > 0,
+			"sdb_memstore_replicate(<pending>, NULL) = %d; expected: >0",
+			check);
+
+	sdb_strbuf_clear(buf);
+	check = sdb_memstore_replicate(store, &r, buf, 1024, -1);
+	fail_unless(check == 0,
+			"sdb_memstore_replicate(<known position>) = %d; expected: 0",
+			check);
+	check = sdb_memstore_apply_replication(replica,
+			sdb_strbuf_string(buf), sdb_strbuf_len(buf), &pos);
+	dump_store(replica, got);
+	fail_unless((check == 3) && (pos == r.seq)
+				&& (! strcmp(sdb_strbuf_string(got),
+						sdb_strbuf_string(expected))),
+			"sdb_memstore_apply_replication(<delta>) = %d (seq=%"PRIu64"); "
+			"restored store:\n%s\nexpected: 3 (seq=%"PRIu64");\n%s",
+			check, pos, sdb_strbuf_string(got), r.seq,
+			sdb_strbuf_string(expected));
+
+	/* malformed entries */
+	check = sdb_memstore_apply_replication(replica,
+			sdb_strbuf_string(buf), sdb_strbuf_len(buf) - 1, &pos);
+	fail_unless(check < 0,
+			"sdb_memstore_apply_replication(<truncated>) = %d; expected: <0",
+			check);
+
+	/* a position which dropped out of the backlog requires a full copy */
+	ck_assert(sdb_memstore_enable_replication(store, 1) == 0);
+	check = sdb_memstore_replicate(store, &r, NULL, 0, -1);
+	fail_unless(check > 0,
+			"sdb_memstore_replicate(<new stream>, NULL) = %d; expected: >0",
+			check);
+	sdb_strbuf_clear(buf);
+	ck_assert(sdb_memstore_replicate(store, &r, buf, 1024, -1) > 0);
+	ck_assert(! r.copying);
+	for (check = 0; check < 2000; ++check) {
+		char name[16];
+		snprintf(name, sizeof(name), "h%d", check + 10);
+		sdb_memstore_host(store, name, 10, 0);
+	}
+	check = sdb_memstore_replicate(store, &r, NULL, 0, -1);
+	fail_unless(check > 0,
+			"sdb_memstore_replicate(<dropped position>, NULL) = %d; "
+			"expected: >0", check);
+
+	/* each part of the copy is bounded; updates during the copy do not
+	 * affect the position it reflects */
+	parts = 0;
+	do {
+		sdb_strbuf_clear(buf);
+		check = sdb_memstore_replicate(store, &r, buf, 1024, -1);
+		/* (plus the end-of-copy marker) */
+		fail_unless((check < 0) || (sdb_strbuf_len(buf) <= 1024 + 16),
+				"sdb_memstore_replicate(<dropped position>, max=1024) wrote "
+				"%zu bytes; expected: <=1040", sdb_strbuf_len(buf));
+		if (++parts == 2)
+			sdb_memstore_host(store, "h0", 20, 0);
+	} while ((check > 0) && r.copying && (parts < 10000));
+	fail_unless((check > 0) && (! r.copying) && (parts > 10)
+				&& (r.seq == 2000),
+			"sdb_memstore_replicate(<dropped position>) = %d "
+			"(seq=%"PRIu64", parts=%zu); expected: >0 (seq=2000, "
+			"parts>10)", check, r.seq, parts);
+
+	close(fds[0]);
+	close(fds[1]);
+	free(r.copy_key);
+	sdb_object_deref(SDB_OBJ(replica));
+	sdb_strbuf_destroy(expected);
+	sdb_strbuf_destroy(got);
+	sdb_strbuf_destroy(buf);
+}
+END_TEST
+
 TEST_MAIN("core::store")
 {
 	TCase *tc = tcase_create("core");
@@ -816,6 +1532,12 @@ TEST_MAIN("core::store")
 	TC_ADD_LOOP_TEST(tc, get_field);
 	tcase_add_test(tc, test_get_child);
 	tcase_add_test(tc, test_scan);
+	tcase_add_test(tc, test_generation);
+	tcase_add_test(tc, test_changed);
+	tcase_add_test(tc, test_sharded);
+	tcase_add_test(tc, test_snapshot);
+	tcase_add_test(tc, test_wal);
+	tcase_add_test(tc, test_replication);
 	ADD_TCASE(tc);
 }
 TEST_MAIN_END
@@ -33,6 +33,7 @@
 #include "testutils.h"
 
 #include <check.h>
+#include <math.h>
 
 #define TS "1970-01-01 00:00:00 +0000"
 #define V "0.000000"
@@ -65,6 +66,10 @@ START_TEST(timeseries)
 
 	fail_unless(ts != NULL,
 			"sdb_timeseries_create(2, {\"abc\", \"xyz\"}, 2) = NULL; expected: <ts>");
+	/* values of all data-sources are stored in a single, contiguous array */
+	fail_unless((ts->timestamps != NULL) && (ts->data[1] == ts->data[0] + 2),
+			"sdb_timeseries_create(2, {\"abc\", \"xyz\"}, 2) did not "
+			"allocate contiguous columns");
 
 	test = sdb_timeseries_tojson(ts, buf);
 	fail_unless(test == 0,
@@ -77,11 +82,295 @@ START_TEST(timeseries)
 }
 END_TEST
 
+START_TEST(timeseries_downsample)
+{
+	const char * const data_names[] = {"abc", "xyz"};
+	sdb_timeseries_t *ts = sdb_timeseries_create(2, data_names, 10);
+	size_t i, j;
+
+	struct {
+		sdb_time_t resolution;
+		size_t max_points;
+		int method;
+		size_t expected_len;
+		/* values of "abc"; "xyz" is twice the value */
+		double expected[5];
+		/* time-stamps in seconds */
+		sdb_time_t expected_ts[5];
+	} golden_data[] = {
+		{ 0, 5, SDB_TIMESERIES_AVERAGE, 5,
+			{ 0.5, 2.5, NAN, 6.5, 8.5 }, { 1, 3, 5, 7, 9 } },
+		{ 0, 5, SDB_TIMESERIES_MIN, 5,
+			{ 0.0, 2.0, NAN, 6.0, 8.0 }, { 1, 3, 5, 7, 9 } },
+		{ 0, 5, SDB_TIMESERIES_MAX, 5,
+			{ 1.0, 3.0, NAN, 7.0, 9.0 }, { 1, 3, 5, 7, 9 } },
+		/* the end time is 9s, that is, 3 buckets */
+		{ SECS_TO_SDB_TIME(4), 0, SDB_TIMESERIES_AVERAGE, 3,
+			{ 1.0, 3.0, 7.5 }, { 2, 5, 9 } },
+		{ SECS_TO_SDB_TIME(4), 2, SDB_TIMESERIES_MAX, 2,
+			{ 3.0, 9.0 }, { 4, 9 } },
+		/* the spike at 8s is preserved */
+		{ 0, 4, SDB_TIMESERIES_LTTB, 4,
+			{ 0.0, 3.0, 100.0, 9.0 }, { 0, 3, 8, 9 } },
+		/* LTTB falls back to averages for less than three points */
+		{ 0, 2, SDB_TIMESERIES_LTTB, 2,
+			{ 1.5, 30.5 }, { 4, 9 } },
+		{ 0, 20, SDB_TIMESERIES_AVERAGE, 10,
+			{ 0.0, 1.0, 2.0, 3.0, NAN }, { 0, 1, 2, 3, 4 } },
+	};
+
+	ck_assert(ts != NULL);
+	ts->start = 0;
+	ts->end = SECS_TO_SDB_TIME(9);
+	for (i = 0; i < 10; ++i) {
+		ts->timestamps[i] = SECS_TO_SDB_TIME(i);
+		ts->data[0][i] = (double)i;
+		ts->data[1][i] = 2.0 * (double)i;
+	}
+	/* NaN values are ignored */
+	ts->data[0][4] = ts->data[0][5] = NAN;
+	ts->data[1][4] = ts->data[1][5] = NAN;
+
+	fail_unless(sdb_timeseries_parse_downsample("LTTB") == SDB_TIMESERIES_LTTB,
+			"sdb_timeseries_parse_downsample(LTTB) = %d; expected: %d",
+			sdb_timeseries_parse_downsample("LTTB"), SDB_TIMESERIES_LTTB);
+	fail_unless(sdb_timeseries_parse_downsample("median") < 0,
+			"sdb_timeseries_parse_downsample(median) = %d; expected: <0",
+			sdb_timeseries_parse_downsample("median"));
+
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(golden_data); ++i) {
+		sdb_timeseries_opts_t opts = SDB_TIMESERIES_OPTS_INIT;
+		sdb_timeseries_t *res;
+		const char *m = SDB_TIMESERIES_DOWNSAMPLE_TO_STRING(golden_data[i].method);
+
+		opts.resolution = golden_data[i].resolution;
+		opts.max_points = golden_data[i].max_points;
+		opts.downsample = golden_data[i].method;
+
+		/* the spike is only used for LTTB to not disturb other results */
+		if (golden_data[i].method == SDB_TIMESERIES_LTTB)
+			ts->data[0][8] = 100.0;
+		else
+			ts->data[0][8] = 8.0;
+		ts->data[1][8] = 2.0 * ts->data[0][8];
+
+		res = sdb_timeseries_downsample(ts, &opts);
+		fail_unless(res != NULL,
+				"sdb_timeseries_downsample(<ts>, %zu points, %s) = NULL; "
+				"expected: <ts>", golden_data[i].max_points, m);
+		fail_unless(res->data_len == golden_data[i].expected_len,
+				"sdb_timeseries_downsample(<ts>, %zu points, %s) returned "
+				"%zu data-points; expected: %zu", golden_data[i].max_points,
+				m, res->data_len, golden_data[i].expected_len);
+		fail_unless((res->start == ts->start) && (res->end == ts->end),
+				"sdb_timeseries_downsample(<ts>, %zu points, %s) changed "
+				"the time range", golden_data[i].max_points, m);
+
+		for (j = 0; (j < res->data_len) && (j < 5); ++j) {
+			double v = golden_data[i].expected[j];
+			sdb_time_t t = SECS_TO_SDB_TIME(golden_data[i].expected_ts[j]);
+
+			fail_unless((isnan(v) && isnan(res->data[0][j]))
+					|| (v == res->data[0][j]),
+					"sdb_timeseries_downsample(<ts>, %zu points, %s)[%zu] = %f; "
+					"expected: %f", golden_data[i].max_points, m, j,
+					res->data[0][j], v);
+			fail_unless((isnan(v) && isnan(res->data[1][j]))
+					|| (2.0 * v == res->data[1][j]),
+					"sdb_timeseries_downsample(<ts>, %zu points, %s)[%zu] "
+					"= %f for data-source 'xyz'; expected: %f",
+					golden_data[i].max_points, m, j,
+					res->data[1][j], 2.0 * v);
+			fail_unless(res->timestamps[j] == t,
+					"sdb_timeseries_downsample(<ts>, %zu points, %s)[%zu] "
+					"time-stamp = %"PRIsdbTIME"; expected: %"PRIsdbTIME,
+					golden_data[i].max_points, m, j,
+					res->timestamps[j], t);
+		}
+		sdb_timeseries_destroy(res);
+	}
+	sdb_timeseries_destroy(ts);
+}
+END_TEST
+
+START_TEST(timeseries_aggregate)
+{
+	const char * const value[] = {"value"};
+	const char * const other[] = {"other"};
+	sdb_timeseries_t *a = sdb_timeseries_create(1, value, 6);
+	sdb_timeseries_t *b = sdb_timeseries_create(1, value, 6);
+	sdb_timeseries_t *c = sdb_timeseries_create(1, other, 6);
+	sdb_timeseries_t *d = sdb_timeseries_create(1, value, 6);
+	/* NULL time-series and time-series with other data-sources are ignored */
+	const sdb_timeseries_t *series[] = { a, NULL, b, c, d };
+	double percentile = 0.0;
+	size_t i, j;
+
+	struct {
+		int function;
+		double percentile;
+		sdb_time_t step;
+		size_t expected_len;
+		double expected[6];
+		/* time-stamps in seconds */
+		sdb_time_t expected_ts[6];
+	} golden_data[] = {
+		{ SDB_TIMESERIES_AGGR_SUM, 0.0, 0, 6,
+			{ 111.0, 122.0, 103.0, 144.0, 155.0, 166.0 },
+			{ 0, 1, 2, 3, 4, 5 } },
+		{ SDB_TIMESERIES_AGGR_AVG, 0.0, 0, 6,
+			{ 37.0, 122.0 / 3.0, 51.5, 48.0, 155.0 / 3.0, 166.0 / 3.0 },
+			{ 0, 1, 2, 3, 4, 5 } },
+		{ SDB_TIMESERIES_AGGR_MIN, 0.0, 0, 6,
+			{ 1.0, 2.0, 3.0, 4.0, 5.0, 6.0 }, { 0, 1, 2, 3, 4, 5 } },
+		{ SDB_TIMESERIES_AGGR_MAX, 0.0, 0, 6,
+			{ 100.0, 100.0, 100.0, 100.0, 100.0, 100.0 },
+			{ 0, 1, 2, 3, 4, 5 } },
+		{ SDB_TIMESERIES_AGGR_PERCENTILE, 50.0, 0, 6,
+			{ 10.0, 20.0, 51.5, 40.0, 50.0, 60.0 }, { 0, 1, 2, 3, 4, 5 } },
+		{ SDB_TIMESERIES_AGGR_PERCENTILE, 75.0, 0, 6,
+			{ 55.0, 60.0, 75.75, 70.0, 75.0, 80.0 }, { 0, 1, 2, 3, 4, 5 } },
+		{ SDB_TIMESERIES_AGGR_PERCENTILE, 0.0, 0, 6,
+			{ 1.0, 2.0, 3.0, 4.0, 5.0, 6.0 }, { 0, 1, 2, 3, 4, 5 } },
+		/* data-points are averaged per time-series first */
+		{ SDB_TIMESERIES_AGGR_SUM, 0.0, SECS_TO_SDB_TIME(2), 3,
+			{ 116.5, 143.5, 160.5 }, { 0, 2, 4 } },
+		{ SDB_TIMESERIES_AGGR_MAX, 0.0, SECS_TO_SDB_TIME(4), 2,
+			{ 100.0, 100.0 }, { 0, 4 } },
+		/* never resample below the resolution of the input */
+		{ SDB_TIMESERIES_AGGR_MIN, 0.0, SECS_TO_SDB_TIME(1) / 2, 6,
+			{ 1.0, 2.0, 3.0, 4.0, 5.0, 6.0 }, { 0, 1, 2, 3, 4, 5 } },
+	};
+
+	ck_assert((a != NULL) && (b != NULL) && (c != NULL) && (d != NULL));
+	for (i = 0; i < 4; ++i) {
+		sdb_timeseries_t *ts = (i == 0) ? a : (i == 1) ? b : (i == 2) ? c : d;
+
+		ts->start = 0;
+		ts->end = SECS_TO_SDB_TIME(5);
+		for (j = 0; j < 6; ++j)
+			ts->timestamps[j] = SECS_TO_SDB_TIME(j);
+	}
+	for (j = 0; j < 6; ++j) {
+		a->data[0][j] = (double)j + 1.0;
+		b->data[0][j] = 10.0 * ((double)j + 1.0);
+		c->data[0][j] = -1.0;
+		d->data[0][j] = 100.0;
+	}
+	b->data[0][2] = NAN;
+
+	fail_unless(sdb_timeseries_parse_aggregate("SUM", NULL)
+				== SDB_TIMESERIES_AGGR_SUM,
+			"sdb_timeseries_parse_aggregate(SUM) = %d; expected: %d",
+			sdb_timeseries_parse_aggregate("SUM", NULL),
+			SDB_TIMESERIES_AGGR_SUM);
+	fail_unless((sdb_timeseries_parse_aggregate("p95", &percentile)
+				== SDB_TIMESERIES_AGGR_PERCENTILE) && (percentile == 95.0),
+			"sdb_timeseries_parse_aggregate(p95) = %d (%f); expected: %d (95)",
+			sdb_timeseries_parse_aggregate("p95", &percentile), percentile,
+			SDB_TIMESERIES_AGGR_PERCENTILE);
+	fail_unless((sdb_timeseries_parse_aggregate("median", &percentile)
+				== SDB_TIMESERIES_AGGR_PERCENTILE) && (percentile == 50.0),
+			"sdb_timeseries_parse_aggregate(median) = %d (%f); "
+			"expected: %d (50)",
+			sdb_timeseries_parse_aggregate("median", &percentile), percentile,
+			SDB_TIMESERIES_AGGR_PERCENTILE);
+	for (i = 0; i < 4; ++i) {
+		const char *names[] = { "p101", "p", "p5x", "lttb" };
+		fail_unless(sdb_timeseries_parse_aggregate(names[i], NULL) < 0,
+				"sdb_timeseries_parse_aggregate(%s) = %d; expected: <0",
+				names[i], sdb_timeseries_parse_aggregate(names[i], NULL));
+	}
+
+	fail_unless(sdb_timeseries_aggregate(series + 1, 1,
+				SDB_TIMESERIES_AGGR_SUM, 0.0, 0) == NULL,
+			"sdb_timeseries_aggregate(<NULL>) = <ts>; expected: NULL");
+	fail_unless(sdb_timeseries_aggregate(series, 1,
+				SDB_TIMESERIES_AGGR_NONE, 0.0, 0) == NULL,
+			"sdb_timeseries_aggregate(<ts>, none) = <ts>; expected: NULL");
+
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(golden_data); ++i) {
+		sdb_timeseries_t *res;
+		const char *f = SDB_TIMESERIES_AGGR_TO_STRING(golden_data[i].function);
+
+		res = sdb_timeseries_aggregate(series, SDB_STATIC_ARRAY_LEN(series),
+				golden_data[i].function, golden_data[i].percentile,
+				golden_data[i].step);
+		fail_unless(res != NULL,
+				"sdb_timeseries_aggregate(<ts>, %s, %"PRIsdbTIME") = NULL; "
+				"expected: <ts>", f, golden_data[i].step);
+		fail_unless((res->data_names_len == 1)
+					&& (! strcmp(res->data_names[0], "value")),
+				"sdb_timeseries_aggregate(<ts>, %s, %"PRIsdbTIME") returned "
+				"unexpected data-sources", f, golden_data[i].step);
+		fail_unless(res->data_len == golden_data[i].expected_len,
+				"sdb_timeseries_aggregate(<ts>, %s, %"PRIsdbTIME") returned "
+				"%zu data-points; expected: %zu", f, golden_data[i].step,
+				res->data_len, golden_data[i].expected_len);
+		fail_unless((res->start == 0) && (res->end == SECS_TO_SDB_TIME(5)),
+				"sdb_timeseries_aggregate(<ts>, %s, %"PRIsdbTIME") changed "
+				"the time range", f, golden_data[i].step);
+
+		for (j = 0; j < res->data_len; ++j) {
+			double v = golden_data[i].expected[j];
+			sdb_time_t t = SECS_TO_SDB_TIME(golden_data[i].expected_ts[j]);
+
+			fail_unless(v == res->data[0][j],
+					"sdb_timeseries_aggregate(<ts>, %s(%f), %"PRIsdbTIME")[%zu] "
+					"= %f; expected: %f", f, golden_data[i].percentile,
+					golden_data[i].step, j, res->data[0][j], v);
+			fail_unless(res->timestamps[j] == t,
+					"sdb_timeseries_aggregate(<ts>, %s, %"PRIsdbTIME")[%zu] "
+					"time-stamp = %"PRIsdbTIME"; expected: %"PRIsdbTIME,
+					f, golden_data[i].step, j, res->timestamps[j], t);
+		}
+		sdb_timeseries_destroy(res);
+	}
+
+	/* without a native step, a wide time range limits the step */
+	{
+		sdb_timeseries_t *single = sdb_timeseries_create(1, value, 1);
+		const sdb_timeseries_t *wide[] = { single };
+		sdb_timeseries_t *res;
+
+		fail_unless(single != NULL,
+				"INTERNAL ERROR: sdb_timeseries_create() = NULL");
+		single->start = 0;
+		single->end = SECS_TO_SDB_TIME(365 * 86400);
+		single->timestamps[0] = SECS_TO_SDB_TIME(42);
+		single->data[0][0] = 1.0;
+
+		res = sdb_timeseries_aggregate(wide, 1, SDB_TIMESERIES_AGGR_SUM,
+				percentile, 1);
+		fail_unless(res != NULL,
+				"sdb_timeseries_aggregate(<single point>, sum, 1) = NULL; "
+				"expected: <ts>");
+		fail_unless((res->data_len > 1)
+					&& (res->data_len <= SDB_TIMESERIES_AGGR_MAX_POINTS),
+				"sdb_timeseries_aggregate(<single point>, sum, 1) returned "
+				"%zu data-points; expected: <= %d", res->data_len,
+				SDB_TIMESERIES_AGGR_MAX_POINTS);
+		fail_unless(res->data[0][0] == 1.0,
+				"sdb_timeseries_aggregate(<single point>, sum, 1)[0] = %f; "
+				"expected: 1.0", res->data[0][0]);
+		sdb_timeseries_destroy(res);
+		sdb_timeseries_destroy(single);
+	}
+
+	sdb_timeseries_destroy(a);
+	sdb_timeseries_destroy(b);
+	sdb_timeseries_destroy(c);
+	sdb_timeseries_destroy(d);
+}
+END_TEST
+
 TEST_MAIN("core::timeseries")
 {
 	TCase *tc = tcase_create("core");
 	tcase_add_test(tc, timeseries_info);
 	tcase_add_test(tc, timeseries);
+	tcase_add_test(tc, timeseries_downsample);
+	tcase_add_test(tc, timeseries_aggregate);
 	ADD_TCASE(tc);
 }
 TEST_MAIN_END
@@ -31,7 +31,9 @@
 
 #include "frontend/connection.h"
 #include "frontend/connection-private.h"
+#include "utils/compress.h"
 #include "utils/os.h"
+#include "utils/proto.h"
 #include "testutils.h"
 
 #include "utils/strbuf.h"
@@ -61,6 +63,9 @@ mock_conn_destroy(sdb_conn_t *conn)
 		free(SDB_OBJ(conn)->name);
 	sdb_strbuf_destroy(conn->buf);
 	sdb_strbuf_destroy(conn->errbuf);
+	sdb_compress_destroy(conn->compress);
+	sdb_strbuf_destroy(conn->inflated);
+	sdb_strbuf_destroy(conn->deflated);
 	if (conn->fd >= 0)
 		close(conn->fd);
 	if (conn->username)
@@ -435,6 +440,164 @@ START_TEST(test_conn_io)
 }
 END_TEST
 
+/* test handling of multiple commands sent at once */
+START_TEST(test_conn_pipeline)
+{
+	sdb_conn_t *conn = mock_conn_create();
+
+	char buffer[10 * 2 * sizeof(uint32_t) + 4];
+	char reply[sizeof(buffer)];
+	size_t i;
+
+	ssize_t check;
+
+	connection_startup(conn);
+
+	/* ten PING commands followed by a partial one */
+	memset(buffer, 0, sizeof(buffer));
+	for (i = 0; i < 10; ++i) {
+		uint32_t tmp = htonl(SDB_CONNECTION_PING);
+		memcpy(buffer + i * 2 * sizeof(uint32_t), &tmp, sizeof(tmp));
+	}
+
+	check = sdb_write(conn->fd, sizeof(buffer), buffer);
+	fail_unless(check == (ssize_t)sizeof(buffer),
+			"sdb_write(<pipelined commands>) = %zi; expected: %zu",
+			check, sizeof(buffer));
+
+	mock_conn_rewind(conn);
+	check = sdb_connection_handle(conn);
+	fail_unless(check == (ssize_t)sizeof(buffer),
+			"sdb_connection_handle() = %zi; expected: %zu",
+			check, sizeof(buffer));
+
+	fail_unless(conn->cmd == SDB_CONNECTION_IDLE,
+			"sdb_connection_handle() did not handle all pipelined "
+			"commands; current command: %u", conn->cmd);
+	fail_unless(sdb_strbuf_len(conn->buf) == 4,
+			"sdb_connection_handle() left %zu bytes in the buffer; "
+			"expected: 4", sdb_strbuf_len(conn->buf));
+
+	/* replies have been appended to the input */
+	lseek(conn->fd, (off_t)sizeof(buffer), SEEK_SET);
+	check = read(conn->fd, reply, sizeof(reply));
+	fail_unless(check == 10 * 2 * sizeof(uint32_t),
+			"sdb_connection_handle() sent %zi bytes of replies; "
+			"expected: %zu", check, 10 * 2 * sizeof(uint32_t));
+	for (i = 0; i < 10; ++i) {
+		uint32_t code = UINT32_MAX, msg_len = UINT32_MAX;
+		sdb_proto_unmarshal_header(reply + i * 2 * sizeof(uint32_t),
+				2 * sizeof(uint32_t), &code, &msg_len);
+		fail_unless((code == SDB_CONNECTION_OK) && (msg_len == 0),
+				"sdb_connection_handle() sent reply <%u, %u> for PING #%zu; "
+				"expected: <%u, 0>", code, msg_len, i, SDB_CONNECTION_OK);
+	}
+
+	mock_conn_destroy(conn);
+}
+END_TEST
+
+/* test negotiating compression and handling compressed messages */
+START_TEST(test_conn_compression)
+{
+	sdb_conn_t *conn = mock_conn_create();
+	sdb_compress_t *client;
+	sdb_strbuf_t *buf = sdb_strbuf_create(1024);
+	sdb_strbuf_t *msg = sdb_strbuf_create(1024);
+	char opt[2 * sizeof(uint32_t)];
+	char reply[64 * 1024];
+	uint32_t code = UINT32_MAX, msg_len = UINT32_MAX;
+	ssize_t check, n;
+	off_t offset;
+	int i;
+
+	connection_startup(conn);
+
+	sdb_proto_marshal_int32(opt, sizeof(opt),
+			SDB_CONNECTION_OPTION_COMPRESSION);
+	sdb_proto_marshal_int32(opt + sizeof(uint32_t), sizeof(uint32_t),
+			SDB_CONNECTION_COMPRESSION_DEFLATE);
+	sdb_compress_message(NULL, buf, SDB_CONNECTION_SET_OPTION,
+			(uint32_t)sizeof(opt), opt);
+	offset = (off_t)sdb_strbuf_len(buf);
+	ck_assert(sdb_write(conn->fd, sdb_strbuf_len(buf),
+				sdb_strbuf_string(buf)) == offset);
+	mock_conn_rewind(conn);
+	sdb_connection_handle(conn);
+
+	lseek(conn->fd, offset, SEEK_SET);
+	check = read(conn->fd, reply, sizeof(reply));
+	ck_assert(check >= 8);
+	sdb_proto_unmarshal_header(reply, (size_t)check, &code, &msg_len);
+	if (! sdb_compress_supported(SDB_CONNECTION_COMPRESSION_DEFLATE)) {
+		fail_unless((code == SDB_CONNECTION_ERROR) && (! conn->compress),
+				"SET_OPTION(COMPRESSION, DEFLATE) without zlib replied "
+				"%u; expected: %u", code, SDB_CONNECTION_ERROR);
+		sdb_strbuf_destroy(buf);
+		sdb_strbuf_destroy(msg);
+		mock_conn_destroy(conn);
+		return;
+	}
+	fail_unless((code == SDB_CONNECTION_OK) && conn->compress,
+			"SET_OPTION(COMPRESSION, DEFLATE) replied %u; expected: %u",
+			code, SDB_CONNECTION_OK);
+	mock_conn_truncate(conn);
+
+	client = sdb_compress_create(SDB_CONNECTION_COMPRESSION_DEFLATE);
+	ck_assert(client != NULL);
+
+	/* compressed commands */
+	for (i = 0; i < 100; ++i)
+		sdb_strbuf_append(msg, "ping ping ping ");
+	sdb_strbuf_clear(buf);
+	sdb_compress_message(client, buf, SDB_CONNECTION_PING,
+			(uint32_t)sdb_strbuf_len(msg), sdb_strbuf_string(msg));
+	sdb_proto_unmarshal_header(SDB_STRBUF_STR(buf), &code, &msg_len);
+	ck_assert(code == SDB_CONNECTION_COMPRESSED);
+	offset = (off_t)sdb_strbuf_len(buf);
+	ck_assert(sdb_write(conn->fd, sdb_strbuf_len(buf),
+				sdb_strbuf_string(buf)) == offset);
+	mock_conn_rewind(conn);
+	check = sdb_connection_handle(conn);
+	fail_unless((check == offset) && (conn->cmd == SDB_CONNECTION_IDLE)
+				&& (! sdb_strbuf_len(conn->buf)),
+			"sdb_connection_handle(<compressed PING>) = %zi; "
+			"expected: %zi", check, (ssize_t)offset);
+
+	lseek(conn->fd, offset, SEEK_SET);
+	check = read(conn->fd, reply, sizeof(reply));
+	sdb_proto_unmarshal_header(reply, (size_t)check, &code, &msg_len);
+	fail_unless((check == 8) && (code == SDB_CONNECTION_OK),
+			"compressed PING: received %zi bytes (code %u); "
+			"expected: 8 bytes (code %u)", check, code, SDB_CONNECTION_OK);
+	mock_conn_truncate(conn);
+
+	/* compressed replies */
+	check = sdb_connection_send(conn, SDB_CONNECTION_DATA,
+			(uint32_t)sdb_strbuf_len(msg), sdb_strbuf_string(msg));
+	mock_conn_rewind(conn);
+	n = read(conn->fd, reply, sizeof(reply));
+	sdb_proto_unmarshal_header(reply, (size_t)n, &code, &msg_len);
+	fail_unless((check == n) && (code == SDB_CONNECTION_COMPRESSED)
+				&& ((size_t)n < sdb_strbuf_len(msg)),
+			"sdb_connection_send(DATA, <%zu bytes>) = %zi (code %u); "
+			"expected: a smaller COMPRESSED message", sdb_strbuf_len(msg),
+			check, code);
+	sdb_strbuf_clear(buf);
+	n = sdb_decompress_message(client, reply + 8, msg_len, &code, buf);
+	fail_unless((code == SDB_CONNECTION_DATA)
+				&& (n == (ssize_t)sdb_strbuf_len(msg))
+				&& (! strcmp(sdb_strbuf_string(buf),
+						sdb_strbuf_string(msg))),
+			"failed to decompress reply: %zi (code %u)", n, code);
+
+	sdb_compress_destroy(client);
+	sdb_strbuf_destroy(buf);
+	sdb_strbuf_destroy(msg);
+	mock_conn_destroy(conn);
+}
+END_TEST
+
 TEST_MAIN("frontend::connection")
 {
 	TCase *tc;
@@ -447,6 +610,8 @@ TEST_MAIN("frontend::connection")
 	tcase_add_test(tc, test_conn_accept);
 	tcase_add_test(tc, test_conn_setup);
 	tcase_add_test(tc, test_conn_io);
+	tcase_add_test(tc, test_conn_pipeline);
+	tcase_add_test(tc, test_conn_compression);
 	ADD_TCASE(tc);
 }
 TEST_MAIN_END
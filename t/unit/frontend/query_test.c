@@ -33,9 +33,15 @@
 #include "core/plugin.h"
 #include "frontend/connection.h"
 #include "frontend/connection-private.h"
+#include "utils/proto.h"
 #include "testutils.h"
 
 #include <check.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
 
 /*
  * private helpers
@@ -264,6 +270,8 @@ mock_conn_destroy(sdb_conn_t *conn)
 	sdb_strbuf_destroy(conn->buf);
 	sdb_strbuf_destroy(conn->errbuf);
 	sdb_strbuf_destroy(MOCK_CONN(conn)->write_buf);
+	sdb_llist_destroy(conn->prepared);
+	sdb_conn_watch_clear(conn);
 	free(conn);
 } /* mock_conn_destroy */
 
@@ -311,6 +319,7 @@ mock_conn_create(void)
 	conn->conn.write = mock_conn_write;
 
 	conn->conn.username = "mock_user";
+	conn->conn.notify_fd = -1;
 	conn->conn.cmd = SDB_CONNECTION_IDLE;
 	conn->conn.cmd_len = 0;
 	return CONN(conn);
@@ -388,7 +397,7 @@ static struct {
 		"["HOST_H1_LISTING","HOST_H2_LISTING"]",
 	},
 	{
-		SDB_CONNECTION_QUERY, "LIST hosts; LIST hosts", -1, /* ignore second (and later) commands */
+		SDB_CONNECTION_QUERY, "LIST hosts; LIST hosts", -1, /* only checks first reply */
 		0, SDB_CONNECTION_DATA, SDB_CONNECTION_LIST,
 		"["HOST_H1_LISTING","HOST_H2_LISTING"]",
 	},
@@ -400,6 +409,17 @@ static struct {
 		SDB_CONNECTION_QUERY, "LIST hosts FILTER name = 's1'", -1,
 		0, SDB_CONNECTION_DATA, SDB_CONNECTION_LIST, "[]",
 	},
+	{
+		SDB_CONNECTION_QUERY, "LIST hosts CHANGED SINCE 2", -1,
+		0, SDB_CONNECTION_DATA, SDB_CONNECTION_LIST,
+		"[{\"name\": \"h1\", \"sequence\": 8, "
+			"\"last_update\": \"1970-01-01 00:00:01 +0000\", "
+			"\"update_interval\": \"0s\", \"backends\": []}]",
+	},
+	{
+		SDB_CONNECTION_QUERY, "LIST hosts CHANGED SINCE 8", -1,
+		0, SDB_CONNECTION_DATA, SDB_CONNECTION_LIST, "[]",
+	},
 	/* SDB_CONNECTION_LIST doesn't support filters yet */
 	{
 		SDB_CONNECTION_QUERY, "FETCH host 'h1'", -1,
@@ -485,6 +505,17 @@ static struct {
 		SDB_CONNECTION_QUERY, "LIST services FILTER host.name = 'h1'", -1,
 		0, SDB_CONNECTION_DATA, SDB_CONNECTION_LIST, "[]",
 	},
+	{
+		SDB_CONNECTION_QUERY, "LIST services CHANGED SINCE 22", -1,
+		0, SDB_CONNECTION_DATA, SDB_CONNECTION_LIST,
+		"[{\"name\": \"h2\", \"sequence\": 2, "
+			"\"last_update\": \"1970-01-01 00:00:03 +0000\", "
+			"\"update_interval\": \"0s\", \"backends\": [], "
+		"\"services\": ["
+			"{\"name\": \"s2\", \"sequence\": 29, "
+				"\"last_update\": \"1970-01-01 00:00:02 +0000\", "
+				"\"update_interval\": \"0s\", \"backends\": []}]}]",
+	},
 	/* SDB_CONNECTION_LIST doesn't support filters yet */
 	{
 		SDB_CONNECTION_QUERY, "FETCH service 'h2'.'s1'", -1,
@@ -753,6 +784,30 @@ static struct {
 		SDB_CONNECTION_STORE, "\0\0\0\x13""\0\0\0\0\xd6\x93\xa4\0""h1\0x1\0aA\0"VALUE, 27+VALUE_LEN,
 		-1, UINT32_MAX, 0, NULL,
 	},
+	{
+		SDB_CONNECTION_STORE_BATCH,
+		"\0\0\0\x0f""\0\0\0\1""\0\0\0\0\xd6\x93\xa4\0""hA\0"
+		"\0\0\0\x12""\0\0\0\2""\0\0\0\0\xd6\x93\xa4\0""hA\0sA", 41,
+		0, SDB_CONNECTION_OK, 0, "Successfully stored 2 objects",
+	},
+	{
+		SDB_CONNECTION_STORE_BATCH, "", 0,
+		0, SDB_CONNECTION_OK, 0, "Successfully stored 0 objects",
+	},
+	{
+		/* the service's host does not exist */
+		SDB_CONNECTION_STORE_BATCH,
+		"\0\0\0\x0f""\0\0\0\1""\0\0\0\0\xd6\x93\xa4\0""hA\0"
+		"\0\0\0\x12""\0\0\0\2""\0\0\0\0\xd6\x93\xa4\0""x1\0sA", 41,
+		-1, UINT32_MAX, 0, NULL,
+	},
+	{
+		/* truncated record */
+		SDB_CONNECTION_STORE_BATCH,
+		"\0\0\0\x0f""\0\0\0\1""\0\0\0\0\xd6\x93\xa4\0""hA\0"
+		"\0\0\0\x12""\0\0\0\2", 27,
+		-1, UINT32_MAX, 0, NULL,
+	},
 };
 
 START_TEST(test_query)
@@ -789,6 +844,9 @@ START_TEST(test_query)
 	case SDB_CONNECTION_STORE:
 		check = sdb_conn_store(conn);
 		break;
+	case SDB_CONNECTION_STORE_BATCH:
+		check = sdb_conn_store_batch(conn);
+		break;
 	default:
 		fail("Invalid command %#x", conn->cmd);
 	}
@@ -836,11 +894,1273 @@ START_TEST(test_query)
 }
 END_TEST
 
+START_TEST(test_multi_statement)
+{
+	sdb_conn_t *conn = mock_conn_create();
+	const char *query = "LIST hosts FILTER name = 'h1'; "
+		"STORE host 'hA'; FETCH host 'x1'; STORE host 'hB'";
+
+	struct {
+		uint32_t code;
+		const char *data;
+	} golden_replies[] = {
+		{ SDB_CONNECTION_DATA, "\0\0\0\x5[" HOST_H1_LISTING "]" },
+		{ SDB_CONNECTION_OK, "Successfully stored host hA" },
+		/* execution stops at the failing FETCH */
+	};
+
+	const char *data;
+	size_t len, i;
+	int check;
+
+	conn->cmd = SDB_CONNECTION_QUERY;
+	conn->cmd_len = (uint32_t)strlen(query);
+	sdb_strbuf_memcpy(conn->buf, query, conn->cmd_len);
+
+	check = sdb_conn_query(conn);
+	fail_unless(check < 0,
+			"sdb_conn_query(%s) = %d; expected: <0", query, check);
+
+	data = sdb_strbuf_string(MOCK_CONN(conn)->write_buf);
+	len = sdb_strbuf_len(MOCK_CONN(conn)->write_buf);
+
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(golden_replies); ++i) {
+		uint32_t code = UINT32_MAX, msg_len = UINT32_MAX;
+		ssize_t n;
+
+		n = sdb_proto_unmarshal_header(data, len, &code, &msg_len);
+		fail_unless(n == (ssize_t)(2 * sizeof(uint32_t)),
+				"sdb_conn_query(%s) did not send reply #%zu", query, i);
+		data += n;
+		len -= n;
+
+		fail_unless(code == golden_replies[i].code,
+				"sdb_conn_query(%s) reply #%zu: code <%u>; expected: <%u>",
+				query, i, code, golden_replies[i].code);
+		fail_unless(len >= msg_len,
+				"sdb_conn_query(%s) reply #%zu truncated", query, i);
+		fail_unless(! memcmp(data, golden_replies[i].data, msg_len),
+				"sdb_conn_query(%s) reply #%zu: unexpected data", query, i);
+		data += msg_len;
+		len -= msg_len;
+	}
+
+	fail_unless(len == 0,
+			"sdb_conn_query(%s) sent %zu bytes of unexpected extra replies",
+			query, len);
+	mock_conn_destroy(conn);
+}
+END_TEST
+
+START_TEST(test_binary_format)
+{
+	sdb_conn_t *conn = mock_conn_create();
+	const char *query = "FETCH host 'h1'";
+	const char opt[] = "\0\0\0\1" "\0\0\0\1";
+
+	struct {
+		int type;
+		const char *name;
+	} golden_objects[] = {
+		{ SDB_HOST, "h1" },
+		{ SDB_HOST | SDB_ATTRIBUTE, "k1" },
+		{ SDB_HOST | SDB_ATTRIBUTE, "k2" },
+		{ SDB_HOST | SDB_ATTRIBUTE, "k3" },
+		{ SDB_METRIC, "m1" },
+		{ SDB_METRIC | SDB_ATTRIBUTE, "hostname" },
+		{ SDB_METRIC | SDB_ATTRIBUTE, "k3" },
+		{ SDB_METRIC, "m2" },
+		{ SDB_METRIC | SDB_ATTRIBUTE, "hostname" },
+	};
+
+	uint32_t code = UINT32_MAX, msg_len = UINT32_MAX;
+	const char *data;
+	size_t len, i;
+	ssize_t n;
+	int check;
+
+	/* unsupported format */
+	conn->cmd = SDB_CONNECTION_SET_OPTION;
+	conn->cmd_len = 8;
+	sdb_strbuf_memcpy(conn->buf, "\0\0\0\1" "\0\0\0\x17", 8);
+	check = sdb_connection_set_option(conn);
+	fail_unless(check < 0,
+			"sdb_connection_set_option(<invalid format>) = %d; expected: <0",
+			check);
+	fail_unless(conn->result_format == SDB_CONNECTION_RESULT_JSON,
+			"sdb_connection_set_option(<invalid format>) changed the format");
+
+	conn->cmd = SDB_CONNECTION_SET_OPTION;
+	conn->cmd_len = 8;
+	sdb_strbuf_memcpy(conn->buf, opt, 8);
+	check = sdb_connection_set_option(conn);
+	fail_unless(check == 0,
+			"sdb_connection_set_option(RESULT_FORMAT, BINARY) = %d; "
+			"expected: 0 (err: %s)", check, sdb_strbuf_string(conn->errbuf));
+	fail_unless(conn->result_format == SDB_CONNECTION_RESULT_BINARY,
+			"sdb_connection_set_option(RESULT_FORMAT, BINARY) did not "
+			"change the format");
+	sdb_strbuf_clear(MOCK_CONN(conn)->write_buf);
+
+	conn->cmd = SDB_CONNECTION_QUERY;
+	conn->cmd_len = (uint32_t)strlen(query);
+	sdb_strbuf_memcpy(conn->buf, query, conn->cmd_len);
+	check = sdb_conn_query(conn);
+	fail_unless(check == 0,
+			"sdb_conn_query(%s) = %d; expected: 0 (err: %s)",
+			query, check, sdb_strbuf_string(conn->errbuf));
+
+	data = sdb_strbuf_string(MOCK_CONN(conn)->write_buf);
+	len = sdb_strbuf_len(MOCK_CONN(conn)->write_buf);
+
+	n = sdb_proto_unmarshal_header(data, len, &code, &msg_len);
+	data += n; len -= n;
+	fail_unless((code == SDB_CONNECTION_DATA) && (msg_len == len),
+			"sdb_conn_query(%s) returned <%u, %u>; expected: <%u, %zu>",
+			query, code, msg_len, SDB_CONNECTION_DATA, len);
+	fail_unless(len < strlen(HOST_H1),
+			"sdb_conn_query(%s) returned %zu bytes in binary format; "
+			"expected: less than JSON (%zu bytes)", query, len,
+			strlen(HOST_H1));
+
+	n = sdb_proto_unmarshal_int32(data, len, &code);
+	data += n; len -= n;
+	fail_unless(code == SDB_CONNECTION_FETCH,
+			"sdb_conn_query(%s) returned %s object; expected: FETCH",
+			query, SDB_CONN_MSGTYPE_TO_STRING((int)code));
+
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(golden_objects); ++i) {
+		sdb_proto_object_t obj;
+		const char *name = NULL;
+
+		n = sdb_proto_unmarshal_object(data, len, &obj);
+		fail_unless(n > 0,
+				"sdb_proto_unmarshal_object(<result #%zu>) = %zi; "
+				"expected: >0", i, n);
+		data += n; len -= n;
+
+		if (obj.type == SDB_HOST)
+			name = obj.data.host.name;
+		else if (obj.type == SDB_METRIC)
+			name = obj.data.metric.name;
+		else if (obj.type & SDB_ATTRIBUTE)
+			name = obj.data.attribute.key;
+		sdb_proto_free_object(&obj);
+
+		fail_unless((obj.type == golden_objects[i].type)
+				&& name && (! strcmp(name, golden_objects[i].name)),
+				"sdb_conn_query(%s) returned object #%zu = %s %s; "
+				"expected: %s %s", query, i,
+				SDB_STORE_TYPE_TO_NAME(obj.type), name,
+				SDB_STORE_TYPE_TO_NAME(golden_objects[i].type),
+				golden_objects[i].name);
+	}
+	fail_unless(len == 0,
+			"sdb_conn_query(%s) returned %zu bytes of unexpected data",
+			query, len);
+
+	mock_conn_destroy(conn);
+}
+END_TEST
+
+START_TEST(test_result_cache)
+{
+	sdb_conn_t *conn = mock_conn_create();
+	sdb_data_t datum = { SDB_TYPE_STRING, { .string = "v" } };
+
+	struct {
+		const char *query;
+		bool cached;
+		/* update h2 before executing the query */
+		bool update;
+	} golden_data[] = {
+		{ "FETCH host 'h1'",                    false, false },
+		{ "  FETCH\thost  'h1' ;",              true,  false },
+		{ "FETCH host 'h2'",                    false, false },
+		{ "LIST hosts",                         false, false },
+		{ "LIST  hosts",                        true,  false },
+		/* updates only invalidate results for the updated host */
+		{ "FETCH host 'h1'",                    true,  true  },
+		{ "FETCH host 'h2'",                    false, false },
+		{ "LIST hosts",                         false, false },
+		/* whitespace in strings, multiple statements, and comments */
+		{ "LOOKUP hosts MATCHING name = 'h1'",  false, false },
+		{ "LOOKUP hosts MATCHING name = 'h1 '", false, false },
+		{ "FETCH host 'h1'; LIST hosts",        false, false },
+		{ "FETCH host 'h1' -- comment",         false, false },
+		{ "FETCH host 'h1'",                    true,  false },
+		/* results depending on the current time are never cached */
+		{ "LOOKUP hosts MATCHING age > 60s",    false, false },
+		{ "LOOKUP hosts MATCHING age > 60s",    false, false },
+		{ "LIST hosts FILTER age < 60s",        false, false },
+		{ "LIST hosts FILTER age < 60s",        false, false },
+	};
+
+	char reply[4096];
+	size_t reply_len = 0;
+	uint64_t hits = 0, misses = 0;
+	size_t i;
+
+	fail_unless(sdb_conn_cache_configure(8) == 0,
+			"sdb_conn_cache_configure(8) = <err>; expected: 0");
+
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(golden_data); ++i) {
+		const char *query = golden_data[i].query;
+		sdb_lru_stats_t stats;
+		size_t len;
+		int check;
+
+		if (golden_data[i].update)
+			sdb_plugin_store_attribute("h2", "k1", &datum,
+					10 * SDB_INTERVAL_SECOND);
+
+		sdb_strbuf_clear(MOCK_CONN(conn)->write_buf);
+		conn->cmd = SDB_CONNECTION_QUERY;
+		conn->cmd_len = (uint32_t)strlen(query);
+		sdb_strbuf_memcpy(conn->buf, query, conn->cmd_len);
+		check = sdb_conn_query(conn);
+		fail_unless(check == 0,
+				"sdb_conn_query(%s) = %d; expected: 0 (err: %s)",
+				query, check, sdb_strbuf_string(conn->errbuf));
+
+		if (golden_data[i].cached)
+			++hits;
+		else if (! strchr(query, ';') && ! strstr(query, "--"))
+			++misses;
+
+		sdb_conn_cache_stats(&stats);
+		fail_unless((stats.hits == hits) && (stats.misses == misses),
+				"sdb_conn_query(%s) resulted in %"PRIu64" cache hits, "
+				"%"PRIu64" misses; expected: %"PRIu64", %"PRIu64,
+				query, stats.hits, stats.misses, hits, misses);
+
+		/* cached replies have to match the original ones */
+		len = sdb_strbuf_len(MOCK_CONN(conn)->write_buf);
+		if (! strcmp(query, "FETCH host 'h1'")) {
+			fail_unless(len <= sizeof(reply),
+					"sdb_conn_query(%s) returned unexpectedly large reply "
+					"(%zu bytes)", query, len);
+			if (reply_len)
+				fail_unless((len == reply_len) && (! memcmp(reply,
+								sdb_strbuf_string(MOCK_CONN(conn)->write_buf),
+								len)),
+						"sdb_conn_query(%s) returned different reply after "
+						"caching", query);
+			memcpy(reply, sdb_strbuf_string(MOCK_CONN(conn)->write_buf), len);
+			reply_len = len;
+		}
+	}
+
+	sdb_conn_cache_configure(0);
+	mock_conn_destroy(conn);
+}
+END_TEST
+
+/* time-series may be fetched concurrently */
+static pthread_mutex_t ts_lock = PTHREAD_MUTEX_INITIALIZER;
+static int ts_fetched = 0;
+
+static sdb_timeseries_info_t *
+test_describe_ts(const char __attribute__((unused)) *id,
+		sdb_object_t __attribute__((unused)) *user_data)
+{
+	const char *names[] = { "value" };
+	return sdb_timeseries_info_create(SDB_STATIC_ARRAY_LEN(names), names);
+} /* test_describe_ts */
+
+static sdb_timeseries_t *
+test_fetch_ts(const char *id, sdb_timeseries_opts_t *opts,
+		sdb_object_t __attribute__((unused)) *user_data)
+{
+	const char *names[] = { "value" };
+	sdb_timeseries_t *ts;
+
+	pthread_mutex_lock(&ts_lock);
+	++ts_fetched;
+	pthread_mutex_unlock(&ts_lock);
+
+	/* unknown time-series */
+	if (strcmp(id, "/m1") && strcmp(id, "/m2"))
+		return NULL;
+
+	ts = sdb_timeseries_create(SDB_STATIC_ARRAY_LEN(names), names, 1);
+	ck_assert(ts != NULL);
+	ts->start = opts->start;
+	ts->end = opts->end;
+	ts->timestamps[0] = opts->start;
+	ts->data[0][0] = (double)ts_fetched;
+	return ts;
+} /* test_fetch_ts */
+
+static sdb_timeseries_fetcher_t test_fetcher = {
+	test_describe_ts, test_fetch_ts,
+};
+
+START_TEST(test_timeseries_cache)
+{
+	sdb_conn_t *conn = mock_conn_create();
+	sdb_metric_store_t store = { "test", "/m1", NULL, 0 };
+
+	struct {
+		const char *query;
+		int fetched;
+	} golden_data[] = {
+		{ "TIMESERIES 'h1'.'m1' START 1970-01-01 00:01:00 "
+			"END 1970-01-01 00:02:00", 1 },
+		/* ranges are rounded down to multiples of the TTL */
+		{ "TIMESERIES 'h1'.'m1' START 1970-01-01 00:01:59 "
+			"END 1970-01-01 00:02:30", 1 },
+		{ "TIMESERIES 'h1'.'m1' START 1970-01-01 00:01:00 "
+			"END 1970-01-01 00:03:00", 2 },
+		{ "TIMESERIES 'h1'.'m1' ['value'] START 1970-01-01 00:01:00 "
+			"END 1970-01-01 00:02:00", 3 },
+		{ "TIMESERIES 'h1'.'m1' START 1970-01-01 00:01:00 "
+			"END 1970-01-01 00:02:00", 3 },
+		/* data-stores may use downsampling options as a hint */
+		{ "TIMESERIES 'h1'.'m1' START 1970-01-01 00:01:00 "
+			"END 1970-01-01 00:02:00 RESOLUTION 1 POINTS", 4 },
+	};
+
+	char reply[1024];
+	size_t reply_len = 0;
+	sdb_lru_stats_t stats;
+	size_t i;
+
+	ck_assert(sdb_plugin_register_timeseries_fetcher("test",
+				&test_fetcher, NULL) == 0);
+	store.last_update = 20 * SDB_INTERVAL_SECOND;
+	sdb_plugin_store_metric("h1", "m1", &store, 20 * SDB_INTERVAL_SECOND);
+
+	fail_unless(sdb_conn_timeseries_cache_configure(8, 0) < 0,
+			"sdb_conn_timeseries_cache_configure(8, 0) = 0; "
+			"expected: <0 (zero TTL)");
+	fail_unless(sdb_conn_timeseries_cache_configure(8,
+				SDB_INTERVAL_MINUTE) == 0,
+			"sdb_conn_timeseries_cache_configure(8, 1m) = <err>; "
+			"expected: 0");
+
+	ts_fetched = 0;
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(golden_data); ++i) {
+		const char *query = golden_data[i].query;
+		size_t len;
+		int check;
+
+		sdb_strbuf_clear(MOCK_CONN(conn)->write_buf);
+		conn->cmd = SDB_CONNECTION_QUERY;
+		conn->cmd_len = (uint32_t)strlen(query);
+		sdb_strbuf_memcpy(conn->buf, query, conn->cmd_len);
+		check = sdb_conn_query(conn);
+		fail_unless(check == 0,
+				"sdb_conn_query(%s) = %d; expected: 0 (err: %s)",
+				query, check, sdb_strbuf_string(conn->errbuf));
+		fail_unless(ts_fetched == golden_data[i].fetched,
+				"sdb_conn_query(%s) fetched %d time-series in total; "
+				"expected: %d", query, ts_fetched, golden_data[i].fetched);
+
+		/* cached replies have to match the original ones */
+		len = sdb_strbuf_len(MOCK_CONN(conn)->write_buf);
+		ck_assert(len <= sizeof(reply));
+		if (i == 1)
+			fail_unless((len == reply_len) && (! memcmp(reply,
+							sdb_strbuf_string(MOCK_CONN(conn)->write_buf),
+							len)),
+					"sdb_conn_query(%s) returned different reply after "
+					"caching", query);
+		memcpy(reply, sdb_strbuf_string(MOCK_CONN(conn)->write_buf), len);
+		reply_len = len;
+	}
+
+	sdb_conn_timeseries_cache_stats(&stats);
+	fail_unless((stats.hits == 2) && (stats.misses == 4)
+				&& (stats.size == 4),
+			"time-series cache: %"PRIu64" hits, %"PRIu64" misses, "
+			"%zu entries; expected: 2, 4, 4",
+			stats.hits, stats.misses, stats.size);
+
+	sdb_conn_timeseries_cache_configure(0, 0);
+	sdb_conn_timeseries_cache_stats(&stats);
+	fail_unless(stats.capacity == 0,
+			"sdb_conn_timeseries_cache_stats() = { capacity = %zu } "
+			"after disabling the cache; expected: 0", stats.capacity);
+	mock_conn_destroy(conn);
+}
+END_TEST
+
+START_TEST(test_timeseries_multi)
+{
+	sdb_conn_t *conn = mock_conn_create();
+	sdb_metric_store_t stores[] = {
+		{ "test", "/m1", NULL, 0 },
+		{ "test", "/m2", NULL, 0 },
+		{ "test", "/unknown", NULL, 0 },
+	};
+
+	struct {
+		const char *query;
+		int fetched;
+		const char *expected[3];
+	} golden_data[] = {
+		{ "TIMESERIES metrics MATCHING name = 'm1'", 2, {
+			"[{\"host\": \"h1\", \"metric\": \"m1\", "
+				"\"timeseries\": {\"start\": ",
+			"{\"host\": \"h2\", \"metric\": \"m1\", "
+				"\"timeseries\": null}]",
+			NULL } },
+		{ "TIMESERIES metrics MATCHING host.name = 'h1' "
+			"START 1970-01-01 00:01:00 END 1970-01-01 00:02:00 "
+			"RESOLUTION 1m", 2, {
+			"[{\"host\": \"h1\", \"metric\": \"m1\", "
+				"\"timeseries\": {\"start\": "
+				"\"1970-01-01 00:01:00 +0000\"",
+			"{\"host\": \"h1\", \"metric\": \"m2\", "
+				"\"timeseries\": {\"start\": ",
+			NULL } },
+		/* the fetched values (1 and 2) are summed up */
+		{ "TIMESERIES metrics MATCHING host.name = 'h1' "
+			"START 1970-01-01 00:01:00 END 1970-01-01 00:02:00 "
+			"AGGREGATE sum", 2, {
+			"{\"start\": \"1970-01-01 00:01:00 +0000\", "
+				"\"end\": \"1970-01-01 00:02:00 +0000\", \"data\": "
+				"{\"value\": [{\"timestamp\": \"1970-01-01 00:01:00 +0000\", "
+				"\"value\": \"3.000000\"},",
+			NULL, NULL } },
+		{ "TIMESERIES metrics MATCHING name = 'm3'", 0, {
+			"[]",
+			NULL, NULL } },
+		/* metrics without any data-store are skipped */
+		{ "TIMESERIES metrics MATCHING host.name = 'h3'", 0, {
+			"[]",
+			NULL, NULL } },
+		/* non-ASCII characters are not escaped */
+		{ "TIMESERIES metrics MATCHING name = 'm4'", 1, {
+			"[{\"host\": \"h\xc3\xa4\", \"metric\": \"m4\", "
+				"\"timeseries\": null}]",
+			NULL, NULL } },
+	};
+
+	size_t i, j, k;
+
+	ck_assert(sdb_plugin_register_timeseries_fetcher("test",
+				&test_fetcher, NULL) == 0);
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(stores); ++i)
+		stores[i].last_update = 20 * SDB_INTERVAL_SECOND;
+	sdb_plugin_store_metric("h1", "m1", &stores[0], 20 * SDB_INTERVAL_SECOND);
+	sdb_plugin_store_metric("h1", "m2", &stores[1], 20 * SDB_INTERVAL_SECOND);
+	sdb_plugin_store_metric("h2", "m1", &stores[2], 20 * SDB_INTERVAL_SECOND);
+	sdb_plugin_store_host("h3", 20 * SDB_INTERVAL_SECOND);
+	sdb_plugin_store_metric("h3", "m1", /* store */ NULL,
+			20 * SDB_INTERVAL_SECOND);
+	sdb_plugin_store_host("h\xc3\xa4", 20 * SDB_INTERVAL_SECOND);
+	sdb_plugin_store_metric("h\xc3\xa4", "m4", &stores[2],
+			20 * SDB_INTERVAL_SECOND);
+
+	/* without and with a pool of fetcher threads */
+	for (k = 0; k < 2; ++k) {
+		if (k)
+			ck_assert(sdb_conn_timeseries_workers_start(3) == 0);
+		for (i = 0; i < SDB_STATIC_ARRAY_LEN(golden_data); ++i) {
+			const char *query = golden_data[i].query;
+			const char *reply;
+			int check;
+
+			ts_fetched = 0;
+			sdb_strbuf_clear(MOCK_CONN(conn)->write_buf);
+			conn->cmd = SDB_CONNECTION_QUERY;
+			conn->cmd_len = (uint32_t)strlen(query);
+			sdb_strbuf_memcpy(conn->buf, query, conn->cmd_len);
+			check = sdb_conn_query(conn);
+			fail_unless(check == 0,
+					"sdb_conn_query(%s) = %d; expected: 0 (err: %s)",
+					query, check, sdb_strbuf_string(conn->errbuf));
+			fail_unless(ts_fetched == golden_data[i].fetched,
+					"sdb_conn_query(%s) fetched %d time-series; expected: %d",
+					query, ts_fetched, golden_data[i].fetched);
+
+			/* skip the message header and the result type */
+			ck_assert(sdb_strbuf_len(MOCK_CONN(conn)->write_buf)
+					> 3 * sizeof(uint32_t));
+			reply = sdb_strbuf_string(MOCK_CONN(conn)->write_buf)
+				+ 3 * sizeof(uint32_t);
+			for (j = 0; golden_data[i].expected[j]; ++j)
+				fail_unless(strstr(reply, golden_data[i].expected[j]) != NULL,
+						"sdb_conn_query(%s) returned '%s'; expected to "
+						"include '%s'", query, reply,
+						golden_data[i].expected[j]);
+		}
+	}
+	sdb_conn_timeseries_workers_stop();
+
+	/* queries matching too many metrics are rejected */
+	sdb_conn_timeseries_max_metrics_configure(1);
+	for (i = 0; i < 2; ++i) {
+		const char *query = i
+			? "TIMESERIES metrics MATCHING host.name = 'h1'"
+			: "TIMESERIES metrics MATCHING name = 'm2'";
+		int check;
+
+		ts_fetched = 0;
+		sdb_strbuf_clear(conn->errbuf);
+		conn->cmd = SDB_CONNECTION_QUERY;
+		conn->cmd_len = (uint32_t)strlen(query);
+		sdb_strbuf_memcpy(conn->buf, query, conn->cmd_len);
+		check = sdb_conn_query(conn);
+		fail_unless(i ? ((check < 0) && (ts_fetched == 0)
+					&& strstr(sdb_strbuf_string(conn->errbuf),
+						"more than 1 metrics"))
+				: (check == 0),
+				"sdb_conn_query(%s) = %d, fetched %d time-series "
+				"(err: %s); expected: %s", query, check, ts_fetched,
+				sdb_strbuf_string(conn->errbuf),
+				i ? "<0 (more than 1 metrics), 0" : "0");
+	}
+	sdb_conn_timeseries_max_metrics_configure(
+			SDB_CONN_TIMESERIES_MAX_METRICS_DEFAULT);
+	mock_conn_destroy(conn);
+}
+END_TEST
+
+START_TEST(test_plan_cache)
+{
+	sdb_conn_t *conn = mock_conn_create();
+
+	struct {
+		const char *query;
+		bool cached;
+	} golden_data[] = {
+		{ "LOOKUP hosts MATCHING name = 'h1'",         false },
+		{ "LOOKUP  hosts\tMATCHING name = 'h1';",      true  },
+		{ "LOOKUP hosts MATCHING name = 'h1 '",        false },
+		{ "FETCH host 'h2' FILTER age > 0s",           false },
+		{ "FETCH host 'h2' FILTER age > 0s",           true  },
+		{ "LIST hosts; LIST services",                 false },
+		{ "LIST services -- comment",                  false },
+		{ "LOOKUP hosts MATCHING name = 'h1'",         true  },
+		/* reconfiguring drops all plans */
+		{ NULL,                                        false },
+		{ "LOOKUP hosts MATCHING name = 'h1'",         false },
+		{ "LOOKUP hosts MATCHING name = 'h1'",         true  },
+	};
+
+	char reply[4096];
+	size_t reply_len = 0;
+	uint64_t hits = 0, misses = 0;
+	size_t i;
+
+	fail_unless(sdb_conn_plan_cache_configure(8) == 0,
+			"sdb_conn_plan_cache_configure(8) = <err>; expected: 0");
+
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(golden_data); ++i) {
+		const char *query = golden_data[i].query;
+		sdb_lru_stats_t stats;
+		size_t len;
+		int check;
+
+		if (! query) {
+			ck_assert(sdb_conn_plan_cache_configure(8) == 0);
+			hits = misses = 0;
+			continue;
+		}
+
+		sdb_strbuf_clear(MOCK_CONN(conn)->write_buf);
+		conn->cmd = SDB_CONNECTION_QUERY;
+		conn->cmd_len = (uint32_t)strlen(query);
+		sdb_strbuf_memcpy(conn->buf, query, conn->cmd_len);
+		check = sdb_conn_query(conn);
+		fail_unless(check == 0,
+				"sdb_conn_query(%s) = %d; expected: 0 (err: %s)",
+				query, check, sdb_strbuf_string(conn->errbuf));
+
+		if (golden_data[i].cached)
+			++hits;
+		else if (! strchr(query, ';') && ! strstr(query, "--"))
+			++misses;
+
+		sdb_conn_plan_cache_stats(&stats);
+		fail_unless((stats.hits == hits) && (stats.misses == misses),
+				"sdb_conn_query(%s) resulted in %"PRIu64" plan cache hits, "
+				"%"PRIu64" misses; expected: %"PRIu64", %"PRIu64,
+				query, stats.hits, stats.misses, hits, misses);
+
+		/* cached plans have to produce the same replies */
+		len = sdb_strbuf_len(MOCK_CONN(conn)->write_buf);
+		if (! strcmp(query, "LOOKUP hosts MATCHING name = 'h1'")) {
+			ck_assert(len <= sizeof(reply));
+			if (reply_len)
+				fail_unless((len == reply_len) && (! memcmp(reply,
+								sdb_strbuf_string(MOCK_CONN(conn)->write_buf),
+								len)),
+						"sdb_conn_query(%s) returned different reply when "
+						"using a cached plan", query);
+			memcpy(reply, sdb_strbuf_string(MOCK_CONN(conn)->write_buf), len);
+			reply_len = len;
+		}
+	}
+
+	/* queries using parameters are rejected and never cached */
+	for (i = 0; i < 2; ++i) {
+		const char *query = "LOOKUP hosts MATCHING name = $1";
+		sdb_lru_stats_t stats;
+		int check;
+
+		sdb_strbuf_clear(conn->errbuf);
+		conn->cmd = SDB_CONNECTION_QUERY;
+		conn->cmd_len = (uint32_t)strlen(query);
+		sdb_strbuf_memcpy(conn->buf, query, conn->cmd_len);
+		check = sdb_conn_query(conn);
+		fail_unless((check < 0) && strstr(sdb_strbuf_string(conn->errbuf),
+					"prepared statements"),
+				"sdb_conn_query(%s) = %d (err: %s); expected: <0 "
+				"(parameters not supported)", query, check,
+				sdb_strbuf_string(conn->errbuf));
+
+		sdb_conn_plan_cache_stats(&stats);
+		fail_unless(stats.hits == hits,
+				"sdb_conn_query(%s) resulted in %"PRIu64" plan cache hits; "
+				"expected: %"PRIu64, query, stats.hits, hits);
+	}
+
+	sdb_conn_plan_cache_configure(0);
+	mock_conn_destroy(conn);
+}
+END_TEST
+
+static int
+send_cmd(sdb_conn_t *conn, uint32_t cmd, const char *buf, size_t len)
+{
+	sdb_strbuf_clear(MOCK_CONN(conn)->write_buf);
+	sdb_strbuf_clear(conn->buf);
+	sdb_strbuf_clear(conn->errbuf);
+	conn->cmd = cmd;
+	conn->cmd_len = (uint32_t)len;
+	sdb_strbuf_memcpy(conn->buf, buf, len);
+
+	if (cmd == SDB_CONNECTION_QUERY)
+		return sdb_conn_query(conn);
+	else if (cmd == SDB_CONNECTION_PREPARE)
+		return sdb_conn_prepare(conn);
+	else if (cmd == SDB_CONNECTION_WATCH)
+		return sdb_conn_watch(conn);
+	return sdb_conn_execute(conn);
+} /* send_cmd */
+
+static int
+prepare(sdb_conn_t *conn, uint32_t id, const char *query)
+{
+	char buf[1024];
+	size_t len = strlen(query);
+
+	ck_assert(len + sizeof(id) <= sizeof(buf));
+	sdb_proto_marshal_int32(buf, sizeof(buf), id);
+	memcpy(buf + sizeof(id), query, len);
+	return send_cmd(conn, SDB_CONNECTION_PREPARE, buf, len + sizeof(id));
+} /* prepare */
+
+static int
+watch(sdb_conn_t *conn, uint32_t id, const char *query)
+{
+	char buf[1024];
+	size_t len = strlen(query);
+
+	ck_assert(len + sizeof(id) <= sizeof(buf));
+	sdb_proto_marshal_int32(buf, sizeof(buf), id);
+	memcpy(buf + sizeof(id), query, len);
+	return send_cmd(conn, SDB_CONNECTION_WATCH, buf, len + sizeof(id));
+} /* watch */
+
+static int
+execute(sdb_conn_t *conn, uint32_t id,
+		const sdb_data_t *params, uint32_t params_num)
+{
+	char buf[1024];
+	size_t len = 0;
+	uint32_t i;
+
+	len += sdb_proto_marshal_int32(buf + len, sizeof(buf) - len, id);
+	len += sdb_proto_marshal_int32(buf + len, sizeof(buf) - len, params_num);
+	for (i = 0; i < params_num; ++i) {
+		ssize_t n = sdb_proto_marshal_data(buf + len, sizeof(buf) - len,
+				&params[i]);
+		ck_assert((n > 0) && (len + (size_t)n <= sizeof(buf)));
+		len += (size_t)n;
+	}
+	return send_cmd(conn, SDB_CONNECTION_EXECUTE, buf, len);
+} /* execute */
+
+START_TEST(test_prepared)
+{
+	sdb_conn_t *conn = mock_conn_create();
+	sdb_data_t params[] = {
+		{ SDB_TYPE_STRING, { .string = "h1" } },
+		{ SDB_TYPE_STRING, { .string = "h2" } },
+		{ SDB_TYPE_INTEGER, { .integer = 42 } },
+	};
+
+	struct {
+		const char *prepared;
+		const sdb_data_t *params;
+		uint32_t params_num;
+		/* equivalent query; NULL if execution is expected to fail */
+		const char *query;
+	} golden_data[] = {
+		{ "LOOKUP hosts MATCHING name = $1", params, 1,
+			"LOOKUP hosts MATCHING name = 'h1'" },
+		{ "LOOKUP hosts MATCHING name = $1", params + 1, 1,
+			"LOOKUP hosts MATCHING name = 'h2'" },
+		{ "LOOKUP hosts MATCHING name = $1 OR name = $2", params, 2,
+			"LOOKUP hosts MATCHING name = 'h1' OR name = 'h2'" },
+		{ "LOOKUP hosts MATCHING name = $2", params, 2,
+			"LOOKUP hosts MATCHING name = 'h2'" },
+		{ "LOOKUP metrics MATCHING attribute['k3'] = $1", params + 2, 1,
+			"LOOKUP metrics MATCHING attribute['k3'] = 42" },
+		{ "LOOKUP services MATCHING name =~ $1", params + 1, 1,
+			"LOOKUP services MATCHING name =~ 'h2'" },
+		{ "FETCH host 'h1' FILTER name = $1", params, 1,
+			"FETCH host 'h1' FILTER name = 'h1'" },
+		{ "LIST hosts", NULL, 0, "LIST hosts" },
+		/* wrong number of parameters */
+		{ "LOOKUP hosts MATCHING name = $1", NULL, 0, NULL },
+		{ "LOOKUP hosts MATCHING name = $1", params, 2, NULL },
+		{ "LOOKUP hosts MATCHING name = $2", params, 1, NULL },
+		{ "LIST hosts", params, 1, NULL },
+	};
+
+	char reply[4096];
+	size_t i;
+
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(golden_data); ++i) {
+		const char *query = golden_data[i].query;
+		size_t reply_len = 0;
+		int check;
+
+		if (query) {
+			check = send_cmd(conn, SDB_CONNECTION_QUERY, query, strlen(query));
+			fail_unless(check == 0,
+					"sdb_conn_query(%s) = %d; expected: 0 (err: %s)",
+					query, check, sdb_strbuf_string(conn->errbuf));
+			reply_len = sdb_strbuf_len(MOCK_CONN(conn)->write_buf);
+			ck_assert(reply_len <= sizeof(reply));
+			memcpy(reply, sdb_strbuf_string(MOCK_CONN(conn)->write_buf),
+					reply_len);
+		}
+
+		check = prepare(conn, (uint32_t)i, golden_data[i].prepared);
+		fail_unless(check == 0,
+				"sdb_conn_prepare(%s) = %d; expected: 0 (err: %s)",
+				golden_data[i].prepared, check,
+				sdb_strbuf_string(conn->errbuf));
+
+		/* execute twice to make sure that parameters can be rebound */
+		check = execute(conn, (uint32_t)i,
+				golden_data[i].params, golden_data[i].params_num);
+		if (check == 0)
+			check = execute(conn, (uint32_t)i,
+					golden_data[i].params, golden_data[i].params_num);
+		if (! query) {
+			fail_unless(check < 0,
+					"sdb_conn_execute(%s, %u params) = %d; expected: <0",
+					golden_data[i].prepared, golden_data[i].params_num, check);
+			continue;
+		}
+		fail_unless(check == 0,
+				"sdb_conn_execute(%s, %u params) = %d; expected: 0 (err: %s)",
+				golden_data[i].prepared, golden_data[i].params_num, check,
+				sdb_strbuf_string(conn->errbuf));
+		fail_unless((sdb_strbuf_len(MOCK_CONN(conn)->write_buf) == reply_len)
+				&& (! memcmp(sdb_strbuf_string(MOCK_CONN(conn)->write_buf),
+						reply, reply_len)),
+				"sdb_conn_execute(%s) returned reply different from the "
+				"reply to '%s'", golden_data[i].prepared, query);
+	}
+
+	/* statements are replaced and discarded by identifier */
+	ck_assert(prepare(conn, 0, "LOOKUP hosts MATCHING name = $1") == 0);
+	ck_assert(execute(conn, 0, params, 1) == 0);
+	ck_assert(send_cmd(conn, SDB_CONNECTION_PREPARE, "\0\0\0\0", 4) == 0);
+	ck_assert(execute(conn, 0, params, 1) < 0);
+	ck_assert(send_cmd(conn, SDB_CONNECTION_PREPARE, "\0\0\0\0", 4) < 0);
+
+	/* invalid statements */
+	ck_assert(prepare(conn, 0, "LIST hosts; LIST services") < 0);
+	ck_assert(prepare(conn, 0, "STORE host 'h3'") < 0);
+	ck_assert(prepare(conn, 0, "LOOKUP hosts MATCHING name = $0") < 0);
+
+	/* placeholders require binding values */
+	ck_assert(send_cmd(conn, SDB_CONNECTION_QUERY,
+				"LIST hosts FILTER name = $1", 27) < 0);
+
+	mock_conn_destroy(conn);
+}
+END_TEST
+
+START_TEST(test_watch)
+{
+	sdb_conn_t *conn = mock_conn_create();
+	sdb_data_t datum = { SDB_TYPE_STRING, { .string = "v" } };
+
+	struct {
+		uint32_t id;
+		int type;
+		const char *name;
+		sdb_time_t last_update;
+	} golden_events[] = {
+		/* updates of the same object are coalesced */
+		{ 1, SDB_HOST | SDB_ATTRIBUTE, "k1", 30 * SDB_INTERVAL_SECOND },
+		/* services are stored along with their 'hostname' attribute */
+		{ 2, SDB_SERVICE, "s3", 10 * SDB_INTERVAL_SECOND },
+		{ 2, SDB_SERVICE | SDB_ATTRIBUTE, "hostname",
+			10 * SDB_INTERVAL_SECOND },
+	};
+
+	uint32_t code = UINT32_MAX, msg_len = UINT32_MAX, id;
+	const char *data;
+	size_t len, i;
+	int fds[2];
+	char c;
+	ssize_t n;
+	int check;
+
+	ck_assert(pipe(fds) == 0);
+	ck_assert(fcntl(fds[0], F_SETFL, O_NONBLOCK) == 0);
+	/* like the trigger pipe of the frontend */
+	ck_assert(fcntl(fds[1], F_SETFL, O_NONBLOCK) == 0);
+	conn->notify_fd = fds[1];
+
+	check = watch(conn, 1, "LOOKUP hosts MATCHING name = 'h1'");
+	fail_unless(check == 0,
+			"sdb_conn_watch(LOOKUP hosts) = %d; expected: 0 (err: %s)",
+			check, sdb_strbuf_string(conn->errbuf));
+	fail_unless(sdb_strbuf_len(MOCK_CONN(conn)->write_buf) == 8,
+			"sdb_conn_watch() sent %zu bytes; expected: 8 (OK reply)",
+			sdb_strbuf_len(MOCK_CONN(conn)->write_buf));
+	check = watch(conn, 2, "LOOKUP services FILTER last_update > 5s");
+	fail_unless(check == 0,
+			"sdb_conn_watch(LOOKUP services) = %d; expected: 0 (err: %s)",
+			check, sdb_strbuf_string(conn->errbuf));
+	sdb_strbuf_clear(MOCK_CONN(conn)->write_buf);
+
+	fail_unless(! sdb_conn_watch_pending(conn),
+			"sdb_conn_watch_pending() = true before any updates");
+
+	sdb_plugin_store_host("h1", 10 * SDB_INTERVAL_SECOND);
+	sdb_plugin_store_host("h2", 10 * SDB_INTERVAL_SECOND);
+	sdb_plugin_store_service("h2", "s3", 10 * SDB_INTERVAL_SECOND);
+	sdb_plugin_store_service("h2", "s4", 1 * SDB_INTERVAL_SECOND);
+	sdb_plugin_store_metric("h1", "m3", NULL, 10 * SDB_INTERVAL_SECOND);
+	sdb_plugin_store_host("h1", 20 * SDB_INTERVAL_SECOND);
+	datum.data.string = "v0";
+	sdb_plugin_store_attribute("h1", "k1", &datum, 25 * SDB_INTERVAL_SECOND);
+	datum.data.string = "v";
+	sdb_plugin_store_attribute("h1", "k1", &datum, 30 * SDB_INTERVAL_SECOND);
+
+	fail_unless(sdb_conn_watch_pending(conn),
+			"sdb_conn_watch_pending() = false after updates");
+	fail_unless(read(fds[0], &c, 1) == 1,
+			"queuing events did not notify the connection handler");
+	while (read(fds[0], &c, 1) == 1)
+		/* drain the pipe */;
+
+	check = sdb_conn_watch_flush(conn);
+	fail_unless(check == (int)SDB_STATIC_ARRAY_LEN(golden_events),
+			"sdb_conn_watch_flush() = %d; expected: %zu",
+			check, SDB_STATIC_ARRAY_LEN(golden_events));
+	fail_unless(! sdb_conn_watch_pending(conn),
+			"sdb_conn_watch_pending() = true after flushing events");
+
+	data = sdb_strbuf_string(MOCK_CONN(conn)->write_buf);
+	len = sdb_strbuf_len(MOCK_CONN(conn)->write_buf);
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(golden_events); ++i) {
+		sdb_proto_object_t obj;
+		const char *name = NULL;
+		sdb_time_t last_update = 0;
+
+		n = sdb_proto_unmarshal_header(data, len, &code, &msg_len);
+		fail_unless((n > 0) && (code == SDB_CONNECTION_EVENT),
+				"event #%zu: got message code %u; expected: %u",
+				i, code, SDB_CONNECTION_EVENT);
+		data += n; len -= n;
+		ck_assert(msg_len <= len);
+
+		n = sdb_proto_unmarshal_int32(data, msg_len, &id);
+		ck_assert(n > 0);
+		n += sdb_proto_unmarshal_object(data + n, msg_len - n, &obj);
+		fail_unless((size_t)n == msg_len,
+				"event #%zu: failed to decode object (%zi of %u bytes)",
+				i, n, msg_len);
+		data += msg_len; len -= msg_len;
+
+		if (obj.type == SDB_HOST) {
+			name = obj.data.host.name;
+			last_update = obj.data.host.last_update;
+		}
+		else if (obj.type == SDB_SERVICE) {
+			name = obj.data.service.name;
+			last_update = obj.data.service.last_update;
+		}
+		else if (obj.type & SDB_ATTRIBUTE) {
+			name = obj.data.attribute.key;
+			last_update = obj.data.attribute.last_update;
+		}
+		sdb_proto_free_object(&obj);
+
+		fail_unless((id == golden_events[i].id)
+				&& (obj.type == golden_events[i].type)
+				&& name && (! strcmp(name, golden_events[i].name))
+				&& (last_update == golden_events[i].last_update),
+				"event #%zu = <%u, %s %s, %"PRIsdbTIME">; "
+				"expected: <%u, %s %s, %"PRIsdbTIME">", i, id,
+				SDB_STORE_TYPE_TO_NAME(obj.type), name, last_update,
+				golden_events[i].id,
+				SDB_STORE_TYPE_TO_NAME(golden_events[i].type),
+				golden_events[i].name, golden_events[i].last_update);
+	}
+	fail_unless(len == 0,
+			"sdb_conn_watch_flush() sent %zu bytes of unexpected data", len);
+
+	/* updates of the timestamp only are not reported */
+	sdb_plugin_store_host("h1", 50 * SDB_INTERVAL_SECOND);
+	sdb_plugin_store_attribute("h1", "k1", &datum, 50 * SDB_INTERVAL_SECOND);
+	sdb_plugin_store_service("h2", "s3", 50 * SDB_INTERVAL_SECOND);
+	fail_unless(! sdb_conn_watch_pending(conn),
+			"re-storing unchanged objects queued an event");
+
+	/* events are signaled even if others are pending already */
+	while (read(fds[0], &c, 1) == 1)
+		/* drain the pipe */;
+	sdb_plugin_store_service("h1", "s5", 10 * SDB_INTERVAL_SECOND);
+	fail_unless(read(fds[0], &c, 1) == 1,
+			"queuing events did not notify the connection handler");
+	sdb_plugin_store_service("h1", "s6", 10 * SDB_INTERVAL_SECOND);
+	fail_unless(read(fds[0], &c, 1) == 1,
+			"queuing events did not notify the connection handler "
+			"while other events were pending");
+	check = sdb_conn_watch_flush(conn);
+	fail_unless(check >= 2,
+			"sdb_conn_watch_flush() = %d; expected: >=2", check);
+
+	/* slow clients lose the oldest events */
+	sdb_strbuf_clear(MOCK_CONN(conn)->write_buf);
+	for (i = 0; i < 1030; ++i) {
+		char name[32];
+		snprintf(name, sizeof(name), "h1-%zu", i);
+		sdb_plugin_store_service("h1", name, 10 * SDB_INTERVAL_SECOND);
+	}
+	check = sdb_conn_watch_flush(conn);
+	fail_unless(check == 1024,
+			"sdb_conn_watch_flush() = %d; expected: 1024", check);
+	data = sdb_strbuf_string(MOCK_CONN(conn)->write_buf);
+	len = sdb_strbuf_len(MOCK_CONN(conn)->write_buf);
+	sdb_proto_unmarshal_header(data, len, &code, &msg_len);
+	fail_unless((code == SDB_CONNECTION_LOG)
+			&& strstr(data + 12, "dropped 1036 events"),
+			"sdb_conn_watch_flush() did not report dropped events");
+
+	/* subscriptions are canceled by identifier */
+	ck_assert(send_cmd(conn, SDB_CONNECTION_WATCH, "\0\0\0\1", 4) == 0);
+	ck_assert(send_cmd(conn, SDB_CONNECTION_WATCH, "\0\0\0\1", 4) < 0);
+	sdb_plugin_store_attribute("h1", "k9", &datum, 60 * SDB_INTERVAL_SECOND);
+	fail_unless(! sdb_conn_watch_pending(conn),
+			"canceled subscription queued an event");
+
+	/* invalid subscriptions */
+	ck_assert(watch(conn, 3, "LIST hosts") < 0);
+	ck_assert(watch(conn, 3, "LOOKUP hosts MATCHING name = $1") < 0);
+	ck_assert(watch(conn, 3, "LOOKUP hosts; LOOKUP services") < 0);
+
+	mock_conn_destroy(conn);
+	close(fds[0]);
+	close(fds[1]);
+}
+END_TEST
+
+START_TEST(test_replicate)
+{
+	sdb_conn_t *conn = mock_conn_create();
+	sdb_memstore_t *store, *replica;
+	sdb_memstore_obj_t *obj, *svc;
+	uint32_t code = UINT32_MAX, msg_len = UINT32_MAX;
+	uint64_t id, seq, pos = 0;
+	const char *data;
+	size_t len;
+	int fds[2];
+	char c;
+	int check;
+
+	ck_assert(pipe(fds) == 0);
+	ck_assert(fcntl(fds[0], F_SETFL, O_NONBLOCK) == 0);
+	conn->notify_fd = fds[1];
+
+	/* the test reader does not record a replication stream */
+	conn->cmd = SDB_CONNECTION_REPLICATE;
+	conn->cmd_len = 0;
+	check = sdb_conn_replicate(conn);
+	fail_unless(check < 0,
+			"sdb_conn_replicate(<replication disabled>) = %d; expected: <0",
+			check);
+
+	sdb_plugin_unregister_all();
+	store = sdb_memstore_create();
+	ck_assert(store != NULL);
+	ck_assert(sdb_memstore_enable_replication(store, 1024 * 1024) == 0);
+	ck_assert(sdb_plugin_register_writer("test-writer",
+				&sdb_memstore_writer, SDB_OBJ(store)) == 0);
+	ck_assert(sdb_plugin_register_reader("test-reader",
+				&sdb_memstore_reader, SDB_OBJ(store)) == 0);
+	sdb_object_deref(SDB_OBJ(store));
+	sdb_plugin_store_host("h1", 1 * SDB_INTERVAL_SECOND);
+	sdb_plugin_store_service("h1", "s1", 1 * SDB_INTERVAL_SECOND);
+
+	/* invalid position */
+	sdb_strbuf_clear(conn->buf);
+	sdb_strbuf_memcpy(conn->buf, "\0\0\0\1", 4);
+	conn->cmd_len = 4;
+	ck_assert(sdb_conn_replicate(conn) < 0);
+
+	/* a new replica receives a full copy first */
+	sdb_strbuf_clear(MOCK_CONN(conn)->write_buf);
+	conn->cmd_len = 0;
+	check = sdb_conn_replicate(conn);
+	data = sdb_strbuf_string(MOCK_CONN(conn)->write_buf);
+	len = sdb_strbuf_len(MOCK_CONN(conn)->write_buf);
+	sdb_proto_unmarshal_header(data, len, &code, &msg_len);
+	fail_unless((check == 0) && (code == SDB_CONNECTION_OK),
+			"sdb_conn_replicate() = %d, sent %s; expected: 0, OK",
+			check, SDB_CONN_MSGTYPE_TO_STRING(code));
+	fail_unless(sdb_conn_replicate_pending(conn),
+			"sdb_conn_replicate_pending(<new replica>) = false; "
+			"expected: true");
+
+	replica = sdb_memstore_create();
+	ck_assert(replica != NULL);
+
+	sdb_strbuf_clear(MOCK_CONN(conn)->write_buf);
+	check = sdb_conn_replicate_flush(conn);
+	data = sdb_strbuf_string(MOCK_CONN(conn)->write_buf);
+	len = sdb_strbuf_len(MOCK_CONN(conn)->write_buf);
+	sdb_proto_unmarshal_header(data, len, &code, &msg_len);
+	fail_unless((check == 1) && (code == SDB_CONNECTION_REPLICATION)
+				&& (len == msg_len + 8) && (msg_len > 16),
+			"sdb_conn_replicate_flush(<new replica>) = %d, sent %s "
+			"(%zu bytes); expected: 1, REPLICATION", check,
+			code == SDB_CONNECTION_REPLICATION ? "REPLICATION" : "other",
+			len);
+	id = conn->repl_pos.id;
+	seq = conn->repl_pos.seq;
+	check = sdb_memstore_apply_replication(replica,
+			data + 24, msg_len - 16, &pos);
+	/* host, service, the service's 'hostname' attribute, and the marker */
+	fail_unless((id != 0) && (check == 4),
+			"sdb_memstore_apply_replication(<full copy>) = %d; "
+			"expected: 4", check);
+	obj = sdb_memstore_get_host(replica, "h1");
+	ck_assert(obj != NULL);
+	svc = sdb_memstore_get_child(obj, SDB_SERVICE, "s1");
+	fail_unless(svc != NULL,
+			"replicated host h1 is missing service s1");
+	sdb_object_deref(SDB_OBJ(svc));
+	sdb_object_deref(SDB_OBJ(obj));
+
+	/* new entries wake up the main loop */
+	fail_unless(! sdb_conn_replicate_pending(conn),
+			"sdb_conn_replicate_pending(<up-to-date>) = true; "
+			"expected: false");
+	sdb_plugin_store_host("h2", 2 * SDB_INTERVAL_SECOND);
+	fail_unless(read(fds[0], &c, 1) == 1,
+			"sdb_conn_replicate_pending() did not register for "
+			"notifications");
+	ck_assert(sdb_conn_replicate_pending(conn));
+
+	sdb_strbuf_clear(MOCK_CONN(conn)->write_buf);
+	check = sdb_conn_replicate_flush(conn);
+	data = sdb_strbuf_string(MOCK_CONN(conn)->write_buf);
+	len = sdb_strbuf_len(MOCK_CONN(conn)->write_buf);
+	sdb_proto_unmarshal_header(data, len, &code, &msg_len);
+	fail_unless((check == 1) && (code == SDB_CONNECTION_REPLICATION)
+				&& (conn->repl_pos.id == id)
+				&& (conn->repl_pos.seq == seq + 1),
+			"sdb_conn_replicate_flush(<new entry>) = %d (seq=%"PRIu64"); "
+			"expected: 1 (seq=%"PRIu64")", check, conn->repl_pos.seq,
+			seq + 1);
+	check = sdb_memstore_apply_replication(replica,
+			data + 24, msg_len - 16, &pos);
+	fail_unless((check == 1) && (pos == seq + 1),
+			"sdb_memstore_apply_replication(<delta>) = %d (seq=%"PRIu64"); "
+			"expected: 1 (seq=%"PRIu64")", check, pos, seq + 1);
+	obj = sdb_memstore_get_host(replica, "h2");
+	fail_unless(obj != NULL, "replicated store is missing host h2");
+	sdb_object_deref(SDB_OBJ(obj));
+
+	sdb_object_deref(SDB_OBJ(replica));
+	mock_conn_destroy(conn);
+	close(fds[0]);
+	close(fds[1]);
+}
+END_TEST
+
+START_TEST(test_store_batch)
+{
+	sdb_conn_t *conn = mock_conn_create();
+	/* host, service of an unknown host, host */
+	const char batch[] =
+		"\0\0\0\x0f""\0\0\0\1""\0\0\0\0\xd6\x93\xa4\0""hA\0"
+		"\0\0\0\x12""\0\0\0\2""\0\0\0\0\xd6\x93\xa4\0""x1\0sA\0"
+		"\0\0\0\x0f""\0\0\0\1""\0\0\0\0\xd6\x93\xa4\0""hB\0";
+	const char *query = "FETCH host 'hB'";
+	uint32_t code = UINT32_MAX, msg_len = UINT32_MAX;
+	const char *err;
+	int check;
+
+	conn->cmd = SDB_CONNECTION_STORE_BATCH;
+	conn->cmd_len = sizeof(batch) - 1;
+	sdb_strbuf_memcpy(conn->buf, batch, conn->cmd_len);
+	check = sdb_conn_store_batch(conn);
+	err = sdb_strbuf_string(conn->errbuf);
+	fail_unless((check < 0)
+				&& (! strncmp(err, "STORE_BATCH: Failed to store 1 of 3 "
+						"objects; record 2: ", 53)),
+			"sdb_conn_store_batch(<invalid record>) = %d (err: %s); "
+			"expected: <0 (Failed to store 1 of 3 objects; record 2: ...)",
+			check, err);
+
+	/* records following the failed one have been stored */
+	sdb_strbuf_clear(MOCK_CONN(conn)->write_buf);
+	conn->cmd = SDB_CONNECTION_QUERY;
+	conn->cmd_len = (uint32_t)strlen(query);
+	sdb_strbuf_memcpy(conn->buf, query, conn->cmd_len);
+	check = sdb_conn_query(conn);
+	sdb_proto_unmarshal_header(SDB_STRBUF_STR(MOCK_CONN(conn)->write_buf),
+			&code, &msg_len);
+	fail_unless((check == 0) && (code == SDB_CONNECTION_DATA),
+			"FETCH host 'hB' after partially failed batch = %d (%s); "
+			"expected: 0 (DATA)", check, SDB_CONN_MSGTYPE_TO_STRING(code));
+	mock_conn_destroy(conn);
+}
+END_TEST
+
+static uint64_t
+unmarshal_int64(const char *buf)
+{
+	uint32_t hi = 0, lo = 0;
+
+	sdb_proto_unmarshal_int32(buf, sizeof(uint32_t), &hi);
+	sdb_proto_unmarshal_int32(buf + sizeof(uint32_t), sizeof(uint32_t), &lo);
+	return ((uint64_t)hi << 32) | lo;
+} /* unmarshal_int64 */
+
+START_TEST(test_replicate_copy)
+{
+	sdb_conn_t *conn = mock_conn_create();
+	sdb_memstore_t *store, *replica;
+	sdb_memstore_obj_t *obj;
+	char value[8192];
+	uint64_t pos = 0;
+	const char *data;
+	size_t len, msgs = 0, i;
+	int check, n;
+
+	sdb_plugin_unregister_all();
+	store = sdb_memstore_create();
+	ck_assert(store != NULL);
+	ck_assert(sdb_memstore_enable_replication(store, 1024 * 1024) == 0);
+	ck_assert(sdb_plugin_register_writer("test-writer",
+				&sdb_memstore_writer, SDB_OBJ(store)) == 0);
+	ck_assert(sdb_plugin_register_reader("test-reader",
+				&sdb_memstore_reader, SDB_OBJ(store)) == 0);
+	sdb_object_deref(SDB_OBJ(store));
+
+	/* about 2.5MB worth of data */
+	memset(value, 'x', sizeof(value) - 1);
+	value[sizeof(value) - 1] = '\0';
+	for (i = 0; i < 300; ++i) {
+		char name[32];
+		snprintf(name, sizeof(name), "h%zu", i);
+		sdb_plugin_store_host(name, 1 * SDB_INTERVAL_SECOND);
+		sdb_plugin_store_attribute(name, "k", &(sdb_data_t){
+					SDB_TYPE_STRING, { .string = value } },
+				1 * SDB_INTERVAL_SECOND);
+	}
+
+	conn->cmd = SDB_CONNECTION_REPLICATE;
+	conn->cmd_len = 0;
+	ck_assert(sdb_conn_replicate(conn) == 0);
+
+	sdb_strbuf_clear(MOCK_CONN(conn)->write_buf);
+	n = sdb_conn_replicate_flush(conn);
+
+	replica = sdb_memstore_create();
+	ck_assert(replica != NULL);
+
+	/* the copy is read and sent in multiple parts of about 1MB; only the
+	 * last one carries the position */
+	data = sdb_strbuf_string(MOCK_CONN(conn)->write_buf);
+	len = sdb_strbuf_len(MOCK_CONN(conn)->write_buf);
+	while (len > 0) {
+		uint32_t code = UINT32_MAX, msg_len = UINT32_MAX;
+		uint64_t id, seq;
+
+		sdb_proto_unmarshal_header(data, len, &code, &msg_len);
+		fail_unless((code == SDB_CONNECTION_REPLICATION)
+					&& (len >= msg_len + 8) && (msg_len > 16)
+					&& (msg_len <= 1024 * 1024 + 16 + sizeof(value)),
+				"sdb_conn_replicate_flush(<large store>) sent message of "
+				"type %u (%u bytes); expected: REPLICATION (<= 1MB)",
+				code, msg_len);
+		id = unmarshal_int64(data + 8);
+		seq = unmarshal_int64(data + 16);
+		fail_unless((msg_len + 8 == len) ? (id == conn->repl_pos.id)
+					&& (seq == conn->repl_pos.seq) && id : (! id) && (! seq),
+				"sdb_conn_replicate_flush(<large store>) message %zu "
+				"carries position %"PRIu64"/%"PRIu64, msgs, id, seq);
+
+		check = sdb_memstore_apply_replication(replica,
+				data + 24, msg_len - 16, &pos);
+		fail_unless(check > 0,
+				"sdb_memstore_apply_replication(<chunk %zu>) = %d; "
+				"expected: >0", msgs, check);
+
+		data += msg_len + 8;
+		len -= msg_len + 8;
+		++msgs;
+	}
+	fail_unless((msgs >= 3) && (n == (int)msgs),
+			"sdb_conn_replicate_flush(<large store>) = %d, sent %zu "
+			"messages; expected: >= 3", n, msgs);
+	fail_unless((! conn->repl_pos.copying) && (! conn->repl_pos.copy_key)
+				&& (! sdb_conn_replicate_pending(conn)),
+			"sdb_conn_replicate_flush(<large store>) did not complete "
+			"the copy");
+	fail_unless(pos == conn->repl_pos.seq,
+			"end-of-copy marker carried position %"PRIu64"; "
+			"expected: %"PRIu64, pos, conn->repl_pos.seq);
+
+	for (i = 0; i < 300; ++i) {
+		char name[32];
+		snprintf(name, sizeof(name), "h%zu", i);
+		obj = sdb_memstore_get_host(replica, name);
+		fail_unless(obj != NULL, "replicated store is missing host %s", name);
+		sdb_object_deref(SDB_OBJ(obj));
+	}
+
+	sdb_object_deref(SDB_OBJ(replica));
+	mock_conn_destroy(conn);
+}
+END_TEST
+
 TEST_MAIN("frontend::query")
 {
 	TCase *tc = tcase_create("core");
 	tcase_add_checked_fixture(tc, populate, turndown);
 	TC_ADD_LOOP_TEST(tc, query);
+	tcase_add_test(tc, test_multi_statement);
+	tcase_add_test(tc, test_binary_format);
+	tcase_add_test(tc, test_result_cache);
+	tcase_add_test(tc, test_plan_cache);
+	tcase_add_test(tc, test_timeseries_cache);
+	tcase_add_test(tc, test_timeseries_multi);
+	tcase_add_test(tc, test_prepared);
+	tcase_add_test(tc, test_watch);
+	tcase_add_test(tc, test_replicate);
+	tcase_add_test(tc, test_replicate_copy);
+	tcase_add_test(tc, test_store_batch);
 	ADD_TCASE(tc);
 }
 TEST_MAIN_END
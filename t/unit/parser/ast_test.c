@@ -68,10 +68,57 @@ START_TEST(test_init)
 }
 END_TEST
 
+START_TEST(test_params_num)
+{
+	struct {
+		const char *query;
+		int expected;
+	} golden_data[] = {
+		{ "LIST hosts", 0 },
+		{ "LOOKUP hosts MATCHING name = $1", 1 },
+		{ "LOOKUP hosts MATCHING name = $2", 2 },
+		{ "LOOKUP hosts MATCHING name = $1 OR name = $3", 3 },
+		{ "LOOKUP hosts MATCHING ANY service.name = $2 FILTER age > $1", 2 },
+		{ "LOOKUP services MATCHING name = 's' FILTER attribute['a'] = $4", 4 },
+		{ "FETCH host 'h1' FILTER name = $1", 1 },
+		{ "LIST services FILTER NOT (age < $2)", 2 },
+		{ "STORE host 'h1'", 0 },
+	};
+	size_t i;
+
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(golden_data); ++i) {
+		sdb_strbuf_t *errbuf = sdb_strbuf_create(64);
+		sdb_llist_t *parsetree;
+		sdb_ast_node_t *ast;
+		int check;
+
+		parsetree = sdb_parser_parse(golden_data[i].query, -1, errbuf);
+		fail_unless(parsetree && (sdb_llist_len(parsetree) == 1),
+				"sdb_parser_parse(%s) failed: %s",
+				golden_data[i].query, sdb_strbuf_string(errbuf));
+		ast = SDB_AST_NODE(sdb_llist_get(parsetree, 0));
+
+		check = sdb_ast_params_num(ast);
+		fail_unless(check == golden_data[i].expected,
+				"sdb_ast_params_num(%s) = %d; expected: %d",
+				golden_data[i].query, check, golden_data[i].expected);
+
+		sdb_object_deref(SDB_OBJ(ast));
+		sdb_llist_destroy(parsetree);
+		sdb_strbuf_destroy(errbuf);
+	}
+
+	fail_unless(sdb_ast_params_num(NULL) == 0,
+			"sdb_ast_params_num(NULL) = %d; expected: 0",
+			sdb_ast_params_num(NULL));
+}
+END_TEST
+
 TEST_MAIN("parser::ast")
 {
 	TCase *tc = tcase_create("core");
 	tcase_add_test(tc, test_init);
+	tcase_add_test(tc, test_params_num);
 	ADD_TCASE(tc);
 }
 TEST_MAIN_END
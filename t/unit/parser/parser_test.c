@@ -76,6 +76,20 @@ struct {
 	{ "LIST metrics",          -1,  1, SDB_AST_TYPE_LIST, SDB_METRIC },
 	{ "LIST metrics FILTER "
 	  "age > 60s",             -1,  1, SDB_AST_TYPE_LIST, SDB_METRIC },
+	{ "LIST hosts CHANGED "
+	  "SINCE 0",               -1,  1, SDB_AST_TYPE_LIST, SDB_HOST },
+	{ "LIST services CHANGED "
+	  "SINCE 42 FILTER "
+	  "age > 60s",             -1,  1, SDB_AST_TYPE_LIST, SDB_SERVICE },
+	{ "LIST metrics FILTER "
+	  "sequence > 42",         -1,  1, SDB_AST_TYPE_LIST, SDB_METRIC },
+	{ "LIST hosts CHANGED "
+	  "SINCE -1",              -1, -1, 0, 0 },
+	{ "LIST hosts CHANGED "
+	  "SINCE 'a'",             -1, -1, 0, 0 },
+	{ "LIST hosts CHANGED",    -1, -1, 0, 0 },
+	{ "LIST hosts FILTER age "
+	  "> 1s CHANGED SINCE 1",  -1, -1, 0, 0 },
 	/* field access */
 	{ "LIST hosts FILTER "
 	  "name = 'a'",            -1,  1, SDB_AST_TYPE_LIST, SDB_HOST },
@@ -89,6 +103,16 @@ struct {
 	  "backend = ['b']",       -1,  1, SDB_AST_TYPE_LIST, SDB_HOST },
 	{ "LIST hosts FILTER ANY "
 	  "attribute.value = 'a'", -1,  1, SDB_AST_TYPE_LIST, SDB_HOST },
+	/* placeholders */
+	{ "LIST hosts FILTER "
+	  "name = $1",             -1,  1, SDB_AST_TYPE_LIST, SDB_HOST },
+	{ "LIST hosts FILTER "
+	  "age > $1 AND $2 IN "
+	  "backend",               -1,  1, SDB_AST_TYPE_LIST, SDB_HOST },
+	{ "LIST hosts FILTER "
+	  "name = $0",             -1, -1, 0, 0 },
+	{ "LIST hosts FILTER "
+	  "name = $65",            -1, -1, 0, 0 },
 	{ "LIST services FILTER "
 	  "name = 'a'",            -1,  1, SDB_AST_TYPE_LIST, SDB_SERVICE },
 	{ "LIST services FILTER "
@@ -183,6 +207,42 @@ struct {
 	  "END 2214-02-02",      -1,  1, SDB_AST_TYPE_TIMESERIES, 0 },
 	{ "TIMESERIES "
 	  "'host'.'metric'",     -1,  1, SDB_AST_TYPE_TIMESERIES, 0 },
+	{ "TIMESERIES 'host'.'metric' "
+	  "RESOLUTION 5m",       -1,  1, SDB_AST_TYPE_TIMESERIES, 0 },
+	{ "TIMESERIES 'host'.'metric' "
+	  "START 2014-02-02 "
+	  "RESOLUTION 1h 30m "
+	  "USING max",           -1,  1, SDB_AST_TYPE_TIMESERIES,
+	                                 SDB_TIMESERIES_MAX },
+	{ "TIMESERIES 'host'.'metric' "
+	  "RESOLUTION 500 "
+	  "POINTS USING lttb",   -1,  1, SDB_AST_TYPE_TIMESERIES,
+	                                 SDB_TIMESERIES_LTTB },
+	{ "TIMESERIES 'host'.'metric' "
+	  "RESOLUTION 500 "
+	  "POINTS",              -1,  1, SDB_AST_TYPE_TIMESERIES, 0 },
+	{ "TIMESERIES metrics "
+	  "MATCHING name = 'm'", -1,  1, SDB_AST_TYPE_TIMESERIES, 0 },
+	{ "TIMESERIES metrics "
+	  "MATCHING host.name "
+	  "=~ 'h' START "
+	  "2014-01-01 "
+	  "RESOLUTION 5m "
+	  "USING min",           -1,  1, SDB_AST_TYPE_TIMESERIES,
+	                                 SDB_TIMESERIES_MIN },
+	{ "TIMESERIES metrics "
+	  "MATCHING name = 'm' "
+	  "AGGREGATE sum",       -1,  1, SDB_AST_TYPE_TIMESERIES, 0 },
+	{ "TIMESERIES metrics "
+	  "MATCHING name = 'm' "
+	  "RESOLUTION 5m "
+	  "AGGREGATE p95",       -1,  1, SDB_AST_TYPE_TIMESERIES, 0 },
+	{ "TIMESERIES metrics "
+	  "MATCHING name = 'm' "
+	  "RESOLUTION 100 "
+	  "POINTS USING max "
+	  "AGGREGATE median",    -1,  1, SDB_AST_TYPE_TIMESERIES,
+	                                 SDB_TIMESERIES_MAX },
 
 	/* STORE commands */
 	{ "STORE host 'host'",   -1,  1, SDB_AST_TYPE_STORE, SDB_HOST },
@@ -676,6 +736,40 @@ struct {
 	  "2015-02-01",          -1, -1, 0, 0 },
 	{ "STORE metric attribute "
 	  "'metric'.'key' 123",  -1, -1, 0, 0 },
+
+	/* invalid TIMESERIES commands */
+	{ "TIMESERIES 'host'.'metric' "
+	  "RESOLUTION 0s",       -1, -1, 0, 0 },
+	{ "TIMESERIES 'host'.'metric' "
+	  "RESOLUTION 0 POINTS", -1, -1, 0, 0 },
+	{ "TIMESERIES 'host'.'metric' "
+	  "RESOLUTION 500",      -1, -1, 0, 0 },
+	{ "TIMESERIES 'host'.'metric' "
+	  "RESOLUTION 5m "
+	  "USING median",        -1, -1, 0, 0 },
+	{ "TIMESERIES 'host'.'metric' "
+	  "USING avg",           -1, -1, 0, 0 },
+	{ "TIMESERIES metrics",  -1, -1, 0, 0 },
+	{ "TIMESERIES hosts "
+	  "MATCHING name = 'h'", -1, -1, 0, 0 },
+	{ "TIMESERIES metrics "
+	  "MATCHING name = 'm' "
+	  "FILTER age > 1s",     -1, -1, 0, 0 },
+	{ "TIMESERIES metrics "
+	  "MATCHING "
+	  "service.name = 's'",  -1, -1, 0, 0 },
+	{ "TIMESERIES metrics "
+	  "MATCHING name = 'm' "
+	  "AGGREGATE stddev",    -1, -1, 0, 0 },
+	{ "TIMESERIES metrics "
+	  "MATCHING name = 'm' "
+	  "AGGREGATE p101",      -1, -1, 0, 0 },
+	{ "TIMESERIES metrics "
+	  "MATCHING name = 'm' "
+	  "AGGREGATE sum "
+	  "RESOLUTION 5m",       -1, -1, 0, 0 },
+	{ "TIMESERIES 'host'.'metric' "
+	  "AGGREGATE sum",       -1, -1, 0, 0 },
 };
 
 START_TEST(test_parse)
@@ -744,6 +838,15 @@ START_TEST(test_parse)
 				parse_data[_i].query, SDB_STORE_TYPE_TO_NAME(s->obj_type),
 				SDB_STORE_TYPE_TO_NAME(parse_data[_i].expected_extra));
 	}
+	else if (node->type == SDB_AST_TYPE_TIMESERIES) {
+		sdb_ast_timeseries_t *ts = SDB_AST_TIMESERIES(node);
+		fail_unless(ts->downsample == parse_data[_i].expected_extra,
+				"sdb_parser_parse(%s)->downsample = %s; expected: %s",
+				parse_data[_i].query,
+				SDB_TIMESERIES_DOWNSAMPLE_TO_STRING(ts->downsample),
+				SDB_TIMESERIES_DOWNSAMPLE_TO_STRING(
+					parse_data[_i].expected_extra));
+	}
 
 	/* TODO: this should move into front-end specific tests */
 	q = sdb_memstore_query_prepare(node);
@@ -1063,6 +1166,13 @@ struct {
 	/* attributes */
 	{ SDB_HOST, "attribute['foo']",     -1, SDB_AST_TYPE_VALUE, -1 },
 
+	/* placeholders */
+	{ SDB_HOST, "$1",                   -1, SDB_AST_TYPE_PARAM, -1 },
+	{ SDB_HOST, "$64",                  -1, SDB_AST_TYPE_PARAM, -1 },
+	{ SDB_HOST, "$1 + age",             -1, SDB_AST_ADD, -1 },
+	{ SDB_HOST, "$0",                   -1, -1, -1 },
+	{ SDB_HOST, "$65",                  -1, -1, -1 },
+
 	/* arithmetic expressions */
 	{ SDB_HOST, "age + age",            -1, SDB_AST_ADD, SDB_TYPE_DATETIME },
 	{ SDB_HOST, "age - age",            -1, SDB_AST_SUB, SDB_TYPE_DATETIME },
@@ -253,6 +253,62 @@ START_TEST(test_iter)
 }
 END_TEST
 
+START_TEST(test_iter_after)
+{
+	struct {
+		const char *name;
+		const char *expected;
+	} golden_data[] = {
+		{ NULL, "a" },
+		{ "", "a" },
+		{ "a", "b" },
+		{ "A", "b" },
+		{ "bb", "c" },
+		{ "g", "h" },
+		{ "n", "o" },
+		{ "o", NULL },
+		{ "x", NULL },
+	};
+	size_t i;
+
+	populate();
+
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(golden_data); ++i) {
+		sdb_avltree_iter_t *iter;
+		sdb_object_t *obj;
+		size_t n = 0;
+
+		iter = sdb_avltree_get_iter_after(tree, golden_data[i].name);
+		fail_unless(iter != NULL,
+				"sdb_avltree_get_iter_after(<tree>, %s) = NULL; "
+				"expected: <iter>", golden_data[i].name);
+
+		obj = sdb_avltree_iter_peek_next(iter);
+		if (! golden_data[i].expected)
+			fail_unless(obj == NULL,
+					"sdb_avltree_get_iter_after(<tree>, %s) starts at %s; "
+					"expected: <end>", golden_data[i].name, obj->name);
+		else
+			fail_unless(obj && (! strcmp(obj->name, golden_data[i].expected)),
+					"sdb_avltree_get_iter_after(<tree>, %s) starts at %s; "
+					"expected: %s", golden_data[i].name,
+					obj ? obj->name : "<end>", golden_data[i].expected);
+
+		/* the iterator covers all remaining nodes */
+		while (sdb_avltree_iter_get_next(iter))
+			++n;
+		fail_unless(n == (golden_data[i].expected
+					? (size_t)('o' - golden_data[i].expected[0] + 1) : 0),
+				"sdb_avltree_get_iter_after(<tree>, %s) iterated %zu nodes",
+				golden_data[i].name, n);
+		sdb_avltree_iter_destroy(iter);
+	}
+
+	fail_unless(sdb_avltree_get_iter_after(NULL, "a") == NULL,
+			"sdb_avltree_get_iter_after(NULL, a) = <iter>; expected: NULL");
+}
+END_TEST
+
 TEST_MAIN("utils::avltree")
 {
 	TCase *tc = tcase_create("core");
@@ -261,6 +317,7 @@ TEST_MAIN("utils::avltree")
 	tcase_add_test(tc, test_insert);
 	tcase_add_test(tc, test_lookup);
 	tcase_add_test(tc, test_iter);
+	tcase_add_test(tc, test_iter_after);
 	ADD_TCASE(tc);
 }
 TEST_MAIN_END
@@ -0,0 +1,176 @@
+/*
+ * SysDB - t/unit/utils/compress_test.c
+ * Copyright (C) 2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
+#include "frontend/proto.h"
+#include "utils/compress.h"
+#include "utils/proto.h"
+#include "testutils.h"
+
+#include <check.h>
+#include <stdio.h>
+#include <string.h>
+
+/* a compressible message resembling a JSON LIST reply */
+static void
+fill_msg(sdb_strbuf_t *msg, int hosts)
+{
+	int i;
+
+	sdb_strbuf_clear(msg);
+	sdb_strbuf_append(msg, "[");
+	for (i = 0; i < hosts; ++i)
+		sdb_strbuf_append(msg, "%s{\"name\": \"host%d.example.com\", "
+				"\"last_update\": \"2015-01-01 00:00:00 +0000\", "
+				"\"update_interval\": \"5m\", \"backends\": "
+				"[\"backend::collectd::unixsock\"]}", i ? ", " : "", i);
+	sdb_strbuf_append(msg, "]");
+} /* fill_msg */
+
+START_TEST(test_supported)
+{
+	fail_unless(! sdb_compress_supported(SDB_CONNECTION_COMPRESSION_NONE),
+			"sdb_compress_supported(NONE) = true; expected: false");
+	fail_unless(! sdb_compress_supported(4711),
+			"sdb_compress_supported(4711) = true; expected: false");
+	fail_unless(sdb_compress_create(4711) == NULL,
+			"sdb_compress_create(4711) = <ctx>; expected: NULL");
+}
+END_TEST
+
+START_TEST(test_uncompressed)
+{
+	sdb_strbuf_t *buf = sdb_strbuf_create(64);
+	const char *msg = "LIST hosts";
+	uint32_t code = 0, len = 0;
+	ssize_t n;
+
+	/* without a context, messages are sent as is */
+	n = sdb_compress_message(NULL, buf, SDB_CONNECTION_QUERY,
+			(uint32_t)strlen(msg), msg);
+	sdb_proto_unmarshal_header(SDB_STRBUF_STR(buf), &code, &len);
+	fail_unless((n == (ssize_t)(strlen(msg) + 8))
+				&& (code == SDB_CONNECTION_QUERY) && (len == strlen(msg))
+				&& (! memcmp(sdb_strbuf_string(buf) + 8, msg, len)),
+			"sdb_compress_message(NULL, QUERY, '%s') = %zd (code %u, len %u); "
+			"expected: %zu (code %u, len %zu)", msg, n, code, len,
+			strlen(msg) + 8, SDB_CONNECTION_QUERY, strlen(msg));
+	sdb_strbuf_destroy(buf);
+}
+END_TEST
+
+START_TEST(test_roundtrip)
+{
+	sdb_compress_t *sender, *receiver;
+	sdb_strbuf_t *msg = sdb_strbuf_create(1024);
+	sdb_strbuf_t *buf = sdb_strbuf_create(1024);
+	sdb_strbuf_t *out = sdb_strbuf_create(1024);
+	size_t first_len = 0;
+	uint32_t code = 0;
+	ssize_t n;
+	int i;
+
+	if (! sdb_compress_supported(SDB_CONNECTION_COMPRESSION_DEFLATE))
+		return;
+
+	sender = sdb_compress_create(SDB_CONNECTION_COMPRESSION_DEFLATE);
+	receiver = sdb_compress_create(SDB_CONNECTION_COMPRESSION_DEFLATE);
+	ck_assert(sender && receiver);
+
+	/* small messages are left alone */
+	sdb_compress_message(sender, buf, SDB_CONNECTION_OK, 2, "ok");
+	ck_assert(sdb_strbuf_len(buf) == 10);
+
+	for (i = 0; i < 3; ++i) {
+		uint32_t len = 0;
+
+		fill_msg(msg, 100);
+		sdb_strbuf_clear(buf);
+		n = sdb_compress_message(sender, buf, SDB_CONNECTION_DATA,
+				(uint32_t)sdb_strbuf_len(msg), sdb_strbuf_string(msg));
+		sdb_proto_unmarshal_header(SDB_STRBUF_STR(buf), &code, &len);
+		fail_unless((n > 0) && (code == SDB_CONNECTION_COMPRESSED)
+					&& ((size_t)n == len + 8)
+					&& (len < sdb_strbuf_len(msg) / 4),
+				"sdb_compress_message(<%zu bytes>) = %zd (code %u, len %u); "
+				"expected: COMPRESSED message of less than %zu bytes",
+				sdb_strbuf_len(msg), n, code, len, sdb_strbuf_len(msg) / 4);
+
+		/* later messages benefit from the shared stream */
+		if (! i)
+			first_len = len;
+		else
+			fail_unless(len < first_len,
+					"compressed message #%d has %u bytes; expected: < %zu",
+					i, len, first_len);
+
+		sdb_strbuf_clear(out);
+		code = 0;
+		n = sdb_decompress_message(receiver, sdb_strbuf_string(buf) + 8,
+				len, &code, out);
+		fail_unless((n == (ssize_t)sdb_strbuf_len(msg))
+					&& (code == SDB_CONNECTION_DATA)
+					&& (! strcmp(sdb_strbuf_string(out),
+							sdb_strbuf_string(msg))),
+				"sdb_decompress_message() = %zd (code %u); expected: %zu "
+				"(code %u) and the original message", n, code,
+				sdb_strbuf_len(msg), SDB_CONNECTION_DATA);
+	}
+
+	/* corrupted data */
+	fill_msg(msg, 10);
+	sdb_strbuf_clear(buf);
+	sdb_compress_message(sender, buf, SDB_CONNECTION_DATA,
+			(uint32_t)sdb_strbuf_len(msg), sdb_strbuf_string(msg));
+	sdb_strbuf_clear(out);
+	n = sdb_decompress_message(receiver,
+			sdb_strbuf_string(buf) + 8, 4, &code, out);
+	fail_unless(n < 0,
+			"sdb_decompress_message(<truncated>) = %zd; expected: <0", n);
+
+	sdb_compress_destroy(sender);
+	sdb_compress_destroy(receiver);
+	sdb_strbuf_destroy(msg);
+	sdb_strbuf_destroy(buf);
+	sdb_strbuf_destroy(out);
+}
+END_TEST
+
+TEST_MAIN("utils::compress")
+{
+	TCase *tc = tcase_create("core");
+	tcase_add_test(tc, test_supported);
+	tcase_add_test(tc, test_uncompressed);
+	tcase_add_test(tc, test_roundtrip);
+	ADD_TCASE(tc);
+}
+TEST_MAIN_END
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
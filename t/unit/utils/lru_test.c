@@ -0,0 +1,312 @@
+/*
+ * SysDB - t/unit/utils/lru_test.c
+ * Copyright (C) 2015 Sebastian 'tokkee' Harl <sh@tokkee.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
+#include "utils/lru.h"
+#include "testutils.h"
+
+#include <check.h>
+#include <inttypes.h>
+#include <string.h>
+
+static sdb_lru_t *lru;
+
+static sdb_object_t test_data[] = {
+	SDB_OBJECT_STATIC("a"),
+	SDB_OBJECT_STATIC("b"),
+	SDB_OBJECT_STATIC("c"),
+	SDB_OBJECT_STATIC("d"),
+	SDB_OBJECT_STATIC("e"),
+};
+
+/* name of the object to be considered stale by is_valid() */
+static const char *stale_name = NULL;
+
+/* object to be inserted by is_valid(), replacing the checked one */
+static sdb_object_t *replacement = NULL;
+
+static bool
+is_valid(sdb_object_t *obj)
+{
+	if (replacement) {
+		/* this would dead-lock if the cache were still locked */
+		sdb_lru_insert(lru, replacement);
+		replacement = NULL;
+	}
+	return (! stale_name) || strcmp(obj->name, stale_name);
+} /* is_valid */
+
+static void
+setup(void)
+{
+	lru = sdb_lru_create(3, is_valid);
+	fail_unless(lru != NULL,
+			"sdb_lru_create(3, <cb>) = NULL; expected LRU cache object");
+	stale_name = NULL;
+	replacement = NULL;
+} /* setup */
+
+static void
+teardown(void)
+{
+	size_t i;
+
+	sdb_lru_destroy(lru);
+	lru = NULL;
+
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(test_data); ++i)
+		fail_unless(test_data[i].ref_cnt == 1,
+				"object '%s' leaked references: ref_cnt = %d; expected: 1",
+				test_data[i].name, test_data[i].ref_cnt);
+} /* teardown */
+
+static void
+check_stats(size_t size, uint64_t hits, uint64_t misses, uint64_t evictions)
+{
+	sdb_lru_stats_t stats;
+
+	memset(&stats, 0, sizeof(stats));
+	sdb_lru_stats(lru, &stats);
+	fail_unless((stats.size == size) && (stats.capacity == 3)
+			&& (stats.hits == hits) && (stats.misses == misses)
+			&& (stats.evictions == evictions),
+			"sdb_lru_stats() = { size: %zu, capacity: %zu, hits: %"PRIu64", "
+			"misses: %"PRIu64", evictions: %"PRIu64" }; expected: "
+			"{ %zu, 3, %"PRIu64", %"PRIu64", %"PRIu64" }",
+			stats.size, stats.capacity, stats.hits, stats.misses,
+			stats.evictions, size, hits, misses, evictions);
+} /* check_stats */
+
+START_TEST(test_null)
+{
+	sdb_object_t *obj;
+	int check;
+
+	fail_unless(sdb_lru_create(0, NULL) == NULL,
+			"sdb_lru_create(0, NULL) = <lru>; expected: NULL");
+
+	check = sdb_lru_insert(NULL, &test_data[0]);
+	fail_unless(check < 0,
+			"sdb_lru_insert(NULL, <obj>) = %d; expected: <0", check);
+	check = sdb_lru_insert(lru, NULL);
+	fail_unless(check < 0,
+			"sdb_lru_insert(<lru>, NULL) = %d; expected: <0", check);
+	obj = sdb_lru_lookup(NULL, "a");
+	fail_unless(obj == NULL,
+			"sdb_lru_lookup(NULL, 'a') = <obj>; expected: NULL");
+	check = sdb_lru_remove(NULL, "a");
+	fail_unless(check < 0,
+			"sdb_lru_remove(NULL, 'a') = %d; expected: <0", check);
+	obj = sdb_lru_shift(NULL);
+	fail_unless(obj == NULL,
+			"sdb_lru_shift(NULL) = <obj>; expected: NULL");
+
+	/* these should not crash */
+	sdb_lru_clear(NULL);
+	sdb_lru_destroy(NULL);
+	sdb_lru_stats(NULL, NULL);
+}
+END_TEST
+
+START_TEST(test_insert_lookup)
+{
+	sdb_object_t *obj;
+	size_t i;
+
+	for (i = 0; i < 3; ++i) {
+		int check = sdb_lru_insert(lru, &test_data[i]);
+		fail_unless(check == 0,
+				"sdb_lru_insert(<lru>, '%s') = %d; expected: 0",
+				test_data[i].name, check);
+	}
+	check_stats(3, 0, 0, 0);
+
+	for (i = 0; i < 3; ++i) {
+		obj = sdb_lru_lookup(lru, test_data[i].name);
+		fail_unless(obj == &test_data[i],
+				"sdb_lru_lookup(<lru>, '%s') = %p; expected: %p",
+				test_data[i].name, obj, &test_data[i]);
+		sdb_object_deref(obj);
+	}
+	obj = sdb_lru_lookup(lru, "A");
+	fail_unless(obj == NULL,
+			"sdb_lru_lookup(<lru>, 'A') = <obj>; expected: NULL "
+			"(lookups are case-sensitive)");
+	check_stats(3, 3, 1, 0);
+
+	/* replacing an object does not change the size */
+	sdb_lru_insert(lru, &test_data[1]);
+	check_stats(3, 3, 1, 0);
+}
+END_TEST
+
+START_TEST(test_evict)
+{
+	sdb_object_t *obj;
+	size_t i;
+
+	for (i = 0; i < 3; ++i)
+		sdb_lru_insert(lru, &test_data[i]);
+
+	/* 'a' becomes the most recently used object, 'b' the least */
+	obj = sdb_lru_lookup(lru, "a");
+	sdb_object_deref(obj);
+
+	sdb_lru_insert(lru, &test_data[3]);
+	check_stats(3, 1, 0, 1);
+	obj = sdb_lru_lookup(lru, "b");
+	fail_unless(obj == NULL,
+			"sdb_lru_lookup(<lru>, 'b') = <obj>; expected: NULL "
+			"(should have been evicted)");
+
+	sdb_lru_insert(lru, &test_data[4]);
+	check_stats(3, 1, 1, 2);
+	obj = sdb_lru_lookup(lru, "c");
+	fail_unless(obj == NULL,
+			"sdb_lru_lookup(<lru>, 'c') = <obj>; expected: NULL "
+			"(should have been evicted)");
+
+	for (i = 0; i < 5; i += 3) {
+		obj = sdb_lru_lookup(lru, test_data[i].name);
+		fail_unless(obj == &test_data[i],
+				"sdb_lru_lookup(<lru>, '%s') = %p; expected: %p",
+				test_data[i].name, obj, &test_data[i]);
+		sdb_object_deref(obj);
+	}
+}
+END_TEST
+
+START_TEST(test_remove)
+{
+	sdb_object_t *obj;
+	int check;
+	size_t i;
+
+	for (i = 0; i < 3; ++i)
+		sdb_lru_insert(lru, &test_data[i]);
+
+	check = sdb_lru_remove(lru, "b");
+	fail_unless(check == 0,
+			"sdb_lru_remove(<lru>, 'b') = %d; expected: 0", check);
+	check = sdb_lru_remove(lru, "b");
+	fail_unless(check > 0,
+			"sdb_lru_remove(<lru>, 'b') = %d; expected: >0", check);
+	check_stats(2, 0, 0, 0);
+
+	/* invalid objects are dropped on lookup */
+	stale_name = "c";
+	obj = sdb_lru_lookup(lru, "c");
+	fail_unless(obj == NULL,
+			"sdb_lru_lookup(<lru>, 'c') = <obj>; expected: NULL "
+			"(object is stale)");
+	check_stats(1, 0, 1, 0);
+
+	/* objects replaced while checking them are kept */
+	{
+		sdb_object_t fresh = SDB_OBJECT_STATIC("a");
+
+		stale_name = "a";
+		replacement = &fresh;
+		obj = sdb_lru_lookup(lru, "a");
+		fail_unless(obj == NULL,
+				"sdb_lru_lookup(<lru>, 'a') = <obj>; expected: NULL "
+				"(object is stale)");
+		check_stats(1, 0, 2, 0);
+
+		stale_name = NULL;
+		obj = sdb_lru_lookup(lru, "a");
+		fail_unless(obj == &fresh,
+				"sdb_lru_lookup(<lru>, 'a') = %p; expected: %p (replaced "
+				"while checking)", obj, &fresh);
+		sdb_object_deref(obj);
+		check_stats(1, 1, 2, 0);
+
+		/* drop the replacement and restore the original state */
+		sdb_lru_remove(lru, "a");
+		sdb_lru_insert(lru, &test_data[0]);
+		fail_unless(fresh.ref_cnt == 1,
+				"replacement object leaked references: ref_cnt = %d; "
+				"expected: 1", fresh.ref_cnt);
+	}
+
+	sdb_lru_clear(lru);
+	check_stats(0, 1, 2, 0);
+	obj = sdb_lru_lookup(lru, "a");
+	fail_unless(obj == NULL,
+			"sdb_lru_lookup(<lru>, 'a') = <obj>; expected: NULL "
+			"after clearing the cache");
+}
+END_TEST
+
+START_TEST(test_shift)
+{
+	sdb_object_t *obj;
+	const char *expected[] = { "b", "a", "c" };
+	size_t i;
+
+	obj = sdb_lru_shift(lru);
+	fail_unless(obj == NULL,
+			"sdb_lru_shift(<empty lru>) = <obj>; expected: NULL");
+
+	for (i = 0; i < 3; ++i)
+		sdb_lru_insert(lru, &test_data[i]);
+	/* re-inserting an object marks it as most recently used */
+	sdb_lru_insert(lru, &test_data[0]);
+	sdb_lru_insert(lru, &test_data[2]);
+
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(expected); ++i) {
+		obj = sdb_lru_shift(lru);
+		fail_unless(obj && (! strcmp(obj->name, expected[i])),
+				"sdb_lru_shift(<lru>) = '%s'; expected: '%s'",
+				obj ? obj->name : "<NULL>", expected[i]);
+		sdb_object_deref(obj);
+	}
+	check_stats(0, 0, 0, 0);
+
+	obj = sdb_lru_shift(lru);
+	fail_unless(obj == NULL,
+			"sdb_lru_shift(<empty lru>) = <obj>; expected: NULL");
+}
+END_TEST
+
+TEST_MAIN("utils::lru")
+{
+	TCase *tc = tcase_create("core");
+	tcase_add_checked_fixture(tc, setup, teardown);
+	tcase_add_test(tc, test_null);
+	tcase_add_test(tc, test_insert_lookup);
+	tcase_add_test(tc, test_evict);
+	tcase_add_test(tc, test_remove);
+	tcase_add_test(tc, test_shift);
+	ADD_TCASE(tc);
+}
+TEST_MAIN_END
+
+/* vim: set tw=78 sw=4 ts=4 noexpandtab : */
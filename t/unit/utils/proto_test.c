@@ -564,6 +564,134 @@ START_TEST(test_marshal_attribute)
 }
 END_TEST
 
+START_TEST(test_unmarshal_object)
+{
+	/* a sequence of records as sent in binary query results */
+	const char records[] =
+		"\0\0\0\x12" HOST_TYPE "\0\0\0\0\0\0\x12\x67" "hostA\0"
+		"\0\0\0\x37" METRIC_TYPE "\0\0\0\0\0\0\x12\x67" "hostA\0" "m1\0"
+			"\0\0\0\2" "rrd\0" "/a\0" "\0\0\0\0\0\0\x12\x67"
+			"rrd\0" "/b\0" "\0\0\0\0\0\0\x12\x68"
+		"\0\0\0\x21" HOST_ATTR_TYPE "\0\0\0\0\0\0\x12\x67" "hostA\0" "k1\0"
+			INT_TYPE "\0\0\0\0\0\0\x12\x67"
+		"\0\0\0\x10" "\0\0\0\1" "\0\0\0"; /* truncated */
+	struct {
+		int type;
+		const char *name;
+		ssize_t expected;
+	} golden_data[] = {
+		{ SDB_HOST, "hostA", 22 },
+		{ SDB_METRIC, "m1", 59 },
+		{ SDB_HOST | SDB_ATTRIBUTE, "k1", 37 },
+		{ 0, NULL, -1 },
+	};
+
+	const char *buf = records;
+	size_t len = sizeof(records) - 1;
+	size_t i;
+
+	for (i = 0; i < SDB_STATIC_ARRAY_LEN(golden_data); ++i) {
+		sdb_proto_object_t obj;
+		const char *name = NULL;
+		ssize_t check;
+
+		memset(&obj, 0, sizeof(obj));
+		check = sdb_proto_unmarshal_object(buf, len, &obj);
+		fail_unless(check == golden_data[i].expected,
+				"<%zu> sdb_proto_unmarshal_object() = %zi; expected: %zi",
+				i, check, golden_data[i].expected);
+		if (check < 0)
+			continue;
+
+		if (obj.type == SDB_HOST)
+			name = obj.data.host.name;
+		else if (obj.type == SDB_METRIC) {
+			name = obj.data.metric.name;
+			fail_unless((obj.stores_num == 2)
+					&& streq(obj.stores[0].id, "/a")
+					&& streq(obj.stores[1].type, "rrd")
+					&& streq(obj.stores[1].id, "/b")
+					&& (obj.stores[1].last_update == 4712)
+					&& streq(obj.data.metric.store_id, "/a"),
+					"<%zu> sdb_proto_unmarshal_object() did not decode "
+					"metric stores", i);
+		}
+		else if (obj.type & SDB_ATTRIBUTE) {
+			name = obj.data.attribute.key;
+			fail_unless((obj.data.attribute.value.type == SDB_TYPE_INTEGER)
+					&& (obj.data.attribute.value.data.integer == 4711),
+					"<%zu> sdb_proto_unmarshal_object() did not decode "
+					"attribute value", i);
+		}
+		fail_unless((obj.type == golden_data[i].type)
+				&& streq(name, golden_data[i].name),
+				"<%zu> sdb_proto_unmarshal_object() = { %s, %s }; "
+				"expected: { %s, %s }", i, SDB_STORE_TYPE_TO_NAME(obj.type),
+				name, SDB_STORE_TYPE_TO_NAME(golden_data[i].type),
+				golden_data[i].name);
+		sdb_proto_free_object(&obj);
+
+		buf += check;
+		len -= check;
+	}
+}
+END_TEST
+
+START_TEST(test_marshal_object)
+{
+	sdb_proto_metric_store_t stores[] = {
+		{ "rrd", "/a", 4711 },
+		{ "rrd", "/b", 4712 },
+	};
+	sdb_proto_object_t obj = { SDB_METRIC, { .metric = {
+		4711, "hostA", "m1", NULL, NULL, 0 } }, stores, 2 };
+	sdb_proto_object_t decoded;
+	char buf[128];
+	ssize_t len, check;
+	size_t i;
+
+	len = sdb_proto_marshal_object(NULL, 0, &obj);
+	fail_unless(len == 59,
+			"sdb_proto_marshal_object(NULL, 0, <metric>) = %zi; expected: 59",
+			len);
+	check = sdb_proto_marshal_object(buf, sizeof(buf), &obj);
+	fail_unless(check == len,
+			"sdb_proto_marshal_object(<buf>, <metric>) = %zi; expected: %zi",
+			check, len);
+
+	memset(&decoded, 0, sizeof(decoded));
+	check = sdb_proto_unmarshal_object(buf, (size_t)len, &decoded);
+	fail_unless(check == len,
+			"sdb_proto_unmarshal_object(<metric>) = %zi; expected: %zi",
+			check, len);
+	fail_unless((decoded.type == SDB_METRIC)
+			&& streq(decoded.data.metric.hostname, "hostA")
+			&& streq(decoded.data.metric.name, "m1")
+			&& (decoded.stores_num == SDB_STATIC_ARRAY_LEN(stores)),
+			"sdb_proto_unmarshal_object(<metric>) = { %s, %s, %s, %zu stores }; "
+			"expected: { METRIC, hostA, m1, 2 stores }",
+			SDB_STORE_TYPE_TO_NAME(decoded.type), decoded.data.metric.hostname,
+			decoded.data.metric.name, decoded.stores_num);
+	for (i = 0; i < decoded.stores_num; ++i)
+		fail_unless(streq(decoded.stores[i].type, stores[i].type)
+				&& streq(decoded.stores[i].id, stores[i].id)
+				&& (decoded.stores[i].last_update == stores[i].last_update),
+				"sdb_proto_unmarshal_object(<metric>) store %zu = "
+				"{ %s, %s, %"PRIsdbTIME" }; expected: { %s, %s, %"PRIsdbTIME" }",
+				i, decoded.stores[i].type, decoded.stores[i].id,
+				decoded.stores[i].last_update, stores[i].type, stores[i].id,
+				stores[i].last_update);
+	sdb_proto_free_object(&decoded);
+
+	/* the number of stores is not trusted */
+	buf[sizeof(uint32_t) + 12 + 9 + 3] = '\x7f';
+	check = sdb_proto_unmarshal_object(buf, (size_t)len, &decoded);
+	fail_unless(check < 0,
+			"sdb_proto_unmarshal_object(<invalid number of stores>) = %zi; "
+			"expected: <0", check);
+}
+END_TEST
+
 TEST_MAIN("utils::proto")
 {
 	TCase *tc = tcase_create("core");
@@ -572,6 +700,8 @@ TEST_MAIN("utils::proto")
 	tcase_add_test(tc, test_marshal_service);
 	tcase_add_test(tc, test_marshal_metric);
 	tcase_add_test(tc, test_marshal_attribute);
+	tcase_add_test(tc, test_unmarshal_object);
+	tcase_add_test(tc, test_marshal_object);
 	ADD_TCASE(tc);
 }
 TEST_MAIN_END
@@ -33,6 +33,9 @@
 #include "testutils.h"
 
 #include <check.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 /*
  * private data types
@@ -544,6 +547,142 @@ START_TEST(test_skip)
 }
 END_TEST
 
+START_TEST(test_skip_append)
+{
+	const char *data;
+	size_t i, len, cap = 0;
+	ssize_t n;
+
+	/* simulate a pipeline of incoming messages which are consumed one by one
+	 * while new data keeps arriving */
+	for (i = 0; i < 1000; ++i) {
+		n = sdb_strbuf_append(buf, "%04zu", i);
+		fail_unless(n == 4,
+				"sdb_strbuf_append() = %zi; expected: 4", n);
+		n = sdb_strbuf_memappend(buf, "abcd", 4);
+		fail_unless(n == 4,
+				"sdb_strbuf_memappend() = %zi; expected: 4", n);
+
+		len = sdb_strbuf_len(buf);
+		fail_unless(len == (i > 0 ? 12 : 8),
+				"sdb_strbuf_len() = %zu (iteration %zu); expected: %d",
+				len, i, i > 0 ? 12 : 8);
+
+		data = sdb_strbuf_string(buf);
+		if (i > 0) {
+			char expected[13];
+			snprintf(expected, sizeof(expected), "abcd%04zuabcd", i);
+			fail_unless(! strcmp(data, expected),
+					"sdb_strbuf_string() = '%s' (iteration %zu); "
+					"expected: '%s'", data, i, expected);
+		}
+		fail_unless(data[len] == '\0',
+				"sdb_strbuf_skip() did not nil-terminate the string");
+
+		sdb_strbuf_skip(buf, 0, i > 0 ? 8 : 4);
+
+		if (i == 10)
+			cap = sdb_strbuf_cap(buf);
+	}
+
+	len = sdb_strbuf_len(buf);
+	fail_unless(len == 4,
+			"sdb_strbuf_len() = %zu; expected: 4", len);
+	fail_unless(sdb_strbuf_cap(buf) == cap,
+			"sdb_strbuf_cap() = %zu after consuming data; expected: %zu "
+			"(buffer should not keep growing)", sdb_strbuf_cap(buf), cap);
+
+	sdb_strbuf_skip(buf, 0, 2);
+	sdb_strbuf_skip(buf, 1, 1);
+	data = sdb_strbuf_string(buf);
+	fail_unless(! strcmp(data, "c"),
+			"sdb_strbuf_skip() = '%s'; expected: 'c'", data);
+
+	n = sdb_strbuf_sprintf(buf, "%s", "abc");
+	data = sdb_strbuf_string(buf);
+	fail_unless((n == 3) && (! strcmp(data, "abc")),
+			"sdb_strbuf_sprintf() = %zi, '%s' (after skip); "
+			"expected: 3, 'abc'", n, data);
+}
+END_TEST
+
+START_TEST(test_read)
+{
+	char input[4096];
+	const char *data;
+	size_t i, len;
+	ssize_t n;
+	int fds[2];
+
+	for (i = 0; i < sizeof(input); ++i)
+		input[i] = (char)('a' + i % 26);
+
+	fail_unless(pipe(fds) == 0, "pipe() failed");
+	fail_unless(write(fds[1], input, sizeof(input)) == sizeof(input),
+			"write() failed");
+	close(fds[1]);
+
+	/* the buffer only has room for a few bytes; everything else has to be
+	 * read into the grown buffer */
+	sdb_strbuf_memcpy(buf, "xyz", 3);
+	sdb_strbuf_skip(buf, 0, 1);
+	n = sdb_strbuf_read(buf, fds[0], 2 * sizeof(input));
+	fail_unless(n == (ssize_t)sizeof(input),
+			"sdb_strbuf_read() = %zi; expected: %zu", n, sizeof(input));
+
+	len = sdb_strbuf_len(buf);
+	fail_unless(len == sizeof(input) + 2,
+			"sdb_strbuf_len() = %zu (after read); expected: %zu",
+			len, sizeof(input) + 2);
+	data = sdb_strbuf_string(buf);
+	fail_unless((! strncmp(data, "yz", 2))
+				&& (! memcmp(data + 2, input, sizeof(input))),
+			"sdb_strbuf_read() did not append data correctly");
+	fail_unless(data[len] == '\0',
+			"sdb_strbuf_read() did not nil-terminate the string");
+
+	n = sdb_strbuf_read(buf, fds[0], 1024);
+	fail_unless(n == 0,
+			"sdb_strbuf_read(<EOF>) = %zi; expected: 0", n);
+	close(fds[0]);
+}
+END_TEST
+
+START_TEST(test_read_large)
+{
+	/* larger than a typical stack */
+	size_t size = 16 * 1024 * 1024;
+	char *input = malloc(size);
+	char tmpl[] = "strbuf_test.XXXXXX";
+	size_t i;
+	ssize_t n;
+	int fd;
+
+	ck_assert(input != NULL);
+	for (i = 0; i < size; ++i)
+		input[i] = (char)('a' + i % 26);
+
+	fd = mkstemp(tmpl);
+	fail_unless(fd >= 0, "mkstemp() failed");
+	unlink(tmpl);
+	fail_unless(write(fd, input, size) == (ssize_t)size, "write() failed");
+	lseek(fd, 0, SEEK_SET);
+
+	sdb_strbuf_memcpy(buf, "x", 1);
+	n = sdb_strbuf_read(buf, fd, size);
+	fail_unless(n == (ssize_t)size,
+			"sdb_strbuf_read(<%zu bytes>) = %zi; expected: %zu",
+			size, n, size);
+	fail_unless((sdb_strbuf_len(buf) == size + 1)
+				&& (! memcmp(sdb_strbuf_string(buf) + 1, input, size)),
+			"sdb_strbuf_read(<%zu bytes>) did not append data correctly",
+			size);
+
+	close(fd);
+	free(input);
+}
+END_TEST
+
 START_TEST(test_clear)
 {
 	const char *data;
@@ -634,6 +773,9 @@ TEST_MAIN("utils::strbuf")
 	tcase_add_test(tc, test_memappend);
 	tcase_add_test(tc, test_chomp);
 	tcase_add_test(tc, test_skip);
+	tcase_add_test(tc, test_skip_append);
+	tcase_add_test(tc, test_read);
+	tcase_add_test(tc, test_read_large);
 	tcase_add_test(tc, test_clear);
 	tcase_add_test(tc, test_string);
 	tcase_add_test(tc, test_len);